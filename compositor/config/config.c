@@ -273,6 +273,7 @@ tw_config_wake_compositor(struct tw_config *c)
 	struct tw_shell *shell = NULL;
 	struct tw_console *console;
 	struct tw_bus *bus;
+	struct tw_server_output_manager *outputs;
 	struct tw_theme_global *theme;
 	struct tw_xdg *xdg = NULL;
 #if _TW_HAS_XWAYLAND
@@ -283,6 +284,7 @@ tw_config_wake_compositor(struct tw_config *c)
 	uint32_t enables = c->current->enable_globals;
 	const char *shell_path;
 	const char *console_path;
+	const char *trace_path;
 
 	initialized = tw_config_request_object(c, "initialized");
 	shell_path =  tw_config_request_object(c, TW_CONFIG_SHELL_PATH);
@@ -294,6 +296,13 @@ tw_config_wake_compositor(struct tw_config *c)
 		if (!(bus = tw_bus_create_global(display)))
 			goto out;
                 tw_config_register_object(c, "bus", bus);
+		outputs = tw_config_request_object(c, "output_manager");
+		if (outputs)
+			tw_bus_expose_frame_stats(
+				bus, outputs,
+				tw_config_request_object(c, "latency"));
+		if ((trace_path = tw_config_request_object(c, "trace_path")))
+			tw_bus_expose_trace(bus, trace_path);
 	}
 
 	if (enables & TW_CONFIG_GLOBAL_TAIWINS_SHELL) {
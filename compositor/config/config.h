@@ -144,12 +144,27 @@ void *
 tw_config_request_object(struct tw_config *config,
                          const char *name);
 
+struct tw_server_output_manager;
+struct tw_latency_tracer;
+
 /* the bus would be used for configuration anyway, we probably just move it
  * inside config
  */
 struct tw_bus *
 tw_bus_create_global(struct wl_display *display);
 
+/* org.taiwins.stats.FrameStats returns the dump of the output statistics and
+ * the input latency of the clients */
+void
+tw_bus_expose_frame_stats(struct tw_bus *bus,
+                          struct tw_server_output_manager *outputs,
+                          struct tw_latency_tracer *latency);
+
+/* org.taiwins.stats.Trace toggles the trace recording to the path and returns
+ * the new state */
+void
+tw_bus_expose_trace(struct tw_bus *bus, const char *path);
+
 /******************************************************************************
  * private APIs
  *****************************************************************************/
@@ -26,13 +26,21 @@
 #include <tdbus.h>
 #include <ctypes/helpers.h>
 
+#include <taiwins/objects/logger.h>
+#include <taiwins/objects/profiler.h>
 #include <taiwins/objects/utils.h>
+#include "options.h"
 #include "utils.h"
+#include "output.h"
+#include "latency.h"
 
 static struct tw_bus {
 	struct wl_display *display;
 	struct tdbus *dbus;
 	struct wl_event_source *source;
+	struct tw_server_output_manager *outputs;
+	struct tw_latency_tracer *latency;
+	const char *trace_path;
 
 	struct wl_listener display_distroy_listener;
 } s_bus;
@@ -93,6 +101,90 @@ static struct tdbus_call_answer tw_bus_answer = {
 	.reader = tw_bus_read_request,
 };
 
+static int tw_bus_read_frame_stats(const struct tdbus_method_call *call)
+{
+	char *dump = NULL;
+	size_t len = 0;
+	FILE *file = open_memstream(&dump, &len);
+	struct tdbus_message *reply;
+	struct tw_bus *bus = get_bus();
+
+	if (!file)
+		return -1;
+	if (bus->outputs)
+		tw_server_output_manager_dump_stats(bus->outputs, file);
+	if (bus->latency)
+		tw_latency_tracer_dump(bus->latency, file);
+	fclose(file);
+
+	reply = tdbus_reply_method(call->message, NULL);
+	tdbus_write(reply, "%s", dump ? dump : "");
+	tdbus_send_message(call->bus, reply);
+	free(dump);
+	return 0;
+}
+
+static struct tdbus_call_answer tw_bus_frame_stats_answer = {
+	.interface = "org.taiwins.stats",
+	.method = "FrameStats",
+	.in_signature = "",
+	.out_signature = "s",
+	.reader = tw_bus_read_frame_stats,
+};
+
+void
+tw_bus_expose_frame_stats(struct tw_bus *bus,
+                          struct tw_server_output_manager *outputs,
+                          struct tw_latency_tracer *latency)
+{
+	bus->outputs = outputs;
+	bus->latency = latency;
+	tdbus_server_add_methods(bus->dbus, "/org/taiwins", 1,
+	                         &tw_bus_frame_stats_answer);
+}
+
+/* the trace file and its flusher thread only exist while recording */
+static int tw_bus_toggle_trace(const struct tdbus_method_call *call)
+{
+	const char *state;
+	struct tdbus_message *reply;
+	struct tw_bus *bus = get_bus();
+
+	if (!_TW_ENABLE_PROFILING) {
+		state = "trace points are not compiled in";
+	} else if (tw_profiler_enabled()) {
+		tw_profiler_close();
+		state = "off";
+	} else if (tw_profiler_open(bus->display, bus->trace_path)) {
+		tw_profiler_enable(true);
+		state = "on";
+	} else {
+		state = "failed to open the trace file";
+	}
+	tw_logl("trace recording: %s", state);
+
+	reply = tdbus_reply_method(call->message, NULL);
+	tdbus_write(reply, "%s", state);
+	tdbus_send_message(call->bus, reply);
+	return 0;
+}
+
+static struct tdbus_call_answer tw_bus_trace_answer = {
+	.interface = "org.taiwins.stats",
+	.method = "Trace",
+	.in_signature = "",
+	.out_signature = "s",
+	.reader = tw_bus_toggle_trace,
+};
+
+void
+tw_bus_expose_trace(struct tw_bus *bus, const char *path)
+{
+	bus->trace_path = path;
+	tdbus_server_add_methods(bus->dbus, "/org/taiwins", 1,
+	                         &tw_bus_trace_answer);
+}
+
 struct tw_bus *
 tw_bus_create_global(struct wl_display *display)
 {
@@ -179,6 +179,7 @@ tw_workspace_release(struct tw_workspace *ws)
 		wl_list_for_each_safe(surf, next, &layers[i]->views,
 		                      layer_link)
 			tw_reset_wl_list(&surf->layer_link);
+		tw_layer_dirty(layers[i]);
 	}
 	//we have this?
 	wl_list_for_each_safe(view, tmp, &ws->recent_views, link)
@@ -491,6 +492,7 @@ tw_workspace_remove_view(struct tw_workspace *w, struct tw_xdg_view *view)
 
 	arrange_view_for_workspace(w, view, DPSR_del, &arg);
 	tw_reset_wl_list(&surface->layer_link);
+	tw_layers_manager_dirty(w->layers_manager);
 	view->added = false;
 	return true;
 }
@@ -567,6 +569,7 @@ tw_workspace_minimize_view(struct tw_workspace *w, struct tw_xdg_view *v)
 	tw_xdg_view_backup_geometry(v);
 	tw_workspace_remove_view(w, v);
 	wl_list_insert(&w->hidden_layer.views, &surface->layer_link);
+	tw_surface_dirty_geometry(surface);
 	tw_workspace_defocus_view(w, v);
 }
 
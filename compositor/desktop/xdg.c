@@ -577,7 +577,7 @@ tw_xdg_switch_workspace(struct tw_xdg *xdg, uint32_t to)
 		xo = xdg_output_from_engine_output(xdg, eo);
 		tw_workspace_resize_output(xdg->actived_workspace[0], xo);
 		rd = wl_container_of(eo->device, rd, device);
-		tw_render_output_dirty(rd);
+		tw_render_output_dirty_cause(rd, TW_REPAINT_CAUSE_CONFIG);
 	}
 	if (view)
 		tw_xdg_view_activate(xdg, view);
@@ -23,7 +23,9 @@
 #include <GLES2/gl2ext.h>
 #include <GLES3/gl3.h>
 #include <assert.h>
+#include <stddef.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <wayland-server-core.h>
 #include <wayland-util.h>
@@ -34,225 +36,356 @@
 #include <taiwins/objects/logger.h>
 #include <taiwins/objects/matrix.h>
 #include <taiwins/objects/plane.h>
+#include <taiwins/objects/subsurface.h>
 #include <taiwins/objects/surface.h>
 #include <taiwins/output_device.h>
 #include <taiwins/render_context_egl.h>
 #include <taiwins/render_surface.h>
 #include <taiwins/render_pipeline.h>
 #include "utils.h"
+#include "probes.h"
+
+#include "render.h"
+
+/* interleaved vertex for batched quads, position in global space */
+struct tw_egl_quad_vertex {
+	GLfloat x, y;
+	GLfloat u, v;
+};
+
+/* quads sharing the same shader and texture, drawn in one call */
+struct tw_egl_quad_batch {
+	struct tw_egl_quad_shader *shader;
+	struct tw_egl_render_texture *texture;
+	struct wl_array vertices;
+	pixman_region32_t area; /**< covered area, for ordering */
+	GLint first;
+	bool blend;
+};
+
+/* offscreen copy of a layer that stopped changing, one per layer and output.
+ * The texture covers the whole output, in the same orientation as the output
+ * framebuffer. */
+struct tw_egl_layer_cache {
+	struct wl_list link;
+	const struct tw_layer *layer;
+	const struct tw_render_output *output;
+
+	uint64_t signature; /**< members, their serials and the output mode */
+	unsigned int clean_frames; /**< repaints with the same signature */
+	bool valid, used;
+
+	GLuint fbo;
+	struct tw_egl_render_texture texture;
+	unsigned int width, height;
+};
 
 struct tw_egl_layer_render_pipeline {
 	struct tw_render_pipeline base;
 	//TODO: this is still a temporary solution,
 	struct tw_plane main_plane;
 
-	struct tw_egl_quad_shader quad_shader;
-	/* for debug rendering */
-	struct tw_egl_quad_shader color_quad_shader;
-	/* for external sampler */
-	struct tw_egl_quad_shader ext_quad_shader;
+	struct tw_egl_quad_shader_cache shaders;
 
 	struct tw_layers_manager *manager;
+
+	/* quads for a frame, built then sorted into batches */
+	struct {
+		GLuint vbo;
+		GLsizeiptr vbo_size;
+		struct wl_array batches; /**< pool of tw_egl_quad_batch */
+		unsigned int nbatches; /**< batches in use */
+		struct wl_array vertices; /**< staging for vbo */
+	} batch;
+
+	struct {
+		bool enabled;
+		struct wl_list caches; /**< tw_egl_layer_cache */
+	} layer_cache;
 };
 
 /******************************************************************************
- * damage stacking
+ * repaints
  *****************************************************************************/
 
 static void
-surface_accumulate_damage(struct tw_surface *surface,
-                          pixman_region32_t *clipped)
+pipeline_scissor_surface(struct tw_render_output *output,
+                         pixman_box32_t *box)
 {
-	pixman_region32_t damage, bbox, opaque;
-	struct tw_view *current = surface->current;
-	struct tw_render_surface *render_surface =
-		wl_container_of(surface, render_surface, surface);
+	//the box are in global space, we would need to convert them into
+	//output_space
+	pixman_box32_t scr_box;
 
-	pixman_region32_init(&damage);
-	pixman_region32_init_rect(&bbox,
-	                          surface->geometry.xywh.x,
-	                          surface->geometry.xywh.y,
-	                          surface->geometry.xywh.width,
-	                          surface->geometry.xywh.height);
-	pixman_region32_init(&opaque);
-
-	if (pixman_region32_not_empty(&surface->geometry.dirty)) {
-		pixman_region32_copy(&damage, &surface->geometry.dirty);
+	if (box != NULL) {
+		glEnable(GL_SCISSOR_TEST);
+		//since the surface is y-down
+		tw_mat3_box_transform(&output->state.view_2d,
+		                      &scr_box, box);
+
+		glScissor(scr_box.x1, scr_box.y1,
+		          scr_box.x2-scr_box.x1, scr_box.y2-scr_box.y1);
 	} else {
-		pixman_region32_intersect_rect(&damage,
-		                               &current->surface_damage,
-		                               0, 0,
-		                               surface->geometry.xywh.width,
-		                               surface->geometry.xywh.height);
-		pixman_region32_translate(&damage, surface->geometry.xywh.x,
-		                          surface->geometry.xywh.y);
-		pixman_region32_intersect(&damage, &damage, &bbox);
+		glDisable(GL_SCISSOR_TEST);
 	}
-	pixman_region32_subtract(&damage, &damage, clipped);
-	pixman_region32_union(&current->plane->damage,
-	                      &current->plane->damage, &damage);
-	//update the clip region here. but yeah, our surface region is not
-	//correct at all.
-	pixman_region32_subtract(&render_surface->clip, &bbox, clipped);
-	pixman_region32_copy(&opaque, &current->opaque_region);
-	pixman_region32_translate(&opaque, surface->geometry.x,
-	                          surface->geometry.y);
-	pixman_region32_intersect(&opaque, &opaque, &bbox);
-	pixman_region32_union(clipped, clipped, &opaque);
-
-	pixman_region32_fini(&damage);
-	pixman_region32_fini(&bbox);
-	pixman_region32_fini(&opaque);
 }
 
-static void
-pipeline_stack_damage(struct tw_egl_layer_render_pipeline *pipeline,
-                      struct tw_plane *plane)
-{
-	struct tw_surface *surface;
-	struct tw_render_output *output;
-	struct tw_render_context *ctx = pipeline->base.ctx;
-	struct tw_layers_manager *layers = pipeline->manager;
-
-	//the clip the total coverred region, opaque is the per-plane covered
-	//region. For now we have only one plane
-	pixman_region32_t opaque;
-
-	SCOPE_PROFILE_BEG();
-	pixman_region32_init(&opaque);
-	wl_list_for_each(surface, &layers->views,
-	                 links[TW_VIEW_GLOBAL_LINK]) {
+/******************************************************************************
+ * quad batching
+ *
+ * Instead of issuing a draw per scissor box, every visible box becomes a quad
+ * in global space with its own texture coordinates. Quads are grouped into
+ * batches by shader and texture, a quad can join an earlier batch as long as
+ * it does not overlap anything queued after that batch, so the painter's
+ * order is kept for blending. All the batches are uploaded into one VBO and
+ * each batch is a single draw call.
+ *
+ * Opaque quads are drawn first with blending disabled. The clip of a surface
+ * excludes the opaque regions above it, so opaque quads never overlap each
+ * other or the translucent quads above them, they can join any batch.
+ *****************************************************************************/
 
-		surface_accumulate_damage(surface, &opaque);
+static struct tw_egl_quad_batch *
+pipeline_new_quad_batch(struct tw_egl_layer_render_pipeline *pipeline,
+                        struct tw_egl_quad_shader *shader,
+                        struct tw_egl_render_texture *texture, bool blend)
+{
+	struct tw_egl_quad_batch *batch;
+	size_t used = pipeline->batch.nbatches * sizeof(*batch);
+
+	//reuse the pooled batches, so their arrays do not reallocate
+	if (used >= pipeline->batch.batches.size) {
+		batch = wl_array_add(&pipeline->batch.batches, sizeof(*batch));
+		if (!batch)
+			return NULL;
+		wl_array_init(&batch->vertices);
+		pixman_region32_init(&batch->area);
+	} else {
+		batch = (struct tw_egl_quad_batch *)
+			((char *)pipeline->batch.batches.data + used);
 	}
+	batch->shader = shader;
+	batch->texture = texture;
+	batch->blend = blend;
+	batch->first = 0;
+	batch->vertices.size = 0;
+	pixman_region32_clear(&batch->area);
+	pipeline->batch.nbatches++;
+	return batch;
+}
 
-	pixman_region32_fini(&opaque);
-
-	wl_list_for_each(output, &ctx->outputs, link) {
-		pixman_region32_t output_damage;
-		pixman_rectangle32_t rect =
-			tw_output_device_geometry(&output->device);
-
-		pixman_region32_init(&output_damage);
-		pixman_region32_intersect_rect(&output_damage, &plane->damage,
-		                               rect.x, rect.y,
-		                               rect.width, rect.height);
-		pixman_region32_subtract(&plane->damage, &plane->damage,
-		                         &output_damage);
-		pixman_region32_translate(&output_damage, -rect.x, -rect.y);
-		pixman_region32_copy(output->state.pending_damage,
-		                     &output_damage);
-		pixman_region32_fini(&output_damage);
+static struct tw_egl_quad_batch *
+pipeline_find_quad_batch(struct tw_egl_layer_render_pipeline *pipeline,
+                         struct tw_egl_quad_shader *shader,
+                         struct tw_egl_render_texture *texture,
+                         bool blend, const pixman_box32_t *box)
+{
+	struct tw_egl_quad_batch *batches = pipeline->batch.batches.data;
+
+	for (int i = pipeline->batch.nbatches-1; i >= 0; i--) {
+		struct tw_egl_quad_batch *batch = &batches[i];
+
+		//the two passes do not interfere each other
+		if (batch->blend != blend)
+			continue;
+		if (batch->shader == shader && batch->texture == texture)
+			return batch;
+		//cannot move the quad below something it overlaps
+		if (blend &&
+		    pixman_region32_contains_rectangle(&batch->area,
+		                                       (pixman_box32_t *)box)
+		    != PIXMAN_REGION_OUT)
+			break;
 	}
-
-	SCOPE_PROFILE_END();
+	return pipeline_new_quad_batch(pipeline, shader, texture, blend);
 }
 
 static inline void
-pipeline_compose_output_buffer_damage(struct tw_render_output *output,
-                                      pixman_region32_t *damage,
-                                      int buffer_age)
+quad_vertex_from_global(struct tw_egl_quad_vertex *vert,
+                        const struct tw_mat3 *inverse, float x, float y)
 {
-	pixman_region32_t *damages[2];
+	float sx, sy;
+
+	//inverse maps global space back to the surface (-1,-1,1,1) space.
+	//y-inverted textures are flipped by the shader permutation
+	tw_mat3_vec_transform(inverse, x, y, &sx, &sy);
+	vert->x = x;
+	vert->y = y;
+	vert->u = (sx + 1.0f) / 2.0f;
+	vert->v = (sy + 1.0f) / 2.0f;
+}
 
-	buffer_age = buffer_age <= 2 ? buffer_age : 2;
-	damages[0] = output->state.curr_damage;
-	damages[1] = output->state.prev_damage;
-	pixman_region32_copy(damage, output->state.pending_damage);
+static void
+pipeline_queue_quad(struct tw_egl_layer_render_pipeline *pipeline,
+                    struct tw_egl_quad_shader *shader,
+                    struct tw_egl_render_texture *texture,
+                    const struct tw_mat3 *inverse, bool blend,
+                    const pixman_box32_t *box)
+{
+	struct tw_egl_quad_vertex *verts;
+	struct tw_egl_quad_batch *batch =
+		pipeline_find_quad_batch(pipeline, shader, texture, blend, box);
 
-	for (int i = 0; i < buffer_age; i++)
-		pixman_region32_union(damage, damage, damages[i]);
+	if (!batch)
+		return;
+	verts = wl_array_add(&batch->vertices, 6 * sizeof(*verts));
+	if (!verts)
+		return;
+	//two triangles per quad, we do not use strips to draw many quads at
+	//once.
+	quad_vertex_from_global(&verts[0], inverse, box->x1, box->y1);
+	quad_vertex_from_global(&verts[1], inverse, box->x2, box->y1);
+	quad_vertex_from_global(&verts[2], inverse, box->x1, box->y2);
+	verts[3] = verts[1];
+	quad_vertex_from_global(&verts[4], inverse, box->x2, box->y2);
+	verts[5] = verts[2];
+
+	//only the translucent quads care about the order
+	if (blend)
+		pixman_region32_union_rect(&batch->area, &batch->area,
+		                           box->x1, box->y1,
+		                           box->x2 - box->x1,
+		                           box->y2 - box->y1);
 }
 
-/******************************************************************************
- * repaints
- *****************************************************************************/
-
 static void
-pipeline_scissor_surface(struct tw_render_output *output,
-                         pixman_box32_t *box)
+pipeline_upload_quads(struct tw_egl_layer_render_pipeline *pipeline)
 {
-	//the box are in global space, we would need to convert them into
-	//output_space
-	pixman_box32_t scr_box;
-
-	if (box != NULL) {
-		glEnable(GL_SCISSOR_TEST);
-		//since the surface is y-down
-		tw_mat3_box_transform(&output->state.view_2d,
-		                      &scr_box, box);
+	struct tw_egl_quad_batch *batches = pipeline->batch.batches.data;
+	struct wl_array *staging = &pipeline->batch.vertices;
+	GLsizeiptr size;
+	void *dst;
+
+	staging->size = 0;
+	for (unsigned i = 0; i < pipeline->batch.nbatches; i++) {
+		batches[i].first = staging->size /
+			sizeof(struct tw_egl_quad_vertex);
+		dst = wl_array_add(staging, batches[i].vertices.size);
+		if (!dst)
+			return;
+		memcpy(dst, batches[i].vertices.data,
+		       batches[i].vertices.size);
+	}
+	size = staging->size;
+
+	glBindBuffer(GL_ARRAY_BUFFER, pipeline->batch.vbo);
+	//orphaning the buffer so we do not stall on the last frame
+	if (size > pipeline->batch.vbo_size)
+		pipeline->batch.vbo_size = size;
+	glBufferData(GL_ARRAY_BUFFER, pipeline->batch.vbo_size, NULL,
+	             GL_STREAM_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, size, staging->data);
+}
 
-		glScissor(scr_box.x1, scr_box.y1,
-		          scr_box.x2-scr_box.x1, scr_box.y2-scr_box.y1);
-	} else {
-		glDisable(GL_SCISSOR_TEST);
+static inline void
+pipeline_draw_quad_batch(struct tw_egl_quad_batch *batch,
+                         const struct tw_mat3 *proj,
+                         struct tw_egl_quad_shader **shader,
+                         struct tw_egl_render_texture **texture)
+{
+	GLsizei count = batch->vertices.size /
+		sizeof(struct tw_egl_quad_vertex);
+
+	if (batch->shader != *shader) {
+		*shader = batch->shader;
+		glUseProgram((*shader)->prog);
+		glUniformMatrix3fv((*shader)->uniform.proj, 1, GL_FALSE,
+		                   proj->d);
+		glUniform1i((*shader)->uniform.target, 0);
+		glUniform1f((*shader)->uniform.alpha, 1.0f);
 	}
+	if (batch->texture != *texture) {
+		*texture = batch->texture;
+		glBindTexture((*texture)->target, (*texture)->gltex);
+	}
+	glDrawArrays(GL_TRIANGLES, batch->first, count);
+}
+
+/* global space to the (-1,-1,1,1) space of the output framebuffer */
+static inline void
+pipeline_output_proj(struct tw_render_output *o, struct tw_mat3 *proj)
+{
+	unsigned int w, h;
+
+	tw_output_device_raw_resolution(&o->device, &w, &h);
+	tw_mat3_ortho_proj(proj, w, h);
+	tw_mat3_multiply(proj, proj, &o->state.view_2d);
 }
 
 static void
-pipeline_draw_quad(bool y_inverted)
+pipeline_flush_quads(struct tw_egl_layer_render_pipeline *pipeline,
+                     struct tw_render_output *o)
 {
-	////////////////////////////////
-	//
-	//      1 <-------- 0
-	//        | \     |
-	//        |   \   |
-	//        |    \  |
-	//        |     \ |
-	//      3 --------- 2
-	//
-	////////////////////////////////
-	GLfloat verts[] = {
-		1, -1,
-		-1, -1,
-		1, 1,
-		-1, 1,
-	};
-	// tex coordinates, OpenGL stores texture upside down, y_inverted here
-	// means the texture follows OpenGL
-	GLfloat texcoords_y_inverted[] = {
-		1, 1,
-		0, 1,
-		1, 0,
-		0, 0
-	};
-	GLfloat texcoords[] = {
-		1, 0,
-		0, 0,
-		1, 1,
-		0, 1
-	};
-
-	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, verts);
-	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0,
-	                      y_inverted ? texcoords_y_inverted : texcoords);
+	struct tw_mat3 proj;
+	struct tw_egl_quad_batch *batches = pipeline->batch.batches.data;
+	struct tw_egl_quad_shader *shader = NULL;
+	struct tw_egl_render_texture *texture = NULL;
+	GLsizei stride = sizeof(struct tw_egl_quad_vertex);
+
+	if (!pipeline->batch.nbatches)
+		return;
+	SCOPE_PROFILE_BEG();
+
+	//quads are in global space, the projection is shared by all of them
+	pipeline_output_proj(o, &proj);
+
+	pipeline_upload_quads(pipeline);
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, stride,
+	                      (void *)offsetof(struct tw_egl_quad_vertex, x));
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, stride,
+	                      (void *)offsetof(struct tw_egl_quad_vertex, u));
 	glEnableVertexAttribArray(0);
 	glEnableVertexAttribArray(1);
+	glDisable(GL_SCISSOR_TEST);
+	glActiveTexture(GL_TEXTURE0);
 
-	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	//opaque pass, front to back
+	glDisable(GL_BLEND);
+	for (int i = pipeline->batch.nbatches-1; i >= 0; i--)
+		if (!batches[i].blend)
+			pipeline_draw_quad_batch(&batches[i], &proj,
+			                         &shader, &texture);
+	//translucent pass, back to front
+	glEnable(GL_BLEND);
+	for (unsigned i = 0; i < pipeline->batch.nbatches; i++)
+		if (batches[i].blend)
+			pipeline_draw_quad_batch(&batches[i], &proj,
+			                         &shader, &texture);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	pipeline->batch.nbatches = 0;
+
+	SCOPE_PROFILE_END();
 }
 
 static void
-pipeline_cleanup_buffer(struct tw_render_output *output)
+pipeline_cleanup_buffer(struct tw_render_output *output,
+                        pixman_region32_t *damage)
 {
-	//TODO: this cleanup function will be replaced when we render only the
-	//damage part
 	unsigned int width, height;
 
 	tw_output_device_raw_resolution(&output->device, &width, &height);
 
-	//restore the scissor information for cleaning up the canvas
-	glDisable(GL_SCISSOR_TEST);
 	//TODO: the viewport is clearly not correct, since the output will have
 	//scale difference, by then we will need to update the viewport, damage
 	//and project matrix
 	glViewport(0, 0, width, height);
-	glEnable(GL_BLEND);
+	//blending is enabled only for the translucent pass
 	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
 
 #if defined( _TW_DEBUG_DAMAGE ) || defined( _TW_DEBUG_CLIP )
-	glClear(GL_COLOR_BUFFER_BIT);
+	pipeline_scissor_surface(output, NULL);
 	glClearColor(0.5f, 0.5f, 0.5f, 1.0f);
+	glClear(GL_COLOR_BUFFER_BIT);
+#else
+	//only clean up the damaged part, the rest of the buffer is still valid
+	int nrects;
+	pixman_box32_t *boxes = pixman_region32_rectangles(damage, &nrects);
+
+	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+	for (int i = 0; i < nrects; i++) {
+		pipeline_scissor_surface(output, &boxes[i]);
+		glClear(GL_COLOR_BUFFER_BIT);
+	}
+	pipeline_scissor_surface(output, NULL);
 #endif
 }
 
@@ -261,14 +394,35 @@ pipeline_cleanup_buffer(struct tw_render_output *output)
 static void
 pipeline_paint_surface_clip(struct tw_render_surface *surface,
                             struct tw_egl_layer_render_pipeline *pipeline,
-                            struct tw_render_output *o,
                             const struct tw_mat3 *proj)
 {
 	int nrects;
 	pixman_box32_t *boxes;
+	struct tw_egl_quad_vertex *verts;
+	struct wl_array *staging = &pipeline->batch.vertices;
+	GLsizei stride = sizeof(struct tw_egl_quad_vertex);
 	//purple color for clip
 	GLfloat debug_colors[4] = {1.0, 0.0, 1.0, 1.0};
-	struct tw_egl_quad_shader *shader = &pipeline->color_quad_shader;
+	struct tw_egl_quad_shader *shader =
+		tw_egl_quad_shader_cache_get(&pipeline->shaders,
+		                             TW_EGL_QUAD_SOLID_COLOR |
+		                             TW_EGL_QUAD_GLOBAL_ALPHA);
+
+	//all the clip boxes in one draw, no scissor per box
+	staging->size = 0;
+	boxes = pixman_region32_rectangles(&surface->clip, &nrects);
+	for (int i = 0; i < nrects; i++) {
+		if (!(verts = wl_array_add(staging, 6 * sizeof(*verts))))
+			return;
+		verts[0] = (struct tw_egl_quad_vertex){boxes[i].x1, boxes[i].y1};
+		verts[1] = (struct tw_egl_quad_vertex){boxes[i].x2, boxes[i].y1};
+		verts[2] = (struct tw_egl_quad_vertex){boxes[i].x1, boxes[i].y2};
+		verts[3] = verts[1];
+		verts[4] = (struct tw_egl_quad_vertex){boxes[i].x2, boxes[i].y2};
+		verts[5] = verts[2];
+	}
+	if (!nrects)
+		return;
 
 	glUseProgram(shader->prog);
 	glUniformMatrix3fv(shader->uniform.proj, 1, GL_FALSE, proj->d);
@@ -276,133 +430,525 @@ pipeline_paint_surface_clip(struct tw_render_surface *surface,
 	            debug_colors[2], debug_colors[3]);
 	glUniform1f(shader->uniform.alpha, 0.5);
 
-	boxes = pixman_region32_rectangles(&surface->clip, &nrects);
-	for (int i = 0; i < nrects; i++) {
-		pipeline_scissor_surface(o, &boxes[i]);
-		pipeline_draw_quad(false);
-	}
+	verts = staging->data;
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, stride, &verts->x);
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, stride, &verts->u);
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+	glDrawArrays(GL_TRIANGLES, 0, 6 * nrects);
 }
 
 #endif
 
+static bool
+pipeline_texture_features(struct tw_egl_render_texture *texture,
+                          uint32_t *features)
+{
+	switch (texture->target) {
+	case GL_TEXTURE_2D:
+		*features = 0;
+		break;
+	case GL_TEXTURE_EXTERNAL_OES:
+		*features = TW_EGL_QUAD_TEXTURE_EXTERNAL;
+		break;
+	default:
+		tw_logl_level(TW_LOG_ERRO, "unknown texture format!");
+		return false;
+	}
+	// OpenGL stores texture upside down, y_inverted here means the texture
+	// follows OpenGL
+	if (texture->base.inverted_y)
+		*features |= TW_EGL_QUAD_Y_INVERT;
+	//the X channel of XRGB buffers is undefined
+	if (!texture->base.has_alpha)
+		*features |= TW_EGL_QUAD_RGBX;
+	return true;
+}
+
+static void
+pipeline_queue_region(struct tw_egl_layer_render_pipeline *pipeline,
+                      struct tw_egl_quad_shader *shader,
+                      struct tw_egl_render_texture *texture,
+                      const struct tw_mat3 *inverse, bool blend,
+                      pixman_region32_t *region)
+{
+	int nrects;
+	pixman_box32_t *boxes = pixman_region32_rectangles(region, &nrects);
+
+	for (int i = 0; i < nrects; i++)
+		pipeline_queue_quad(pipeline, shader, texture, inverse, blend,
+		                    &boxes[i]);
+}
+
 static void
 pipeline_paint_surface(struct tw_surface *surface,
                        struct tw_egl_layer_render_pipeline *pipeline,
                        struct tw_render_output *o,
                        pixman_region32_t *output_damage)
 {
-	int nrects;
-	pixman_box32_t *boxes;
-	struct tw_mat3 proj, tmp;
+	uint32_t features;
 	struct tw_egl_quad_shader *shader;
 	struct tw_egl_render_texture *texture =
 		wl_container_of(surface->buffer.handle.ptr, texture, base);
 	struct tw_render_surface *render_surface =
 		wl_container_of(surface, render_surface, surface);
-	pixman_region32_t damage;
-	unsigned int w, h;
+	struct tw_render_arena *arena = &pipeline->base.ctx->frame_arena;
+	pixman_region32_t *damage, *opaque, *local, *translucent;
 
 	if (!texture)
 		return;
 
-	switch (texture->target) {
-	case GL_TEXTURE_2D:
-		shader = &pipeline->quad_shader;
-		break;
-	case GL_TEXTURE_EXTERNAL_OES:
-		shader = &pipeline->ext_quad_shader;
-		break;
-	default:
-		tw_logl_level(TW_LOG_ERRO, "unknown texture format!");
+	//extracting damages, we only draw what is damaged on this buffer
+	damage = tw_render_arena_region(arena);
+	opaque = tw_render_arena_region(arena);
+	local = tw_render_arena_region(arena);
+	translucent = tw_render_arena_region(arena);
+	if (!damage || !opaque || !local || !translucent)
+		return;
+#if defined( _TW_DEBUG_CLIP )
+	pixman_region32_copy(damage, &render_surface->clip);
+#else
+	pixman_region32_intersect(damage, &render_surface->clip,
+	                          output_damage);
+#endif
+	if (!pixman_region32_not_empty(damage))
+		return;
+	//deferred buffers are uploaded only when they are actually painted
+	tw_egl_render_context_flush_surface(pipeline->base.ctx, surface);
+
+	if (!pipeline_texture_features(texture, &features))
 		return;
-	}
 	//scope start
 	SCOPE_PROFILE_BEG();
 
-	tw_output_device_raw_resolution(&o->device, &w, &h);
+	//split the opaque part, it does not need blending
+	if (!texture->base.has_alpha) {
+		pixman_region32_copy(opaque, damage);
+	} else {
+		pixman_region32_copy(local, &surface->current->opaque_region);
+		pixman_region32_translate(local, surface->geometry.x,
+		                          surface->geometry.y);
+		pixman_region32_intersect(opaque, local, damage);
+	}
+	pixman_region32_subtract(translucent, damage, opaque);
+
+	//the cheapest fragment path for each part
+	shader = tw_egl_quad_shader_cache_get(&pipeline->shaders,
+	                                      features | TW_EGL_QUAD_OPAQUE);
+	pipeline_queue_region(pipeline, shader, texture,
+	                      &surface->geometry.inverse_transform, false,
+	                      opaque);
+	shader = tw_egl_quad_shader_cache_get(&pipeline->shaders, features);
+	pipeline_queue_region(pipeline, shader, texture,
+	                      &surface->geometry.inverse_transform, true,
+	                      translucent);
 
-	tw_mat3_multiply(&tmp,
-	                 &o->state.view_2d,
-	                 &surface->geometry.transform);
-	tw_mat3_ortho_proj(&proj, w, h);
-	tw_mat3_multiply(&proj, &proj, &tmp);
+	SCOPE_PROFILE_END();
+}
 
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(texture->target, texture->gltex);
-	glTexParameteri(texture->target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(texture->target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+#if defined ( _TW_DEBUG_CLIP )
 
-	glUseProgram(shader->prog);
-	glUniformMatrix3fv(shader->uniform.proj, 1, GL_FALSE, proj.d);
-	glUniform1i(shader->uniform.target, 0);
-	glUniform1f(shader->uniform.alpha, 1.0f);
+static void
+pipeline_paint_surface_clips(struct tw_egl_layer_render_pipeline *pipeline,
+                             struct tw_render_output *o)
+{
+	struct tw_mat3 proj;
+	struct tw_surface *surface;
+	struct tw_render_surface *render_surface;
 
-	//extracting damages
-	pixman_region32_init(&damage);
-	pixman_region32_intersect(&damage, &render_surface->clip,
-	                          output_damage);
+	//clips are in global space as the quads
+	pipeline_output_proj(o, &proj);
+	glEnable(GL_BLEND);
+	wl_list_for_each_reverse(surface, &pipeline->manager->views,
+	                         links[TW_VIEW_GLOBAL_LINK]) {
+		render_surface = wl_container_of(surface, render_surface,
+		                                 surface);
+		pipeline_paint_surface_clip(render_surface, pipeline, &proj);
+	}
+}
 
-#if defined( _TW_DEBUG_CLIP )
-	boxes = pixman_region32_rectangles(&render_surface->clip, &nrects);
-#else
-	//TODO this is clearly not right, we should use damage but we keep
-	//drawing on the wrong buffer
-	boxes = pixman_region32_rectangles(&render_surface->clip, &nrects);
 #endif
 
-	for (int i = 0; i < nrects; i++) {
-		pipeline_scissor_surface(o, &boxes[i]);
-		pipeline_draw_quad(texture->base.inverted_y);
+/******************************************************************************
+ * layer cache
+ *
+ * Layers like the background or the panels rarely change, but every time the
+ * damage passes through them all of their surfaces are drawn again. Once the
+ * members of a layer stayed unchanged for a few repaints, the layer is drawn
+ * into an offscreen texture and painted as one quad from then on. Any commit
+ * with damage, move or restack of a member, or a new output mode changes the
+ * signature of the layer and drops it back to direct drawing.
+ *
+ * The cache costs a full output sized texture per layer, so only layers with
+ * more than one view are cached, the ones not seen in a repaint are freed.
+ *****************************************************************************/
+
+#define TW_EGL_LAYER_CACHE_MIN_VIEWS 2
+#define TW_EGL_LAYER_CACHE_CLEAN_FRAMES 2
+
+static inline uint64_t
+layer_cache_hash(uint64_t hash, uint64_t value)
+{
+	hash ^= value;
+	hash *= 0x100000001b3ULL;
+	return hash;
+}
+
+/* from the bottom view of a range to the one above it */
+static inline struct wl_list *
+layer_range_next(struct wl_list *views, struct wl_list *pos)
+{
+	return pos == views ? views : pos->prev;
+}
+
+static uint64_t
+layer_range_signature(struct wl_list *views, struct wl_list *bottom,
+                      unsigned int n, struct tw_render_output *output)
+{
+	unsigned int w, h;
+	struct wl_list *pos = bottom;
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	tw_output_device_raw_resolution(&output->device, &w, &h);
+	hash = layer_cache_hash(hash, ((uint64_t)w << 32) | h);
+	for (unsigned i = 0; i < 9; i++)
+		hash = layer_cache_hash(hash, (uint64_t)(int64_t)
+		                        (output->state.view_2d.d[i] * 256.0f));
+
+	for (unsigned i = 0; i < n && pos != views; i++) {
+		struct tw_surface *surface =
+			wl_container_of(pos, surface, links[TW_VIEW_GLOBAL_LINK]);
+		struct tw_render_surface *render_surface =
+			wl_container_of(surface, render_surface, surface);
+		pixman_rectangle32_t *xywh = &surface->geometry.xywh;
+
+		hash = layer_cache_hash(hash, (uintptr_t)surface);
+		hash = layer_cache_hash(hash,
+		                        (uintptr_t)surface->buffer.handle.ptr);
+		hash = layer_cache_hash(hash, render_surface->dirty_serial);
+		hash = layer_cache_hash(hash, ((uint64_t)(uint32_t)xywh->x << 32) |
+		                        (uint32_t)xywh->y);
+		hash = layer_cache_hash(hash, ((uint64_t)xywh->width << 32) |
+		                        xywh->height);
+		pos = layer_range_next(views, pos);
 	}
+	return hash;
+}
 
-	pixman_region32_fini(&damage);
+static void
+layer_cache_release(struct tw_egl_layer_cache *cache)
+{
+	if (cache->fbo)
+		glDeleteFramebuffers(1, &cache->fbo);
+	if (cache->texture.gltex)
+		glDeleteTextures(1, &cache->texture.gltex);
+	cache->fbo = 0;
+	cache->texture.gltex = 0;
+	cache->valid = false;
+}
 
-#if defined ( _TW_DEBUG_CLIP )
-	pipeline_paint_surface_clip(render_surface, pipeline, o, &proj);
+static void
+layer_cache_destroy(struct tw_egl_layer_cache *cache)
+{
+	layer_cache_release(cache);
+	wl_list_remove(&cache->link);
+	free(cache);
+}
+
+static struct tw_egl_layer_cache *
+pipeline_find_layer_cache(struct tw_egl_layer_render_pipeline *pipeline,
+                          const struct tw_layer *layer,
+                          const struct tw_render_output *output, bool create)
+{
+	struct tw_egl_layer_cache *cache;
+
+	wl_list_for_each(cache, &pipeline->layer_cache.caches, link)
+		if (cache->layer == layer && cache->output == output)
+			return cache;
+	if (!create || !(cache = calloc(1, sizeof(*cache))))
+		return NULL;
+	cache->layer = layer;
+	cache->output = output;
+	cache->texture.target = GL_TEXTURE_2D;
+	cache->texture.base.has_alpha = true;
+	wl_list_insert(&pipeline->layer_cache.caches, &cache->link);
+	return cache;
+}
+
+/* expects the cache fbo bound */
+static bool
+layer_cache_alloc(struct tw_egl_layer_cache *cache, unsigned int width,
+                  unsigned int height)
+{
+	GLuint tex;
+
+	if (cache->fbo && cache->width == width && cache->height == height)
+		return true;
+	layer_cache_release(cache);
+
+	glGenTextures(1, &tex);
+	glBindTexture(GL_TEXTURE_2D, tex);
+	//sampled texel to pixel
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA,
+	             GL_UNSIGNED_BYTE, NULL);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	cache->texture.gltex = tex;
+	cache->texture.base.width = width;
+	cache->texture.base.height = height;
+
+	glGenFramebuffers(1, &cache->fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, cache->fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+	                       GL_TEXTURE_2D, tex, 0);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) !=
+	    GL_FRAMEBUFFER_COMPLETE) {
+		tw_logl_level(TW_LOG_WARN, "incomplete layer cache fbo");
+		layer_cache_release(cache);
+		return false;
+	}
+	cache->width = width;
+	cache->height = height;
+	return true;
+}
+
+/* draw all the members of the layer into the cache, not only the visible
+ * part, so the cache stays valid when the layers above move */
+static bool
+layer_cache_render(struct tw_egl_layer_render_pipeline *pipeline,
+                   struct tw_egl_layer_cache *cache,
+                   struct tw_render_output *output, struct wl_list *bottom,
+                   unsigned int n)
+{
+	GLint fb = 0;
+	uint32_t features;
+	unsigned int w, h;
+	struct wl_list *views = &pipeline->manager->views;
+	struct wl_list *pos = bottom;
+	pixman_rectangle32_t rect = tw_output_device_geometry(&output->device);
+	pixman_region32_t region;
+
+	tw_output_device_raw_resolution(&output->device, &w, &h);
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &fb);
+	if (!layer_cache_alloc(cache, w, h)) {
+		glBindFramebuffer(GL_FRAMEBUFFER, fb);
+		return false;
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, cache->fbo);
+	glViewport(0, 0, w, h);
+	glDisable(GL_SCISSOR_TEST);
+	glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+	glClear(GL_COLOR_BUFFER_BIT);
+	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+	for (unsigned i = 0; i < n && pos != views; i++) {
+		struct tw_surface *surface =
+			wl_container_of(pos, surface, links[TW_VIEW_GLOBAL_LINK]);
+		struct tw_egl_render_texture *texture =
+			wl_container_of(surface->buffer.handle.ptr, texture,
+			                base);
+
+		pos = layer_range_next(views, pos);
+		if (!texture || !pipeline_texture_features(texture, &features))
+			continue;
+		tw_egl_render_context_flush_surface(pipeline->base.ctx,
+		                                    surface);
+		pixman_region32_init_rect(&region, rect.x, rect.y,
+		                          rect.width, rect.height);
+		pixman_region32_intersect_rect(&region, &region,
+		                               surface->geometry.xywh.x,
+		                               surface->geometry.xywh.y,
+		                               surface->geometry.xywh.width,
+		                               surface->geometry.xywh.height);
+		pipeline_queue_region(pipeline,
+		                      tw_egl_quad_shader_cache_get(
+			                      &pipeline->shaders, features),
+		                      texture,
+		                      &surface->geometry.inverse_transform,
+		                      true, &region);
+		pixman_region32_fini(&region);
+	}
+	pipeline_flush_quads(pipeline, output);
+	glBindFramebuffer(GL_FRAMEBUFFER, fb);
+	return true;
+}
+
+/* update the cache states before anything is queued for the output, the
+ * caches need the quad batches for rendering themselves */
+static void
+pipeline_prepare_layer_caches(struct tw_egl_layer_render_pipeline *pipeline,
+                              struct tw_render_output *output)
+{
+	struct tw_layer *layer;
+	struct tw_egl_layer_cache *cache, *tmp;
+	struct wl_list *views = &pipeline->manager->views;
+	struct wl_list *bottom = views->prev;
+
+	wl_list_for_each(cache, &pipeline->layer_cache.caches, link)
+		if (cache->output == output)
+			cache->used = false;
+
+	wl_list_for_each_reverse(layer, &pipeline->manager->layers, link) {
+		unsigned int n = layer->n_views;
+		struct wl_list *range = bottom;
+		uint64_t signature;
+
+		for (unsigned i = 0; i < n; i++)
+			bottom = layer_range_next(views, bottom);
+		if (!pipeline->layer_cache.enabled ||
+		    n < TW_EGL_LAYER_CACHE_MIN_VIEWS)
+			continue;
+		cache = pipeline_find_layer_cache(pipeline, layer, output,
+		                                  true);
+		if (!cache)
+			continue;
+		cache->used = true;
+		signature = layer_range_signature(views, range, n, output);
+		if (signature != cache->signature) {
+			cache->signature = signature;
+			cache->clean_frames = 0;
+			cache->valid = false;
+		} else if (cache->clean_frames <
+		           TW_EGL_LAYER_CACHE_CLEAN_FRAMES) {
+			cache->clean_frames++;
+		} else if (!cache->valid) {
+			cache->valid = layer_cache_render(pipeline, cache,
+			                                  output, range, n);
+		}
+	}
+
+	wl_list_for_each_safe(cache, tmp, &pipeline->layer_cache.caches, link)
+		if (cache->output == output && !cache->used)
+			layer_cache_destroy(cache);
+}
+
+static void
+pipeline_paint_layer_cache(struct tw_egl_layer_render_pipeline *pipeline,
+                           struct tw_egl_layer_cache *cache,
+                           struct tw_render_output *o,
+                           struct wl_list *bottom, unsigned int n,
+                           pixman_region32_t *output_damage)
+{
+	struct tw_mat3 proj;
+	struct wl_list *views = &pipeline->manager->views;
+	struct wl_list *pos = bottom;
+	pixman_region32_t damage;
+
+	//the visible part of the layer is the union of the member clips
+	pixman_region32_init(&damage);
+	for (unsigned i = 0; i < n && pos != views; i++) {
+		struct tw_surface *surface =
+			wl_container_of(pos, surface, links[TW_VIEW_GLOBAL_LINK]);
+		struct tw_render_surface *render_surface =
+			wl_container_of(surface, render_surface, surface);
+
+		pixman_region32_union(&damage, &damage, &render_surface->clip);
+		pos = layer_range_next(views, pos);
+	}
+#if !defined( _TW_DEBUG_CLIP )
+	pixman_region32_intersect(&damage, &damage, output_damage);
 #endif
-	SCOPE_PROFILE_END();
+	//the cache is in framebuffer space, the texture coordinates are the
+	//normalized framebuffer coordinates
+	pipeline_output_proj(o, &proj);
+	pipeline_queue_region(pipeline,
+	                      tw_egl_quad_shader_cache_get(&pipeline->shaders,
+	                                                   0),
+	                      &cache->texture, &proj, true, &damage);
+	pixman_region32_fini(&damage);
+}
+
+static void
+pipeline_paint_layers(struct tw_egl_layer_render_pipeline *pipeline,
+                      struct tw_render_output *o,
+                      pixman_region32_t *output_damage)
+{
+	struct tw_layer *layer;
+	struct tw_surface *surface;
+	struct tw_egl_layer_cache *cache;
+	struct wl_list *views = &pipeline->manager->views;
+	struct wl_list *bottom = views->prev;
+
+	//for non-opaque surface to work, you really have to draw in reverse
+	//order
+	if (!pipeline->layer_cache.enabled) {
+		wl_list_for_each_reverse(surface, views,
+		                         links[TW_VIEW_GLOBAL_LINK])
+			pipeline_paint_surface(surface, pipeline, o,
+			                       output_damage);
+		return;
+	}
+	wl_list_for_each_reverse(layer, &pipeline->manager->layers, link) {
+		unsigned int n = layer->n_views;
+
+		cache = pipeline_find_layer_cache(pipeline, layer, o, false);
+		if (cache && cache->valid) {
+			pipeline_paint_layer_cache(pipeline, cache, o, bottom,
+			                           n, output_damage);
+			for (unsigned i = 0; i < n; i++)
+				bottom = layer_range_next(views, bottom);
+			continue;
+		}
+		for (unsigned i = 0; i < n && bottom != views; i++) {
+			surface = wl_container_of(bottom, surface,
+			                          links[TW_VIEW_GLOBAL_LINK]);
+			pipeline_paint_surface(surface, pipeline, o,
+			                       output_damage);
+			bottom = layer_range_next(views, bottom);
+		}
+	}
 }
 
 /******************************************************************************
  * pipeline implementation
  *****************************************************************************/
 
+static void
+pipeline_prepare_frame(struct tw_render_pipeline *base)
+{
+	struct tw_egl_layer_render_pipeline *pipeline =
+		wl_container_of(base, pipeline, base);
+
+	tw_render_context_build_view_list(base->ctx, pipeline->manager);
+	tw_layer_renderer_stack_damage(base->ctx, pipeline->manager,
+	                               &pipeline->main_plane);
+}
+
 static void
 pipeline_repaint_output(struct tw_render_pipeline *base,
                         struct tw_render_output *output, int buffer_age)
 {
-	struct tw_surface *surface;
 	struct tw_egl_layer_render_pipeline *pipeline =
 		wl_container_of(base, pipeline, base);
-        struct tw_layers_manager *manager = pipeline->manager;
-	pixman_region32_t output_damage;
+	pixman_region32_t *output_damage;
 
 	SCOPE_PROFILE_BEG();
+	TW_PROBE2(repaint_begin, output->device.id, buffer_age);
 
-	tw_render_context_build_view_list(base->ctx, pipeline->manager);
-	pixman_region32_init(&output_damage);
-
-	//move to plane
-	wl_list_for_each(surface, &manager->views,
-	                 links[TW_VIEW_GLOBAL_LINK]) {
-		surface->current->plane = &pipeline->main_plane;
-	}
+	//not in a batch, prepare the scene for this output only
+	if (!base->prepared)
+		pipeline_prepare_frame(base);
+	if (!(output_damage = tw_render_arena_region(&base->ctx->frame_arena)))
+		goto out;
+	tw_layer_renderer_compose_output_damage(output, output_damage,
+	                                        buffer_age);
 
-	pipeline_stack_damage(pipeline, &pipeline->main_plane);
-	pipeline_compose_output_buffer_damage(output, &output_damage,
-	                                      buffer_age);
+	pipeline_prepare_layer_caches(pipeline, output);
+	pipeline_cleanup_buffer(output, output_damage);
 
-	pipeline_cleanup_buffer(output);
-
-	//for non-opaque surface to work, you really have to draw in reverse
-	//order
-	wl_list_for_each_reverse(surface, &manager->views,
-	                         links[TW_VIEW_GLOBAL_LINK])
-		pipeline_paint_surface(surface, pipeline, output,
-		                       &output_damage);
-
-	pixman_region32_fini(&output_damage);
+	pipeline_paint_layers(pipeline, output, output_damage);
+	pipeline_flush_quads(pipeline, output);
+	//the surfaces not painted still have to give their buffers back
+	tw_egl_render_context_flush_pending(base->ctx);
 
+#if defined ( _TW_DEBUG_CLIP )
+	pipeline_paint_surface_clips(pipeline, output);
+#endif
+out:
+	TW_PROBE1(repaint_end, output->device.id);
 	SCOPE_PROFILE_END();
 }
 
@@ -412,12 +958,23 @@ pipeline_destroy(struct tw_render_pipeline *base)
 	struct tw_egl_layer_render_pipeline *pipeline =
 		wl_container_of(base, pipeline, base);
 
+	struct tw_egl_quad_batch *batch;
+	struct tw_egl_layer_cache *cache, *tmp;
+
 	tw_plane_fini(&pipeline->main_plane);
 	tw_render_pipeline_fini(base);
 
-	tw_egl_quad_color_shader_fini(&pipeline->color_quad_shader);
-	tw_egl_quad_tex_shader_fini(&pipeline->quad_shader);
-	tw_egl_quad_texext_shader_fini(&pipeline->ext_quad_shader);
+	wl_array_for_each(batch, &pipeline->batch.batches) {
+		wl_array_release(&batch->vertices);
+		pixman_region32_fini(&batch->area);
+	}
+	wl_array_release(&pipeline->batch.batches);
+	wl_array_release(&pipeline->batch.vertices);
+	glDeleteBuffers(1, &pipeline->batch.vbo);
+	wl_list_for_each_safe(cache, tmp, &pipeline->layer_cache.caches, link)
+		layer_cache_destroy(cache);
+
+	tw_egl_quad_shader_cache_fini(&pipeline->shaders);
         free(pipeline);
 }
 
@@ -431,12 +988,30 @@ tw_egl_render_pipeline_create_default(struct tw_render_context *ctx,
         pipeline->manager = manager;
         tw_render_pipeline_init(&pipeline->base, "EGL Sample", ctx);
 
-	tw_egl_quad_color_shader_init(&pipeline->color_quad_shader);
-	tw_egl_quad_tex_shader_init(&pipeline->quad_shader);
-	tw_egl_quad_texext_shader_init(&pipeline->ext_quad_shader);
+	tw_egl_quad_shader_cache_init(&pipeline->shaders);
 	tw_plane_init(&pipeline->main_plane);
+
+	wl_array_init(&pipeline->batch.batches);
+	wl_array_init(&pipeline->batch.vertices);
+	glGenBuffers(1, &pipeline->batch.vbo);
+	wl_list_init(&pipeline->layer_cache.caches);
+
 	pipeline->base.impl.destroy = pipeline_destroy;
+	pipeline->base.impl.prepare_frame = pipeline_prepare_frame;
 	pipeline->base.impl.repaint_output = pipeline_repaint_output;
 
 	return &pipeline->base;
 }
+
+void
+tw_egl_render_pipeline_enable_layer_cache(struct tw_render_pipeline *base,
+                                          bool enable)
+{
+	struct tw_egl_layer_render_pipeline *pipeline =
+		wl_container_of(base, pipeline, base);
+
+	if (base->impl.repaint_output != pipeline_repaint_output)
+		return;
+	//the unused caches are freed on the next repaint
+	pipeline->layer_cache.enabled = enable;
+}
@@ -0,0 +1,167 @@
+/*
+ * frame_stats.c - taiwins per output frame statistics
+ *
+ * Copyright (c) 2021 Xichen Zhou
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <taiwins/objects/utils.h>
+#include <taiwins/render_output.h>
+#include <ctypes/helpers.h>
+
+#include "frame_stats.h"
+
+static const char *cause_names[TW_FRAME_CAUSE_CNT] = {
+	[TW_FRAME_CAUSE_SURFACE] = "surface",
+	[TW_FRAME_CAUSE_CURSOR] = "cursor",
+	[TW_FRAME_CAUSE_CONFIG] = "config",
+	[TW_FRAME_CAUSE_OUTPUT] = "output",
+	[TW_FRAME_CAUSE_OTHER] = "other",
+};
+
+/* histogram bucket upper bounds in microseconds, the last one is open */
+static const uint32_t bucket_bounds[] = {
+	1000, 2000, 4000, 8000, 16667, 33333, 66667, UINT32_MAX,
+};
+#define BUCKET_CNT (sizeof(bucket_bounds) / sizeof(bucket_bounds[0]))
+
+void
+tw_frame_stats_window_add(struct tw_frame_stats_window *window, uint32_t us)
+{
+	window->samples[window->idx] = us;
+	window->idx = (window->idx + 1) % TW_FRAME_STATS_CNT;
+	window->cnt = MIN(window->cnt + 1, TW_FRAME_STATS_CNT);
+}
+
+static int
+cmp_samples(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	return (x > y) - (x < y);
+}
+
+void
+tw_frame_stats_window_dump(const struct tw_frame_stats_window *window,
+                           const char *name, FILE *file)
+{
+	uint32_t sorted[TW_FRAME_STATS_CNT];
+	unsigned int n = window->cnt, buckets[BUCKET_CNT] = {0};
+
+	fprintf(file, "  %-8s", name);
+	if (!n) {
+		fprintf(file, " no samples\n");
+		return;
+	}
+	memcpy(sorted, window->samples, n * sizeof(uint32_t));
+	qsort(sorted, n, sizeof(uint32_t), cmp_samples);
+	fprintf(file, " p50 %u p90 %u p99 %u max %u us\n",
+	        sorted[(n-1) * 50 / 100], sorted[(n-1) * 90 / 100],
+	        sorted[(n-1) * 99 / 100], sorted[n-1]);
+
+	for (unsigned i = 0, b = 0; i < n; i++) {
+		while (sorted[i] > bucket_bounds[b])
+			b++;
+		buckets[b]++;
+	}
+	fprintf(file, "  %-8s", "");
+	for (unsigned b = 0; b < BUCKET_CNT; b++) {
+		if (bucket_bounds[b] == UINT32_MAX)
+			fprintf(file, " >%u:%u", bucket_bounds[b-1] / 1000,
+			        buckets[b]);
+		else
+			fprintf(file, " <=%u:%u", bucket_bounds[b] / 1000,
+			        buckets[b]);
+	}
+	fprintf(file, " (ms:count)\n");
+}
+
+void
+tw_frame_stats_init(struct tw_frame_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+}
+
+void
+tw_frame_stats_add_frame(struct tw_frame_stats *stats, uint32_t render_us,
+                         uint32_t causes)
+{
+	stats->frames++;
+	tw_frame_stats_window_add(&stats->render, render_us);
+
+	if (causes & TW_REPAINT_CAUSE_SURFACE)
+		stats->causes[TW_FRAME_CAUSE_SURFACE]++;
+	if (causes & TW_REPAINT_CAUSE_CURSOR)
+		stats->causes[TW_FRAME_CAUSE_CURSOR]++;
+	if (causes & TW_REPAINT_CAUSE_CONFIG)
+		stats->causes[TW_FRAME_CAUSE_CONFIG]++;
+	if (causes & TW_REPAINT_CAUSE_OUTPUT)
+		stats->causes[TW_FRAME_CAUSE_OUTPUT]++;
+	if (!causes)
+		stats->causes[TW_FRAME_CAUSE_OTHER]++;
+}
+
+void
+tw_frame_stats_add_present(struct tw_frame_stats *stats,
+                           const struct timespec *present,
+                           uint32_t refresh_us, bool missed)
+{
+	long interval;
+
+	if (missed)
+		stats->missed++;
+	if (stats->has_present) {
+		interval = tw_timespec_diff_us(present, &stats->last_present);
+		if (interval > 0) {
+			tw_frame_stats_window_add(&stats->interval, interval);
+			//vblanks passed without a frame, a missed one is not
+			//counted as idle
+			if (refresh_us) {
+				long vblanks = (interval + refresh_us / 2) /
+					refresh_us;
+				if (vblanks > 1)
+					stats->idle += vblanks - 1 - missed;
+			}
+		}
+	}
+	stats->last_present = *present;
+	stats->has_present = true;
+}
+
+void
+tw_frame_stats_reset_clock(struct tw_frame_stats *stats)
+{
+	stats->has_present = false;
+}
+
+void
+tw_frame_stats_dump(const struct tw_frame_stats *stats, const char *name,
+                    FILE *file)
+{
+	fprintf(file, "output %s: frames %llu missed %llu idle %llu\n", name,
+	        (unsigned long long)stats->frames,
+	        (unsigned long long)stats->missed,
+	        (unsigned long long)stats->idle);
+	tw_frame_stats_window_dump(&stats->render, "render", file);
+	tw_frame_stats_window_dump(&stats->interval, "interval", file);
+	fprintf(file, "  %-8s", "causes");
+	for (int i = 0; i < TW_FRAME_CAUSE_CNT; i++)
+		fprintf(file, " %s %llu", cause_names[i],
+		        (unsigned long long)stats->causes[i]);
+	fprintf(file, "\n");
+}
@@ -0,0 +1,103 @@
+/*
+ * frame_stats.h - taiwins per output frame statistics
+ *
+ * Copyright (c) 2021 Xichen Zhou
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+#ifndef TW_FRAME_STATS_H
+#define TW_FRAME_STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+/* the rolling window the histograms cover */
+#define TW_FRAME_STATS_CNT 256
+
+enum tw_frame_stats_cause {
+	TW_FRAME_CAUSE_SURFACE,
+	TW_FRAME_CAUSE_CURSOR,
+	TW_FRAME_CAUSE_CONFIG,
+	TW_FRAME_CAUSE_OUTPUT,
+	TW_FRAME_CAUSE_OTHER,
+	TW_FRAME_CAUSE_CNT,
+};
+
+struct tw_frame_stats_window {
+	uint32_t samples[TW_FRAME_STATS_CNT]; /**< in microseconds */
+	unsigned int idx, cnt;
+};
+
+struct tw_frame_stats {
+	struct tw_frame_stats_window render; /**< repaint time */
+	struct tw_frame_stats_window interval; /**< between presents */
+
+	uint64_t frames;
+	uint64_t missed; /**< presented after the vblank we aimed at */
+	uint64_t idle; /**< vblanks passed without a frame */
+	uint64_t causes[TW_FRAME_CAUSE_CNT];
+
+	struct timespec last_present;
+	bool has_present;
+};
+
+void
+tw_frame_stats_window_add(struct tw_frame_stats_window *window, uint32_t us);
+
+/**
+ * @brief print the percentiles and the histogram of the window
+ */
+void
+tw_frame_stats_window_dump(const struct tw_frame_stats_window *window,
+                           const char *name, FILE *file);
+
+void
+tw_frame_stats_init(struct tw_frame_stats *stats);
+
+/**
+ * @brief record a repaint, the causes are tw_render_output_repaint_cause bits
+ */
+void
+tw_frame_stats_add_frame(struct tw_frame_stats *stats, uint32_t render_us,
+                         uint32_t causes);
+
+void
+tw_frame_stats_add_present(struct tw_frame_stats *stats,
+                           const struct timespec *present,
+                           uint32_t refresh_us, bool missed);
+
+/**
+ * @brief presents before a clock reset are not comparable to the ones after
+ */
+void
+tw_frame_stats_reset_clock(struct tw_frame_stats *stats);
+
+void
+tw_frame_stats_dump(const struct tw_frame_stats *stats, const char *name,
+                    FILE *file);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif /* EOF */
@@ -0,0 +1,288 @@
+/*
+ * latency.c - taiwins input to present latency tracer
+ *
+ * Copyright (c) 2021 Xichen Zhou
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include <wayland-server.h>
+#include <taiwins/backend.h>
+#include <taiwins/render_surface.h>
+#include <taiwins/objects/surface.h>
+#include <taiwins/objects/utils.h>
+
+#include "latency.h"
+
+/******************************************************************************
+ * latency tracer
+ *
+ * An input delivered to a focused surface starts a measurement for its client,
+ * from the timestamp the kernel gave the event. The next commit of that client
+ * is taken as the response, the outputs it shows on are repainted, and the
+ * first present of one of those frames ends the measurement. Inputs arriving
+ * while a measurement is running only count from the oldest one. Backends
+ * stamp input with CLOCK_MONOTONIC, so only outputs on that clock are used.
+ *****************************************************************************/
+
+/* inputs a client never responded to */
+#define TW_LATENCY_TIMEOUT_MS 500
+
+static void
+notify_latency_client_destroy(struct wl_listener *listener, void *data)
+{
+	struct tw_latency_client *client =
+		wl_container_of(listener, client, destroy);
+
+	wl_list_remove(&client->destroy.link);
+	wl_list_remove(&client->link);
+	free(client);
+}
+
+static struct tw_latency_client *
+latency_client_get(struct tw_latency_tracer *tracer,
+                   struct wl_client *wl_client)
+{
+	struct tw_latency_client *client;
+	pid_t pid;
+	FILE *file;
+	char path[64];
+
+	wl_list_for_each(client, &tracer->clients, link)
+		if (client->client == wl_client)
+			return client;
+	if (!(client = calloc(1, sizeof(*client))))
+		return NULL;
+	client->client = wl_client;
+	client->state = TW_LATENCY_IDLE;
+	wl_client_get_credentials(wl_client, &pid, NULL, NULL);
+	snprintf(client->name, sizeof(client->name), "pid %d", (int)pid);
+	snprintf(path, sizeof(path), "/proc/%d/comm", (int)pid);
+	if ((file = fopen(path, "r"))) {
+		char comm[16] = {0};
+
+		if (fgets(comm, sizeof(comm), file)) {
+			comm[strcspn(comm, "\n")] = '\0';
+			snprintf(client->name, sizeof(client->name), "%s[%d]",
+			         comm, (int)pid);
+		}
+		fclose(file);
+	}
+	wl_list_insert(tracer->clients.prev, &client->link);
+	client->destroy.notify = notify_latency_client_destroy;
+	wl_client_add_destroy_listener(wl_client, &client->destroy);
+	return client;
+}
+
+/******************************************************************************
+ * listeners
+ *****************************************************************************/
+
+static void
+notify_latency_seat_input(struct wl_listener *listener, void *data)
+{
+	struct tw_latency_tracer *tracer =
+		wl_container_of(listener, tracer, listeners.seat_input);
+	struct tw_engine_seat *seat = data;
+	struct tw_latency_client *client;
+	uint32_t time = seat->last_input.time;
+
+	if (!seat->last_input.surface || !time)
+		return;
+	client = latency_client_get(tracer,
+	                            wl_resource_get_client(
+		                            seat->last_input.surface));
+	if (!client)
+		return;
+	if (client->state == TW_LATENCY_IDLE ||
+	    (client->state == TW_LATENCY_INPUT &&
+	     time - client->input_ms > TW_LATENCY_TIMEOUT_MS)) {
+		client->state = TW_LATENCY_INPUT;
+		client->input_ms = time;
+	}
+}
+
+static void
+notify_latency_surface_dirty(struct wl_listener *listener, void *data)
+{
+	struct tw_latency_tracer *tracer =
+		wl_container_of(listener, tracer, listeners.surface_dirty);
+	struct tw_surface *surface = data;
+	struct tw_render_surface *render_surface =
+		wl_container_of(surface, render_surface, surface);
+	struct wl_client *wl_client;
+	struct tw_latency_client *client;
+
+	if (!surface->resource || wl_list_empty(&tracer->clients))
+		return;
+	wl_client = wl_resource_get_client(surface->resource);
+	wl_list_for_each(client, &tracer->clients, link) {
+		if (client->client != wl_client ||
+		    client->state != TW_LATENCY_INPUT)
+			continue;
+		if (tw_get_time_ms(CLOCK_MONOTONIC) - client->input_ms >
+		    TW_LATENCY_TIMEOUT_MS) {
+			client->state = TW_LATENCY_IDLE;
+		} else if (render_surface->output_mask) {
+			client->state = TW_LATENCY_COMMITTED;
+			client->outputs = render_surface->output_mask;
+		}
+		break;
+	}
+}
+
+static void
+notify_latency_output_post_frame(struct wl_listener *listener, void *data)
+{
+	struct tw_latency_output *slot =
+		wl_container_of(listener, slot, post_frame);
+	struct tw_latency_tracer *tracer = slot->tracer;
+	struct tw_latency_client *client;
+	uint32_t bit = 1u << slot->output->device.id;
+
+	wl_list_for_each(client, &tracer->clients, link) {
+		if (client->state == TW_LATENCY_COMMITTED &&
+		    (client->outputs & bit)) {
+			client->state = TW_LATENCY_PAINTED;
+			client->outputs = bit;
+		}
+	}
+}
+
+static void
+notify_latency_output_present(struct wl_listener *listener, void *data)
+{
+	struct tw_event_output_present *event = data;
+	struct tw_latency_output *slot =
+		wl_container_of(listener, slot, present);
+	struct tw_latency_tracer *tracer = slot->tracer;
+	struct tw_render_output *output = slot->output;
+	struct tw_latency_client *client;
+	uint32_t bit = 1u << output->device.id;
+	uint64_t present_us = tw_timespec_to_us(&event->time);
+
+	if (output->device.clk_id != CLOCK_MONOTONIC)
+		return;
+	wl_list_for_each(client, &tracer->clients, link) {
+		uint32_t ms;
+
+		if (client->state != TW_LATENCY_PAINTED ||
+		    !(client->outputs & bit))
+			continue;
+		//input time is a wrapping 32 bits millisecond
+		ms = (uint32_t)(present_us / 1000) - client->input_ms;
+		tw_frame_stats_window_add(&client->latency,
+		                          ms * 1000 + present_us % 1000);
+		client->samples++;
+		client->state = TW_LATENCY_IDLE;
+	}
+}
+
+static void
+notify_latency_output_destroy(struct wl_listener *listener, void *data)
+{
+	struct tw_latency_output *slot =
+		wl_container_of(listener, slot, destroy);
+
+	tw_reset_wl_list(&slot->post_frame.link);
+	tw_reset_wl_list(&slot->present.link);
+	tw_reset_wl_list(&slot->destroy.link);
+	slot->output = NULL;
+}
+
+static void
+notify_latency_new_output(struct wl_listener *listener, void *data)
+{
+	struct tw_latency_tracer *tracer =
+		wl_container_of(listener, tracer, listeners.new_output);
+	struct tw_output_device *device = data;
+	struct tw_render_output *output =
+		wl_container_of(device, output, device);
+	struct tw_latency_output *slot = &tracer->outputs[device->id];
+
+	slot->tracer = tracer;
+	slot->output = output;
+	tw_signal_setup_listener(&output->signals.post_frame,
+	                         &slot->post_frame,
+	                         notify_latency_output_post_frame);
+	tw_signal_setup_listener(&output->signals.present,
+	                         &slot->present,
+	                         notify_latency_output_present);
+	tw_signal_setup_listener(&device->signals.destroy,
+	                         &slot->destroy,
+	                         notify_latency_output_destroy);
+}
+
+static void
+notify_latency_context_destroy(struct wl_listener *listener, void *data)
+{
+	struct tw_latency_tracer *tracer =
+		wl_container_of(listener, tracer, listeners.context_destroy);
+
+	tracer->ctx = NULL;
+	tw_reset_wl_list(&tracer->listeners.seat_input.link);
+	tw_reset_wl_list(&tracer->listeners.surface_dirty.link);
+	tw_reset_wl_list(&tracer->listeners.new_output.link);
+	tw_reset_wl_list(&tracer->listeners.context_destroy.link);
+}
+
+/******************************************************************************
+ * APIs
+ *****************************************************************************/
+
+void
+tw_latency_tracer_dump(struct tw_latency_tracer *tracer, FILE *file)
+{
+	struct tw_latency_client *client;
+
+	wl_list_for_each(client, &tracer->clients, link) {
+		if (!client->samples)
+			continue;
+		fprintf(file, "client %s: samples %llu\n", client->name,
+		        (unsigned long long)client->samples);
+		tw_frame_stats_window_dump(&client->latency, "latency", file);
+	}
+}
+
+struct tw_latency_tracer *
+tw_latency_tracer_create_global(struct tw_engine *engine,
+                                struct tw_render_context *ctx)
+{
+	static struct tw_latency_tracer tracer = {0};
+	struct tw_backend *backend = engine->backend;
+
+	tracer.engine = engine;
+	tracer.ctx = ctx;
+	wl_list_init(&tracer.clients);
+
+	tw_signal_setup_listener(&engine->signals.seat_input,
+	                         &tracer.listeners.seat_input,
+	                         notify_latency_seat_input);
+	tw_signal_setup_listener(&ctx->signals.wl_surface_dirty,
+	                         &tracer.listeners.surface_dirty,
+	                         notify_latency_surface_dirty);
+	tw_signal_setup_listener(&backend->signals.new_output,
+	                         &tracer.listeners.new_output,
+	                         notify_latency_new_output);
+	tw_signal_setup_listener(&ctx->signals.destroy,
+	                         &tracer.listeners.context_destroy,
+	                         notify_latency_context_destroy);
+	return &tracer;
+}
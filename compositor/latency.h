@@ -0,0 +1,94 @@
+/*
+ * latency.h - taiwins input to present latency tracer
+ *
+ * Copyright (c) 2021 Xichen Zhou
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+#ifndef TW_LATENCY_H
+#define TW_LATENCY_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <wayland-server-core.h>
+#include <taiwins/engine.h>
+#include <taiwins/render_context.h>
+#include <taiwins/render_output.h>
+
+#include "frame_stats.h"
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+enum tw_latency_state {
+	TW_LATENCY_IDLE,
+	TW_LATENCY_INPUT, /**< input delivered, waiting for a commit */
+	TW_LATENCY_COMMITTED, /**< client responded, waiting for a repaint */
+	TW_LATENCY_PAINTED, /**< repainted, waiting for the present */
+};
+
+/* latency samples of a client, one pending input at a time */
+struct tw_latency_client {
+	struct wl_list link; /* tw_latency_tracer:clients */
+	struct wl_client *client;
+	struct wl_listener destroy;
+	char name[32];
+
+	enum tw_latency_state state;
+	uint32_t input_ms; /**< kernel timestamp of the oldest input */
+	uint32_t outputs; /**< outputs showing the response */
+
+	struct tw_frame_stats_window latency;
+	uint64_t samples;
+};
+
+struct tw_latency_output {
+	struct tw_latency_tracer *tracer;
+	struct tw_render_output *output;
+	struct wl_listener post_frame;
+	struct wl_listener present;
+	struct wl_listener destroy;
+};
+
+struct tw_latency_tracer {
+	struct tw_engine *engine;
+	struct tw_render_context *ctx;
+	struct wl_list clients;
+
+	struct tw_latency_output outputs[32];
+
+	struct {
+		struct wl_listener seat_input;
+		struct wl_listener surface_dirty;
+		struct wl_listener new_output;
+		struct wl_listener context_destroy;
+	} listeners;
+};
+
+struct tw_latency_tracer *
+tw_latency_tracer_create_global(struct tw_engine *engine,
+                                struct tw_render_context *ctx);
+
+void
+tw_latency_tracer_dump(struct tw_latency_tracer *tracer, FILE *file);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif /* EOF */
@@ -0,0 +1,179 @@
+/*
+ * layer_renderer.c - damage stacking shared by the layer renderers
+ *
+ * Copyright (c) 2021 Xichen Zhou
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+#include <wayland-server-core.h>
+#include <wayland-util.h>
+#include <pixman.h>
+
+#include <taiwins/objects/layers.h>
+#include <taiwins/objects/plane.h>
+#include <taiwins/objects/surface.h>
+#include <taiwins/output_device.h>
+#include <taiwins/render_context.h>
+#include <taiwins/render_output.h>
+#include <taiwins/render_surface.h>
+#include "utils.h"
+
+#include "render.h"
+
+/******************************************************************************
+ * damage stacking
+ *****************************************************************************/
+
+/* repainting a 64x64 tile is about the price of one more clear and one more
+ * fragment in every surface clip */
+#define TW_LAYER_RENDERER_RECT_COST 4096
+#define TW_LAYER_RENDERER_MAX_RECTS 16
+
+/* every result goes to a fresh arena region, pixman would reallocate the
+ * boxes of a destination that is also a source */
+static void
+surface_accumulate_damage(struct tw_surface *surface,
+                          const pixman_rectangle32_t *rect,
+                          struct tw_render_arena *arena,
+                          pixman_region32_t **clipped,
+                          pixman_region32_t **output_damage)
+{
+	pixman_region32_t bbox;
+	pixman_region32_t *damage = tw_render_arena_region(arena);
+	pixman_region32_t *local = tw_render_arena_region(arena);
+	pixman_region32_t *unclipped = tw_render_arena_region(arena);
+	pixman_region32_t *visible = tw_render_arena_region(arena);
+	pixman_region32_t *opaque = tw_render_arena_region(arena);
+	pixman_region32_t *covered = tw_render_arena_region(arena);
+	pixman_region32_t *sum = tw_render_arena_region(arena);
+	struct tw_view *current = surface->current;
+	struct tw_render_surface *render_surface =
+		wl_container_of(surface, render_surface, surface);
+	struct tw_render_texture *texture = tw_surface_has_texture(surface) ?
+		surface->buffer.handle.ptr : NULL;
+
+	if (!damage || !local || !unclipped || !visible || !opaque ||
+	    !covered || !sum)
+		return;
+	pixman_region32_init_rect(&bbox,
+	                          surface->geometry.xywh.x,
+	                          surface->geometry.xywh.y,
+	                          surface->geometry.xywh.width,
+	                          surface->geometry.xywh.height);
+	pixman_region32_intersect_rect(&bbox, &bbox, rect->x, rect->y,
+	                               rect->width, rect->height);
+
+	if (pixman_region32_not_empty(&surface->geometry.dirty)) {
+		pixman_region32_intersect_rect(unclipped,
+		                               &surface->geometry.dirty,
+		                               rect->x, rect->y,
+		                               rect->width, rect->height);
+	} else {
+		pixman_region32_intersect_rect(local,
+		                               &current->surface_damage,
+		                               0, 0,
+		                               surface->geometry.xywh.width,
+		                               surface->geometry.xywh.height);
+		pixman_region32_translate(local, surface->geometry.xywh.x,
+		                          surface->geometry.xywh.y);
+		pixman_region32_intersect(unclipped, local, &bbox);
+	}
+	pixman_region32_subtract(damage, unclipped, *clipped);
+	pixman_region32_union(sum, *output_damage, damage);
+	*output_damage = sum;
+	//the clip is the union of the visible parts on every output, copied
+	//back so it keeps its boxes instead of reallocating
+	pixman_region32_subtract(visible, &bbox, *clipped);
+	if (pixman_region32_not_empty(&render_surface->clip)) {
+		pixman_region32_union(unclipped, &render_surface->clip,
+		                      visible);
+		pixman_region32_copy(&render_surface->clip, unclipped);
+	} else {
+		pixman_region32_copy(&render_surface->clip, visible);
+	}
+	//a buffer without alpha covers everything below it
+	if (texture && !texture->has_alpha) {
+		pixman_region32_copy(opaque, visible);
+	} else {
+		pixman_region32_copy(local, &current->opaque_region);
+		pixman_region32_translate(local, surface->geometry.x,
+		                          surface->geometry.y);
+		pixman_region32_intersect(opaque, local, visible);
+	}
+	pixman_region32_union(covered, *clipped, opaque);
+	*clipped = covered;
+
+	pixman_region32_fini(&bbox);
+}
+
+void
+tw_layer_renderer_stack_damage(struct tw_render_context *ctx,
+                               struct tw_layers_manager *layers,
+                               struct tw_plane *plane)
+{
+	struct tw_surface *surface, **view;
+	struct tw_render_surface *render_surface;
+	struct tw_render_output *output;
+	struct tw_render_arena *arena = &ctx->frame_arena;
+
+	SCOPE_PROFILE_BEG();
+
+	//move to plane, for now we have only one plane
+	wl_list_for_each(surface, &layers->views, links[TW_VIEW_GLOBAL_LINK]) {
+		render_surface = wl_container_of(surface, render_surface,
+		                                 surface);
+		surface->current->plane = plane;
+		tw_region_reset(&render_surface->clip);
+	}
+
+	//every output stacks only the views touching it, the opaque region
+	//of the views above clips the ones below
+	wl_list_for_each(output, &ctx->outputs, link) {
+		pixman_region32_t *opaque = tw_render_arena_region(arena);
+		pixman_region32_t *output_damage =
+			tw_render_arena_region(arena);
+		pixman_rectangle32_t rect =
+			tw_output_device_geometry(&output->device);
+
+		if (!opaque || !output_damage)
+			break;
+		wl_array_for_each(view, &output->touching_views)
+			surface_accumulate_damage(*view, &rect, arena,
+			                          &opaque, &output_damage);
+		pixman_region32_translate(output_damage, -rect.x, -rect.y);
+		//accumulate, the output may not have repainted since last time
+		pixman_region32_union(output->state.pending_damage,
+		                      output->state.pending_damage,
+		                      output_damage);
+	}
+
+	SCOPE_PROFILE_END();
+}
+
+void
+tw_layer_renderer_compose_output_damage(struct tw_render_output *output,
+                                        pixman_region32_t *damage,
+                                        int buffer_age)
+{
+	pixman_rectangle32_t rect = tw_output_device_geometry(&output->device);
+
+	tw_render_output_get_buffer_damage(output, buffer_age, damage);
+	//growing the damage is always safe, everything inside is repainted
+	tw_region_simplify(damage, damage, TW_LAYER_RENDERER_MAX_RECTS,
+	                   TW_LAYER_RENDERER_RECT_COST);
+	pixman_region32_translate(damage, rect.x, rect.y);
+}
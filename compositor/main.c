@@ -32,6 +32,7 @@
 #include <wayland-server.h>
 #include <taiwins/objects/logger.h>
 #include <taiwins/objects/profiler.h>
+#include <taiwins/objects/recorder.h>
 #include <taiwins/objects/subprocess.h>
 #include <taiwins/objects/seat.h>
 #include <taiwins/objects/utils.h>
@@ -46,8 +47,10 @@
 #include <taiwins/render_context.h>
 #include <taiwins/render_pipeline.h>
 
+#include "options.h"
 #include "input.h"
 #include "output.h"
+#include "latency.h"
 #include "render.h"
 #include "desktop/xdg.h"
 #include "config/config.h"
@@ -58,6 +61,9 @@ struct tw_options {
 	const char *console_path;
 	const char *log_path;
 	const char *profiling_path;
+	const char *session_path;
+	bool deferred_upload;
+	bool layer_cache;
 };
 
 struct tw_server {
@@ -71,6 +77,7 @@ struct tw_server {
         struct tw_config config;
 	struct tw_server_output_manager *output_manager;
 	struct tw_server_input_manager *input_manager;
+	struct tw_latency_tracer *latency;
 };
 
 static bool
@@ -110,10 +117,12 @@ bind_listeners(struct tw_server *server)
 	server->input_manager =
 		tw_server_input_manager_create_global(server->engine,
 		                                      &server->config);
+	server->latency =
+		tw_latency_tracer_create_global(server->engine, server->ctx);
 }
 
 static bool
-bind_render(struct tw_server *server)
+bind_render(struct tw_server *server, const struct tw_options *options)
 {
 	const struct tw_egl_options *opts =
 		tw_backend_get_egl_params(server->backend);
@@ -122,12 +131,16 @@ bind_render(struct tw_server *server)
 
 	if (!server->ctx)
 		return false;
+	tw_egl_render_context_set_deferred_upload(server->ctx,
+	                                          options->deferred_upload);
 
 	struct tw_render_pipeline *pipeline =
 		tw_egl_render_pipeline_create_default(
 			server->ctx, &server->engine->layers_manager);
 	if (!pipeline)
 		return false;
+	tw_egl_render_pipeline_enable_layer_cache(pipeline,
+	                                          options->layer_cache);
 
 	wl_list_insert(server->ctx->pipelines.prev, &pipeline->link);
 	return true;
@@ -157,7 +170,8 @@ bind_socket(struct tw_server *server)
 }
 
 static bool
-tw_server_init(struct tw_server *server, struct wl_display *display)
+tw_server_init(struct tw_server *server, struct wl_display *display,
+               const struct tw_options *options)
 {
 	server->display = display;
 	server->loop = wl_display_get_event_loop(display);
@@ -168,7 +182,7 @@ tw_server_init(struct tw_server *server, struct wl_display *display)
 		return false;
 	if (!bind_config(server))
 		return false;
-	if (!bind_render(server))
+	if (!bind_render(server, options))
 		return false;
 
 	bind_listeners(server);
@@ -191,6 +205,8 @@ tw_term_on_signal(int sig_num, void *data)
 	return 1;
 }
 
+static char s_trace_path[PATH_MAX];
+
 static int
 tw_handle_sigchld(int sig_num, void *data)
 {
@@ -250,7 +266,14 @@ print_help(void)
 		"  -c, --console          Specify the taiwins console client path.\n"
 		"  -l, --log-path         Specify the logging path.\n"
 		"  -n, --no-shell         Launch taiwins without shell client.\n"
-		"  -p, --profiling-path   Specify the profiling path.\n"
+		"  -p, --profiling-path   Record a trace from start to the path,\n"
+		"                         otherwise org.taiwins.stats.Trace on\n"
+		"                         the bus toggles recording to\n"
+		"                         $XDG_RUNTIME_DIR/taiwins.trace.\n"
+		"  -r, --record-session   Record the client requests to the path,\n"
+		"                         for taiwins-replay.\n"
+		"  -d, --defer-upload     Upload client buffers at repaint.\n"
+		"  -C, --layer-cache      Draw static layers from offscreen cache.\n"
 		"\n";
 	fprintf(stdout, "%s", usage);
 }
@@ -283,6 +306,9 @@ parse_options(struct tw_options *options, int argc, char **argv)
 		{"log-path", required_argument, NULL, 'l'},
 		{"no-shell", no_argument, NULL, 'n'},
 		{"profiling-path", required_argument, NULL, 'p'},
+		{"record-session", required_argument, NULL, 'r'},
+		{"defer-upload", no_argument, NULL, 'd'},
+		{"layer-cache", no_argument, NULL, 'C'},
 		{0,0,0,0},
 	};
 	//init options
@@ -296,7 +322,7 @@ parse_options(struct tw_options *options, int argc, char **argv)
 
 	while (1) {
 		int opt_index = 0;
-		c = getopt_long(argc, argv, "hvns:c:l:p:",
+		c = getopt_long(argc, argv, "hvndCs:c:l:p:r:",
 		                long_options, &opt_index);
 		if (c == -1)
 			break;
@@ -324,6 +350,15 @@ parse_options(struct tw_options *options, int argc, char **argv)
 		case 'p':
 			options->profiling_path = optarg;
 			break;
+		case 'r':
+			options->session_path = optarg;
+			break;
+		case 'd':
+			options->deferred_upload = true;
+			break;
+		case 'C':
+			options->layer_cache = true;
+			break;
 		default:
 			fprintf(stderr, "uknown argument %c\n.", c);
 			exit(EXIT_FAILURE);
@@ -343,6 +378,7 @@ main(int argc, char *argv[])
 	char *cfg_err = NULL;
 	struct tw_server ec = {0};
 	struct wl_event_source *signals[4];
+	const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
 	struct wl_display *display;
 	struct wl_event_loop *loop;
 	struct tw_options options = {0};
@@ -365,10 +401,24 @@ main(int argc, char *argv[])
 		tw_logl("EE: failed to get event_loop from display\n");
 		goto err_event_loop;
 	}
-	if (!options.profiling_path)
-		options.profiling_path = "/dev/null";
-	if (!tw_profiler_open(display, options.profiling_path))
-		goto err_profiler;
+	if (options.profiling_path)
+		snprintf(s_trace_path, sizeof(s_trace_path), "%s",
+		         options.profiling_path);
+	else if (runtime_dir)
+		snprintf(s_trace_path, sizeof(s_trace_path), "%s/taiwins.trace",
+		         runtime_dir);
+	if (options.profiling_path && !_TW_ENABLE_PROFILING) {
+		tw_logl_level(TW_LOG_WARN, "trace points are not compiled in, "
+		              "rebuild with -Dprofiler=enabled to record");
+	} else if (options.profiling_path) {
+		if (!tw_profiler_open(display, s_trace_path))
+			goto err_profiler;
+		tw_profiler_enable(true);
+	}
+	//the recorder goes away with the display
+	if (options.session_path &&
+	    !tw_protocol_recorder_create(display, options.session_path))
+		tw_logl_level(TW_LOG_WARN, "failed to record the session");
 
 	signals[0] = wl_event_loop_add_signal(loop, SIGTERM,
 	                                      tw_term_on_signal, display);
@@ -380,7 +430,7 @@ main(int argc, char *argv[])
 	                                      tw_handle_sigchld, display);
 	if (!signals[0] || !signals[1] || !signals[2] || !signals[3])
 		goto err_signal;
-	if (!tw_server_init(&ec, display))
+	if (!tw_server_init(&ec, display, &options))
 		goto err_backend;
 	if (!drop_permissions())
 		goto err_permission;
@@ -389,6 +439,12 @@ main(int argc, char *argv[])
 	                          (void *)options.shell_path);
 	tw_config_register_object(&ec.config, TW_CONFIG_CONSOLE_PATH,
 	                          (void *)options.console_path);
+	tw_config_register_object(&ec.config, "output_manager",
+	                          ec.output_manager);
+	tw_config_register_object(&ec.config, "latency", ec.latency);
+	if (s_trace_path[0])
+		tw_config_register_object(&ec.config, "trace_path",
+		                          s_trace_path);
 	if (!tw_config_run(&ec.config, &cfg_err)) {
 		if (!tw_config_run_default(&ec.config))
 			goto err_config;
@@ -409,7 +465,8 @@ err_permission:
 err_backend:
 err_signal:
 	for (int i = 0; i < 4; i++)
-		wl_event_source_remove(signals[i]);
+		if (signals[i])
+			wl_event_source_remove(signals[i]);
 err_event_loop:
 	tw_profiler_close();
 err_profiler:
@@ -42,30 +42,86 @@
 static void
 tw_server_output_fini(struct tw_server_output *output);
 
+/* the frame time we plan for, the rest are covered by the margin */
+#define TW_FRAME_TIME_PERCENTILE 95
+#define TW_FRAME_MARGIN_MIN_US 500
+#define TW_FRAME_MARGIN_STEP_US 500
+#define TW_FRAME_MARGIN_DECAY_US 20
+
 static inline void
 update_output_frame_time(struct tw_server_output *output,
                          const struct timespec *strt,
                          const struct timespec *end)
 {
-	uint32_t ft;
-	uint64_t tstart = tw_timespec_to_us(strt);
-	uint64_t tend = tw_timespec_to_us(end);
-
-	/* assert(tend >= tstart); */
-	ft = MAX((uint32_t)0, (uint32_t)(tend - tstart));
-	output->state.fts[output->state.ft_idx] = ft;
-	output->state.ft_idx = (output->state.ft_idx + 1) % TW_FRAME_TIME_CNT;
+	long ft = tw_timespec_diff_us(end, strt);
+
+	output->state.fts[output->state.ft_idx] = MAX(ft, 0);
+	output->state.ft_idx = (output->state.ft_idx + 1) % TW_SERVER_FRAME_TIME_CNT;
+	output->state.ft_cnt = MIN(output->state.ft_cnt + 1,
+	                           TW_SERVER_FRAME_TIME_CNT);
 }
 
-/* getting the max frame time in milliseconds */
-static inline uint32_t
-calc_output_max_frametime(struct tw_server_output *output)
+/* the percentile of the recent frame times in microseconds, 0 if we have no
+ * samples yet */
+static uint32_t
+calc_output_predicted_frametime(struct tw_server_output *output)
 {
-	uint32_t *fts = output->state.fts;
-	uint32_t ft = MAX(MAX(MAX(fts[0], fts[1]), MAX(fts[2],fts[3])),
-	                  MAX(MAX(fts[4], fts[5]), MAX(fts[6],fts[7])));
-	//ceil algorithm, output basically
-	return ft ? ((ft + 1000) / 1000) : ft;
+	uint32_t fts[TW_SERVER_FRAME_TIME_CNT];
+	unsigned int n = output->state.ft_cnt, k;
+
+	if (!n)
+		return 0;
+	//insertion sort, we have only a few samples
+	for (unsigned i = 0; i < n; i++) {
+		uint32_t ft = output->state.fts[i];
+		unsigned j = i;
+
+		for (; j > 0 && fts[j-1] > ft; j--)
+			fts[j] = fts[j-1];
+		fts[j] = ft;
+	}
+	k = (n * TW_FRAME_TIME_PERCENTILE + 99) / 100;
+	return fts[MAX(k, 1u) - 1];
+}
+
+/* a frame presented more than half a refresh after the vblank it aimed at
+ * missed it */
+static bool
+update_output_frame_margin(struct tw_server_output *output,
+                           const struct timespec *present)
+{
+	struct tw_output_device *device = output->device;
+	uint32_t refresh_us =
+		tw_millihertz_to_ns(device->current.current_mode.refresh) /
+		1000;
+	long late_us;
+	bool missed;
+
+	if (!output->state.has_target)
+		return false;
+	output->state.has_target = false;
+	late_us = tw_timespec_diff_us(present, &output->state.target);
+	missed = late_us > (long)refresh_us / 2;
+
+	if (missed)
+		output->state.margin_us = MIN(output->state.margin_us +
+		                              TW_FRAME_MARGIN_STEP_US,
+		                              refresh_us / 2);
+	else if (output->state.margin_us > TW_FRAME_MARGIN_MIN_US)
+		output->state.margin_us =
+			MAX(output->state.margin_us - TW_FRAME_MARGIN_DECAY_US,
+			    (uint32_t)TW_FRAME_MARGIN_MIN_US);
+	return missed;
+}
+
+static inline void
+reset_output_frame_time(struct tw_server_output *output)
+{
+	output->state.ft_idx = 0;
+	output->state.ft_cnt = 0;
+	output->state.margin_us = TW_FRAME_MARGIN_MIN_US;
+	output->state.has_target = false;
+	memset(output->state.fts, 0, sizeof(output->state.fts));
 }
 
 /******************************************************************************
@@ -110,73 +166,204 @@ reassign_surface_outputs(struct tw_render_surface *render_surface,
 {
 	uint32_t area = 0, max = 0, mask = 0;
 	struct tw_render_output *output, *major = NULL;
-	pixman_region32_t surface_region;
-	pixman_box32_t *e;
 	struct tw_surface *surface = &render_surface->surface;
+	pixman_rectangle32_t *g = &surface->geometry.xywh;
 
-	pixman_region32_init_rect(&surface_region,
-	                          surface->geometry.xywh.x,
-	                          surface->geometry.xywh.y,
-	                          surface->geometry.xywh.width,
-	                          surface->geometry.xywh.height);
+	//plain box math, this runs for every moved surface
 	wl_list_for_each(output, &ctx->outputs, link) {
-		pixman_region32_t clip;
 		struct tw_output_device *device = &output->device;
 		pixman_rectangle32_t rect =
 			tw_output_device_geometry(device);
+		int32_t x1 = MAX(rect.x, g->x);
+		int32_t y1 = MAX(rect.y, g->y);
+		int32_t x2 = MIN(rect.x + (int32_t)rect.width,
+		                 g->x + (int32_t)g->width);
+		int32_t y2 = MIN(rect.y + (int32_t)rect.height,
+		                 g->y + (int32_t)g->height);
 		//TODO dealing with cloning output
 		// if (output->cloning >= 0)
 		//	continue;
-		pixman_region32_init_rect(&clip, rect.x, rect.y,
-		                          rect.width, rect.height);
-		pixman_region32_intersect(&clip, &clip, &surface_region);
-		e = pixman_region32_extents(&clip);
-		area = (e->x2 - e->x1) * (e->y2 - e->y1);
-		if (pixman_region32_not_empty(&clip))
+		area = (x1 < x2 && y1 < y2) ? (x2 - x1) * (y2 - y1) : 0;
+		if (area)
 			mask |= (1u << device->id);
 		if (area >= max) {
 			major = output;
 			max = area;
 		}
-		pixman_region32_fini(&clip);
 	}
-	pixman_region32_fini(&surface_region);
 
 	update_surface_mask(surface, engine, major, mask);
 }
 
-/******************************************************************************
- * output listeners
- *****************************************************************************/
+static inline void
+timespec_add_us(struct timespec *ts, long us)
+{
+	ts->tv_sec += us / 1000000;
+	ts->tv_nsec += (us % 1000000) * 1000;
+	if (ts->tv_nsec >= TW_NS_PER_S) {
+		ts->tv_sec += 1;
+		ts->tv_nsec -= TW_NS_PER_S;
+	}
+}
 
-static int
-notify_output_frame(void *data)
+static inline void
+output_repaint(struct tw_server_output *output)
 {
-	struct tw_server_output *output = data;
 	struct tw_render_output *render_output =
 		wl_container_of(output->device, render_output, device);
 	tw_render_output_post_frame(render_output);
+}
+
+static inline void
+output_flush_frame(struct tw_server_output *output)
+{
+	struct tw_render_output *render_output;
+
+	if (!output->device || !output->state.has_frame_done)
+		return;
+	render_output = wl_container_of(output->device, render_output, device);
+	output->state.has_frame_done = false;
+	tw_render_output_flush_frame(render_output, &output->state.frame_done);
+}
+
+/******************************************************************************
+ * repaint scheduler
+ *
+ * All the outputs share one timer. An output needing a frame gets a deadline,
+ * the latest time its repaint can start and still catch its next vblank. When
+ * the earliest deadline comes, every output due within the merge window joins
+ * the batch, starting a bit earlier costs a little latency but the scene is
+ * built and the damage stacked only once for the batch. Outputs in a batch are
+ * repainted by their vblank, the nearest first.
+ *****************************************************************************/
+
+#define TW_SCHED_MERGE_US 2000
+
+static void
+scheduler_arm(struct tw_server_output_manager *mgr);
+
+static void
+scheduler_run(struct tw_server_output_manager *mgr)
+{
+	unsigned int n = 0;
+	struct tw_server_output *batch[32];
+	struct timespec now, end;
+
+	if (!mgr->ctx)
+		return;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	for (int i = 0; i < 32; i++) {
+		struct tw_server_output *output = &mgr->outputs[i];
+		unsigned j = n;
+
+		if (!output->device || !output->state.pending ||
+		    tw_timespec_diff_us(&output->state.deadline, &now) >
+		    TW_SCHED_MERGE_US)
+			continue;
+		output->state.pending = false;
+		//sorted by vblank
+		for (; j > 0 && tw_timespec_diff_ns(&batch[j-1]->state.vblank,
+		                                    &output->state.vblank) > 0;
+		     j--)
+			batch[j] = batch[j-1];
+		batch[j] = output;
+		n++;
+	}
+	if (n) {
+		tw_render_context_begin_frames(mgr->ctx);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		mgr->sched.prepare_us = (mgr->sched.prepare_us * 7 +
+		                         MAX(tw_timespec_diff_us(&end, &now),
+		                             0)) / 8;
+		for (unsigned i = 0; i < n; i++)
+			output_repaint(batch[i]);
+		tw_render_context_end_frames(mgr->ctx);
+		for (unsigned i = 0; i < n; i++)
+			output_flush_frame(batch[i]);
+	}
+	scheduler_arm(mgr);
+}
+
+static int
+notify_scheduler_timer(void *data)
+{
+	scheduler_run(data);
 	return 0;
 }
 
+static void
+notify_scheduler_idle(void *data)
+{
+	struct tw_server_output_manager *mgr = data;
+
+	mgr->sched.idle = NULL;
+	scheduler_run(mgr);
+}
+
+static void
+scheduler_arm(struct tw_server_output_manager *mgr)
+{
+	long delay = -1;
+	struct timespec now;
+	struct wl_event_loop *loop;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	for (int i = 0; i < 32; i++) {
+		struct tw_server_output *output = &mgr->outputs[i];
+		long us;
+
+		if (!output->device || !output->state.pending)
+			continue;
+		us = tw_timespec_diff_us(&output->state.deadline, &now);
+		delay = delay < 0 ? MAX(us, 0) : MIN(delay, MAX(us, 0));
+	}
+	if (!mgr->sched.timer)
+		return;
+	if (delay < 0) {
+		wl_event_source_timer_update(mgr->sched.timer, 0);
+		return;
+	}
+	//the timer has only millisecond precision, round down to be early.
+	//Outputs already due are repainted once we are done with the current
+	//dispatch, so the ones dirtied together go in the same batch.
+	if (delay / 1000 < 1) {
+		if (mgr->sched.idle)
+			return;
+		loop = wl_display_get_event_loop(mgr->ctx->display);
+		mgr->sched.idle = wl_event_loop_add_idle(loop,
+		                                         notify_scheduler_idle,
+		                                         mgr);
+	} else {
+		wl_event_source_timer_update(mgr->sched.timer, delay / 1000);
+	}
+}
+
+/******************************************************************************
+ * output listeners
+ *****************************************************************************/
+
 static void
 notify_output_reshedule_frame(struct wl_listener *listener, void *data)
 {
-	int delay, ms_left = 0; //< left for render
+	long us_left = 0, delay = 0; //< left for render
 	struct tw_server_output *output =
 		wl_container_of(listener, output, listeners.need_frame);
+	struct tw_server_output_manager *mgr = output->mgr;
 	struct tw_output_device *device = data;
+	struct timespec mono_now;
 
-	int frametime = calc_output_max_frametime(output);
+	uint32_t frametime = calc_output_predicted_frametime(output);
 
 	assert(output->device == device);
 	if (!device->current.enabled)
 		return;
 
+	output->state.has_target = false;
 	if (frametime) { //becomes max_render_time
 		struct timespec now;
-		//get current time as soon as possible
-		clock_gettime(device->clk_id, &now);
+		//get current time as soon as possible, on the clock of the
+		//presentation timestamps
+		tw_output_device_get_time(device, &now);
 
 		struct timespec predict_refresh = output->state.last_present;
 		unsigned mhz = device->current.current_mode.refresh;
@@ -194,20 +381,26 @@ notify_output_reshedule_frame(struct wl_listener *listener, void *data)
 			predict_refresh.tv_nsec -= TW_NS_PER_S;
 		}
 
-		//this is the floored difference.
-		if (predict_refresh.tv_sec >= now.tv_sec)
-			ms_left = tw_timespec_diff_ms(&predict_refresh, &now);
-	}
-	//here we added 2 extra ms frametime, it seems with amount, we are
-	//able to catch up with next vblank. TODO we can we not rely on this,
-	//otherwise we would have to move this repaint logic out of libtaiwins.
-	delay = (ms_left - (frametime + 2));
-
-	if (delay < 1) {
-		notify_output_frame(output);
-	} else {
-		wl_event_source_timer_update(output->state.frame_timer, delay);
+		us_left = tw_timespec_diff_us(&predict_refresh, &now);
+		if (us_left > 0) {
+			output->state.target = predict_refresh;
+			output->state.has_target = true;
+		}
 	}
+	//start as late as the predicted frame time plus the margin allows, the
+	//batch also prepares the scene before any output repaints.
+	if (output->state.has_target)
+		delay = us_left - (long)(frametime + output->state.margin_us +
+		                         mgr->sched.prepare_us);
+
+	//device clock may differ, the scheduler works in CLOCK_MONOTONIC
+	clock_gettime(CLOCK_MONOTONIC, &mono_now);
+	output->state.deadline = mono_now;
+	output->state.vblank = mono_now;
+	timespec_add_us(&output->state.deadline, MAX(delay, 0));
+	timespec_add_us(&output->state.vblank, MAX(us_left, 0));
+	output->state.pending = true;
+	scheduler_arm(mgr);
 }
 
 static void
@@ -232,7 +425,12 @@ notify_output_post_frame(struct wl_listener *listener, void *data)
 
 	clock_gettime(output->device->clk_id, &now);
 	update_output_frame_time(output, &output->state.ts, &now);
-	tw_render_output_flush_frame(render_output, &now);
+	tw_frame_stats_add_frame(&output->stats,
+	                         MAX(tw_timespec_diff_us(&now,
+	                                                 &output->state.ts), 0),
+	                         render_output->state.repaint_causes);
+	output->state.frame_done = now;
+	output->state.has_frame_done = true;
 	PROFILE_END("notify_output_repaint");
 }
 
@@ -242,8 +440,15 @@ notify_output_present(struct wl_listener *listener, void *data)
 	struct tw_server_output *output =
 		wl_container_of(listener, output, listeners.present);
 	struct tw_event_output_present *event = data;
+	uint32_t refresh_us =
+		tw_millihertz_to_ns(output->device->current.current_mode.refresh)
+		/ 1000;
+	bool missed;
 
 	output->state.last_present = event->time;
+	missed = update_output_frame_margin(output, &event->time);
+	tw_frame_stats_add_present(&output->stats, &event->time, refresh_us,
+	                           missed);
 	SCOPE_PROFILE_TS();
 }
 
@@ -252,8 +457,8 @@ notify_output_clock_reset(struct wl_listener *listener, void *data)
 {
 	struct tw_server_output *output =
 		wl_container_of(listener, output, listeners.clock_reset);
-	output->state.ft_idx = 0;
-	memset(output->state.fts, 0, sizeof(output->state.fts));
+	reset_output_frame_time(output);
+	tw_frame_stats_reset_clock(&output->stats);
 }
 
 static void
@@ -273,8 +478,7 @@ notify_output_destroy(struct wl_listener *listener, void *data)
 static void
 tw_server_output_fini(struct tw_server_output *output)
 {
-	wl_event_source_remove(output->state.frame_timer);
-	output->state.frame_timer = NULL;
+	output->state.pending = false;
 	output->device = NULL;
 
 	tw_reset_wl_list(&output->listeners.destroy.link);
@@ -287,16 +491,16 @@ tw_server_output_fini(struct tw_server_output *output)
 static void
 tw_server_output_init(struct tw_server_output *output,
                       struct tw_output_device *device,
-                      struct tw_render_context *ctx)
+                      struct tw_server_output_manager *mgr)
 {
 	struct tw_render_output *render_output =
 		wl_container_of(device, render_output, device);
-	struct wl_display *display = ctx->display;
-	struct wl_event_loop *loop = wl_display_get_event_loop(display);
 
 	output->device = device;
-        output->state.frame_timer =
-	        wl_event_loop_add_timer(loop, notify_output_frame, output);
+	output->mgr = mgr;
+	output->state.pending = false;
+	reset_output_frame_time(output);
+	tw_frame_stats_init(&output->stats);
 
         tw_signal_setup_listener(&render_output->signals.need_frame,
                                  &output->listeners.need_frame,
@@ -333,20 +537,44 @@ notify_mgr_tw_surface_dirty(struct wl_listener *listener, void *data)
 		wl_container_of(surface, render_surface, surface);
 	struct tw_render_context *ctx = mgr->ctx;
 	struct tw_render_output *output;
+	enum tw_render_output_repaint_cause cause =
+		surface == mgr->engine->global_cursor.curr_surface ?
+		TW_REPAINT_CAUSE_CURSOR : TW_REPAINT_CAUSE_SURFACE;
 
 	if (pixman_region32_not_empty(&surface->geometry.dirty))
 		reassign_surface_outputs(render_surface, ctx, mgr->engine);
 
 	wl_list_for_each(output, &ctx->outputs, link) {
 		if ((1u << output->device.id) & render_surface->output_mask)
-			tw_render_output_dirty(output);
+			tw_render_output_dirty_cause(output, cause);
 	}
 }
 
 static void
 notify_mgr_tw_surface_lost(struct wl_listener *listener, void *data)
 {
-	//TODO just dirty the output regards the surface damage.
+	struct tw_server_output_manager *mgr =
+		wl_container_of(listener, mgr, listeners.surface_lost);
+	struct tw_surface *surface = data;
+	struct tw_render_surface *render_surface =
+		wl_container_of(surface, render_surface, surface);
+	struct tw_render_output *output;
+	pixman_region32_t area;
+
+	//the view lists forget the surface, repaint what it covered
+	pixman_region32_init_rect(&area,
+	                          surface->geometry.xywh.x,
+	                          surface->geometry.xywh.y,
+	                          surface->geometry.xywh.width,
+	                          surface->geometry.xywh.height);
+	pixman_region32_union(&area, &area, &surface->geometry.dirty);
+	wl_list_for_each(output, &mgr->ctx->outputs, link) {
+		if (!((1u << output->device.id) & render_surface->output_mask))
+			continue;
+		tw_render_output_damage_region(output, &area);
+		tw_render_output_dirty_cause(output, TW_REPAINT_CAUSE_SURFACE);
+	}
+	pixman_region32_fini(&area);
 }
 
 static void
@@ -357,7 +585,7 @@ notify_mgr_new_output(struct wl_listener *listener, void *data)
 	struct tw_output_device *device = data;
 	unsigned id = device->id;
 
-	tw_server_output_init(&mgr->outputs[id], device, mgr->ctx);
+	tw_server_output_init(&mgr->outputs[id], device, mgr);
 }
 
 static void
@@ -368,6 +596,12 @@ notify_mgr_render_context_lost(struct wl_listener *listener, void *data)
 
         mgr->ctx = NULL;
 	mgr->engine = NULL;
+	if (mgr->sched.idle)
+		wl_event_source_remove(mgr->sched.idle);
+	if (mgr->sched.timer)
+		wl_event_source_remove(mgr->sched.timer);
+	mgr->sched.idle = NULL;
+	mgr->sched.timer = NULL;
 
 	tw_reset_wl_list(&mgr->listeners.context_destroy.link);
 	tw_reset_wl_list(&mgr->listeners.surface_dirty.link);
@@ -381,9 +615,12 @@ tw_server_output_manager_create_global(struct tw_engine *engine,
 {
 	static struct tw_server_output_manager mgr = {0};
 	struct tw_backend *backend = engine->backend;
+	struct wl_event_loop *loop = wl_display_get_event_loop(ctx->display);
 
 	mgr.engine = engine;
 	mgr.ctx = ctx;
+	mgr.sched.timer = wl_event_loop_add_timer(loop, notify_scheduler_timer,
+	                                          &mgr);
 
 	tw_signal_setup_listener(&backend->signals.new_output,
 	                         &mgr.listeners.new_output,
@@ -399,3 +636,38 @@ tw_server_output_manager_create_global(struct tw_engine *engine,
 	                         notify_mgr_render_context_lost);
 	return &mgr;
 }
+
+static void
+dump_object_stats(struct tw_render_context *ctx, FILE *file)
+{
+	static const struct wl_interface *interfaces[] = {
+		&wl_surface_interface,
+		&wl_subsurface_interface,
+		&wl_region_interface,
+	};
+	struct tw_slab_stats stats;
+
+	for (unsigned i = 0; i < NUMOF(interfaces); i++) {
+		if (!tw_render_context_get_object_stats(ctx, interfaces[i],
+		                                        &stats))
+			continue;
+		fprintf(file, "objects %s: live %zu peak %zu pages %zu "
+		        "churn %.1f /s\n", interfaces[i]->name, stats.live,
+		        stats.peak, stats.pages, stats.churn);
+	}
+}
+
+void
+tw_server_output_manager_dump_stats(struct tw_server_output_manager *mgr,
+                                    FILE *file)
+{
+	for (int i = 0; i < 32; i++) {
+		struct tw_server_output *output = &mgr->outputs[i];
+
+		if (output->device)
+			tw_frame_stats_dump(&output->stats,
+			                    output->device->name, file);
+	}
+	if (mgr->ctx)
+		dump_object_stats(mgr->ctx, file);
+}
@@ -29,24 +29,42 @@
 #include <taiwins/render_context.h>
 #include <taiwins/objects/compositor.h>
 
+#include "frame_stats.h"
+
 #ifdef  __cplusplus
 extern "C" {
 #endif
 
-#define TW_FRAME_TIME_CNT 8
+#define TW_SERVER_FRAME_TIME_CNT 64
+
+struct tw_server_output_manager;
 
 //we shall see how this works
 struct tw_server_output {
 	struct tw_output_device *device;
+	struct tw_server_output_manager *mgr;
 
 	struct {
-		/** average frame time in microseconds */
-		uint32_t fts[TW_FRAME_TIME_CNT], ft_idx;
+		/** recent frame times in microseconds */
+		uint32_t fts[TW_SERVER_FRAME_TIME_CNT], ft_idx, ft_cnt;
+		/** safety margin on top of the predicted frame time, grows on
+		 * missed vblanks, decays on frames presented in time */
+		uint32_t margin_us;
 		struct timespec ts; /** used for recording start of frame */
 		struct timespec last_present;
-		struct wl_event_source *frame_timer;
+		struct timespec target; /**< the vblank we scheduled for */
+		bool has_target;
+		/** in CLOCK_MONOTONIC, the latest repaint start that still
+		 * makes the vblank, and the vblank itself */
+		struct timespec deadline, vblank;
+		bool pending; /**< waiting in the repaint scheduler */
+		/** frame callbacks are sent once the batch is done */
+		struct timespec frame_done;
+		bool has_frame_done;
 	} state;
 
+	struct tw_frame_stats stats;
+
 	struct {
 		/**< device signals */
 		struct wl_listener destroy;
@@ -67,6 +85,13 @@ struct tw_server_output_manager {
 	//reflect to the engine
 	struct tw_server_output outputs[32];
 
+	/* one repaint scheduler for all the outputs */
+	struct {
+		struct wl_event_source *timer;
+		struct wl_event_source *idle;
+		uint32_t prepare_us; /**< average scene preparation time */
+	} sched;
+
 	struct {
 		struct wl_listener context_destroy;
 		struct wl_listener surface_dirty;
@@ -80,6 +105,10 @@ struct tw_server_output_manager *
 tw_server_output_manager_create_global(struct tw_engine *engine,
                                        struct tw_render_context *ctx);
 
+void
+tw_server_output_manager_dump_stats(struct tw_server_output_manager *mgr,
+                                    FILE *file);
+
 
 #ifdef  __cplusplus
 }
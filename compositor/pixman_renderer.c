@@ -0,0 +1,285 @@
+/*
+ * pixman_renderer.c - taiwins desktop pixman renderer
+ *
+ * Copyright (c) 2021 Xichen Zhou
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <wayland-server-core.h>
+#include <wayland-util.h>
+#include <pixman.h>
+
+#include <taiwins/objects/layers.h>
+#include <taiwins/objects/logger.h>
+#include <taiwins/objects/matrix.h>
+#include <taiwins/objects/plane.h>
+#include <taiwins/objects/surface.h>
+#include <taiwins/output_device.h>
+#include <taiwins/render_context_pixman.h>
+#include <taiwins/render_surface.h>
+#include <taiwins/render_pipeline.h>
+#include "utils.h"
+#include "probes.h"
+
+#include "render.h"
+
+struct tw_pixman_layer_render_pipeline {
+	struct tw_render_pipeline base;
+	struct tw_plane main_plane;
+
+	struct tw_layers_manager *manager;
+};
+
+/******************************************************************************
+ * repaints
+ *****************************************************************************/
+
+/* view_2d maps global space into GL space, which is y-up, we flip it back */
+static inline void
+pipeline_output_transform(struct tw_render_output *output,
+                          struct tw_mat3 *global_to_output)
+{
+	unsigned int w, h;
+	struct tw_mat3 flip;
+
+	tw_output_device_raw_resolution(&output->device, &w, &h);
+	tw_mat3_init(&flip);
+	flip.d[4] = -1;
+	flip.d[7] = h;
+	tw_mat3_multiply(global_to_output, &flip, &output->state.view_2d);
+}
+
+/* our matrices are column major, pixman_f_transform is row major */
+static inline void
+pipeline_mat3_to_transform(pixman_transform_t *dst, const struct tw_mat3 *src)
+{
+	struct pixman_f_transform ft;
+
+	for (int r = 0; r < 3; r++)
+		for (int c = 0; c < 3; c++)
+			ft.m[r][c] = src->d[c*3+r];
+	pixman_transform_from_pixman_f_transform(dst, &ft);
+}
+
+/* the boxes of the region in output space, in the frame arena. A region is
+ * disjoint, so are its transformed boxes */
+static pixman_box32_t *
+pipeline_output_boxes(struct tw_render_arena *arena,
+                      const struct tw_mat3 *global_to_output,
+                      pixman_region32_t *region, int *nrects)
+{
+	pixman_box32_t *src = pixman_region32_rectangles(region, nrects);
+	pixman_box32_t *dst = tw_render_arena_alloc(arena,
+	                                            *nrects * sizeof(*dst));
+
+	if (!dst) {
+		*nrects = 0;
+		return NULL;
+	}
+	for (int i = 0; i < *nrects; i++)
+		tw_mat3_box_transform(global_to_output, &dst[i], &src[i]);
+	return dst;
+}
+
+static void
+pipeline_cleanup_buffer(pixman_image_t *target,
+                        struct tw_render_arena *arena,
+                        const struct tw_mat3 *global_to_output,
+                        pixman_region32_t *damage)
+{
+	int nrects;
+	pixman_box32_t *boxes;
+	pixman_color_t black = {0, 0, 0, 0xffff};
+
+#if defined ( _TW_DEBUG_DAMAGE )
+	pixman_color_t gray = {0x4000, 0x4000, 0x4000, 0xffff};
+	pixman_box32_t all = {0, 0,
+	                      pixman_image_get_width(target),
+	                      pixman_image_get_height(target)};
+
+	pixman_image_fill_boxes(PIXMAN_OP_SRC, target, &gray, 1, &all);
+#endif
+	boxes = pipeline_output_boxes(arena, global_to_output, damage,
+	                              &nrects);
+	if (nrects)
+		pixman_image_fill_boxes(PIXMAN_OP_SRC, target, &black, nrects,
+		                        boxes);
+}
+
+static void
+pipeline_paint_surface(struct tw_surface *surface,
+                       struct tw_pixman_layer_render_pipeline *pipeline,
+                       pixman_image_t *target,
+                       const struct tw_mat3 *global_to_output,
+                       pixman_region32_t *output_damage)
+{
+	struct tw_render_surface *render_surface =
+		wl_container_of(surface, render_surface, surface);
+	struct tw_pixman_render_texture *texture =
+		wl_container_of(surface->buffer.handle.ptr, texture, base);
+	struct tw_render_arena *arena = &pipeline->base.ctx->frame_arena;
+	struct tw_mat3 output_to_global, tex, dst_to_src;
+	pixman_region32_t *damage;
+	pixman_transform_t transform;
+	pixman_box32_t *boxes;
+	int nrects;
+	bool opaque;
+
+	if (!surface->buffer.handle.ptr || !texture->image)
+		return;
+	if (!(damage = tw_render_arena_region(arena)))
+		return;
+
+	pixman_region32_intersect(damage, &render_surface->clip,
+	                          output_damage);
+	if (!pixman_region32_not_empty(damage))
+		return;
+	boxes = pipeline_output_boxes(arena, global_to_output, damage,
+	                              &nrects);
+
+	//destination pixel -> global -> (-1, 1) surface space -> texel.
+	tw_mat3_scale(&tex, texture->base.width / 2.0,
+	              texture->base.inverted_y ?
+	              -(texture->base.height / 2.0) :
+	              texture->base.height / 2.0);
+	tex.d[6] = texture->base.width / 2.0;
+	tex.d[7] = texture->base.height / 2.0;
+	tw_mat3_inverse(&output_to_global, global_to_output);
+	tw_mat3_multiply(&dst_to_src, &surface->geometry.inverse_transform,
+	                 &output_to_global);
+	tw_mat3_multiply(&dst_to_src, &tex, &dst_to_src);
+	pipeline_mat3_to_transform(&transform, &dst_to_src);
+
+	//the transform stays on the image, pixman keeps its allocation and
+	//skips the copy when it did not change. Resetting it to NULL would
+	//free it and allocate it again on the next frame
+	pixman_image_set_transform(texture->image, &transform);
+	//nearest is exact and takes the fast blitting path for pure
+	//translations
+	pixman_image_set_filter(texture->image,
+	                        pixman_transform_is_int_translate(&transform) ?
+	                        PIXMAN_FILTER_NEAREST : PIXMAN_FILTER_BILINEAR,
+	                        NULL, 0);
+	opaque = !texture->base.has_alpha &&
+		pixman_transform_is_int_translate(&transform);
+
+	//one composite per box instead of a clip region, pixman would copy
+	//the clip into the image
+	for (int i = 0; i < nrects; i++)
+		pixman_image_composite32(opaque ?
+		                         PIXMAN_OP_SRC : PIXMAN_OP_OVER,
+		                         texture->image, NULL, target,
+		                         boxes[i].x1, boxes[i].y1, 0, 0,
+		                         boxes[i].x1, boxes[i].y1,
+		                         boxes[i].x2 - boxes[i].x1,
+		                         boxes[i].y2 - boxes[i].y1);
+}
+
+/******************************************************************************
+ * pipeline implementation
+ *****************************************************************************/
+
+static void
+pipeline_prepare_frame(struct tw_render_pipeline *base)
+{
+	struct tw_pixman_layer_render_pipeline *pipeline =
+		wl_container_of(base, pipeline, base);
+
+	tw_render_context_build_view_list(base->ctx, pipeline->manager);
+	tw_layer_renderer_stack_damage(base->ctx, pipeline->manager,
+	                               &pipeline->main_plane);
+}
+
+static void
+pipeline_repaint_output(struct tw_render_pipeline *base,
+                        struct tw_render_output *output, int buffer_age)
+{
+	size_t n;
+	struct tw_surface **view;
+	struct tw_pixman_layer_render_pipeline *pipeline =
+		wl_container_of(base, pipeline, base);
+	pixman_image_t *target = tw_pixman_presentable_image(&output->surface);
+	struct tw_render_arena *arena = &base->ctx->frame_arena;
+	pixman_region32_t *output_damage;
+	struct tw_mat3 global_to_output;
+
+	if (!target) {
+		tw_logl_level(TW_LOG_ERRO, "output is not presentable with "
+		              "pixman renderer");
+		return;
+	}
+
+	SCOPE_PROFILE_BEG();
+	TW_PROBE2(repaint_begin, output->device.id, buffer_age);
+
+	//not in a batch, prepare the scene for this output only
+	if (!base->prepared)
+		pipeline_prepare_frame(base);
+	if (!(output_damage = tw_render_arena_region(arena)))
+		goto out;
+	tw_layer_renderer_compose_output_damage(output, output_damage,
+	                                        buffer_age);
+
+	pipeline_output_transform(output, &global_to_output);
+	pipeline_cleanup_buffer(target, arena, &global_to_output,
+	                        output_damage);
+
+	//bottom to top, only the views touching this output
+	view = output->touching_views.data;
+	n = output->touching_views.size / sizeof(*view);
+	for (size_t i = n; i > 0; i--)
+		pipeline_paint_surface(view[i-1], pipeline, target,
+		                       &global_to_output, output_damage);
+out:
+	TW_PROBE1(repaint_end, output->device.id);
+	SCOPE_PROFILE_END();
+}
+
+static void
+pipeline_destroy(struct tw_render_pipeline *base)
+{
+	struct tw_pixman_layer_render_pipeline *pipeline =
+		wl_container_of(base, pipeline, base);
+
+	tw_plane_fini(&pipeline->main_plane);
+	tw_render_pipeline_fini(base);
+	free(pipeline);
+}
+
+struct tw_render_pipeline *
+tw_pixman_render_pipeline_create_default(struct tw_render_context *ctx,
+                                         struct tw_layers_manager *manager)
+{
+	struct tw_pixman_layer_render_pipeline *pipeline;
+
+	if (ctx->type != TW_RENDERER_PIXMAN)
+		return NULL;
+	if (!(pipeline = calloc(1, sizeof(*pipeline))))
+		return NULL;
+
+	pipeline->manager = manager;
+	tw_render_pipeline_init(&pipeline->base, "Pixman Sample", ctx);
+	tw_plane_init(&pipeline->main_plane);
+
+	pipeline->base.impl.destroy = pipeline_destroy;
+	pipeline->base.impl.prepare_frame = pipeline_prepare_frame;
+	pipeline->base.impl.repaint_output = pipeline_repaint_output;
+
+	return &pipeline->base;
+}
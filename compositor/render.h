@@ -22,11 +22,48 @@
 #ifndef TW_PIPELINE_EGL_H
 #define TW_PIPELINE_EGL_H
 
+#include <pixman.h>
 #include <taiwins/objects/layers.h>
+#include <taiwins/objects/plane.h>
 #include <taiwins/render_context_egl.h>
+#include <taiwins/render_output.h>
 
 struct tw_render_pipeline *
 tw_egl_render_pipeline_create_default(struct tw_render_context *ctx,
                                       struct tw_layers_manager *manager);
 
+/**
+ * @brief draw the layers which stopped changing from offscreen textures
+ */
+void
+tw_egl_render_pipeline_enable_layer_cache(struct tw_render_pipeline *pipeline,
+                                          bool enable);
+
+struct tw_render_pipeline *
+tw_pixman_render_pipeline_create_default(struct tw_render_context *ctx,
+                                         struct tw_layers_manager *manager);
+
+/**
+ * @brief stack the damage of the views onto the pending damage of the
+ * outputs they touch.
+ *
+ * It also updates the clip region of the render surfaces, the view list needs
+ * to be built before.
+ */
+void
+tw_layer_renderer_stack_damage(struct tw_render_context *ctx,
+                               struct tw_layers_manager *manager,
+                               struct tw_plane *plane);
+
+/**
+ * @brief compose the damage of the current output buffer, in global space
+ *
+ * The damage is simplified into a few rectangles, it may cover more than the
+ * actual damage.
+ */
+void
+tw_layer_renderer_compose_output_damage(struct tw_render_output *output,
+                                        pixman_region32_t *damage,
+                                        int buffer_age);
+
 #endif /* EOF */
@@ -56,6 +56,8 @@ struct tw_libinput_input {
 	struct libinput *libinput;
 	struct wl_event_source *event;
 	bool disabled;
+	/** set by TW_INPUT_RECORD=path */
+	struct tw_input_recorder *recorder;
 
 	const struct tw_libinput_impl *impl;
 	struct wl_list devices;
@@ -0,0 +1,56 @@
+/*
+ * probes.h - taiwins static tracepoints
+ *
+ * Copyright (c) 2021 Xichen Zhou
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+#ifndef TW_PROBES_INTERNAL_H
+#define TW_PROBES_INTERNAL_H
+
+#include "options.h"
+
+/*
+ * USDT probes under the "taiwins" provider. A probe site is a single nop in
+ * the text plus an ELF note. The arguments are evaluated on every pass, with
+ * or without a tracer, so keep them to the values already at hand, e.g:
+ *
+ *     bpftrace -e 'usdt:/usr/bin/taiwins:taiwins:surface_commit { ... }'
+ *     perf probe -x /usr/lib/libtaiwins.so sdt_taiwins:repaint_begin
+ *
+ * Without sys/sdt.h the probes compile to nothing.
+ */
+
+#if _TW_HAS_USDT
+
+#include <sys/sdt.h>
+
+#define TW_PROBE(name) DTRACE_PROBE(taiwins, name)
+#define TW_PROBE1(name, a) DTRACE_PROBE1(taiwins, name, a)
+#define TW_PROBE2(name, a, b) DTRACE_PROBE2(taiwins, name, a, b)
+#define TW_PROBE3(name, a, b, c) DTRACE_PROBE3(taiwins, name, a, b, c)
+
+#else
+
+#define TW_PROBE(name) do {} while (0)
+#define TW_PROBE1(name, a) do {} while (0)
+#define TW_PROBE2(name, a, b) do {} while (0)
+#define TW_PROBE3(name, a, b, c) do {} while (0)
+
+#endif
+
+#endif /* EOF */
@@ -22,6 +22,8 @@
 #ifndef TW_HEADLESS_BACKEND_H
 #define TW_HEADLESS_BACKEND_H
 
+#include <stdint.h>
+#include <time.h>
 #include "backend.h"
 #include "input_device.h"
 
@@ -35,9 +37,52 @@ tw_headless_backend_create(struct wl_display *display);
 bool
 tw_headless_backend_add_output(struct tw_backend *backend,
                                unsigned int width, unsigned int height);
+/**
+ * @brief add an output with refresh in mHz, frames are presented at its
+ * vblanks. Refresh of 0 presents every frame as soon as it is rendered.
+ */
+bool
+tw_headless_backend_add_output_mode(struct tw_backend *backend,
+                                    unsigned int width, unsigned int height,
+                                    unsigned int refresh);
 bool
 tw_headless_backend_add_input_device(struct tw_backend *backend,
                                      enum tw_input_device_type type);
+/**
+ * @brief replay an input recording through new headless devices
+ *
+ * The speed scales the recorded timing, 0 emits the events as fast as the
+ * event loop goes. Absolute positions land on the first output.
+ */
+bool
+tw_headless_backend_add_input_replay(struct tw_backend *backend,
+                                     const char *path, double speed);
+
+/**
+ * @brief drive the vblanks by hand
+ *
+ * In manual clock mode time does not pass on its own, pending frames are
+ * presented when the clock is stepped over their vblank, with the time of the
+ * manual clock. Tests and benchmarks can run faster than real time.
+ */
+void
+tw_headless_backend_set_manual_clock(struct tw_backend *backend, bool manual);
+
+void
+tw_headless_backend_get_time(struct tw_backend *backend, struct timespec *now);
+
+/**
+ * @brief advance the manual clock, returns the number of vblanks passed
+ */
+unsigned int
+tw_headless_backend_step_time(struct tw_backend *backend, uint64_t ns);
+
+/**
+ * @brief advance the manual clock to the next pending vblank, returns 0 if no
+ * output has a frame waiting
+ */
+unsigned int
+tw_headless_backend_step_vblank(struct tw_backend *backend);
 
 #ifdef  __cplusplus
 }
@@ -91,6 +91,12 @@ struct tw_engine_seat {
 	struct xkb_rule_names keyboard_rule_names;
 	struct xkb_keymap *keymap;
 
+	/** the last input event, valid during engine::seat_input */
+	struct {
+		uint32_t time; /**< msec of the event from the backend */
+		struct wl_resource *surface; /**< focus it is delivered to */
+	} last_input;
+
 	struct {
 		struct wl_listener focus;
 		struct wl_listener unfocus;
@@ -143,6 +149,10 @@ struct tw_engine {
 		struct wl_listener new_output;
 		struct wl_listener new_input;
 		struct wl_listener new_xdg_output;
+		struct wl_listener backend_start;
+		struct wl_listener backend_stop;
+		struct wl_listener surface_dirty;
+		struct wl_listener surface_destroy;
 	} listeners;
         /* signals */
 	struct {
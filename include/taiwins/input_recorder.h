@@ -0,0 +1,119 @@
+/*
+ * input_recorder.h - taiwins input event recorder
+ *
+ * Copyright (c) 2021 Xichen Zhou
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+#ifndef TW_INPUT_RECORDER_H
+#define TW_INPUT_RECORDER_H
+
+#include <stdint.h>
+#include "input_device.h"
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+/*
+ * input recording format, a header followed by fixed size records. A device
+ * record comes before the first event of the device, absolute positions are
+ * normalized to 0..1 of the output.
+ */
+#define TW_INPUT_RECORD_MAGIC 0x52495754 /* TWIR */
+#define TW_INPUT_RECORD_VERSION 1
+#define TW_INPUT_RECORD_MAX_DEVICES 64
+
+enum tw_input_record_type {
+	TW_INPUT_RECORD_DEVICE = 1,
+	TW_INPUT_RECORD_DEVICE_GONE,
+	TW_INPUT_RECORD_KEY,
+	TW_INPUT_RECORD_MOTION,
+	TW_INPUT_RECORD_MOTION_ABS,
+	TW_INPUT_RECORD_BUTTON,
+	TW_INPUT_RECORD_AXIS,
+	TW_INPUT_RECORD_SWIPE,
+	TW_INPUT_RECORD_PINCH,
+	TW_INPUT_RECORD_TOUCH_DOWN,
+	TW_INPUT_RECORD_TOUCH_MOTION,
+	TW_INPUT_RECORD_TOUCH_UP,
+};
+
+struct tw_input_record_header {
+	uint32_t magic;
+	uint32_t version;
+};
+
+struct tw_input_record {
+	uint64_t ts; /**< nanoseconds since the recording started */
+	uint16_t type;
+	uint16_t device;
+	uint32_t time; /**< time of the event in milliseconds */
+	union {
+		struct {
+			uint32_t type; /**< enum tw_input_device_type */
+			char name[32];
+		} device;
+		struct {
+			uint32_t keycode, state;
+		} key;
+		struct {
+			double dx, dy, unaccel_dx, unaccel_dy;
+		} motion;
+		struct {
+			int32_t id; /**< touch slot */
+			double x, y;
+		} abs;
+		struct {
+			uint32_t button, state;
+		} button;
+		struct {
+			uint32_t source, axis;
+			int32_t discrete;
+			double delta;
+		} axis;
+		struct {
+			uint32_t state, fingers, cancelled;
+			double dx, dy, scale, rotation;
+		} gesture;
+	} u;
+};
+
+struct tw_input_recorder;
+
+struct tw_input_recorder *
+tw_input_recorder_create(const char *path);
+
+void
+tw_input_recorder_destroy(struct tw_input_recorder *recorder);
+
+/**
+ * @brief write the record of the device, ts and device are filled here
+ */
+void
+tw_input_recorder_write(struct tw_input_recorder *recorder,
+                        struct tw_input_device *device,
+                        struct tw_input_record *record);
+void
+tw_input_recorder_remove_device(struct tw_input_recorder *recorder,
+                                struct tw_input_device *device);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif /* EOF */
@@ -22,6 +22,8 @@
 #ifndef TW_LAYERS_H
 #define TW_LAYERS_H
 
+#include <stdbool.h>
+#include <stdint.h>
 #include <wayland-server.h>
 
 #ifdef  __cplusplus
@@ -73,13 +75,21 @@ enum tw_layer_pos {
 /**
  * @brief similar to weston_layer
  */
+struct tw_layers_manager;
+
 struct tw_layer {
 	struct wl_list link;
 	enum tw_layer_pos position;
+	struct tw_layers_manager *manager; /**< set by tw_layer_set_position */
 
 	struct wl_list views;
+	/** views of the layer in the manager view list, subsurfaces
+	 * included, counted by tw_render_context_build_view_list */
+	unsigned int n_views;
 };
 
+struct tw_surface;
+
 struct tw_layers_manager {
 	struct wl_display *display;
 	struct wl_list layers;
@@ -88,6 +98,22 @@ struct tw_layers_manager {
 	struct wl_listener destroy_listener;
 	//global layers
 	struct tw_layer cursor_layer;
+
+	/** bumped by tw_layers_manager_dirty, users of the views compare it
+	 * with the serial they were built at */
+	uint32_t serial;
+
+	/** uniform grid of the pickable views, rebuilt when outdated */
+	struct {
+		uint32_t serial;
+		int32_t x, y;
+		uint32_t cell, cols, rows;
+		struct wl_array order; /**< tw_surface *, in picking order */
+		struct wl_array offsets; /**< uint32_t, cols*rows+1 */
+		struct wl_array cells; /**< tw_surface *, by cell */
+		bool moved; /**< views moved since the grid was built */
+		bool moving; /**< views moved since the last pick */
+	} pick;
 };
 
 void
@@ -99,6 +125,12 @@ tw_layer_set_position(struct tw_layer *layer, enum tw_layer_pos pos,
 void
 tw_layer_unset_position(struct tw_layer *layer);
 
+/**
+ * @brief mark the views outdated after editing the views of the layer
+ */
+void
+tw_layer_dirty(struct tw_layer *layer);
+
 struct tw_layers_manager *
 tw_layers_manager_create_global(struct wl_display *display);
 
@@ -106,6 +138,36 @@ void
 tw_layers_manager_init(struct tw_layers_manager *manager,
                        struct wl_display *display);
 
+/**
+ * @brief mark the views outdated
+ *
+ * Call it when views move, change stacking order or get destroyed, the
+ * picking grid and the render view lists are rebuilt at their next use.
+ */
+void
+tw_layers_manager_dirty(struct tw_layers_manager *manager);
+
+/**
+ * @brief mark the geometry of the views outdated
+ *
+ * For the views moving with the pointer, rebuilding the grid on every motion
+ * costs more than walking the layers. Picks walk the layers while the views
+ * keep moving, the grid is rebuilt once they stopped.
+ */
+void
+tw_layers_manager_dirty_geometry(struct tw_layers_manager *manager);
+
+/**
+ * @brief pick the top surface with input at the global position
+ *
+ * Walks layers below the cursor layer in stacking order, subsurfaces before
+ * their parent. Only the views in the grid cell of the point are tested,
+ * unless views moved since the last pick.
+ */
+struct tw_surface *
+tw_layers_manager_pick_surface(struct tw_layers_manager *manager,
+                               float x, float y, float *sx, float *sy);
+
 #ifdef  __cplusplus
 }
 #endif
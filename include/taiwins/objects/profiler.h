@@ -23,18 +23,54 @@
 #define TW_PROFILER_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <wayland-server-core.h>
 
 #ifdef  __cplusplus
 extern "C" {
 #endif
 
+/* binary trace format, a header followed by events. A TW_TRACE_NAME record
+ * precedes the first event using a name, its `tid` is the string length and
+ * the string follows the record. */
+#define TW_TRACE_MAGIC 0x52545754 /* TWTR */
+#define TW_TRACE_VERSION 1
+
+enum tw_trace_phase {
+	TW_TRACE_BEGIN = 'B',
+	TW_TRACE_END = 'E',
+	TW_TRACE_INSTANT = 'i',
+	TW_TRACE_NAME = 'N',
+};
+
+struct tw_trace_header {
+	uint32_t magic;
+	uint32_t version;
+};
+
+struct tw_trace_event {
+	uint64_t ts; /**< CLOCK_MONOTONIC in nanoseconds */
+	uint64_t name; /**< name id */
+	uint32_t tid;
+	uint8_t phase;
+	uint8_t pad[3];
+};
+
+/**
+ * @brief open the trace file, recording stays off until tw_profiler_enable
+ */
 bool
 tw_profiler_open(struct wl_display *display, const char *file);
 
 void
 tw_profiler_close();
 
+void
+tw_profiler_enable(bool enable);
+
+bool
+tw_profiler_enabled(void);
+
 void
 tw_profiler_start_timer(const char *name);
 
@@ -0,0 +1,85 @@
+/*
+ * recorder.h - taiwins wayland protocol session recorder
+ *
+ * Copyright (c) 2021 Xichen Zhou
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+#ifndef TW_RECORDER_H
+#define TW_RECORDER_H
+
+#include <stdint.h>
+#include <wayland-server-core.h>
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+/*
+ * session format, a header followed by records, each record is followed by
+ * `size` bytes of payload.
+ *
+ * TW_SESSION_CLIENT: the client name.
+ * TW_SESSION_REQUEST: uint32 object id, uint32 opcode, then every argument as
+ * its signature character followed by:
+ *   i, u, f, o, n: 4 bytes, objects as ids, 0 for null
+ *   s, a: uint32 length then the bytes, strings include the NUL, 0 for null
+ *   h: uint32 size of the file behind the fd, contents are not kept
+ * TW_SESSION_SHM: uint32 buffer id, width, height, stride, format and span
+ * count, then for every span uint32 first row, row count and the rows. Only
+ * the rows changed since the last commit of the buffer are written, it
+ * precedes the wl_surface.commit of the buffer.
+ */
+#define TW_SESSION_MAGIC 0x53535754 /* TWSS */
+#define TW_SESSION_VERSION 1
+
+enum tw_session_record_type {
+	TW_SESSION_CLIENT = 1,
+	TW_SESSION_CLIENT_GONE,
+	TW_SESSION_REQUEST,
+	TW_SESSION_SHM,
+};
+
+struct tw_session_header {
+	uint32_t magic;
+	uint32_t version;
+};
+
+struct tw_session_record {
+	uint64_t ts; /**< nanoseconds since the recording started */
+	uint32_t size;
+	uint16_t type;
+	uint16_t client;
+};
+
+struct tw_protocol_recorder;
+
+/**
+ * @brief record every client request into the file until the display is
+ * destroyed
+ */
+struct tw_protocol_recorder *
+tw_protocol_recorder_create(struct wl_display *display, const char *path);
+
+void
+tw_protocol_recorder_destroy(struct tw_protocol_recorder *recorder);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif /* EOF */
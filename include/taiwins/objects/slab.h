@@ -0,0 +1,94 @@
+/*
+ * slab.h - taiwins fixed size object allocator
+ *
+ * Copyright (c) 2021 Xichen Zhou
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+#ifndef TW_SLAB_H
+#define TW_SLAB_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <wayland-util.h>
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+#define TW_SLAB_PAGE_SIZE 65536
+#define TW_SLAB_ALIGN 64 /* a cache line */
+
+struct tw_slab_page;
+
+struct tw_slab_stats {
+	size_t live, peak, pages;
+	uint64_t allocs, frees;
+	double churn; /**< allocs and frees per second since the last sample */
+};
+
+/**
+ * @brief pages of same sized objects
+ *
+ * Every object starts on a cache line, the free objects are kept in per page
+ * free lists. One empty page is kept for the next allocation, the other
+ * pages are released as soon as they are empty.
+ */
+struct tw_slab {
+	const char *name;
+	size_t size; /**< object size, rounded to TW_SLAB_ALIGN */
+	unsigned int per_page;
+	struct wl_list pages; /**< pages with free objects first */
+	struct tw_slab_page *spare; /**< an empty page kept around */
+	struct tw_slab_stats stats;
+
+	struct {
+		uint64_t ops;
+		struct timespec ts;
+	} sample;
+};
+
+void
+tw_slab_init(struct tw_slab *slab, size_t size, const char *name);
+
+/**
+ * @brief release the pages, every object should be freed by then
+ */
+void
+tw_slab_fini(struct tw_slab *slab);
+
+/**
+ * @brief allocate a zeroed object, NULL if out of memory
+ */
+void *
+tw_slab_alloc(struct tw_slab *slab);
+
+void
+tw_slab_free(struct tw_slab *slab, void *ptr);
+
+/**
+ * @brief get the stats, the churn covers the time since the last call
+ */
+void
+tw_slab_sample_stats(struct tw_slab *slab, struct tw_slab_stats *stats);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif /* EOF */
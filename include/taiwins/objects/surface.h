@@ -96,6 +96,12 @@ struct tw_surface_buffer {
 	/* if there is a texture with the surface, the listener should be
 	 * used at surface destruction. */
 	struct wl_listener surface_destroy_listener;
+	/* the importer did not read the resource at commit, it keeps the
+	 * resource until tw_surface_buffer_release_deferred */
+	bool deferred;
+	/* drops the deferred resource if the client destroys it first */
+	struct wl_listener resource_destroy_listener;
+	struct wl_list deferred_link; /**< used by the importer */
 	struct {
 		bool (*buffer_import)(struct tw_event_buffer_uploading *event,
 		                      void *callback);
@@ -261,9 +267,33 @@ tw_region_create(struct wl_client *client, uint32_t version, uint32_t id,
 struct tw_region *
 tw_region_from_resource(struct wl_resource *wl_region);
 
+/**
+ * @brief empty the region, keeping its box buffer for the next use
+ */
+void
+tw_region_reset(pixman_region32_t *region);
+
+/**
+ * @brief merge the boxes of a region into fewer, larger ones
+ *
+ * The result covers the src region. Boxes are merged when the extra area is
+ * less than rect_cost, the pixel cost of handling one more rectangle. The
+ * result has no more than max_rects rectangles, in the worst case the extents
+ * of src. dst and src can be the same region.
+ */
+void
+tw_region_simplify(pixman_region32_t *dst, pixman_region32_t *src,
+                   unsigned int max_rects, uint32_t rect_cost);
+
 void
 tw_surface_buffer_release(struct tw_surface_buffer *buffer);
 
+/**
+ * @brief release the resource importer kept from commit, after reading it
+ */
+void
+tw_surface_buffer_release_deferred(struct tw_surface_buffer *buffer);
+
 bool
 tw_surface_buffer_update(struct tw_surface_buffer *buffer,
                          struct wl_resource *resource,
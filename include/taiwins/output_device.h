@@ -56,6 +56,9 @@ struct tw_output_device_state {
 
 struct tw_output_device_impl {
 	bool (*commit_state) (struct tw_output_device *device);
+	/** optional, the time of the clock presenting the frames, if the
+	 * backend does not follow clk_id */
+	void (*now) (struct tw_output_device *device, struct timespec *now);
 };
 
 /**
@@ -128,6 +131,14 @@ tw_output_device_commit_state(struct tw_output_device *device);
 pixman_rectangle32_t
 tw_output_device_geometry(const struct tw_output_device *device);
 
+/**
+ * @brief get the current time of the output, in the timebase of its
+ * presentation timestamps
+ */
+void
+tw_output_device_get_time(const struct tw_output_device *device,
+                          struct timespec *now);
+
 /**
  * @brief get raw resolution, without scale or transform
  */
@@ -0,0 +1,83 @@
+/*
+ * render_arena.h - taiwins per-frame scratch allocator
+ *
+ * Copyright (c) 2021 Xichen Zhou
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+#ifndef TW_RENDER_ARENA_H
+#define TW_RENDER_ARENA_H
+
+#include <stddef.h>
+#include <pixman.h>
+#include <wayland-util.h>
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+struct tw_render_arena_block;
+
+/**
+ * @brief scratch memory of a frame
+ *
+ * Everything handed out by the arena is valid until the next
+ * tw_render_arena_reset, which happens after every
+ * tw_render_output_post_frame outside of a batch and at
+ * tw_render_context_end_frames. Nothing is freed in between, the blocks and
+ * the box buffers of the regions are kept for the next frame, so a frame
+ * costing the same as the last one does not touch malloc.
+ */
+struct tw_render_arena {
+	struct tw_render_arena_block *blocks; /**< current block first */
+	struct wl_array regions; /**< pixman_region32_t *, kept across frames */
+	size_t used_regions;
+};
+
+void
+tw_render_arena_init(struct tw_render_arena *arena);
+
+void
+tw_render_arena_fini(struct tw_render_arena *arena);
+
+/**
+ * @brief allocate size bytes aligned to 16, NULL if out of memory
+ */
+void *
+tw_render_arena_alloc(struct tw_render_arena *arena, size_t size);
+
+/**
+ * @brief get an empty region, NULL if out of memory
+ *
+ * The region keeps the boxes of its last use. Pixman reallocates the
+ * destination when it is also a source of an operation, write the results
+ * into fresh regions to keep reusing them.
+ */
+pixman_region32_t *
+tw_render_arena_region(struct tw_render_arena *arena);
+
+/**
+ * @brief release everything allocated since the last reset
+ */
+void
+tw_render_arena_reset(struct tw_render_arena *arena);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif /* EOF */
@@ -31,6 +31,8 @@
 #include <taiwins/objects/compositor.h>
 #include <taiwins/objects/surface.h>
 #include <taiwins/objects/layers.h>
+#include <taiwins/objects/slab.h>
+#include <taiwins/render_arena.h>
 
 #ifdef  __cplusplus
 extern "C" {
@@ -45,6 +47,7 @@ struct tw_render_texture;
 enum tw_renderer_type {
 	TW_RENDERER_EGL,
 	TW_RENDERER_VK,
+	TW_RENDERER_PIXMAN,
 };
 
 struct tw_render_presentable_impl {
@@ -106,6 +109,9 @@ struct tw_render_context {
 		struct wl_signal output_lost;
 		struct wl_signal wl_surface_dirty;
 		struct wl_signal wl_surface_destroy;
+		/** around the output frames of a batch */
+		struct wl_signal begin_frames;
+		struct wl_signal end_frames;
 	} signals;
 
 	//globals
@@ -113,17 +119,72 @@ struct tw_render_context {
 	struct tw_compositor compositor_manager;
 
 	struct wl_list pipelines;
+
+	/** the view lists are kept between frames, rebuilt only when views
+	 * moved, restacked or the layers changed */
+	struct {
+		bool dirty;
+		uint32_t serial; /**< layers manager serial of the lists */
+		uint32_t build; /**< bumped on every rebuild */
+		struct tw_layers_manager *manager;
+		struct wl_array prev; /**< tw_surface *, scratch of rebuilds */
+	} views;
+
+	/** scratch of the pipelines, reset after every output frame, or once
+	 * by tw_render_context_end_frames for a batch */
+	struct tw_render_arena frame_arena;
+	bool in_batch;
 };
 
 struct tw_render_context *
 tw_render_context_create_egl(struct wl_display *display,
                              const struct tw_egl_options *opts);
+
+struct tw_render_context *
+tw_render_context_create_pixman(struct wl_display *display);
+
 void
 tw_render_context_destroy(struct tw_render_context *ctx);
 
+/**
+ * @brief update the global and per-output view lists of the manager
+ *
+ * The lists are retained, this is a no-op unless the views changed since the
+ * last build.
+ */
 void
 tw_render_context_build_view_list(struct tw_render_context *ctx,
                                   struct tw_layers_manager *manager);
+
+/**
+ * @brief force rebuilding the view lists at the next frame
+ */
+void
+tw_render_context_dirty_views(struct tw_render_context *ctx);
+
+/**
+ * @brief start repainting a batch of outputs
+ *
+ * The pipelines prepare the scene once here, the outputs posted before
+ * tw_render_context_end_frames reuse it instead of preparing it on every
+ * repaint.
+ */
+void
+tw_render_context_begin_frames(struct tw_render_context *ctx);
+
+void
+tw_render_context_end_frames(struct tw_render_context *ctx);
+
+/**
+ * @brief allocator stats of the wl_surface, wl_subsurface or wl_region
+ * objects, false for other interfaces
+ *
+ * The churn covers the time since the last call for the interface.
+ */
+bool
+tw_render_context_get_object_stats(struct tw_render_context *ctx,
+                                   const struct wl_interface *interface,
+                                   struct tw_slab_stats *stats);
 #ifdef  __cplusplus
 }
 #endif
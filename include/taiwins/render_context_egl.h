@@ -25,8 +25,10 @@
 #include <GLES2/gl2.h>
 #include <GLES2/gl2ext.h>
 #include <EGL/egl.h>
+#include <pixman.h>
 #include <wayland-server.h>
 #include <taiwins/objects/egl.h>
+#include <taiwins/objects/surface.h>
 
 #include "render_context.h"
 
@@ -46,37 +48,75 @@ struct tw_egl_quad_shader {
 	} uniform;
 };
 
+/* features of quad shader permutations */
+enum tw_egl_quad_shader_feature {
+	TW_EGL_QUAD_TEXTURE_EXTERNAL = 1 << 0, /**< samplerExternalOES */
+	TW_EGL_QUAD_SOLID_COLOR = 1 << 1, /**< color uniform, no texture */
+	TW_EGL_QUAD_OPAQUE = 1 << 2, /**< output alpha is always 1 */
+	TW_EGL_QUAD_RGBX = 1 << 3, /**< texture alpha channel is ignored */
+	TW_EGL_QUAD_GLOBAL_ALPHA = 1 << 4, /**< alpha uniform, if not 1.0 */
+	TW_EGL_QUAD_Y_INVERT = 1 << 5, /**< flipping the texcoord */
+};
+
+#define TW_EGL_QUAD_FEATURE_CNT 6
+#define TW_EGL_QUAD_SHADER_CNT (1 << TW_EGL_QUAD_FEATURE_CNT)
+
+/**
+ * @brief lazily compiled quad shader permutations, indexed by features
+ *
+ * The vertex attributes are bound to 0 for position and 1 for texcoord.
+ */
+struct tw_egl_quad_shader_cache {
+	struct tw_egl_quad_shader shaders[TW_EGL_QUAD_SHADER_CNT];
+};
+
 struct tw_egl_render_texture {
 	struct tw_render_texture base;
 	GLenum target;  /**< GL_TEXTURE_2D or GL_TEXTURE_EXTERNAL_OES */
 	EGLImageKHR image;
 	GLuint gltex;
+	pixman_region32_t pending_damage; /**< deferred, in buffer space */
 };
 
 struct tw_render_context *
 tw_render_context_create_egl(struct wl_display *display,
                              const struct tw_egl_options *opts);
-GLuint
-tw_egl_shader_create_program(const GLchar *vs_src, const GLchar *fs_src);
-
-void
-tw_egl_quad_color_shader_init(struct tw_egl_quad_shader *shader);
-
+/**
+ * @brief defer the shm uploads to repaint
+ *
+ * Commits would only keep the latest wl_buffer and accumulate its damage, the
+ * render pipeline uploads it by tw_egl_render_context_flush_surface for the
+ * surfaces it paints and by tw_egl_render_context_flush_pending for the rest
+ * at the end of the repaint, so hidden or unmapped surfaces do not hold their
+ * buffers. Buffers replaced before that are released without being uploaded.
+ */
 void
-tw_egl_quad_color_shader_fini(struct tw_egl_quad_shader *shader);
+tw_egl_render_context_set_deferred_upload(struct tw_render_context *ctx,
+                                          bool deferred);
+bool
+tw_egl_render_context_flush_surface(struct tw_render_context *ctx,
+                                    struct tw_surface *surface);
 
 void
-tw_egl_quad_tex_shader_init(struct tw_egl_quad_shader *shader);
+tw_egl_render_context_flush_pending(struct tw_render_context *ctx);
 
-void
-tw_egl_quad_tex_shader_fini(struct tw_egl_quad_shader *shader);
+GLuint
+tw_egl_shader_create_program(const GLchar *vs_src, const GLchar *fs_src);
 
 void
-tw_egl_quad_texext_shader_init(struct tw_egl_quad_shader *shader);
+tw_egl_quad_shader_cache_init(struct tw_egl_quad_shader_cache *cache);
 
 void
-tw_egl_quad_texext_shader_fini(struct tw_egl_quad_shader *shader);
+tw_egl_quad_shader_cache_fini(struct tw_egl_quad_shader_cache *cache);
 
+/**
+ * @brief get the shader permutation for the features, compile it if needed
+ *
+ * requires the GL context to be current.
+ */
+struct tw_egl_quad_shader *
+tw_egl_quad_shader_cache_get(struct tw_egl_quad_shader_cache *cache,
+                             uint32_t features);
 
 #ifdef  __cplusplus
 }
@@ -0,0 +1,59 @@
+/*
+ * render_context_pixman.h - taiwins pixman render context
+ *
+ * Copyright (c) 2021 Xichen Zhou
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+#ifndef TW_RENDER_CONTEXT_PIXMAN_H
+#define TW_RENDER_CONTEXT_PIXMAN_H
+
+#include <pixman.h>
+#include <wayland-server.h>
+
+#include "render_context.h"
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+struct tw_pixman_render_texture {
+	struct tw_render_texture base;
+	pixman_image_t *image; /**< owned copy of the shm buffer */
+};
+
+/**
+ * @brief create a render context does all the composition on CPU
+ *
+ * The context only supports wl_shm buffers and offscreen presentables, it is
+ * useful where no GPU is available, like in headless testing.
+ */
+struct tw_render_context *
+tw_render_context_create_pixman(struct wl_display *display);
+
+/**
+ * @brief get the backing image of a presentable created by pixman context
+ */
+pixman_image_t *
+tw_pixman_presentable_image(struct tw_render_presentable *presentable);
+
+#ifdef  __cplusplus
+}
+#endif
+
+
+#endif /* EOF */
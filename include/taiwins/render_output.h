@@ -36,6 +36,9 @@ extern "C" {
 #endif
 
 #define TW_FRAME_TIME_CNT 8
+/* number of frames of damage we remember, buffers older than that are fully
+ * repainted */
+#define TW_DAMAGE_HISTORY_CNT 8
 
 struct tw_render_context;
 
@@ -46,6 +49,14 @@ enum tw_render_output_repaint_state {
 	TW_REPAINT_COMMITTED = 6, /**< repaint done, need swap */
 };
 
+/* what made the output dirty, accumulated until the next repaint */
+enum tw_render_output_repaint_cause {
+	TW_REPAINT_CAUSE_SURFACE = 1 << 0, /**< client surface damage */
+	TW_REPAINT_CAUSE_CURSOR = 1 << 1, /**< cursor moved or changed */
+	TW_REPAINT_CAUSE_CONFIG = 1 << 2, /**< config or workspace change */
+	TW_REPAINT_CAUSE_OUTPUT = 1 << 3, /**< output mode or state change */
+};
+
 struct tw_event_output_present {
 	struct tw_render_output *output;
 	struct timespec time;
@@ -60,18 +71,24 @@ struct tw_render_output {
 
 	struct wl_list link; /**< ctx->output */
 	struct wl_list views;
+	/** tw_surface *, the views touching the output, top to bottom */
+	struct wl_array touching_views;
 	struct wl_event_source *repaint_timer;
 	/* important to set it for surface to be renderable */
 	struct tw_render_context *ctx;
 
 	/* render_output s'occupy with render_data of the output */
 	struct {
-		/**< we have 3 frame_damages for triple buffering */
-		pixman_region32_t damages[3];
-		pixman_region32_t *pending_damage, *curr_damage, *prev_damage;
+		/**< ring of frame damages in output space, the pending damage
+		 * is at damage_head, damage of the frame N ago is at
+		 * damage_head-N */
+		pixman_region32_t damages[TW_DAMAGE_HISTORY_CNT];
+		pixman_region32_t *pending_damage;
+		unsigned int damage_head;
 		struct tw_mat3 view_2d; /* global to output space */
 
 		uint32_t repaint_state;
+		uint32_t repaint_causes; /**< cleared after post_frame */
 	} state;
 
 	struct {
@@ -91,6 +108,31 @@ struct tw_render_output {
 void
 tw_render_output_dirty(struct tw_render_output *output);
 
+/**
+ * @brief dirty the output, recording the cause for the frame statistics
+ */
+void
+tw_render_output_dirty_cause(struct tw_render_output *output,
+                             enum tw_render_output_repaint_cause cause);
+
+/**
+ * @brief add the part of a damage in global space to the pending damage
+ */
+void
+tw_render_output_damage_region(struct tw_render_output *output,
+                               const pixman_region32_t *damage);
+
+/**
+ * @brief get the damage needs to be repainted for a buffer of given age
+ *
+ * The result is the pending damage plus the damage of the last (age-1)
+ * frames, in output space. Buffer age of 0 or older than the history we keep
+ * means the buffer content is undefined, the whole output is damaged.
+ */
+void
+tw_render_output_get_buffer_damage(struct tw_render_output *output,
+                                   int buffer_age, pixman_region32_t *damage);
+
 /**
  * @brief flush frame will send wl_callback::done for the wl_surfaces.
  *
@@ -105,7 +147,8 @@ tw_render_output_flush_frame(struct tw_render_output *output,
  *
  * User may call this upon receiving a need_frame signal to trigger the actual
  * rendering, the render_output would repaint if there is no repainting started
- * already
+ * already. The frame arena of the context is reset once the post_frame
+ * listeners return.
  */
 void
 tw_render_output_post_frame(struct tw_render_output *output);
@@ -23,6 +23,7 @@
 #define TW_RENDER_PIPELINE_H
 
 #include <assert.h>
+#include <stdbool.h>
 #include <wayland-server.h>
 
 #include "render_context.h"
@@ -45,7 +46,14 @@ struct tw_render_pipeline {
 		struct wl_signal post_output_repaint;
 	} signals;
 
+	/** scene is built for the current batch of outputs, see
+	 * tw_render_context_begin_frames */
+	bool prepared;
+
 	struct {
+		/** optional, the output independent work of a frame, like
+		 * building view list and stacking damage */
+		void (*prepare_frame)(struct tw_render_pipeline *pipeline);
 		void (*repaint_output)(struct tw_render_pipeline *pipeline,
 		                       struct tw_render_output *output,
 		                       int buffer_age);
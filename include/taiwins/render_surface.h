@@ -48,6 +48,10 @@ struct tw_render_surface {
 
 	int32_t output; /**< the primary output for this surface */
 	uint32_t output_mask; /**< the output it touches */
+	uint32_t dirty_serial; /**< bumped on every content/geometry change */
+	/** the view list build it was in and its index there */
+	uint32_t view_build;
+	unsigned int view_index;
 
 #ifdef TW_OVERLAY_PLANE
 	pixman_region32_t output_damage[32];
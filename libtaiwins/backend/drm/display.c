@@ -500,7 +500,7 @@ tw_drm_display_start(struct tw_drm_display *output)
 	                         &output->presentable_commit,
 	                         notify_display_presentable_commit);
 	prepare_display_start(output);
-	tw_render_output_dirty(&output->output);
+	tw_render_output_dirty_cause(&output->output, TW_REPAINT_CAUSE_OUTPUT);
 }
 
 void
@@ -520,7 +520,7 @@ static void
 tw_drm_display_continue(struct tw_drm_display *output)
 {
 	prepare_display_start(output);
-	tw_render_output_dirty(&output->output);
+	tw_render_output_dirty_cause(&output->output, TW_REPAINT_CAUSE_OUTPUT);
 }
 
 static void
@@ -31,7 +31,9 @@
 #include <taiwins/objects/egl.h>
 
 #include <taiwins/backend.h>
+#include <taiwins/backend_headless.h>
 #include <taiwins/input_device.h>
+#include <taiwins/input_recorder.h>
 #include <taiwins/output_device.h>
 
 #include "render.h"
@@ -55,13 +57,33 @@ struct tw_headless_backend {
 	//only used by gl renderers.
 	unsigned int internal_format;
 	struct wl_listener display_destroy;
+	struct tw_headless_input_replay *replay;
 
+	//vblanks only happen on tw_headless_backend_step_* in manual mode
+	bool manual_clock;
+	struct timespec clock;
+};
+
+struct tw_headless_input_replay {
+	struct tw_headless_backend *headless;
+	FILE *file;
+	double speed;
+	struct timespec start;
+	struct wl_event_source *timer;
+	struct tw_input_record next;
+	bool has_next;
+	struct tw_input_device *devices[TW_INPUT_RECORD_MAX_DEVICES];
 };
 
 struct tw_headless_output {
 	struct tw_render_output output;
-	struct wl_event_source *timer;
+	struct tw_headless_backend *headless;
+	struct wl_event_source *timer; /**< armed while a frame is pending */
 	struct wl_listener present_listener;
+
+	bool frame_pending;
+	struct timespec last_vblank, next_vblank;
+	uint64_t seq;
 };
 
 static const struct tw_egl_options *
@@ -75,14 +97,46 @@ headless_gen_egl_params(struct tw_backend *backend)
 	return &egl_opts;
 }
 
-static int
-headless_frame(void *data)
+/******************************************************************************
+ * vblank
+ *
+ * A committed frame is presented at the next vblank of the output refresh,
+ * the timer only runs while a frame waits for it so an idle output does not
+ * wake up at all. Outputs without a refresh present right on commit. With the
+ * manual clock, time stands still until the user steps it.
+ *****************************************************************************/
+
+static void
+headless_now(struct tw_headless_backend *headless, struct timespec *now)
+{
+	if (headless->manual_clock)
+		*now = headless->clock;
+	else
+		clock_gettime(CLOCK_MONOTONIC, now);
+}
+
+static void
+headless_vblank(struct tw_headless_output *output)
 {
-	struct tw_headless_output *output = data;
+	struct tw_event_output_present event = {
+		.output = &output->output,
+		.time = output->next_vblank,
+		.seq = ++output->seq,
+		//paced by the refresh, like a vsync
+		.flags = output->output.device.current.current_mode.refresh ?
+			1 : 0,
+	};
 
-	wl_signal_emit(&output->output.signals.need_frame,
-	               &output->output.device);
-	wl_event_source_timer_update(output->timer, 1000000 / (60 * 1000));
+	output->frame_pending = false;
+	output->last_vblank = output->next_vblank;
+	tw_render_output_present(&output->output, &event);
+	tw_render_output_clean_maybe(&output->output);
+}
+
+static int
+handle_headless_vblank_timer(void *data)
+{
+	headless_vblank(data);
 	return 0;
 }
 
@@ -91,8 +145,37 @@ notify_output_commit(struct wl_listener *listener, void *data)
 {
 	struct tw_headless_output *output =
 		wl_container_of(listener, output, present_listener);
-	tw_render_output_present(&output->output, NULL);
-	tw_render_output_clean_maybe(&output->output);
+	struct tw_headless_backend *headless = output->headless;
+	uint64_t period = tw_millihertz_to_ns(
+		output->output.device.current.current_mode.refresh);
+	struct timespec now;
+	int64_t since;
+
+	headless_now(headless, &now);
+	output->next_vblank = now;
+	output->frame_pending = true;
+	if (!period) {
+		if (!headless->manual_clock)
+			headless_vblank(output);
+		return;
+	}
+	//the first vblank after now, keeping the phase of the last one
+	since = tw_timespec_diff_ns(&now, &output->last_vblank);
+	if (since >= 0) {
+		uint64_t ns = period - since % period;
+
+		output->next_vblank.tv_sec += ns / TW_NS_PER_S;
+		output->next_vblank.tv_nsec += ns % TW_NS_PER_S;
+		if (output->next_vblank.tv_nsec >= TW_NS_PER_S) {
+			output->next_vblank.tv_sec += 1;
+			output->next_vblank.tv_nsec -= TW_NS_PER_S;
+		}
+	}
+	if (!headless->manual_clock)
+		wl_event_source_timer_update(
+			output->timer,
+			(tw_timespec_diff_ns(&output->next_vblank, &now) +
+			 999999) / 1000000);
 }
 
 static bool
@@ -103,6 +186,9 @@ headless_output_start(struct tw_headless_output *output,
 	struct wl_event_loop *loop =
 		wl_display_get_event_loop(headless->display);
 
+	output->headless = headless;
+	headless_now(headless, &output->last_vblank);
+
 	tw_signal_setup_listener(&output->output.surface.commit,
 	                         &output->present_listener,
 	                         notify_output_commit);
@@ -119,10 +205,10 @@ headless_output_start(struct tw_headless_output *output,
 	                                     headless->base.ctx,
 	                                     width, height);
 
-        output->timer = wl_event_loop_add_timer(loop, headless_frame,
-                                                  headless);
-	wl_event_source_timer_update(output->timer, 1000000 / (60 * 1000));
-
+	output->timer = wl_event_loop_add_timer(
+		loop, handle_headless_vblank_timer, output);
+	//the first frame, later ones come from damage
+	tw_render_output_dirty(&output->output);
 
 	return false;
 }
@@ -134,6 +220,257 @@ headless_input_start(struct tw_input_device *device,
 	wl_signal_emit(&headless->base.signals.new_input, device);
 }
 
+static struct tw_input_device *
+headless_input_device_create(struct tw_headless_backend *headless,
+                             enum tw_input_device_type type, const char *name)
+{
+	struct tw_input_device *device = calloc(1, sizeof(*device));
+
+	if (!device)
+		return NULL;
+	tw_input_device_init(device, type, 0, NULL);
+	snprintf(device->name, sizeof(device->name), "%s", name);
+	wl_list_insert(headless->base.inputs.prev, &device->link);
+
+	if (headless->base.started)
+		headless_input_start(device, headless);
+	return device;
+}
+
+/******************************************************************************
+ * input replay
+ *****************************************************************************/
+
+/* events emitted per dispatch when replaying without waits */
+#define HEADLESS_REPLAY_BATCH 256
+
+static void
+headless_replay_destroy(struct tw_headless_input_replay *replay)
+{
+	replay->headless->replay = NULL;
+	if (replay->timer)
+		wl_event_source_remove(replay->timer);
+	fclose(replay->file);
+	free(replay);
+}
+
+static void
+headless_replay_emit(struct tw_headless_input_replay *replay,
+                     struct tw_input_record *record)
+{
+	struct tw_headless_backend *headless = replay->headless;
+	struct tw_input_device *dev = replay->devices[record->device];
+	struct tw_input_source *emitter = dev ? dev->emitter : NULL;
+	struct tw_output_device *output = wl_list_empty(&headless->base.outputs) ?
+		NULL : wl_container_of(headless->base.outputs.next, output,
+		                       link);
+	//the replayed events happen now
+	uint32_t time = tw_get_time_ms(CLOCK_MONOTONIC);
+
+	if (record->type == TW_INPUT_RECORD_DEVICE) {
+		if (record->u.device.type > TW_INPUT_TYPE_SWITCH) {
+			tw_logl_level(TW_LOG_WARN, "input replay: unknown "
+			              "device type %u", record->u.device.type);
+			return;
+		}
+		//a recording may reuse the index without a gone record
+		if (dev) {
+			tw_input_device_fini(dev);
+			free(dev);
+		}
+		record->u.device.name[sizeof(record->u.device.name)-1] = '\0';
+		replay->devices[record->device] =
+			headless_input_device_create(headless,
+			                             record->u.device.type,
+			                             record->u.device.name);
+		return;
+	} else if (record->type == TW_INPUT_RECORD_DEVICE_GONE) {
+		if (dev)
+			tw_input_device_fini(dev);
+		free(dev);
+		replay->devices[record->device] = NULL;
+		return;
+	} else if (!emitter) {
+		return;
+	}
+
+	switch (record->type) {
+	case TW_INPUT_RECORD_KEY: {
+		struct tw_event_keyboard_key key = {
+			.dev = dev,
+			.time = time,
+			.keycode = record->u.key.keycode,
+			.state = record->u.key.state,
+		};
+		if (dev->type == TW_INPUT_TYPE_KEYBOARD)
+			tw_input_device_notify_key(dev, &key);
+		break;
+	}
+	case TW_INPUT_RECORD_MOTION: {
+		struct tw_event_pointer_motion motion = {
+			.dev = dev,
+			.time = time,
+			.delta_x = record->u.motion.dx,
+			.delta_y = record->u.motion.dy,
+			.unaccel_dx = record->u.motion.unaccel_dx,
+			.unaccel_dy = record->u.motion.unaccel_dy,
+		};
+		tw_input_signal_emit(emitter, pointer.motion, &motion);
+		wl_signal_emit(&emitter->pointer.frame, dev);
+		break;
+	}
+	case TW_INPUT_RECORD_MOTION_ABS: {
+		struct tw_event_pointer_motion_abs abs = {
+			.dev = dev,
+			.time_msec = time,
+			.output = output,
+			.x = record->u.abs.x,
+			.y = record->u.abs.y,
+		};
+		if (!output)
+			break;
+		tw_input_signal_emit(emitter, pointer.motion_absolute, &abs);
+		wl_signal_emit(&emitter->pointer.frame, dev);
+		break;
+	}
+	case TW_INPUT_RECORD_BUTTON: {
+		struct tw_event_pointer_button button = {
+			.dev = dev,
+			.time = time,
+			.button = record->u.button.button,
+			.state = record->u.button.state,
+		};
+		tw_input_signal_emit(emitter, pointer.button, &button);
+		wl_signal_emit(&emitter->pointer.frame, dev);
+		break;
+	}
+	case TW_INPUT_RECORD_AXIS: {
+		struct tw_event_pointer_axis axis = {
+			.dev = dev,
+			.time = time,
+			.source = record->u.axis.source,
+			.axis = record->u.axis.axis,
+			.delta = record->u.axis.delta,
+			.delta_discrete = record->u.axis.discrete,
+		};
+		tw_input_signal_emit(emitter, pointer.axis, &axis);
+		wl_signal_emit(&emitter->pointer.frame, dev);
+		break;
+	}
+	case TW_INPUT_RECORD_SWIPE:
+	case TW_INPUT_RECORD_PINCH: {
+		bool pinch = record->type == TW_INPUT_RECORD_PINCH;
+		struct tw_event_pointer_gesture gesture = {
+			.dev = dev,
+			.time = time,
+			.fingers = record->u.gesture.fingers,
+			.state = record->u.gesture.state,
+			.dx = record->u.gesture.dx,
+			.dy = record->u.gesture.dy,
+			.scale = record->u.gesture.scale,
+			.rotation = record->u.gesture.rotation,
+			.cancelled = record->u.gesture.cancelled,
+		};
+		if (pinch && gesture.state == TW_POINTER_GESTURE_BEGIN)
+			tw_input_signal_emit(emitter, pointer.pinch_begin,
+			                     &gesture);
+		else if (pinch && gesture.state == TW_POINTER_GESTURE_UPDATE)
+			tw_input_signal_emit(emitter, pointer.pinch_update,
+			                     &gesture);
+		else if (pinch)
+			tw_input_signal_emit(emitter, pointer.pinch_end,
+			                     &gesture);
+		else if (gesture.state == TW_POINTER_GESTURE_BEGIN)
+			tw_input_signal_emit(emitter, pointer.swipe_begin,
+			                     &gesture);
+		else if (gesture.state == TW_POINTER_GESTURE_UPDATE)
+			tw_input_signal_emit(emitter, pointer.swipe_update,
+			                     &gesture);
+		else
+			tw_input_signal_emit(emitter, pointer.swipe_end,
+			                     &gesture);
+		break;
+	}
+	case TW_INPUT_RECORD_TOUCH_DOWN: {
+		struct tw_event_touch_down down = {
+			.dev = dev,
+			.time = time,
+			.touch_id = record->u.abs.id,
+			.output = output,
+			.x = record->u.abs.x,
+			.y = record->u.abs.y,
+		};
+		if (output)
+			tw_input_signal_emit(emitter, touch.down, &down);
+		break;
+	}
+	case TW_INPUT_RECORD_TOUCH_MOTION: {
+		struct tw_event_touch_motion motion = {
+			.dev = dev,
+			.time = time,
+			.touch_id = record->u.abs.id,
+			.output = output,
+			.x = record->u.abs.x,
+			.y = record->u.abs.y,
+		};
+		if (output)
+			tw_input_signal_emit(emitter, touch.motion, &motion);
+		break;
+	}
+	case TW_INPUT_RECORD_TOUCH_UP: {
+		struct tw_event_touch_up up = {
+			.dev = dev,
+			.time = time,
+			.touch_id = record->u.abs.id,
+		};
+		tw_input_signal_emit(emitter, touch.up, &up);
+		break;
+	}
+	}
+}
+
+static int
+headless_replay_next(void *data)
+{
+	struct tw_headless_input_replay *replay = data;
+	struct timespec now;
+	uint64_t elapsed, due;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	elapsed = tw_timespec_diff_ns(&now, &replay->start);
+
+	for (int n = 0;; n++) {
+		if (!replay->has_next &&
+		    fread(&replay->next, sizeof(replay->next), 1,
+		          replay->file) != 1) {
+			tw_logl("input replay finished");
+			headless_replay_destroy(replay);
+			return 0;
+		}
+		replay->has_next = true;
+		due = replay->speed > 0 ? replay->next.ts / replay->speed : 0;
+		if (due > elapsed) {
+			wl_event_source_timer_update(
+				replay->timer,
+				(due - elapsed + 999999) / 1000000);
+			return 0;
+		} else if (!replay->speed && n >= HEADLESS_REPLAY_BATCH) {
+			wl_event_source_timer_update(replay->timer, 1);
+			return 0;
+		}
+		if (replay->next.device < TW_INPUT_RECORD_MAX_DEVICES)
+			headless_replay_emit(replay, &replay->next);
+		replay->has_next = false;
+	}
+}
+
+static void
+headless_replay_start(struct tw_headless_input_replay *replay)
+{
+	clock_gettime(CLOCK_MONOTONIC, &replay->start);
+	wl_event_source_timer_update(replay->timer, 1);
+}
+
 static bool
 headless_start(struct tw_backend *backend, struct tw_render_context *ctx)
 {
@@ -148,6 +485,8 @@ headless_start(struct tw_backend *backend, struct tw_render_context *ctx)
 
 	wl_list_for_each(input, &headless->base.inputs, link)
 		headless_input_start(input, headless);
+	if (headless->replay)
+		headless_replay_start(headless->replay);
 
 	return true;
 }
@@ -167,8 +506,18 @@ headless_commit_output_state(struct tw_output_device *device)
 	return true;
 }
 
+static void
+headless_output_now(struct tw_output_device *device, struct timespec *now)
+{
+	struct tw_headless_output *output =
+		wl_container_of(device, output, output.device);
+
+	headless_now(output->headless, now);
+}
+
 static const struct tw_output_device_impl headless_output_impl = {
 	.commit_state = headless_commit_output_state,
+	.now = headless_output_now,
 };
 
 static void
@@ -178,10 +527,13 @@ headless_destroy(struct tw_headless_backend *headless)
 	struct tw_input_device *input, *itmp;
 
 	wl_signal_emit(&headless->base.signals.stop, &headless->base);
+	if (headless->replay)
+		headless_replay_destroy(headless->replay);
 	wl_list_for_each_safe(output, otmp, &headless->base.outputs,
 	                      output.device.link) {
 		tw_render_output_fini(&output->output);
-		wl_event_source_remove(output->timer);
+		if (output->timer)
+			wl_event_source_remove(output->timer);
 		free(output);
 	}
 
@@ -238,9 +590,17 @@ tw_headless_backend_create(struct wl_display *display)
 WL_EXPORT bool
 tw_headless_backend_add_output(struct tw_backend *backend,
                                unsigned int width, unsigned int height)
+{
+	return tw_headless_backend_add_output_mode(backend, width, height, 0);
+}
+
+WL_EXPORT bool
+tw_headless_backend_add_output_mode(struct tw_backend *backend,
+                                    unsigned int width, unsigned int height,
+                                    unsigned int refresh)
 {
 	struct tw_headless_backend *headless =
-		wl_container_of(backend->impl, headless, base);
+		wl_container_of(backend, headless, base);
 	struct tw_headless_output *output = calloc(1, sizeof(*output));
 	struct tw_output_device *device;
 
@@ -253,7 +613,7 @@ tw_headless_backend_add_output(struct tw_backend *backend,
                               headless->display);
 
         tw_output_device_set_custom_mode(&output->output.device,
-                                         width, height, 0);
+                                         width, height, refresh);
         snprintf(device->name, sizeof(device->name),
                  "headless-output%u", wl_list_length(&headless->base.outputs));
         strncpy(device->make, "headless", sizeof(device->make));
@@ -271,19 +631,132 @@ tw_headless_backend_add_input_device(struct tw_backend *backend,
                                      enum tw_input_device_type type)
 {
 	struct tw_headless_backend *headless =
-		wl_container_of(backend->impl, headless, base);
-	struct tw_input_device *device = calloc(1, sizeof(*device));
-	if (!device)
-		return false;
+		wl_container_of(backend, headless, base);
+	const char *name = (type == TW_INPUT_TYPE_KEYBOARD) ?
+		"headless keyboard" : ((type == TW_INPUT_TYPE_POINTER) ?
+		                       "headless pointer" : "headless touch");
 
-	tw_input_device_init(device, type, 0, NULL);
-	sprintf(device->name, "headless %s",
-	        (type == TW_INPUT_TYPE_KEYBOARD) ? "keyboard" :
-	        ((type == TW_INPUT_TYPE_POINTER) ? "pointer" : "touch"));
-	wl_list_insert(headless->base.inputs.prev, &device->link);
+	return headless_input_device_create(headless, type, name) != NULL;
+}
 
-	if (backend->started)
-		headless_input_start(device, headless);
+WL_EXPORT bool
+tw_headless_backend_add_input_replay(struct tw_backend *backend,
+                                     const char *path, double speed)
+{
+	struct tw_headless_backend *headless =
+		wl_container_of(backend, headless, base);
+	struct wl_event_loop *loop =
+		wl_display_get_event_loop(headless->display);
+	struct tw_input_record_header header;
+	struct tw_headless_input_replay *replay;
 
+	if (headless->replay || speed < 0)
+		return false;
+	if (!(replay = calloc(1, sizeof(*replay))))
+		return false;
+	replay->headless = headless;
+	replay->speed = speed;
+	if (!(replay->file = fopen(path, "rb"))) {
+		tw_logl_level(TW_LOG_ERRO, "failed to open %s", path);
+		free(replay);
+		return false;
+	}
+	if (fread(&header, sizeof(header), 1, replay->file) != 1 ||
+	    header.magic != TW_INPUT_RECORD_MAGIC ||
+	    header.version != TW_INPUT_RECORD_VERSION) {
+		tw_logl_level(TW_LOG_ERRO, "%s is not an input recording",
+		              path);
+		goto err;
+	}
+	replay->timer = wl_event_loop_add_timer(loop, headless_replay_next,
+	                                        replay);
+	if (!replay->timer)
+		goto err;
+	headless->replay = replay;
+	if (backend->started)
+		headless_replay_start(replay);
+	return true;
+err:
+	fclose(replay->file);
+	free(replay);
 	return false;
 }
+
+WL_EXPORT void
+tw_headless_backend_set_manual_clock(struct tw_backend *backend, bool manual)
+{
+	struct tw_headless_backend *headless =
+		wl_container_of(backend, headless, base);
+	struct tw_headless_output *output;
+
+	if (manual == headless->manual_clock)
+		return;
+	//continue from the real time in both directions
+	clock_gettime(CLOCK_MONOTONIC, &headless->clock);
+	headless->manual_clock = manual;
+	wl_list_for_each(output, &headless->base.outputs, output.device.link) {
+		if (!output->frame_pending)
+			continue;
+		if (manual && output->timer)
+			wl_event_source_timer_update(output->timer, 0);
+		else if (!manual)
+			headless_vblank(output);
+	}
+}
+
+WL_EXPORT void
+tw_headless_backend_get_time(struct tw_backend *backend, struct timespec *now)
+{
+	struct tw_headless_backend *headless =
+		wl_container_of(backend, headless, base);
+	headless_now(headless, now);
+}
+
+WL_EXPORT unsigned int
+tw_headless_backend_step_time(struct tw_backend *backend, uint64_t ns)
+{
+	struct tw_headless_backend *headless =
+		wl_container_of(backend, headless, base);
+	struct tw_headless_output *output, *tmp;
+	unsigned int vblanks = 0;
+
+	if (!headless->manual_clock)
+		return 0;
+	headless->clock.tv_sec += ns / TW_NS_PER_S;
+	headless->clock.tv_nsec += ns % TW_NS_PER_S;
+	if (headless->clock.tv_nsec >= TW_NS_PER_S) {
+		headless->clock.tv_sec += 1;
+		headless->clock.tv_nsec -= TW_NS_PER_S;
+	}
+	wl_list_for_each_safe(output, tmp, &headless->base.outputs,
+	                      output.device.link) {
+		if (!output->frame_pending ||
+		    tw_timespec_diff_ns(&output->next_vblank,
+		                        &headless->clock) > 0)
+			continue;
+		headless_vblank(output);
+		vblanks++;
+	}
+	return vblanks;
+}
+
+WL_EXPORT unsigned int
+tw_headless_backend_step_vblank(struct tw_backend *backend)
+{
+	struct tw_headless_backend *headless =
+		wl_container_of(backend, headless, base);
+	struct tw_headless_output *output, *next = NULL;
+	int64_t ns;
+
+	if (!headless->manual_clock)
+		return 0;
+	wl_list_for_each(output, &headless->base.outputs, output.device.link)
+		if (output->frame_pending &&
+		    (!next || tw_timespec_diff_ns(&output->next_vblank,
+		                                  &next->next_vblank) < 0))
+			next = output;
+	if (!next)
+		return 0;
+	ns = tw_timespec_diff_ns(&next->next_vblank, &headless->clock);
+	return tw_headless_backend_step_time(backend, ns > 0 ? ns : 0);
+}
@@ -374,7 +374,7 @@ tw_wl_surface_start(struct tw_wl_surface *output)
 	//trigger the initial frame
 	output->frame = NULL;
 	handle_callback_done(output, output->frame, 0);
-	tw_render_output_dirty(&output->output);
+	tw_render_output_dirty_cause(&output->output, TW_REPAINT_CAUSE_OUTPUT);
 }
 
 void
@@ -64,7 +64,7 @@ static inline void
 handle_x11_request_frame(struct tw_x11_backend *x11,
                          struct tw_x11_output *output)
 {
-	tw_render_output_dirty(&output->output);
+	tw_render_output_dirty_cause(&output->output, TW_REPAINT_CAUSE_OUTPUT);
 }
 
 static int
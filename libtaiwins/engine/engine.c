@@ -52,6 +52,7 @@
 #include <taiwins/engine.h>
 #include "utils.h"
 #include "internal.h"
+#include "probes.h"
 
 static struct tw_engine s_engine = {0};
 
@@ -90,6 +91,55 @@ notify_new_xdg_output(struct wl_listener *listener, void *data)
 	tw_engine_new_xdg_output(engine, xdg_output);
 }
 
+/* the views moved or restacked, content updates keep the grid. Picking walks
+ * the layers while they keep moving */
+static void
+notify_engine_surface_dirty(struct wl_listener *listener, void *data)
+{
+	struct tw_engine *engine =
+		wl_container_of(listener, engine, listeners.surface_dirty);
+	struct tw_surface *surface = data;
+
+	//cursor is not pickable, it moves with every motion
+	if (surface != engine->global_cursor.curr_surface &&
+	    pixman_region32_not_empty(&surface->geometry.dirty))
+		tw_layers_manager_dirty_geometry(&engine->layers_manager);
+}
+
+static void
+notify_engine_surface_destroy(struct wl_listener *listener, void *data)
+{
+	struct tw_engine *engine =
+		wl_container_of(listener, engine, listeners.surface_destroy);
+	tw_layers_manager_dirty(&engine->layers_manager);
+}
+
+static void
+notify_engine_backend_start(struct wl_listener *listener, void *data)
+{
+	struct tw_engine *engine =
+		wl_container_of(listener, engine, listeners.backend_start);
+	struct tw_render_context *ctx = engine->backend->ctx;
+
+	tw_signal_setup_listener(&ctx->signals.wl_surface_dirty,
+	                         &engine->listeners.surface_dirty,
+	                         notify_engine_surface_dirty);
+	tw_signal_setup_listener(&ctx->signals.wl_surface_destroy,
+	                         &engine->listeners.surface_destroy,
+	                         notify_engine_surface_destroy);
+}
+
+static void
+notify_engine_backend_stop(struct wl_listener *listener, void *data)
+{
+	struct tw_engine *engine =
+		wl_container_of(listener, engine, listeners.backend_stop);
+
+	tw_reset_wl_list(&engine->listeners.surface_dirty.link);
+	tw_reset_wl_list(&engine->listeners.surface_destroy.link);
+	tw_layers_manager_dirty(&engine->layers_manager);
+}
+
 static void
 notify_engine_release(struct wl_listener *listener, void *data)
 {
@@ -97,6 +147,10 @@ notify_engine_release(struct wl_listener *listener, void *data)
 		wl_container_of(listener, engine, listeners.display_destroy);
 
         wl_list_remove(&engine->listeners.display_destroy.link);
+	tw_reset_wl_list(&engine->listeners.backend_start.link);
+	tw_reset_wl_list(&engine->listeners.backend_stop.link);
+	tw_reset_wl_list(&engine->listeners.surface_dirty.link);
+	tw_reset_wl_list(&engine->listeners.surface_destroy.link);
 	tw_cursor_fini(&engine->global_cursor);
 	engine->started = false;
 	engine->display = NULL;
@@ -176,6 +230,14 @@ tw_engine_create_global(struct wl_display *display, struct tw_backend *backend)
 	tw_signal_setup_listener(&engine->output_manager.new_output,
 	                         &engine->listeners.new_xdg_output,
 	                         notify_new_xdg_output);
+	tw_signal_setup_listener(&backend->signals.start,
+	                         &engine->listeners.backend_start,
+	                         notify_engine_backend_start);
+	tw_signal_setup_listener(&backend->signals.stop,
+	                         &engine->listeners.backend_stop,
+	                         notify_engine_backend_stop);
+	wl_list_init(&engine->listeners.surface_dirty.link);
+	wl_list_init(&engine->listeners.surface_destroy.link);
 	//signals
 	wl_signal_init(&engine->signals.seat_created);
 	wl_signal_init(&engine->signals.seat_focused);
@@ -193,55 +255,18 @@ err_context:
 
 }
 
-static struct tw_surface *
-try_pick_subsurfaces(struct tw_surface *parent, float x, float y,
-                     float *sx, float *sy)
-{
-	struct tw_surface *surface;
-	struct tw_subsurface *sub;
-	//recursively picking subsurfaces, we need to find a way to avoid this
-	wl_list_for_each(sub, &parent->subsurfaces, parent_link) {
-		surface = try_pick_subsurfaces(sub->surface, x, y, sx, sy);
-		if (!surface)
-			surface = sub->surface;
-		if (tw_surface_has_input_point(surface, x, y)) {
-			tw_surface_to_local_pos(surface, x, y, sx, sy);
-			return surface;
-		}
-	}
-	return NULL;
-}
-
 struct tw_surface *
 tw_engine_pick_surface_from_layers(struct tw_engine *engine,
                                    float x, float y, float *sx, float *sy)
 {
-	struct tw_layer *layer;
-	struct tw_layers_manager *layers = &engine->layers_manager;
-	struct tw_surface *surface, *sub, *picked = NULL;
+	struct tw_surface *picked;
 
 	SCOPE_PROFILE_BEG();
+	TW_PROBE(pick_surface_begin);
 
-	//TODO: for very small amount of views, this works well. But it is a
-	//linear algorithm so when number of windows gets very large, we may
-	//have problems.
-	wl_list_for_each(layer, &layers->layers, link) {
-		if (layer->position >= TW_LAYER_POS_CURSOR)
-			continue;
-		wl_list_for_each(surface, &layer->views,
-		                 layer_link) {
-			if ((sub = try_pick_subsurfaces(surface, x, y,
-			                                sx, sy))) {
-				picked = sub;
-				goto out;
-			} else if (tw_surface_has_input_point(surface, x, y)) {
-				tw_surface_to_local_pos(surface, x, y, sx, sy);
-				picked = surface;
-				goto out;
-			}
-		}
-	}
-out:
+	picked = tw_layers_manager_pick_surface(&engine->layers_manager,
+	                                        x, y, sx, sy);
+	TW_PROBE1(pick_surface_end, picked);
 	SCOPE_PROFILE_END();
 	if (!picked) {
 		*sx = -1000000;
@@ -33,6 +33,7 @@
 
 #include "utils.h"
 #include "internal.h"
+#include "probes.h"
 
 static inline bool
 seat_has_keyboard(struct tw_seat *seat)
@@ -104,12 +105,22 @@ notify_seat_remove_device(struct wl_listener *listener, void *data)
 	}
 }
 
+static inline void
+seat_stamp_input(struct tw_engine_seat *seat, uint32_t time,
+                 struct wl_resource *surface)
+{
+	seat->last_input.time = time;
+	seat->last_input.surface = surface;
+}
+
 static void
 notify_seat_input_event(struct wl_listener *listener, void *data)
 {
 	struct tw_engine_seat *seat =
 		wl_container_of(listener, seat, sink.event);
 	wl_signal_emit(&seat->engine->signals.seat_input, seat);
+	//not every event is stamped, do not leave a stale one
+	seat_stamp_input(seat, 0, NULL);
 }
 
 static void
@@ -196,8 +207,10 @@ notify_seat_keyboard_key(struct wl_listener *listener, void *data)
 	struct tw_keyboard *seat_keyboard = &seat->tw_seat->keyboard;
 	struct tw_event_keyboard_key *event = data;
 
+	TW_PROBE3(input_key, event->time, event->keycode, event->state);
 	tw_keyboard_notify_key(seat_keyboard, event->time, event->keycode,
 	                       event->state);
+	seat_stamp_input(seat, event->time, seat_keyboard->focused_surface);
 }
 
 /******************************************************************************
@@ -212,12 +225,14 @@ notify_seat_pointer_button(struct wl_listener *listener, void *data)
 	struct tw_event_pointer_button *event = data;
 	struct tw_pointer *seat_pointer = &seat->tw_seat->pointer;
 
+	TW_PROBE3(input_button, event->time, event->button, event->state);
 	if (event->state == WL_POINTER_BUTTON_STATE_PRESSED)
 		seat_pointer->btn_count++;
 	else
 		seat_pointer->btn_count--;
 	tw_pointer_notify_button(seat_pointer, event->time, event->button,
 	                         event->state);
+	seat_stamp_input(seat, event->time, seat_pointer->focused_surface);
 }
 
 static void
@@ -229,6 +244,7 @@ pointer_focus_motion(struct tw_engine_seat *seat, uint32_t timespec)
 	float x = seat->engine->global_cursor.x;
 	float y = seat->engine->global_cursor.y;
 
+	TW_PROBE3(input_motion, timespec, (int)x, (int)y);
 	if (pointer->grab && pointer->grab->impl->enter)
 		focused = tw_engine_pick_surface_from_layers(seat->engine,
 		                                             x, y, &x, &y);
@@ -239,6 +255,7 @@ pointer_focus_motion(struct tw_engine_seat *seat, uint32_t timespec)
 			tw_pointer_notify_motion(pointer, timespec, x, y);
 	else if (focused)
 		tw_pointer_notify_enter(pointer, focused->resource, x, y);
+	seat_stamp_input(seat, timespec, pointer->focused_surface);
 }
 
 static void
@@ -287,10 +304,11 @@ notify_seat_pointer_axis(struct wl_listener *listener, void *data)
 	struct tw_pointer *pointer = &seat->tw_seat->pointer;
 	struct tw_event_pointer_axis *event = data;
 
+	TW_PROBE2(input_axis, event->time, event->axis);
 	tw_pointer_notify_axis(pointer, event->time,
 	                       event->axis, event->delta,
 	                       (int)event->delta_discrete, event->source);
-
+	seat_stamp_input(seat, event->time, pointer->focused_surface);
 }
 
 static void
@@ -421,6 +439,7 @@ notify_seat_touch_down(struct wl_listener *listener, void *data)
 		tw_touch_notify_down(touch, event->time,
 		                     event->touch_id, x, y);
 	}
+	seat_stamp_input(seat, event->time, touch->focused_surface);
 }
 
 static void
@@ -432,6 +451,7 @@ notify_seat_touch_up(struct wl_listener *listener, void *data)
 	struct tw_touch *touch = &seat->tw_seat->touch;
 
 	tw_touch_notify_up(touch, event->time, event->touch_id);
+	seat_stamp_input(seat, event->time, touch->focused_surface);
 }
 
 static void
@@ -454,6 +474,7 @@ notify_seat_touch_motion(struct wl_listener *listener, void *data)
 		tw_touch_notify_motion(touch, event->time,
 		                       event->touch_id, x, y);
 	}
+	seat_stamp_input(seat, event->time, touch->focused_surface);
 }
 
 static void
@@ -0,0 +1,146 @@
+/*
+ * input_recorder.c - taiwins input event recorder
+ *
+ * Copyright (c) 2021 Xichen Zhou
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <wayland-server-core.h>
+#include <taiwins/objects/logger.h>
+#include <taiwins/objects/utils.h>
+
+#include <taiwins/input_recorder.h>
+
+struct tw_input_recorder {
+	FILE *file;
+	struct timespec start;
+	struct tw_input_device *devices[TW_INPUT_RECORD_MAX_DEVICES];
+};
+
+static void
+input_recorder_write(struct tw_input_recorder *recorder,
+                     struct tw_input_record *record)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	record->ts = tw_timespec_diff_ns(&now, &recorder->start);
+	fwrite(record, sizeof(*record), 1, recorder->file);
+}
+
+static int
+input_recorder_add_device(struct tw_input_recorder *recorder,
+                          struct tw_input_device *device)
+{
+	struct tw_input_record record = {
+		.type = TW_INPUT_RECORD_DEVICE,
+	};
+
+	for (int i = 0; i < TW_INPUT_RECORD_MAX_DEVICES; i++) {
+		if (recorder->devices[i])
+			continue;
+		recorder->devices[i] = device;
+		record.device = i;
+		record.u.device.type = device->type;
+		strncpy(record.u.device.name, device->name,
+		        sizeof(record.u.device.name) - 1);
+		input_recorder_write(recorder, &record);
+		return i;
+	}
+	return -1;
+}
+
+WL_EXPORT struct tw_input_recorder *
+tw_input_recorder_create(const char *path)
+{
+	struct tw_input_record_header header = {
+		.magic = TW_INPUT_RECORD_MAGIC,
+		.version = TW_INPUT_RECORD_VERSION,
+	};
+	struct tw_input_recorder *recorder = calloc(1, sizeof(*recorder));
+	int fd;
+
+	if (!recorder)
+		return NULL;
+	//the keys typed are in there, only the user may read them
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd < 0 || !(recorder->file = fdopen(fd, "wb"))) {
+		tw_logl_level(TW_LOG_ERRO, "failed to open %s for recording",
+		              path);
+		if (fd >= 0)
+			close(fd);
+		free(recorder);
+		return NULL;
+	}
+	tw_logl_level(TW_LOG_WARN, "recording all the input to %s, "
+	              "including every key typed", path);
+	fwrite(&header, sizeof(header), 1, recorder->file);
+	clock_gettime(CLOCK_MONOTONIC, &recorder->start);
+	return recorder;
+}
+
+WL_EXPORT void
+tw_input_recorder_destroy(struct tw_input_recorder *recorder)
+{
+	if (!recorder)
+		return;
+	fclose(recorder->file);
+	free(recorder);
+}
+
+WL_EXPORT void
+tw_input_recorder_write(struct tw_input_recorder *recorder,
+                        struct tw_input_device *device,
+                        struct tw_input_record *record)
+{
+	int id = -1;
+
+	for (int i = 0; i < TW_INPUT_RECORD_MAX_DEVICES; i++) {
+		if (recorder->devices[i] == device) {
+			id = i;
+			break;
+		}
+	}
+	if (id < 0 && (id = input_recorder_add_device(recorder, device)) < 0)
+		return;
+	record->device = id;
+	input_recorder_write(recorder, record);
+}
+
+WL_EXPORT void
+tw_input_recorder_remove_device(struct tw_input_recorder *recorder,
+                                struct tw_input_device *device)
+{
+	for (int i = 0; i < TW_INPUT_RECORD_MAX_DEVICES; i++) {
+		struct tw_input_record record = {
+			.type = TW_INPUT_RECORD_DEVICE_GONE,
+			.device = i,
+		};
+
+		if (recorder->devices[i] != device)
+			continue;
+		input_recorder_write(recorder, &record);
+		recorder->devices[i] = NULL;
+		return;
+	}
+}
@@ -28,6 +28,7 @@
 
 #include <taiwins/backend.h>
 #include <taiwins/input_device.h>
+#include <taiwins/input_recorder.h>
 #include <taiwins/objects/utils.h>
 #include <taiwins/objects/logger.h>
 #include "input_libinput.h"
@@ -369,6 +370,202 @@ handle_device_touch_up_event(struct tw_libinput_device *dev,
 	}
 }
 
+/******************************************************************************
+ * recording
+ *****************************************************************************/
+
+static void
+record_device_pointer_event(struct tw_input_record *record,
+                            enum libinput_event_type type,
+                            struct libinput_event_pointer *event)
+{
+	record->time = libinput_event_pointer_get_time(event);
+	switch (type) {
+	case LIBINPUT_EVENT_POINTER_MOTION:
+		record->type = TW_INPUT_RECORD_MOTION;
+		record->u.motion.dx = libinput_event_pointer_get_dx(event);
+		record->u.motion.dy = libinput_event_pointer_get_dy(event);
+		record->u.motion.unaccel_dx =
+			libinput_event_pointer_get_dx_unaccelerated(event);
+		record->u.motion.unaccel_dy =
+			libinput_event_pointer_get_dy_unaccelerated(event);
+		break;
+	case LIBINPUT_EVENT_POINTER_MOTION_ABSOLUTE:
+		record->type = TW_INPUT_RECORD_MOTION_ABS;
+		record->u.abs.x =
+			libinput_event_pointer_get_absolute_x_transformed(
+				event, 1);
+		record->u.abs.y =
+			libinput_event_pointer_get_absolute_y_transformed(
+				event, 1);
+		break;
+	case LIBINPUT_EVENT_POINTER_BUTTON:
+		record->type = TW_INPUT_RECORD_BUTTON;
+		record->u.button.button =
+			libinput_event_pointer_get_button(event);
+		record->u.button.state =
+			libinput_event_pointer_get_button_state(event) ==
+			LIBINPUT_BUTTON_STATE_PRESSED ?
+			WL_POINTER_BUTTON_STATE_PRESSED :
+			WL_POINTER_BUTTON_STATE_RELEASED;
+		break;
+	default:
+		break;
+	}
+}
+
+/* one record per axis, the same as we emit them */
+static void
+record_device_axis_event(struct tw_input_recorder *recorder,
+                         struct tw_libinput_device *dev,
+                         struct tw_input_record *record,
+                         struct libinput_event_pointer *event)
+{
+	static const struct {
+		enum libinput_pointer_axis axis;
+		enum wl_pointer_axis wl_axis;
+	} axes[] = {
+		{LIBINPUT_POINTER_AXIS_SCROLL_HORIZONTAL,
+		 WL_POINTER_AXIS_HORIZONTAL_SCROLL},
+		{LIBINPUT_POINTER_AXIS_SCROLL_VERTICAL,
+		 WL_POINTER_AXIS_VERTICAL_SCROLL},
+	};
+
+	record->type = TW_INPUT_RECORD_AXIS;
+	record->time = libinput_event_pointer_get_time(event);
+	switch (libinput_event_pointer_get_axis_source(event)) {
+	case LIBINPUT_POINTER_AXIS_SOURCE_WHEEL:
+		record->u.axis.source = WL_POINTER_AXIS_SOURCE_WHEEL;
+		break;
+	case LIBINPUT_POINTER_AXIS_SOURCE_WHEEL_TILT:
+		record->u.axis.source = WL_POINTER_AXIS_SOURCE_WHEEL_TILT;
+		break;
+	case LIBINPUT_POINTER_AXIS_SOURCE_CONTINUOUS:
+		record->u.axis.source = WL_POINTER_AXIS_SOURCE_CONTINUOUS;
+		break;
+	case LIBINPUT_POINTER_AXIS_SOURCE_FINGER:
+		record->u.axis.source = WL_POINTER_AXIS_SOURCE_FINGER;
+		break;
+	}
+	for (unsigned i = 0; i < 2; i++) {
+		if (!libinput_event_pointer_has_axis(event, axes[i].axis))
+			continue;
+		record->u.axis.axis = axes[i].wl_axis;
+		record->u.axis.delta = libinput_event_pointer_get_axis_value(
+			event, axes[i].axis);
+		record->u.axis.discrete =
+			libinput_event_pointer_get_axis_value_discrete(
+				event, axes[i].axis);
+		tw_input_recorder_write(recorder, &dev->base, record);
+		break;
+	}
+}
+
+static void
+record_device_gesture_event(struct tw_input_record *record,
+                            enum libinput_event_type type,
+                            struct libinput_event_gesture *event)
+{
+	record->time = libinput_event_gesture_get_time(event);
+	switch (type) {
+	case LIBINPUT_EVENT_GESTURE_SWIPE_BEGIN:
+	case LIBINPUT_EVENT_GESTURE_PINCH_BEGIN:
+		record->u.gesture.state = TW_POINTER_GESTURE_BEGIN;
+		record->u.gesture.fingers =
+			libinput_event_gesture_get_finger_count(event);
+		break;
+	case LIBINPUT_EVENT_GESTURE_SWIPE_UPDATE:
+	case LIBINPUT_EVENT_GESTURE_PINCH_UPDATE:
+		record->u.gesture.state = TW_POINTER_GESTURE_UPDATE;
+		record->u.gesture.dx = libinput_event_gesture_get_dx(event);
+		record->u.gesture.dy = libinput_event_gesture_get_dy(event);
+		if (type == LIBINPUT_EVENT_GESTURE_PINCH_UPDATE) {
+			record->u.gesture.scale =
+				libinput_event_gesture_get_scale(event);
+			record->u.gesture.rotation =
+				libinput_event_gesture_get_angle_delta(event);
+		}
+		break;
+	default:
+		record->u.gesture.state = TW_POINTER_GESTURE_END;
+		record->u.gesture.cancelled =
+			libinput_event_gesture_get_cancelled(event);
+		break;
+	}
+	record->type = (type >= LIBINPUT_EVENT_GESTURE_PINCH_BEGIN) ?
+		TW_INPUT_RECORD_PINCH : TW_INPUT_RECORD_SWIPE;
+}
+
+static void
+record_device_touch_event(struct tw_input_record *record,
+                          enum libinput_event_type type,
+                          struct libinput_event_touch *event)
+{
+	record->time = libinput_event_touch_get_time(event);
+	record->u.abs.id = libinput_event_touch_get_seat_slot(event);
+	if (type == LIBINPUT_EVENT_TOUCH_UP) {
+		record->type = TW_INPUT_RECORD_TOUCH_UP;
+		return;
+	}
+	record->type = type == LIBINPUT_EVENT_TOUCH_DOWN ?
+		TW_INPUT_RECORD_TOUCH_DOWN : TW_INPUT_RECORD_TOUCH_MOTION;
+	record->u.abs.x = libinput_event_touch_get_x_transformed(event, 1);
+	record->u.abs.y = libinput_event_touch_get_y_transformed(event, 1);
+}
+
+static void
+record_device_event(struct tw_input_recorder *recorder,
+                    struct tw_libinput_device *dev,
+                    struct libinput_event *event)
+{
+	struct tw_input_record record = {0};
+	enum libinput_event_type type = libinput_event_get_type(event);
+	struct libinput_event_keyboard *key;
+
+	switch (type) {
+	case LIBINPUT_EVENT_KEYBOARD_KEY:
+		key = libinput_event_get_keyboard_event(event);
+		record.type = TW_INPUT_RECORD_KEY;
+		record.time = libinput_event_keyboard_get_time(key);
+		record.u.key.keycode = libinput_event_keyboard_get_key(key);
+		record.u.key.state =
+			libinput_event_keyboard_get_key_state(key) ==
+			LIBINPUT_KEY_STATE_PRESSED ?
+			WL_KEYBOARD_KEY_STATE_PRESSED :
+			WL_KEYBOARD_KEY_STATE_RELEASED;
+		break;
+	case LIBINPUT_EVENT_POINTER_MOTION:
+	case LIBINPUT_EVENT_POINTER_MOTION_ABSOLUTE:
+	case LIBINPUT_EVENT_POINTER_BUTTON:
+		record_device_pointer_event(
+			&record, type, libinput_event_get_pointer_event(event));
+		break;
+	case LIBINPUT_EVENT_POINTER_AXIS:
+		record_device_axis_event(
+			recorder, dev, &record,
+			libinput_event_get_pointer_event(event));
+		return;
+	case LIBINPUT_EVENT_TOUCH_DOWN:
+	case LIBINPUT_EVENT_TOUCH_MOTION:
+	case LIBINPUT_EVENT_TOUCH_UP:
+		record_device_touch_event(
+			&record, type, libinput_event_get_touch_event(event));
+		break;
+	case LIBINPUT_EVENT_GESTURE_SWIPE_BEGIN:
+	case LIBINPUT_EVENT_GESTURE_SWIPE_UPDATE:
+	case LIBINPUT_EVENT_GESTURE_SWIPE_END:
+	case LIBINPUT_EVENT_GESTURE_PINCH_BEGIN:
+	case LIBINPUT_EVENT_GESTURE_PINCH_UPDATE:
+	case LIBINPUT_EVENT_GESTURE_PINCH_END:
+		record_device_gesture_event(
+			&record, type, libinput_event_get_gesture_event(event));
+		break;
+	default:
+		return;
+	}
+	tw_input_recorder_write(recorder, &dev->base, &record);
+}
+
 /******************************************************************************
  * assembler
  *****************************************************************************/
@@ -384,6 +581,8 @@ handle_device_event(struct libinput_event *event)
         if (!dev)
 		return;
         assert(dev->libinput == libinput_device);
+        if (dev->input->recorder)
+	        record_device_event(dev->input->recorder, dev, event);
 
         switch(libinput_event_get_type(event)) {
 	case LIBINPUT_EVENT_KEYBOARD_KEY:
@@ -29,6 +29,7 @@
 
 #include <taiwins/backend.h>
 #include <taiwins/input_device.h>
+#include <taiwins/input_recorder.h>
 #include <taiwins/objects/utils.h>
 #include <taiwins/objects/logger.h>
 #include "input_libinput.h"
@@ -136,6 +137,9 @@ tw_libinput_device_destroy(struct tw_libinput_device *dev)
 {
 	if (!dev)
 		return;
+	if (dev->input->recorder)
+		tw_input_recorder_remove_device(dev->input->recorder,
+		                                &dev->base);
 	wl_list_remove(&dev->link);
 	tw_input_device_fini(&dev->base);
 	free(dev);
@@ -239,7 +243,11 @@ tw_libinput_input_init(struct tw_libinput_input *input,
 	input->backend = backend;
 	input->disabled = false;
 	input->impl = impl ? impl : &dummy_impl;
+	input->recorder = NULL;
 	libinput_set_user_data(libinput, input);
+	if (getenv("TW_INPUT_RECORD"))
+		input->recorder =
+			tw_input_recorder_create(getenv("TW_INPUT_RECORD"));
 
 	libinput_log_set_handler(libinput, &libinput_log_func);
 
@@ -295,4 +303,6 @@ tw_libinput_input_fini(struct tw_libinput_input *input)
 	}
 	wl_list_for_each_safe(dev, dev_tmp, &input->devices, link)
 		tw_libinput_device_destroy(dev);
+	tw_input_recorder_destroy(input->recorder);
+	input->recorder = NULL;
 }
@@ -31,6 +31,36 @@
 #include <taiwins/objects/surface.h>
 
 
+static void
+notify_buffer_resource_destroy(struct wl_listener *listener, void *data)
+{
+	struct tw_surface_buffer *buffer =
+		wl_container_of(listener, buffer, resource_destroy_listener);
+	struct tw_surface *surface = wl_container_of(buffer, surface, buffer);
+
+	//the content was never read, the pending upload is gone with it
+	for (int i = 0; i < 3; i++)
+		if (surface->surface_states[i].buffer_resource ==
+		    buffer->resource)
+			surface->surface_states[i].buffer_resource = NULL;
+	buffer->resource = NULL;
+	buffer->deferred = false;
+	tw_reset_wl_list(&buffer->resource_destroy_listener.link);
+	tw_reset_wl_list(&buffer->deferred_link);
+}
+
+static inline void
+buffer_watch_deferred(struct tw_surface_buffer *buffer)
+{
+	tw_reset_wl_list(&buffer->resource_destroy_listener.link);
+	if (!buffer->deferred || !buffer->resource)
+		return;
+	buffer->resource_destroy_listener.notify =
+		notify_buffer_resource_destroy;
+	wl_resource_add_destroy_listener(buffer->resource,
+	                                 &buffer->resource_destroy_listener);
+}
+
 WL_EXPORT bool
 tw_surface_buffer_update(struct tw_surface_buffer *buffer,
                          struct wl_resource *resource,
@@ -51,8 +81,10 @@ tw_surface_buffer_update(struct tw_surface_buffer *buffer,
 		ret = buffer->buffer_import.buffer_import(&event, user_data);
 	}
 	//if updating failed, nothing changes.
-	if (ret)
+	if (ret) {
 		buffer->resource = resource;
+		buffer_watch_deferred(buffer);
+	}
 	return ret;
 }
 
@@ -72,8 +104,10 @@ tw_surface_buffer_new(struct tw_surface_buffer *buffer,
 		user_data = buffer->buffer_import.callback;
 		buffer->buffer_import.buffer_import(&event, user_data);
 	}
-	if (tw_surface_has_texture(surface))
+	if (tw_surface_has_texture(surface)) {
 		buffer->resource = resource;
+		buffer_watch_deferred(buffer);
+	}
 }
 
 WL_EXPORT void
@@ -83,4 +117,20 @@ tw_surface_buffer_release(struct tw_surface_buffer *buffer)
 		return;
 	wl_buffer_send_release(buffer->resource);
 	buffer->resource = NULL; //?
+	buffer->deferred = false;
+	tw_reset_wl_list(&buffer->resource_destroy_listener.link);
+	tw_reset_wl_list(&buffer->deferred_link);
+}
+
+WL_EXPORT void
+tw_surface_buffer_release_deferred(struct tw_surface_buffer *buffer)
+{
+	struct tw_surface *surface = wl_container_of(buffer, surface, buffer);
+
+	if (!buffer->deferred)
+		return;
+	//surface would not release it on next commit.
+	if (surface->current->buffer_resource == buffer->resource)
+		surface->current->buffer_resource = NULL;
+	tw_surface_buffer_release(buffer);
 }
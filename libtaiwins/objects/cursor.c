@@ -121,9 +121,11 @@ tw_cursor_set_surface(struct tw_cursor *cursor,
 	cursor->hotspot_x = hotspot_x;
 	cursor->hotspot_y = hotspot_y;
 	cursor->curr_surface = surface;
-	if (cursor->cursor_layer)
+	if (cursor->cursor_layer) {
 		wl_list_insert(cursor->cursor_layer->views.prev,
 		               &surface->layer_link);
+		tw_layer_dirty(cursor->cursor_layer);
+	}
 }
 
 WL_EXPORT void
@@ -134,6 +136,8 @@ tw_cursor_unset_surface(struct tw_cursor *cursor)
 	if (curr_surface) {
 		tw_reset_wl_list(&curr_surface->layer_link);
 		tw_reset_wl_list(&cursor->surface_destroy.link);
+		if (cursor->cursor_layer)
+			tw_layer_dirty(cursor->cursor_layer);
 
 		cursor->curr_surface = NULL;
 	}
@@ -19,18 +19,248 @@
  *
  */
 
+#include <math.h>
+#include <string.h>
 #include <wayland-server-core.h>
 #include <wayland-util.h>
 #include <taiwins/objects/layers.h>
+#include <taiwins/objects/surface.h>
+#include <taiwins/objects/subsurface.h>
+
+#define PICK_CELL_SIZE 128
+#define PICK_MAX_CELLS 4096
+
+#define MAX(a, b) \
+	({ __typeof__ (a) _a = (a); \
+		__typeof__ (b) _b = (b); \
+		_a > _b ? _a : _b; })
+
+#define MIN(a, b) \
+	({ __typeof__ (a) _a = (a); \
+		__typeof__ (b) _b = (b); \
+		_a < _b ? _a : _b; })
 
 static struct tw_layers_manager s_layers_manager = {0};
 
 static void
 notify_display_destroy(struct wl_listener *listener, void *data)
 {
-	//there is nothing to do right now.
+	struct tw_layers_manager *manager =
+		wl_container_of(listener, manager, destroy_listener);
+
+	wl_list_remove(&listener->link);
+	wl_list_init(&listener->link);
+	wl_array_release(&manager->pick.order);
+	wl_array_release(&manager->pick.offsets);
+	wl_array_release(&manager->pick.cells);
+	wl_array_init(&manager->pick.order);
+	wl_array_init(&manager->pick.offsets);
+	wl_array_init(&manager->pick.cells);
+	tw_layers_manager_dirty(manager);
+}
+
+/******************************************************************************
+ * picking grid
+ *****************************************************************************/
+
+static inline void *
+pick_array_resize(struct wl_array *array, size_t size)
+{
+	array->size = 0;
+	return wl_array_add(array, size);
+}
+
+/* same order as picking one by one, the subsurfaces before the parent */
+static void
+pick_collect_surface(struct wl_array *order, struct tw_surface *surface)
+{
+	struct tw_subsurface *sub;
+	struct tw_surface **p;
+
+	wl_list_for_each(sub, &surface->subsurfaces, parent_link)
+		pick_collect_surface(order, sub->surface);
+	if ((p = wl_array_add(order, sizeof(*p))))
+		*p = surface;
+}
+
+static inline void
+pick_surface_cells(struct tw_layers_manager *manager,
+                   struct tw_surface *surface,
+                   uint32_t *c1, uint32_t *r1, uint32_t *c2, uint32_t *r2)
+{
+	int64_t x = surface->geometry.xywh.x - manager->pick.x;
+	int64_t y = surface->geometry.xywh.y - manager->pick.y;
+	//tw_surface_has_point includes the right and bottom edges
+	*c1 = x / manager->pick.cell;
+	*r1 = y / manager->pick.cell;
+	*c2 = (x + surface->geometry.xywh.width) / manager->pick.cell;
+	*r2 = (y + surface->geometry.xywh.height) / manager->pick.cell;
+}
+
+static void
+pick_build_grid(struct tw_layers_manager *manager)
+{
+	struct tw_surface **s, **cells = NULL;
+	uint32_t c1, r1, c2, r2, n, *offsets;
+	int64_t x1 = INT32_MAX, y1 = INT32_MAX, x2 = INT32_MIN, y2 = INT32_MIN;
+	int64_t cell = PICK_CELL_SIZE, cols, rows;
+
+	wl_array_for_each(s, &manager->pick.order) {
+		pixman_rectangle32_t *box = &(*s)->geometry.xywh;
+		x1 = MIN(x1, box->x);
+		y1 = MIN(y1, box->y);
+		x2 = MAX(x2, (int64_t)box->x + box->width);
+		y2 = MAX(y2, (int64_t)box->y + box->height);
+	}
+	if (!manager->pick.order.size)
+		x1 = y1 = x2 = y2 = 0;
+	do {
+		cols = (x2 - x1) / cell + 1;
+		rows = (y2 - y1) / cell + 1;
+		cell *= 2;
+	} while (cols * rows > PICK_MAX_CELLS);
+	manager->pick.x = x1;
+	manager->pick.y = y1;
+	manager->pick.cell = cell / 2;
+	manager->pick.cols = cols;
+	manager->pick.rows = rows;
+
+	//count the views per cell, then fill them in picking order
+	n = cols * rows;
+	if (!(offsets = pick_array_resize(&manager->pick.offsets,
+	                                  (n + 1) * sizeof(uint32_t))))
+		goto err;
+	memset(offsets, 0, (n + 1) * sizeof(uint32_t));
+	wl_array_for_each(s, &manager->pick.order) {
+		pick_surface_cells(manager, *s, &c1, &r1, &c2, &r2);
+		for (uint32_t r = r1; r <= r2; r++)
+			for (uint32_t c = c1; c <= c2; c++)
+				offsets[r * cols + c + 1]++;
+	}
+	for (uint32_t i = 0; i < n; i++)
+		offsets[i + 1] += offsets[i];
+	manager->pick.cells.size = 0;
+	if (offsets[n] && !(cells = pick_array_resize(&manager->pick.cells,
+	                                              offsets[n] *
+	                                              sizeof(*cells))))
+		goto err;
+	wl_array_for_each(s, &manager->pick.order) {
+		pick_surface_cells(manager, *s, &c1, &r1, &c2, &r2);
+		for (uint32_t r = r1; r <= r2; r++)
+			for (uint32_t c = c1; c <= c2; c++)
+				cells[offsets[r * cols + c]++] = *s;
+	}
+	//offsets moved to the end of each cell
+	memmove(offsets + 1, offsets, n * sizeof(uint32_t));
+	offsets[0] = 0;
+	return;
+err:
+	manager->pick.cols = manager->pick.rows = 0;
+	manager->pick.serial = manager->serial - 1;
+}
+
+static void
+pick_rebuild(struct tw_layers_manager *manager)
+{
+	struct tw_layer *layer;
+	struct tw_surface *surface;
+
+	manager->pick.order.size = 0;
+	wl_list_for_each(layer, &manager->layers, link) {
+		if (layer->position >= TW_LAYER_POS_CURSOR)
+			continue;
+		wl_list_for_each(surface, &layer->views, layer_link)
+			pick_collect_surface(&manager->pick.order, surface);
+	}
+	manager->pick.serial = manager->serial;
+	manager->pick.moved = false;
+	pick_build_grid(manager);
 }
 
+/* the same order as the grid, straight from the layers */
+static struct tw_surface *
+pick_linear_surface(struct tw_surface *surface, float x, float y)
+{
+	struct tw_subsurface *sub;
+	struct tw_surface *picked;
+
+	wl_list_for_each(sub, &surface->subsurfaces, parent_link)
+		if ((picked = pick_linear_surface(sub->surface, x, y)))
+			return picked;
+	return tw_surface_has_input_point(surface, x, y) ? surface : NULL;
+}
+
+static struct tw_surface *
+pick_linear(struct tw_layers_manager *manager, float x, float y)
+{
+	struct tw_layer *layer;
+	struct tw_surface *surface, *picked;
+
+	wl_list_for_each(layer, &manager->layers, link) {
+		if (layer->position >= TW_LAYER_POS_CURSOR)
+			continue;
+		wl_list_for_each(surface, &layer->views, layer_link)
+			if ((picked = pick_linear_surface(surface, x, y)))
+				return picked;
+	}
+	return NULL;
+}
+
+WL_EXPORT void
+tw_layers_manager_dirty(struct tw_layers_manager *manager)
+{
+	manager->serial++;
+}
+
+WL_EXPORT void
+tw_layers_manager_dirty_geometry(struct tw_layers_manager *manager)
+{
+	manager->pick.moved = true;
+	manager->pick.moving = true;
+}
+
+WL_EXPORT struct tw_surface *
+tw_layers_manager_pick_surface(struct tw_layers_manager *manager,
+                               float x, float y, float *sx, float *sy)
+{
+	int64_t c, r;
+	uint32_t *offsets;
+	struct tw_surface **cells, *picked;
+
+	//the views are moving, the grid would be outdated by the next pick
+	if (manager->pick.moving) {
+		manager->pick.moving = false;
+		if ((picked = pick_linear(manager, x, y)))
+			tw_surface_to_local_pos(picked, x, y, sx, sy);
+		return picked;
+	}
+	if (manager->pick.serial != manager->serial || manager->pick.moved)
+		pick_rebuild(manager);
+	c = (int64_t)floorf(x) - manager->pick.x;
+	r = (int64_t)floorf(y) - manager->pick.y;
+	if (c < 0 || r < 0)
+		return NULL;
+	c /= manager->pick.cell;
+	r /= manager->pick.cell;
+	if (c >= manager->pick.cols || r >= manager->pick.rows)
+		return NULL;
+
+	offsets = manager->pick.offsets.data;
+	cells = manager->pick.cells.data;
+	for (uint32_t i = offsets[r * manager->pick.cols + c];
+	     i < offsets[r * manager->pick.cols + c + 1]; i++) {
+		if (tw_surface_has_input_point(cells[i], x, y)) {
+			tw_surface_to_local_pos(cells[i], x, y, sx, sy);
+			return cells[i];
+		}
+	}
+	return NULL;
+}
+
+/******************************************************************************
+ * layers
+ *****************************************************************************/
+
 WL_EXPORT void
 tw_layers_manager_init(struct tw_layers_manager *manager,
                        struct wl_display *display)
@@ -39,6 +269,13 @@ tw_layers_manager_init(struct tw_layers_manager *manager,
 	wl_list_init(&manager->views);
 	wl_list_init(&manager->destroy_listener.link);
 	tw_layer_init(&manager->cursor_layer);
+	wl_array_init(&manager->pick.order);
+	wl_array_init(&manager->pick.offsets);
+	wl_array_init(&manager->pick.cells);
+	manager->serial = 1;
+	manager->pick.serial = 0;
+	manager->pick.moved = false;
+	manager->pick.moving = false;
 
 	manager->display = display;
 	manager->destroy_listener.notify = notify_display_destroy;
@@ -60,6 +297,8 @@ tw_layer_init(struct tw_layer *layer)
 {
 	wl_list_init(&layer->link);
 	wl_list_init(&layer->views);
+	layer->n_views = 0;
+	layer->manager = NULL;
 }
 
 
@@ -72,6 +311,8 @@ tw_layer_set_position(struct tw_layer *layer, enum tw_layer_pos pos,
 	wl_list_remove(&layer->link);
 	wl_list_init(&layer->link);
 	layer->position = pos;
+	layer->manager = manager;
+	tw_layers_manager_dirty(manager);
 
 	//from bottom to top
 	wl_list_for_each_reverse_safe(l, tmp, layers, link) {
@@ -88,4 +329,13 @@ tw_layer_unset_position(struct tw_layer *layer)
 {
 	wl_list_remove(&layer->link);
 	wl_list_init(&layer->link);
+	if (layer->manager)
+		tw_layers_manager_dirty(layer->manager);
+}
+
+WL_EXPORT void
+tw_layer_dirty(struct tw_layer *layer)
+{
+	if (layer->manager)
+		tw_layers_manager_dirty(layer->manager);
 }
@@ -22,29 +22,44 @@
 #ifndef _GNU_SOURCE
 #define _GNU_SOURCE
 #endif
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
-#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
 #include <stdio.h>
-#include <math.h>
 #include <time.h>
 #include <unistd.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <pthread.h>
 #include <wayland-server-core.h>
 
+#include <taiwins/objects/logger.h>
 #include <taiwins/objects/profiler.h>
 
-#define THREAD_ID() (unsigned int)pthread_self()
+/******************************************************************************
+ * trace recorder
+ *
+ * Every thread records into its own ring of fixed size binary events, the
+ * recording thread is the only producer and the flusher thread is the only
+ * consumer, so the rings need no lock. The flusher drains the rings into the
+ * trace file periodically, writing each scope name the first time it sees it.
+ * When a ring is full the events are dropped rather than blocking the
+ * compositor. A ring is freed when its thread exits.
+ *****************************************************************************/
 
-#define MAX_SCOPES 10
+#define TRACE_RING_SIZE 8192 /* power of 2 */
+#define TRACE_NAME_SLOTS 4096 /* power of 2 */
+#define TRACE_FLUSH_MS 100
 
-struct tw_profiler_scope
-{
-	const char *name;
-	long long start_time;
-	long long end_time;
-	unsigned int tid;
+struct trace_ring {
+	struct trace_ring *next;
+	_Atomic uint32_t head; /**< written by the recording thread */
+	_Atomic uint32_t tail; /**< written by the flusher */
+	uint32_t tid;
+	_Atomic uint32_t dropped;
+	struct tw_trace_event events[TRACE_RING_SIZE];
 };
 
 static struct tw_profiler {
@@ -52,63 +67,208 @@ static struct tw_profiler {
 	struct wl_listener display_destroy;
 	FILE *file;
 
-	bool empty;
-	int32_t depth;
-	struct tw_profiler_scope scopes[MAX_SCOPES];
+	_Atomic bool enabled;
+	pthread_mutex_t lock; /**< guards rings and the file */
+	pthread_cond_t cond;
+	pthread_t flusher;
+	bool running;
+	struct trace_ring *rings;
+	//names already written to the file
+	uint64_t names[TRACE_NAME_SLOTS];
+} s_profiler = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
 
-} s_profiler = {0};
+static __thread struct trace_ring *t_ring = NULL;
+static pthread_key_t s_ring_key;
+static pthread_once_t s_ring_key_once = PTHREAD_ONCE_INIT;
 
-static inline void
-write_header(FILE *file)
+static void
+trace_drain_locked(void);
+
+/* the thread is gone, write out what it left and forget its ring */
+static void
+trace_ring_release(void *data)
+{
+	struct trace_ring *ring = data, **p;
+
+	pthread_mutex_lock(&s_profiler.lock);
+	trace_drain_locked();
+	for (p = &s_profiler.rings; *p; p = &(*p)->next) {
+		if (*p == ring) {
+			*p = ring->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&s_profiler.lock);
+	free(ring);
+}
+
+static void
+trace_ring_key_create(void)
+{
+	pthread_key_create(&s_ring_key, trace_ring_release);
+}
+
+static struct trace_ring *
+trace_ring_get(void)
 {
-	fprintf(file, "{\"otherData\": {},\"traceEvents\":[\n");
-	fflush(file);
+	struct trace_ring *ring;
+
+	if (t_ring)
+		return t_ring;
+	pthread_once(&s_ring_key_once, trace_ring_key_create);
+	if (!(ring = calloc(1, sizeof(*ring))))
+		return NULL;
+	ring->tid = (uint32_t)syscall(SYS_gettid);
+
+	pthread_mutex_lock(&s_profiler.lock);
+	ring->next = s_profiler.rings;
+	s_profiler.rings = ring;
+	pthread_mutex_unlock(&s_profiler.lock);
+	pthread_setspecific(s_ring_key, ring);
+	t_ring = ring;
+	return ring;
 }
 
 static inline void
-write_footer(FILE *file)
+trace_record(const char *name, uint8_t phase)
 {
-	fprintf(file, "]}\n");
-	fflush(file);
+	struct timespec spec;
+	struct trace_ring *ring;
+	struct tw_trace_event *event;
+	uint32_t head, tail;
+
+	if (!atomic_load_explicit(&s_profiler.enabled, memory_order_relaxed))
+		return;
+	if (!(ring = trace_ring_get()))
+		return;
+	head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+	if (head - tail >= TRACE_RING_SIZE) {
+		atomic_fetch_add_explicit(&ring->dropped, 1,
+		                          memory_order_relaxed);
+		return;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &spec);
+	event = &ring->events[head & (TRACE_RING_SIZE-1)];
+	event->ts = (uint64_t)spec.tv_sec * 1000000000ULL + spec.tv_nsec;
+	event->name = (uint64_t)(uintptr_t)name;
+	event->tid = ring->tid;
+	event->phase = phase;
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
 }
 
+/* the names are string literals or __func__, their address identifies them */
 static void
-write_start(const struct tw_profiler_scope *scope, FILE *file, bool comma)
+trace_write_name(FILE *file, uint64_t name)
 {
-	if (comma)
-		fprintf(file, ",");
-	fprintf(file, "{");
-	fprintf(file, "\"cat\":\"function\",");
-	fprintf(file, "\"name\":\"%s\",", scope->name);
-	fprintf(file, "\"ph\":\"B\",");
-	fprintf(file, "\"pid\":0,");
-	fprintf(file, "\"tid\":%2u,", scope->tid);
-	fprintf(file, "\"ts\":%lld", scope->start_time);
-	fprintf(file, "}\n");
+	const char *str = (const char *)(uintptr_t)name;
+	uint32_t slot = (uint32_t)((name >> 3) * 0x9e3779b1u);
+	struct tw_trace_event record = {
+		.name = name,
+		.phase = TW_TRACE_NAME,
+	};
+
+	for (int i = 0; i < TRACE_NAME_SLOTS; i++) {
+		uint64_t *entry =
+			&s_profiler.names[(slot + i) & (TRACE_NAME_SLOTS-1)];
+		if (*entry == name)
+			return;
+		if (!*entry) {
+			*entry = name;
+			break;
+		}
+	}
+	//table full, writing it again is harmless
+	record.tid = strlen(str);
+	fwrite(&record, sizeof(record), 1, file);
+	fwrite(str, record.tid, 1, file);
 }
 
 static void
-write_end(const struct tw_profiler_scope *scope, FILE *file, bool comma)
+trace_drain_locked(void)
 {
-	if (comma)
-		fprintf(file, ",");
-	fprintf(file, "{");
-	fprintf(file, "\"cat\":\"function\",");
-	fprintf(file, "\"name\":\"%s\",", scope->name);
-	fprintf(file, "\"ph\":\"E\",");
-	fprintf(file, "\"pid\":0,");
-	fprintf(file, "\"tid\":%2u,", scope->tid);
-	fprintf(file, "\"ts\":%lld", scope->end_time);
-	fprintf(file, "}\n");
+	FILE *file = s_profiler.file;
+
+	for (struct trace_ring *ring = s_profiler.rings; ring;
+	     ring = ring->next) {
+		uint32_t tail = atomic_load_explicit(&ring->tail,
+		                                     memory_order_relaxed);
+		uint32_t head = atomic_load_explicit(&ring->head,
+		                                     memory_order_acquire);
+
+		for (; tail != head; tail++) {
+			struct tw_trace_event *event =
+				&ring->events[tail & (TRACE_RING_SIZE-1)];
+			if (file) {
+				trace_write_name(file, event->name);
+				fwrite(event, sizeof(*event), 1, file);
+			}
+		}
+		atomic_store_explicit(&ring->tail, tail, memory_order_release);
+	}
+	if (file)
+		fflush(file);
 }
 
+static void *
+trace_flusher(void *data)
+{
+	struct timespec deadline;
+
+	pthread_mutex_lock(&s_profiler.lock);
+	while (s_profiler.running) {
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_nsec += TRACE_FLUSH_MS * 1000000L;
+		if (deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_sec += 1;
+			deadline.tv_nsec -= 1000000000L;
+		}
+		pthread_cond_timedwait(&s_profiler.cond, &s_profiler.lock,
+		                       &deadline);
+		trace_drain_locked();
+	}
+	pthread_mutex_unlock(&s_profiler.lock);
+	return NULL;
+}
+
+/******************************************************************************
+ * API
+ *****************************************************************************/
+
 WL_EXPORT void
 tw_profiler_close()
 {
-	write_footer(s_profiler.file);
-	if (s_profiler.file != stdout && s_profiler.file != stderr)
-		fclose(s_profiler.file);
+	FILE *file;
+	struct trace_ring *ring;
+	uint32_t dropped = 0;
+
+	if (!s_profiler.file)
+		return;
+	atomic_store(&s_profiler.enabled, false);
+	pthread_mutex_lock(&s_profiler.lock);
+	s_profiler.running = false;
+	pthread_cond_signal(&s_profiler.cond);
+	pthread_mutex_unlock(&s_profiler.lock);
+	pthread_join(s_profiler.flusher, NULL);
+
+	//exiting threads drain and unlink their rings under the lock as well
+	pthread_mutex_lock(&s_profiler.lock);
+	trace_drain_locked();
+	//rings live as long as their threads, they are reused by the next
+	//trace and freed at thread exit
+	for (ring = s_profiler.rings; ring; ring = ring->next)
+		dropped += atomic_exchange(&ring->dropped, 0);
+	file = s_profiler.file;
 	s_profiler.file = NULL;
+	pthread_mutex_unlock(&s_profiler.lock);
+	if (dropped)
+		tw_logl_level(TW_LOG_WARN, "trace dropped %u events", dropped);
+
+	if (file != stdout && file != stderr)
+		fclose(file);
 }
 
 static void
@@ -122,16 +282,28 @@ notify_profile_display_destroy(struct wl_listener *listener, void *data)
 WL_EXPORT bool
 tw_profiler_open(struct wl_display *display, const char *fname)
 {
-	FILE *file = fopen(fname, "w");
-	if (!file)
-		return false;
-	if (s_profiler.file && s_profiler.file != stdout &&
-	    s_profiler.file != stderr)
-		fclose(s_profiler.file);
+	FILE *file;
+	struct tw_trace_header header = {
+		.magic = TW_TRACE_MAGIC,
+		.version = TW_TRACE_VERSION,
+	};
 
+	tw_profiler_close();
+	if (!(file = fopen(fname, "wb")))
+		return false;
+	if (fwrite(&header, sizeof(header), 1, file) != 1) {
+		fclose(file);
+		return false;
+	}
 	s_profiler.file = file;
-	s_profiler.empty = true;
-	s_profiler.display = display;
+	memset(s_profiler.names, 0, sizeof(s_profiler.names));
+	s_profiler.running = true;
+	if (pthread_create(&s_profiler.flusher, NULL, trace_flusher, NULL)) {
+		s_profiler.running = false;
+		s_profiler.file = NULL;
+		fclose(file);
+		return false;
+	}
 
 	if (!s_profiler.display) {
 		s_profiler.display = display;
@@ -141,47 +313,35 @@ tw_profiler_open(struct wl_display *display, const char *fname)
 		wl_display_add_destroy_listener(display,
 		                                &s_profiler.display_destroy);
 	}
-	write_header(file);
 	return true;
 }
 
 WL_EXPORT void
-tw_profiler_start_timer(const char *name)
+tw_profiler_enable(bool enable)
 {
-	struct timespec spec;
-	struct tw_profiler_scope *scope;
+	atomic_store(&s_profiler.enabled, enable && s_profiler.file);
+}
 
-        assert(s_profiler.depth < MAX_SCOPES);
-        scope = &s_profiler.scopes[s_profiler.depth];
-        scope->name = name;
-        scope->tid = THREAD_ID();
-	clock_gettime(CLOCK_MONOTONIC, &spec);
-	scope->start_time = (spec.tv_sec*1000000 + spec.tv_nsec/1000);
-	write_start(scope, s_profiler.file, !s_profiler.empty);
-	s_profiler.empty = false;
-	s_profiler.depth+=1;
+WL_EXPORT bool
+tw_profiler_enabled(void)
+{
+	return atomic_load(&s_profiler.enabled);
 }
 
 WL_EXPORT void
-tw_profiler_stop_timer(const char *name)
+tw_profiler_start_timer(const char *name)
 {
-	int32_t depth = s_profiler.depth-1;
-	struct tw_profiler_scope *scope;
-	struct timespec spec;
+	trace_record(name, TW_TRACE_BEGIN);
+}
 
-	assert(depth >= 0);
-	assert(s_profiler.scopes[depth].name == name);
-	s_profiler.depth-=1;
-	scope = &s_profiler.scopes[depth];
-	clock_gettime(CLOCK_MONOTONIC, &spec);
-	scope->end_time = (spec.tv_sec*1000000 + spec.tv_nsec/1000);
-	write_end(scope, s_profiler.file, !s_profiler.empty);
-	s_profiler.empty = false;
+WL_EXPORT void
+tw_profiler_stop_timer(const char *name)
+{
+	trace_record(name, TW_TRACE_END);
 }
 
 WL_EXPORT void
 tw_profiler_timestamp(const char *name)
 {
-	tw_profiler_start_timer(name);
-	tw_profiler_stop_timer(name);
+	trace_record(name, TW_TRACE_INSTANT);
 }
@@ -0,0 +1,434 @@
+/*
+ * recorder.c - taiwins wayland protocol session recorder
+ *
+ * Copyright (c) 2021 Xichen Zhou
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <wayland-server-core.h>
+#include <wayland-server-protocol.h>
+#include <wayland-util.h>
+
+#include <taiwins/objects/logger.h>
+#include <taiwins/objects/utils.h>
+#include <taiwins/objects/surface.h>
+#include <taiwins/objects/recorder.h>
+
+/******************************************************************************
+ * protocol recorder
+ *
+ * The protocol logger sees every request after its objects are resolved and
+ * before it is dispatched, so a wl_surface.commit still has its buffer
+ * attached in the pending state. The recorder keeps a shadow copy of every shm
+ * buffer it has seen and writes out the rows the client changed since, that is
+ * the content the compositor reads for the commit.
+ *****************************************************************************/
+
+struct tw_protocol_recorder {
+	struct wl_display *display;
+	struct wl_protocol_logger *logger;
+	FILE *file;
+	struct timespec start;
+	uint16_t next_client;
+
+	struct wl_list clients;
+	struct wl_list buffers;
+	struct wl_array payload;
+	struct wl_listener display_destroy;
+};
+
+struct recorder_client {
+	struct tw_protocol_recorder *recorder;
+	struct wl_list link;
+	struct wl_listener destroy;
+	uint16_t id;
+};
+
+struct recorder_buffer {
+	struct wl_list link;
+	struct wl_listener destroy;
+	int32_t width, height, stride;
+	uint8_t *shadow;
+};
+
+static void
+recorder_write(struct tw_protocol_recorder *recorder, uint16_t type,
+               uint16_t client, const void *payload, size_t size)
+{
+	struct timespec now;
+	struct tw_session_record record = {
+		.size = size,
+		.type = type,
+		.client = client,
+	};
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	record.ts = tw_timespec_diff_ns(&now, &recorder->start);
+	fwrite(&record, sizeof(record), 1, recorder->file);
+	if (size)
+		fwrite(payload, size, 1, recorder->file);
+}
+
+static inline void
+payload_add(struct wl_array *payload, const void *data, size_t size)
+{
+	void *dst = wl_array_add(payload, size);
+	if (dst)
+		memcpy(dst, data, size);
+}
+
+static inline void
+payload_add_u32(struct wl_array *payload, uint32_t value)
+{
+	payload_add(payload, &value, sizeof(value));
+}
+
+/******************************************************************************
+ * clients
+ *****************************************************************************/
+
+static void
+notify_recorder_client_destroy(struct wl_listener *listener, void *data)
+{
+	struct recorder_client *client =
+		wl_container_of(listener, client, destroy);
+
+	recorder_write(client->recorder, TW_SESSION_CLIENT_GONE, client->id,
+	               NULL, 0);
+	wl_list_remove(&client->destroy.link);
+	wl_list_remove(&client->link);
+	free(client);
+}
+
+static struct recorder_client *
+recorder_client_get(struct tw_protocol_recorder *recorder,
+                    struct wl_client *wl_client)
+{
+	struct wl_listener *listener =
+		wl_client_get_destroy_listener(wl_client,
+		                               notify_recorder_client_destroy);
+	struct recorder_client *client;
+	char name[64], path[64];
+	FILE *comm;
+	pid_t pid;
+
+	if (listener)
+		return wl_container_of(listener, client, destroy);
+	if (!(client = calloc(1, sizeof(*client))))
+		return NULL;
+	client->recorder = recorder;
+	client->id = ++recorder->next_client;
+	client->destroy.notify = notify_recorder_client_destroy;
+	wl_client_add_destroy_listener(wl_client, &client->destroy);
+	wl_list_insert(recorder->clients.prev, &client->link);
+
+	wl_client_get_credentials(wl_client, &pid, NULL, NULL);
+	snprintf(name, sizeof(name), "pid %d", (int)pid);
+	snprintf(path, sizeof(path), "/proc/%d/comm", (int)pid);
+	if ((comm = fopen(path, "r"))) {
+		if (fgets(name, sizeof(name), comm))
+			name[strcspn(name, "\n")] = '\0';
+		fclose(comm);
+	}
+	recorder_write(recorder, TW_SESSION_CLIENT, client->id, name,
+	               strlen(name) + 1);
+	return client;
+}
+
+/******************************************************************************
+ * shm snapshots
+ *****************************************************************************/
+
+static void
+notify_recorder_buffer_destroy(struct wl_listener *listener, void *data)
+{
+	struct recorder_buffer *buffer =
+		wl_container_of(listener, buffer, destroy);
+
+	wl_list_remove(&buffer->destroy.link);
+	wl_list_remove(&buffer->link);
+	free(buffer->shadow);
+	free(buffer);
+}
+
+static struct recorder_buffer *
+recorder_buffer_get(struct tw_protocol_recorder *recorder,
+                    struct wl_resource *resource)
+{
+	struct wl_listener *listener =
+		wl_resource_get_destroy_listener(resource,
+		                                 notify_recorder_buffer_destroy);
+	struct recorder_buffer *buffer;
+
+	if (listener)
+		return wl_container_of(listener, buffer, destroy);
+	if (!(buffer = calloc(1, sizeof(*buffer))))
+		return NULL;
+	buffer->destroy.notify = notify_recorder_buffer_destroy;
+	wl_resource_add_destroy_listener(resource, &buffer->destroy);
+	wl_list_insert(recorder->buffers.prev, &buffer->link);
+	return buffer;
+}
+
+static void
+recorder_add_span(struct wl_array *payload, struct recorder_buffer *buffer,
+                  const uint8_t *data, int32_t first, int32_t end)
+{
+	size_t offset = (size_t)first * buffer->stride;
+	size_t size = (size_t)(end - first) * buffer->stride;
+
+	memcpy(buffer->shadow + offset, data + offset, size);
+	payload_add_u32(payload, first);
+	payload_add_u32(payload, end - first);
+	payload_add(payload, data + offset, size);
+	//span count, the array may have moved
+	((uint32_t *)payload->data)[5]++;
+}
+
+static void
+recorder_snapshot_shm(struct tw_protocol_recorder *recorder,
+                      struct recorder_client *client,
+                      struct wl_resource *resource)
+{
+	struct wl_shm_buffer *shm = wl_shm_buffer_get(resource);
+	struct recorder_buffer *buffer;
+	struct wl_array *payload = &recorder->payload;
+	int32_t width, height, stride;
+	const uint8_t *data;
+
+	if (!shm || !(buffer = recorder_buffer_get(recorder, resource)))
+		return;
+	width = wl_shm_buffer_get_width(shm);
+	height = wl_shm_buffer_get_height(shm);
+	stride = wl_shm_buffer_get_stride(shm);
+	//the buffer changed its size, start over
+	if (!buffer->shadow || buffer->stride != stride ||
+	    buffer->height != height) {
+		free(buffer->shadow);
+		buffer->shadow = NULL;
+		buffer->width = width;
+		buffer->height = height;
+		buffer->stride = stride;
+	}
+
+	payload->size = 0;
+	payload_add_u32(payload, wl_resource_get_id(resource));
+	payload_add_u32(payload, width);
+	payload_add_u32(payload, height);
+	payload_add_u32(payload, stride);
+	payload_add_u32(payload, wl_shm_buffer_get_format(shm));
+	payload_add_u32(payload, 0);
+
+	wl_shm_buffer_begin_access(shm);
+	data = wl_shm_buffer_get_data(shm);
+	//the first snapshot of a buffer writes all the rows
+	if (!buffer->shadow &&
+	    (buffer->shadow = malloc((size_t)stride * height)))
+		recorder_add_span(payload, buffer, data, 0, height);
+	for (int32_t y = 0; buffer->shadow && y < height; ) {
+		int32_t first;
+
+		if (!memcmp(buffer->shadow + (size_t)y * stride,
+		            data + (size_t)y * stride, stride)) {
+			y++;
+			continue;
+		}
+		for (first = y++; y < height; y++)
+			if (!memcmp(buffer->shadow + (size_t)y * stride,
+			            data + (size_t)y * stride, stride))
+				break;
+		recorder_add_span(payload, buffer, data, first, y);
+	}
+	wl_shm_buffer_end_access(shm);
+
+	if (((uint32_t *)payload->data)[5])
+		recorder_write(recorder, TW_SESSION_SHM, client->id,
+		               payload->data, payload->size);
+}
+
+/******************************************************************************
+ * requests
+ *****************************************************************************/
+
+static void
+recorder_add_arguments(struct wl_array *payload,
+                       const struct wl_protocol_logger_message *message)
+{
+	const char *sig = message->message->signature;
+	int i = 0;
+
+	for (; *sig && i < message->arguments_count; sig++) {
+		const union wl_argument *arg = &message->arguments[i];
+		struct stat st;
+		char type = *sig;
+
+		if (type == '?' || (type >= '0' && type <= '9'))
+			continue;
+		payload_add(payload, &type, 1);
+		switch (type) {
+		case 'i':
+		case 'u':
+		case 'f':
+		case 'n':
+			payload_add_u32(payload, arg->u);
+			break;
+		case 'o':
+			payload_add_u32(payload, arg->o ?
+			                wl_resource_get_id(
+				                (struct wl_resource *)arg->o) : 0);
+			break;
+		case 's':
+			payload_add_u32(payload, arg->s ? strlen(arg->s) + 1 : 0);
+			if (arg->s)
+				payload_add(payload, arg->s, strlen(arg->s) + 1);
+			break;
+		case 'a':
+			payload_add_u32(payload, arg->a ? arg->a->size : 0);
+			if (arg->a && arg->a->size)
+				payload_add(payload, arg->a->data,
+				            arg->a->size);
+			break;
+		case 'h':
+			payload_add_u32(payload, fstat(arg->h, &st) == 0 ?
+			                (uint32_t)st.st_size : 0);
+			break;
+		}
+		i++;
+	}
+}
+
+static void
+handle_recorder_log(void *user_data, enum wl_protocol_logger_type direction,
+                    const struct wl_protocol_logger_message *message)
+{
+	struct tw_protocol_recorder *recorder = user_data;
+	struct wl_resource *resource = message->resource;
+	struct wl_array *payload = &recorder->payload;
+	struct recorder_client *client;
+
+	if (direction != WL_PROTOCOL_LOGGER_REQUEST)
+		return;
+	client = recorder_client_get(recorder,
+	                             wl_resource_get_client(resource));
+	if (!client)
+		return;
+	if (!strcmp(wl_resource_get_class(resource), "wl_surface") &&
+	    !strcmp(message->message->name, "commit")) {
+		struct tw_surface *surface =
+			tw_surface_from_resource(resource);
+		struct tw_view *pending = surface->pending;
+
+		if ((pending->commit_state & TW_SURFACE_ATTACHED) &&
+		    pending->buffer_resource)
+			recorder_snapshot_shm(recorder, client,
+			                      pending->buffer_resource);
+	}
+
+	payload->size = 0;
+	payload_add_u32(payload, wl_resource_get_id(resource));
+	payload_add_u32(payload, message->message_opcode);
+	recorder_add_arguments(payload, message);
+	recorder_write(recorder, TW_SESSION_REQUEST, client->id,
+	               payload->data, payload->size);
+}
+
+/******************************************************************************
+ * APIs
+ *****************************************************************************/
+
+static void
+notify_recorder_display_destroy(struct wl_listener *listener, void *data)
+{
+	struct tw_protocol_recorder *recorder =
+		wl_container_of(listener, recorder, display_destroy);
+	tw_protocol_recorder_destroy(recorder);
+}
+
+WL_EXPORT struct tw_protocol_recorder *
+tw_protocol_recorder_create(struct wl_display *display, const char *path)
+{
+	struct tw_session_header header = {
+		.magic = TW_SESSION_MAGIC,
+		.version = TW_SESSION_VERSION,
+	};
+	struct tw_protocol_recorder *recorder = calloc(1, sizeof(*recorder));
+	int fd;
+
+	if (!recorder)
+		return NULL;
+	//client content and text are in there, only the user may read them
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd < 0 || !(recorder->file = fdopen(fd, "wb"))) {
+		tw_logl_level(TW_LOG_ERRO, "failed to open session %s", path);
+		if (fd >= 0)
+			close(fd);
+		free(recorder);
+		return NULL;
+	}
+	recorder->logger =
+		wl_display_add_protocol_logger(display, handle_recorder_log,
+		                               recorder);
+	if (!recorder->logger) {
+		fclose(recorder->file);
+		free(recorder);
+		return NULL;
+	}
+	tw_logl_level(TW_LOG_WARN, "recording the client requests to %s, "
+	              "including their buffers and text", path);
+	fwrite(&header, sizeof(header), 1, recorder->file);
+	recorder->display = display;
+	clock_gettime(CLOCK_MONOTONIC, &recorder->start);
+	wl_list_init(&recorder->clients);
+	wl_list_init(&recorder->buffers);
+	wl_array_init(&recorder->payload);
+	tw_set_display_destroy_listener(display, &recorder->display_destroy,
+	                                notify_recorder_display_destroy);
+	return recorder;
+}
+
+WL_EXPORT void
+tw_protocol_recorder_destroy(struct tw_protocol_recorder *recorder)
+{
+	struct recorder_client *client, *ctmp;
+	struct recorder_buffer *buffer, *btmp;
+
+	wl_protocol_logger_destroy(recorder->logger);
+	wl_list_remove(&recorder->display_destroy.link);
+	wl_list_for_each_safe(client, ctmp, &recorder->clients, link) {
+		wl_list_remove(&client->destroy.link);
+		wl_list_remove(&client->link);
+		free(client);
+	}
+	wl_list_for_each_safe(buffer, btmp, &recorder->buffers, link) {
+		wl_list_remove(&buffer->destroy.link);
+		wl_list_remove(&buffer->link);
+		free(buffer->shadow);
+		free(buffer);
+	}
+	wl_array_release(&recorder->payload);
+	fclose(recorder->file);
+	free(recorder);
+}
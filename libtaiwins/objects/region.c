@@ -20,11 +20,13 @@
  */
 
 #include <assert.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <wayland-server-core.h>
 #include <wayland-server-protocol.h>
 #include <wayland-server.h>
 
+#include <ctypes/helpers.h>
 #include <taiwins/objects/surface.h>
 #include <taiwins/objects/utils.h>
 
@@ -100,3 +102,150 @@ tw_region_create(struct wl_client *client, uint32_t ver, uint32_t id,
 	pixman_region32_init(&tw_region->region);
 	return tw_region;
 }
+
+WL_EXPORT void
+tw_region_reset(pixman_region32_t *region)
+{
+	//a region with no rects is empty to pixman, clear would free the boxes
+	if (region->data && region->data->size) {
+		region->data->numRects = 0;
+		region->extents = (pixman_box32_t){0, 0, 0, 0};
+	} else {
+		pixman_region32_clear(region);
+	}
+}
+
+/******************************************************************************
+ * region simplification
+ *
+ * Pixman regions are y-x banded, a few overlapping rectangles easily break into
+ * dozens of thin boxes, each one costs a draw or a clear. The boxes are merged
+ * greedily as long as the extra area is cheaper than the rectangle it saves.
+ *****************************************************************************/
+
+static inline int64_t
+box_area(const pixman_box32_t *box)
+{
+	return (int64_t)(box->x2 - box->x1) * (box->y2 - box->y1);
+}
+
+static inline void
+box_union(pixman_box32_t *dst, const pixman_box32_t *a,
+          const pixman_box32_t *b)
+{
+	dst->x1 = MIN(a->x1, b->x1);
+	dst->y1 = MIN(a->y1, b->y1);
+	dst->x2 = MAX(a->x2, b->x2);
+	dst->y2 = MAX(a->y2, b->y2);
+}
+
+static inline bool
+box_overlap(const pixman_box32_t *a, const pixman_box32_t *b)
+{
+	return a->x1 < b->x2 && b->x1 < a->x2 &&
+		a->y1 < b->y2 && b->y1 < a->y2;
+}
+
+static int64_t
+region_cost(pixman_region32_t *region, uint32_t rect_cost)
+{
+	int n;
+	int64_t cost = 0;
+	pixman_box32_t *boxes = pixman_region32_rectangles(region, &n);
+
+	for (int i = 0; i < n; i++)
+		cost += box_area(&boxes[i]) + rect_cost;
+	return cost;
+}
+
+#define TW_REGION_SIMPLIFY_STACK_BOXES 64
+
+/* merge the box into the cheapest one in the list, a grown box swallows the
+ * ones it overlaps so the list stays disjoint. Return the new count */
+static int
+boxes_add_merged(pixman_box32_t *boxes, int m, pixman_box32_t box,
+                 uint32_t rect_cost)
+{
+	int best = -1;
+	int64_t delta, best_delta = rect_cost;
+	pixman_box32_t merged;
+
+	for (int j = 0; j < m; j++) {
+		box_union(&merged, &boxes[j], &box);
+		delta = box_area(&merged) - box_area(&boxes[j]) -
+			box_area(&box);
+		if (delta < best_delta) {
+			best = j;
+			best_delta = delta;
+		}
+	}
+	if (best < 0) {
+		boxes[m++] = box;
+		return m;
+	}
+	box_union(&box, &boxes[best], &box);
+	boxes[best] = boxes[--m];
+	for (int j = 0; j < m; j++) {
+		if (box_overlap(&boxes[j], &box)) {
+			box_union(&box, &boxes[j], &box);
+			boxes[j] = boxes[--m];
+			j = -1;
+		}
+	}
+	boxes[m++] = box;
+	return m;
+}
+
+WL_EXPORT void
+tw_region_simplify(pixman_region32_t *dst, pixman_region32_t *src,
+                   unsigned int max_rects, uint32_t rect_cost)
+{
+	int n, m = 0;
+	pixman_box32_t *boxes = pixman_region32_rectangles(src, &n);
+	pixman_box32_t stack[TW_REGION_SIMPLIFY_STACK_BOXES];
+	pixman_box32_t *merged = stack;
+	pixman_region32_t result;
+
+	if (n <= 1) {
+		pixman_region32_copy(dst, src);
+		return;
+	}
+	//this runs every frame, the heap only for unusually broken damage
+	if (n > TW_REGION_SIMPLIFY_STACK_BOXES &&
+	    !(merged = malloc(n * sizeof(*merged)))) {
+		pixman_box32_t extents = *pixman_region32_extents(src);
+
+		if ((unsigned)n > max_rects) {
+			pixman_region32_fini(dst);
+			pixman_region32_init_with_extents(dst, &extents);
+		} else {
+			pixman_region32_copy(dst, src);
+		}
+		return;
+	}
+	for (int i = 0; i < n; i++)
+		m = boxes_add_merged(merged, m, boxes[i], rect_cost);
+	//nothing merged, the boxes are the ones of src
+	if (m == n && (unsigned)n <= max_rects) {
+		pixman_region32_copy(dst, src);
+		goto out;
+	}
+	pixman_region32_init_rects(&result, merged, m);
+
+	//banding the merged boxes may split them again
+	if ((unsigned)pixman_region32_n_rects(&result) > max_rects) {
+		pixman_region32_fini(&result);
+		pixman_region32_init_with_extents(&result,
+		                                  pixman_region32_extents(src));
+	} else if ((unsigned)n <= max_rects &&
+	           region_cost(&result, rect_cost) >=
+	           region_cost(src, rect_cost)) {
+		//not worth it
+		pixman_region32_copy(&result, src);
+	}
+	pixman_region32_copy(dst, &result);
+	pixman_region32_fini(&result);
+out:
+	if (merged != stack)
+		free(merged);
+}
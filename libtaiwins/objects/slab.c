@@ -0,0 +1,179 @@
+/*
+ * slab.c - taiwins fixed size object allocator
+ *
+ * Copyright (c) 2021 Xichen Zhou
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <wayland-server-core.h>
+#include <ctypes/helpers.h>
+#include <taiwins/objects/utils.h>
+
+#include <taiwins/objects/slab.h>
+
+/* pages are aligned to their size, an object finds its page by masking */
+struct tw_slab_page {
+	struct wl_list link;
+	struct tw_slab *slab;
+	void *free; /**< freed objects, linked through their first word */
+	unsigned int live;
+	unsigned int unused; /**< objects never handed out start here */
+};
+
+#define SLAB_HEADER_SIZE \
+	((sizeof(struct tw_slab_page) + TW_SLAB_ALIGN - 1) & \
+	 ~(size_t)(TW_SLAB_ALIGN - 1))
+
+static inline struct tw_slab_page *
+slab_page_of(void *ptr)
+{
+	return (struct tw_slab_page *)
+		((uintptr_t)ptr & ~(uintptr_t)(TW_SLAB_PAGE_SIZE - 1));
+}
+
+static struct tw_slab_page *
+slab_new_page(struct tw_slab *slab)
+{
+	struct tw_slab_page *page =
+		aligned_alloc(TW_SLAB_PAGE_SIZE, TW_SLAB_PAGE_SIZE);
+
+	if (!page)
+		return NULL;
+	page->slab = slab;
+	page->free = NULL;
+	page->live = 0;
+	page->unused = 0;
+	wl_list_insert(&slab->pages, &page->link);
+	slab->stats.pages++;
+	return page;
+}
+
+static void
+slab_release_page(struct tw_slab *slab, struct tw_slab_page *page)
+{
+	wl_list_remove(&page->link);
+	slab->stats.pages--;
+	free(page);
+}
+
+WL_EXPORT void
+tw_slab_init(struct tw_slab *slab, size_t size, const char *name)
+{
+	size = size ? size : 1;
+	slab->name = name;
+	slab->size = (size + TW_SLAB_ALIGN - 1) & ~(size_t)(TW_SLAB_ALIGN - 1);
+	slab->per_page = (TW_SLAB_PAGE_SIZE - SLAB_HEADER_SIZE) / slab->size;
+	assert(slab->per_page > 0);
+	slab->spare = NULL;
+	wl_list_init(&slab->pages);
+	memset(&slab->stats, 0, sizeof(slab->stats));
+	slab->sample.ops = 0;
+	clock_gettime(CLOCK_MONOTONIC, &slab->sample.ts);
+}
+
+WL_EXPORT void
+tw_slab_fini(struct tw_slab *slab)
+{
+	struct tw_slab_page *page, *tmp;
+
+	wl_list_for_each_safe(page, tmp, &slab->pages, link)
+		slab_release_page(slab, page);
+	slab->spare = NULL;
+}
+
+WL_EXPORT void *
+tw_slab_alloc(struct tw_slab *slab)
+{
+	struct tw_slab_page *page = NULL;
+	void *obj;
+
+	if (!wl_list_empty(&slab->pages))
+		page = wl_container_of(slab->pages.next, page, link);
+	if (!page || page->live == slab->per_page)
+		page = slab_new_page(slab);
+	if (!page)
+		return NULL;
+	if (page == slab->spare)
+		slab->spare = NULL;
+
+	if (page->free) {
+		obj = page->free;
+		page->free = *(void **)obj;
+	} else {
+		obj = (char *)page + SLAB_HEADER_SIZE +
+			(size_t)page->unused++ * slab->size;
+	}
+	//full pages go to the back, the front one always has room
+	if (++page->live == slab->per_page) {
+		wl_list_remove(&page->link);
+		wl_list_insert(slab->pages.prev, &page->link);
+	}
+	slab->stats.allocs++;
+	slab->stats.live++;
+	slab->stats.peak = MAX(slab->stats.peak, slab->stats.live);
+	memset(obj, 0, slab->size);
+	return obj;
+}
+
+WL_EXPORT void
+tw_slab_free(struct tw_slab *slab, void *ptr)
+{
+	struct tw_slab_page *page;
+
+	if (!ptr)
+		return;
+	page = slab_page_of(ptr);
+	assert(page->slab == slab);
+	assert(page->live > 0);
+
+	*(void **)ptr = page->free;
+	page->free = ptr;
+	page->live--;
+	slab->stats.frees++;
+	slab->stats.live--;
+
+	//keep one empty page, a surface created right after does not need a
+	//new one
+	if (!page->live && slab->spare && slab->spare != page) {
+		slab_release_page(slab, page);
+		return;
+	} else if (!page->live) {
+		slab->spare = page;
+	}
+	wl_list_remove(&page->link);
+	wl_list_insert(&slab->pages, &page->link);
+}
+
+WL_EXPORT void
+tw_slab_sample_stats(struct tw_slab *slab, struct tw_slab_stats *stats)
+{
+	struct timespec now;
+	uint64_t ops = slab->stats.allocs + slab->stats.frees;
+	int64_t us;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	us = tw_timespec_diff_us(&now, &slab->sample.ts);
+	slab->stats.churn = us > 0 ?
+		(double)(ops - slab->sample.ops) * 1e6 / us : 0.0;
+	slab->sample.ops = ops;
+	slab->sample.ts = now;
+	*stats = slab->stats;
+}
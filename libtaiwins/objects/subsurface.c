@@ -294,6 +294,9 @@ tw_subsurface_init(struct tw_subsurface *sub, struct wl_resource *resource,
 WL_EXPORT void
 tw_subsurface_hide(struct tw_subsurface *subsurface)
 {
+	//leaving the parent stacking
+	if (subsurface->surface && !wl_list_empty(&subsurface->parent_link))
+		tw_surface_dirty_geometry(subsurface->surface);
 	subsurface->parent = NULL;
 	tw_reset_wl_list(&subsurface->parent_link);
 	tw_reset_wl_list(&subsurface->parent_pending_link);
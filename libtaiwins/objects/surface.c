@@ -33,6 +33,7 @@
 #include <taiwins/objects/utils.h>
 #include <taiwins/objects/surface.h>
 #include <taiwins/objects/subsurface.h>
+#include "probes.h"
 
 #define CALLBACK_VERSION 1
 #define SURFACE_VERSION 4
@@ -307,6 +308,15 @@ surface_update_buffer(struct tw_surface *surface)
 	struct wl_resource *resource = surface->current->buffer_resource;
 	pixman_region32_t *damage = &surface->current->buffer_damage;
 
+	//importer has not read the buffer yet and nothing new is attached,
+	//carry the buffer over.
+	if (surface->buffer.deferred &&
+	    !(surface->current->commit_state & TW_SURFACE_ATTACHED)) {
+		surface->current->buffer_resource =
+			surface->previous->buffer_resource;
+		surface->previous->buffer_resource = NULL;
+		return;
+	}
 	if (surface->previous->buffer_resource) {
 		assert(surface->buffer.resource ==
 		       surface->previous->buffer_resource);
@@ -343,8 +353,9 @@ surface_update_buffer(struct tw_surface *surface)
 		surface_build_buffer_matrix(surface);
 		surface_to_buffer_damage(surface);
 	}
-	//release the buffer now.
-	if (surface->buffer.resource) {
+	//release the buffer now, unless the importer reads it later, then it is
+	//released either by importer or by the next commit.
+	if (surface->buffer.resource && !surface->buffer.deferred) {
 		tw_surface_buffer_release(&surface->buffer);
 		surface->current->buffer_resource = NULL;
 	}
@@ -516,6 +527,8 @@ subsurface_append_to_parent(struct tw_subsurface *subsurface)
 		tw_reset_wl_list(&subsurface->parent_link);
 		wl_list_insert(subsurface->parent->subsurfaces.prev,
 		               &subsurface->parent_link);
+		//stacking changed
+		tw_surface_dirty_geometry(subsurface->surface);
 	}
 }
 
@@ -558,6 +571,7 @@ surface_commit(struct wl_client *client,
 	struct tw_subsurface *subsurface;
 	struct tw_surface *surface = tw_surface_from_resource(resource);
 
+	TW_PROBE1(surface_commit, surface);
 	if (tw_surface_is_subsurface(surface, false))
 		committed = surface_commit_as_subsurface(surface, false);
 	else
@@ -572,6 +586,7 @@ surface_commit(struct wl_client *client,
 		subsurface_commit_for_parent(subsurface, committed);
 
 	wl_signal_emit(&surface->signals.commit, surface);
+	TW_PROBE2(surface_commit_done, surface, committed);
 }
 
 static const struct wl_surface_interface surface_impl = {
@@ -793,6 +808,8 @@ tw_surface_create(struct wl_client *client, uint32_t ver, uint32_t id,
 #endif
 
 	wl_list_init(&surface->buffer.surface_destroy_listener.link);
+	wl_list_init(&surface->buffer.resource_destroy_listener.link);
+	wl_list_init(&surface->buffer.deferred_link);
 	wl_list_init(&surface->subsurfaces);
 	wl_list_init(&surface->subsurfaces_pending);
 	wl_list_init(&surface->frame_callbacks);
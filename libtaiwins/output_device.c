@@ -221,6 +221,16 @@ tw_output_device_loc_to_global(const struct tw_output_device *output,
 	*gy = output->current.gy + y * height;
 }
 
+WL_EXPORT void
+tw_output_device_get_time(const struct tw_output_device *device,
+                          struct timespec *now)
+{
+	if (device->impl && device->impl->now)
+		device->impl->now((struct tw_output_device *)device, now);
+	else
+		clock_gettime(device->clk_id, now);
+}
+
 WL_EXPORT void
 tw_output_device_raw_resolution(const struct tw_output_device *device,
                                 unsigned *width, unsigned *height)
@@ -38,6 +38,9 @@
 extern "C" {
 #endif
 
+/* number of pixel unpack buffers we cycle through for uploading */
+#define TW_EGL_UPLOAD_PBO_CNT 4
+
 struct tw_egl_render_context {
 	struct tw_render_context base;
 	struct tw_egl egl;
@@ -52,12 +55,47 @@ struct tw_egl_render_context {
 		PFNGLPOPDEBUGGROUPKHRPROC glPopDebugGroupKHR;
 		PFNGLPUSHDEBUGGROUPKHRPROC glPushDebugGroupKHR;
 	} funcs;
+
+	/* shm upload engine, context is made current once for all the
+	 * uploads between begin_upload and end_upload */
+	struct {
+		unsigned int depth; /**< nested begin_upload calls */
+		bool was_current; /**< context was current at begin_upload */
+		bool deferred; /**< upload shm buffers at repaint */
+		bool use_pbo; /**< pixel unpack buffers require GLES 3 */
+		GLuint pbos[TW_EGL_UPLOAD_PBO_CNT];
+		unsigned int pbo_head;
+		struct wl_array boxes; /**< scratch for coalesced damage */
+		struct wl_list pending; /**< tw_surface_buffer:deferred_link */
+	} upload;
 };
 
 bool
 tw_egl_render_context_import_buffer(struct tw_event_buffer_uploading *event,
                                     void *callback);
 
+void
+tw_egl_render_context_begin_upload(struct tw_egl_render_context *ctx);
+
+void
+tw_egl_render_context_end_upload(struct tw_egl_render_context *ctx);
+
+void
+tw_egl_render_context_fini_upload(struct tw_egl_render_context *ctx);
+
+/* program binary cache, all of them require a current context */
+bool
+tw_egl_program_cache_enabled(void);
+
+uint64_t
+tw_egl_program_cache_key(GLsizei count, const GLchar **vs_srcs,
+                         const GLchar **fs_srcs);
+GLuint
+tw_egl_program_cache_load(uint64_t key);
+
+void
+tw_egl_program_cache_store(uint64_t key, GLuint prog);
+
 void
 tw_gles_debug_push(struct tw_egl_render_context *ctx, const char *func);
 
@@ -0,0 +1,234 @@
+/*
+ * program_cache.c - taiwins egl program binary cache
+ *
+ * Copyright (c) 2021 Xichen Zhou
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+#include <GLES3/gl3.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <ctypes/os/file.h>
+#include <taiwins/objects/logger.h>
+
+#include "internal.h"
+
+/******************************************************************************
+ * program binary cache
+ *
+ * Linked programs are stored in $XDG_CACHE_HOME/taiwins/shaders, each program
+ * in its own file named by the key. The key hashes the driver
+ * vendor/renderer/version strings along with the shader sources, a driver
+ * update simply misses the cache. Any failure falls back to compiling.
+ *****************************************************************************/
+
+#define PROGRAM_CACHE_MAGIC 0x54575047 /* TWPG */
+#define PROGRAM_CACHE_VERSION 1
+
+struct program_cache_header {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t key;
+	uint32_t format;
+	uint32_t length;
+};
+
+static struct {
+	bool initialized;
+	bool enabled;
+	uint64_t driver_hash;
+	char dir[PATH_MAX - 32]; /* leave room for the file names */
+} program_cache = {0};
+
+static inline uint64_t
+fnv1a_hash(uint64_t hash, const char *str)
+{
+	for (const char *c = str; c && *c; c++) {
+		hash ^= (unsigned char)*c;
+		hash *= 0x100000001b3ULL;
+	}
+	//separator, so "ab"+"c" differs from "a"+"bc"
+	hash ^= 0xff;
+	hash *= 0x100000001b3ULL;
+	return hash;
+}
+
+static bool
+program_cache_init_dir(void)
+{
+	const char *xdg_cache = getenv("XDG_CACHE_HOME");
+	const char *home = getenv("HOME");
+	mode_t mode = S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH;
+
+	if (xdg_cache && *xdg_cache)
+		snprintf(program_cache.dir, sizeof(program_cache.dir),
+		         "%s/taiwins/shaders", xdg_cache);
+	else if (home && *home)
+		snprintf(program_cache.dir, sizeof(program_cache.dir),
+		         "%s/.cache/taiwins/shaders", home);
+	else
+		return false;
+	return mkdir_p(program_cache.dir, mode) == 0;
+}
+
+/* only GLES 3 has program binary in core, context needs to be current */
+static void
+program_cache_init(void)
+{
+	int major = 0;
+	GLint nformats = 0;
+	const char *version = (const char *)glGetString(GL_VERSION);
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	program_cache.initialized = true;
+	if (!version || sscanf(version, "OpenGL ES %d", &major) != 1 ||
+	    major < 3)
+		return;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &nformats);
+	if (nformats <= 0)
+		return;
+	if (!program_cache_init_dir()) {
+		tw_logl_level(TW_LOG_WARN, "cannot create shader cache dir");
+		return;
+	}
+	hash = fnv1a_hash(hash, (const char *)glGetString(GL_VENDOR));
+	hash = fnv1a_hash(hash, (const char *)glGetString(GL_RENDERER));
+	hash = fnv1a_hash(hash, version);
+	program_cache.driver_hash = hash;
+	program_cache.enabled = true;
+}
+
+static inline void
+program_cache_path(char path[PATH_MAX], uint64_t key)
+{
+	snprintf(path, PATH_MAX, "%s/%016" PRIx64 ".bin",
+	         program_cache.dir, key);
+}
+
+bool
+tw_egl_program_cache_enabled(void)
+{
+	if (!program_cache.initialized)
+		program_cache_init();
+	return program_cache.enabled;
+}
+
+uint64_t
+tw_egl_program_cache_key(GLsizei count, const GLchar **vs_srcs,
+                         const GLchar **fs_srcs)
+{
+	uint64_t hash = program_cache.driver_hash;
+
+	hash = fnv1a_hash(hash, "vs");
+	for (int i = 0; i < count; i++)
+		hash = fnv1a_hash(hash, vs_srcs[i]);
+	hash = fnv1a_hash(hash, "fs");
+	for (int i = 0; i < count; i++)
+		hash = fnv1a_hash(hash, fs_srcs[i]);
+	return hash;
+}
+
+GLuint
+tw_egl_program_cache_load(uint64_t key)
+{
+	FILE *file;
+	GLuint prog = 0;
+	GLint status = GL_FALSE;
+	void *binary = NULL;
+	char path[PATH_MAX];
+	struct program_cache_header header;
+
+	if (!tw_egl_program_cache_enabled())
+		return 0;
+	program_cache_path(path, key);
+	if (!(file = fopen(path, "rb")))
+		return 0;
+	if (fread(&header, sizeof(header), 1, file) != 1 ||
+	    header.magic != PROGRAM_CACHE_MAGIC ||
+	    header.version != PROGRAM_CACHE_VERSION ||
+	    header.key != key || !header.length)
+		goto out;
+	if (!(binary = malloc(header.length)))
+		goto out;
+	if (fread(binary, header.length, 1, file) != 1)
+		goto out;
+
+	prog = glCreateProgram();
+	glProgramBinary(prog, header.format, binary, header.length);
+	glGetProgramiv(prog, GL_LINK_STATUS, &status);
+	//driver may reject binaries even with the same version string
+	if (status != GL_TRUE) {
+		glDeleteProgram(prog);
+		prog = 0;
+	}
+out:
+	free(binary);
+	fclose(file);
+	if (!prog)
+		unlink(path);
+	return prog;
+}
+
+void
+tw_egl_program_cache_store(uint64_t key, GLuint prog)
+{
+	FILE *file;
+	GLint length = 0;
+	GLenum format;
+	void *binary = NULL;
+	char path[PATH_MAX], tmp_path[PATH_MAX+8];
+	struct program_cache_header header = {
+		.magic = PROGRAM_CACHE_MAGIC,
+		.version = PROGRAM_CACHE_VERSION,
+		.key = key,
+	};
+
+	if (!tw_egl_program_cache_enabled())
+		return;
+	glGetProgramiv(prog, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0 || !(binary = malloc(length)))
+		return;
+	glGetProgramBinary(prog, length, &length, &format, binary);
+	if (length <= 0)
+		goto out;
+	header.format = format;
+	header.length = length;
+
+	//write to a temporary then rename, never leaving a partial entry
+	program_cache_path(path, key);
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+	if (!(file = fopen(tmp_path, "wb")))
+		goto out;
+	if (fwrite(&header, sizeof(header), 1, file) != 1 ||
+	    fwrite(binary, length, 1, file) != 1) {
+		fclose(file);
+		unlink(tmp_path);
+		goto out;
+	}
+	fclose(file);
+	if (rename(tmp_path, path))
+		unlink(tmp_path);
+out:
+	free(binary);
+}
@@ -174,6 +174,7 @@ notify_context_display_destroy(struct wl_listener *listener, void *display)
 
 	wl_signal_emit(&ctx->base.signals.destroy, &ctx->base);
 
+	tw_egl_render_context_fini_upload(ctx);
 	tw_egl_fini(&ctx->egl);
 	wl_array_release(&ctx->pixel_formats);
 	wl_list_remove(&ctx->base.display_destroy.link);
@@ -182,6 +183,8 @@ notify_context_display_destroy(struct wl_listener *listener, void *display)
 		tw_render_pipeline_destroy(pipeline);
 	tw_linux_dmabuf_fini(&ctx->base.dma_manager);
 	tw_compositor_fini(&ctx->base.compositor_manager);
+	tw_render_arena_fini(&ctx->base.frame_arena);
+	wl_array_release(&ctx->base.views.prev);
 
 	free(ctx);
 }
@@ -324,6 +327,18 @@ tw_gles_debug_pop(struct tw_egl_render_context *ctx)
  * initializers
  *****************************************************************************/
 
+static void
+init_context_upload(struct tw_egl_render_context *ctx)
+{
+	EGLint version = 2;
+
+	eglQueryContext(ctx->egl.display, ctx->egl.context,
+	                EGL_CONTEXT_CLIENT_VERSION, &version);
+	ctx->upload.use_pbo = version >= 3;
+	wl_array_init(&ctx->upload.boxes);
+	wl_list_init(&ctx->upload.pending);
+}
+
 WL_EXPORT struct tw_render_context *
 tw_render_context_create_egl(struct wl_display *display,
                              const struct tw_egl_options *opts)
@@ -341,6 +356,7 @@ tw_render_context_create_egl(struct wl_display *display,
 		goto err_init_base;
 
 	init_context_formats(ctx);
+	init_context_upload(ctx);
 	tw_egl_bind_wl_display(&ctx->egl, display);
 
 	tw_egl_impl_linux_dmabuf(&ctx->egl, &ctx->base.dma_manager);
@@ -20,12 +20,18 @@
  */
 
 #include <assert.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <time.h>
 #include <GLES3/gl3.h>
 
 #include <taiwins/objects/logger.h>
+#include <taiwins/objects/utils.h>
 #include <taiwins/render_context_egl.h>
 #include <wayland-util.h>
 
+#include "internal.h"
+
 /******************************************************************************
  * shader collections
  *
@@ -43,55 +49,66 @@
  * We would like to reduce the bandwidth as much as possible.
  *****************************************************************************/
 
+/* the permutations are generated by prepending the feature defines */
 static const GLchar quad_vs[] =
 	"uniform mat3 proj;\n"
-	"uniform vec4 color;\n"
 	"attribute vec2 pos;\n"
 	"attribute vec2 texcoord;\n"
-	"varying vec4 o_color;\n"
 	"varying vec2 o_texcoord;\n"
 	"\n"
 	"void main() {\n"
 	"	gl_Position = vec4(proj * vec3(pos, 1.0), 1.0);\n"
-	"	o_color = color;\n"
+	"#ifdef Y_INVERT\n"
+	"	o_texcoord = vec2(texcoord.x, 1.0 - texcoord.y);\n"
+	"#else\n"
 	"	o_texcoord = texcoord;\n"
+	"#endif\n"
 	"}\n";
 
-static const GLchar color_quad_fs[] =
-	"precision mediump float;\n"
-	"uniform float alpha;\n"
-	"varying vec4 o_color;\n"
-	"varying vec2 o_texcoord;\n"
-	"\n"
-	"void main() {\n"
-	"	gl_FragColor = o_color * alpha;\n"
-	"}\n"
-	"\n";
-
-static const GLchar tex_quad_fs[] =
-	"precision mediump float;\n"
-	"uniform float alpha;\n"
-	"uniform sampler2D tex;\n"
-	"varying vec4 o_color;\n"
-	"varying vec2 o_texcoord;\n"
-	"\n"
-	"void main() {\n"
-	"	gl_FragColor = texture2D(tex, o_texcoord) * alpha;\n"
-	"}\n"
-	"\n";
-
-const GLchar tex_quad_ext_fs[] =
-	"#extension GL_OES_EGL_image_external : require\n\n"
+static const GLchar quad_fs[] =
 	"precision mediump float;\n"
-	"varying vec4 o_color;\n"
 	"varying vec2 o_texcoord;\n"
+	"#if defined(SOLID_COLOR)\n"
+	"uniform vec4 color;\n"
+	"#elif defined(TEXTURE_EXTERNAL)\n"
 	"uniform samplerExternalOES tex;\n"
+	"#else\n"
+	"uniform sampler2D tex;\n"
+	"#endif\n"
+	"#ifdef GLOBAL_ALPHA\n"
 	"uniform float alpha;\n"
+	"#endif\n"
 	"\n"
 	"void main() {\n"
-	"	gl_FragColor = texture2D(tex, o_texcoord) * alpha;\n"
+	"#ifdef SOLID_COLOR\n"
+	"	vec4 c = color;\n"
+	"#else\n"
+	"	vec4 c = texture2D(tex, o_texcoord);\n"
+	"#endif\n"
+	"#ifdef RGBX\n"
+	"	c.a = 1.0;\n"
+	"#endif\n"
+	"#ifdef GLOBAL_ALPHA\n"
+	"	c *= alpha;\n"
+	"#endif\n"
+	"#ifdef OPAQUE\n"
+	"	c.a = 1.0;\n"
+	"#endif\n"
+	"	gl_FragColor = c;\n"
 	"}\n";
 
+static const struct {
+	uint32_t feature;
+	const char *define;
+} quad_feature_defines[TW_EGL_QUAD_FEATURE_CNT] = {
+	{TW_EGL_QUAD_TEXTURE_EXTERNAL, "#define TEXTURE_EXTERNAL\n"},
+	{TW_EGL_QUAD_SOLID_COLOR, "#define SOLID_COLOR\n"},
+	{TW_EGL_QUAD_OPAQUE, "#define OPAQUE\n"},
+	{TW_EGL_QUAD_RGBX, "#define RGBX\n"},
+	{TW_EGL_QUAD_GLOBAL_ALPHA, "#define GLOBAL_ALPHA\n"},
+	{TW_EGL_QUAD_Y_INVERT, "#define Y_INVERT\n"},
+};
+
 static inline void
 diagnose_shader(GLuint shader, GLenum type)
 {
@@ -130,29 +147,33 @@ diagnose_program(GLuint prog)
 }
 
 static GLuint
-compile_shader(GLenum type, const GLchar *src)
+compile_shader(GLenum type, GLsizei count, const GLchar **srcs)
 {
 	GLuint shader = glCreateShader(type);
-	glShaderSource(shader, 1, &src, NULL);
+	glShaderSource(shader, count, srcs, NULL);
 	glCompileShader(shader);
 	diagnose_shader(shader, type);
 
 	return shader;
 }
 
-/*****************************************************************************
- * exposed APIs
- ****************************************************************************/
-WL_EXPORT GLuint
-tw_egl_shader_create_program(const GLchar *vs_src, const GLchar *fs_src)
+static GLuint
+link_program(GLsizei count, const GLchar **vs_srcs, const GLchar **fs_srcs,
+             bool retrievable)
 {
 	GLuint p;
-	GLuint vs = compile_shader(GL_VERTEX_SHADER, vs_src);
-	GLuint fs = compile_shader(GL_FRAGMENT_SHADER, fs_src);
+	GLuint vs = compile_shader(GL_VERTEX_SHADER, count, vs_srcs);
+	GLuint fs = compile_shader(GL_FRAGMENT_SHADER, count, fs_srcs);
 
 	p = glCreateProgram();
 	glAttachShader(p, vs);
 	glAttachShader(p, fs);
+	//the pipelines rely on these locations
+	glBindAttribLocation(p, 0, "pos");
+	glBindAttribLocation(p, 1, "texcoord");
+	if (retrievable)
+		glProgramParameteri(p, GL_PROGRAM_BINARY_RETRIEVABLE_HINT,
+		                    GL_TRUE);
 	glLinkProgram(p);
 	glDetachShader(p, vs);
 	glDetachShader(p, fs);
@@ -163,56 +184,108 @@ tw_egl_shader_create_program(const GLchar *vs_src, const GLchar *fs_src)
 	return p;
 }
 
-WL_EXPORT void
-tw_egl_quad_color_shader_init(struct tw_egl_quad_shader *shader)
+/* try the program binary cache first, compile on a miss */
+static GLuint
+create_program(GLsizei count, const GLchar **vs_srcs, const GLchar **fs_srcs)
 {
-	shader->prog = tw_egl_shader_create_program(quad_vs, color_quad_fs);
-	shader->uniform.proj = glGetUniformLocation(shader->prog, "proj");
-	shader->uniform.target = glGetUniformLocation(shader->prog, "color");
-	shader->uniform.alpha = glGetUniformLocation(shader->prog, "alpha");
-	assert(shader->uniform.proj >= 0);
-	assert(shader->uniform.target >= 0);
-	assert(shader->uniform.alpha >= 0);
-}
+	GLuint p;
+	uint64_t key = 0;
+	bool cached = tw_egl_program_cache_enabled();
+	struct timespec start, end;
 
-WL_EXPORT void
-tw_egl_quad_color_shader_fini(struct tw_egl_quad_shader *shader)
-{
-	glDeleteProgram(shader->prog);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (cached) {
+		key = tw_egl_program_cache_key(count, vs_srcs, fs_srcs);
+		p = tw_egl_program_cache_load(key);
+		if (p) {
+			clock_gettime(CLOCK_MONOTONIC, &end);
+			tw_logl_level(TW_LOG_DBUG, "program %016"PRIx64" loaded "
+			              "in %ld us", key,
+			              tw_timespec_diff_us(&end, &start));
+			return p;
+		}
+	}
+	p = link_program(count, vs_srcs, fs_srcs, cached);
+	if (cached)
+		tw_egl_program_cache_store(key, p);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	tw_logl_level(TW_LOG_DBUG, "program %016"PRIx64" compiled in %ld us",
+	              key, tw_timespec_diff_us(&end, &start));
+
+	return p;
 }
 
-WL_EXPORT void
-tw_egl_quad_tex_shader_init(struct tw_egl_quad_shader *shader)
+static void
+quad_shader_init(struct tw_egl_quad_shader *shader, uint32_t features)
 {
-	shader->prog = tw_egl_shader_create_program(quad_vs, tex_quad_fs);
+	unsigned int n = 0;
+	const GLchar *defines[TW_EGL_QUAD_FEATURE_CNT+1];
+	const GLchar *vs_srcs[TW_EGL_QUAD_FEATURE_CNT+2];
+	const GLchar *fs_srcs[TW_EGL_QUAD_FEATURE_CNT+2];
+
+	//extension directive has to come before anything else
+	defines[n++] = (features & TW_EGL_QUAD_TEXTURE_EXTERNAL) ?
+		"#extension GL_OES_EGL_image_external : require\n" : "";
+	for (unsigned i = 0; i < TW_EGL_QUAD_FEATURE_CNT; i++)
+		defines[n++] = (features & quad_feature_defines[i].feature) ?
+			quad_feature_defines[i].define : "";
+	for (unsigned i = 0; i < n; i++)
+		vs_srcs[i] = fs_srcs[i] = defines[i];
+	vs_srcs[0] = ""; //sampler extension only for fragment shader
+	vs_srcs[n] = quad_vs;
+	fs_srcs[n] = quad_fs;
+
+	shader->prog = create_program(n+1, vs_srcs, fs_srcs);
 	shader->uniform.proj = glGetUniformLocation(shader->prog, "proj");
-	shader->uniform.target = glGetUniformLocation(shader->prog, "tex");
+	shader->uniform.target = glGetUniformLocation(
+		shader->prog,
+		(features & TW_EGL_QUAD_SOLID_COLOR) ? "color" : "tex");
+	//-1 if there is no global alpha, setting it does nothing
 	shader->uniform.alpha = glGetUniformLocation(shader->prog, "alpha");
 	assert(shader->uniform.proj >= 0);
 	assert(shader->uniform.target >= 0);
-	assert(shader->uniform.alpha >= 0);
 }
 
-WL_EXPORT void
-tw_egl_quad_tex_shader_fini(struct tw_egl_quad_shader *shader)
+/*****************************************************************************
+ * exposed APIs
+ ****************************************************************************/
+WL_EXPORT GLuint
+tw_egl_shader_create_program(const GLchar *vs_src, const GLchar *fs_src)
 {
-	glDeleteProgram(shader->prog);
+	return create_program(1, &vs_src, &fs_src);
 }
 
 WL_EXPORT void
-tw_egl_quad_texext_shader_init(struct tw_egl_quad_shader *shader)
+tw_egl_quad_shader_cache_init(struct tw_egl_quad_shader_cache *cache)
 {
-	shader->prog = tw_egl_shader_create_program(quad_vs, tex_quad_ext_fs);
-	shader->uniform.proj = glGetUniformLocation(shader->prog, "proj");
-	shader->uniform.target = glGetUniformLocation(shader->prog, "tex");
-	shader->uniform.alpha = glGetUniformLocation(shader->prog, "alpha");
-	assert(shader->uniform.proj >= 0);
-	assert(shader->uniform.target >= 0);
-	assert(shader->uniform.alpha >= 0);
+	for (unsigned i = 0; i < TW_EGL_QUAD_SHADER_CNT; i++)
+		cache->shaders[i].prog = 0;
 }
 
 WL_EXPORT void
-tw_egl_quad_texext_shader_fini(struct tw_egl_quad_shader *shader)
+tw_egl_quad_shader_cache_fini(struct tw_egl_quad_shader_cache *cache)
 {
-	glDeleteProgram(shader->prog);
+	for (unsigned i = 0; i < TW_EGL_QUAD_SHADER_CNT; i++) {
+		if (cache->shaders[i].prog)
+			glDeleteProgram(cache->shaders[i].prog);
+		cache->shaders[i].prog = 0;
+	}
+}
+
+WL_EXPORT struct tw_egl_quad_shader *
+tw_egl_quad_shader_cache_get(struct tw_egl_quad_shader_cache *cache,
+                             uint32_t features)
+{
+	struct tw_egl_quad_shader *shader;
+
+	assert(features < TW_EGL_QUAD_SHADER_CNT);
+	//solid color does not sample anything
+	if (features & TW_EGL_QUAD_SOLID_COLOR)
+		features &= ~(TW_EGL_QUAD_TEXTURE_EXTERNAL |
+		              TW_EGL_QUAD_RGBX | TW_EGL_QUAD_Y_INVERT);
+	//compiled on first use
+	shader = &cache->shaders[features];
+	if (!shader->prog)
+		quad_shader_init(shader, features);
+	return shader;
 }
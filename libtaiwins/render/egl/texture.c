@@ -35,6 +35,7 @@
 #include <pixman.h>
 #include <string.h>
 #include <wayland-server.h>
+#include <ctypes/helpers.h>
 
 #include <taiwins/objects/logger.h>
 #include <taiwins/objects/dmabuf.h>
@@ -44,6 +45,7 @@
 #include <taiwins/render_context.h>
 
 #include "internal.h"
+#include "probes.h"
 
 static inline bool
 wl_format_supported(struct tw_egl_render_context *ctx,
@@ -91,10 +93,184 @@ wl_format_has_alpha(enum wl_shm_format format)
 }
 
 
+/******************************************************************************
+ * upload engine
+ *****************************************************************************/
+
+/* a glTexSubImage2D call costs about as much as copying this many pixels,
+ * adjacent damage boxes are merged if the merge wastes less than that */
+#define TW_EGL_UPLOAD_CALL_COST 4096
+
+static inline int64_t
+box_area(const pixman_box32_t *box)
+{
+	return (int64_t)(box->x2 - box->x1) * (box->y2 - box->y1);
+}
+
+void
+tw_egl_render_context_begin_upload(struct tw_egl_render_context *ctx)
+{
+	if (ctx->upload.depth++)
+		return;
+	//at repaint we upload on top of the output surface, do not switch.
+	ctx->upload.was_current = eglGetCurrentContext() == ctx->egl.context;
+	if (!ctx->upload.was_current)
+		tw_egl_make_current(&ctx->egl, EGL_NO_SURFACE);
+	TW_GLES_DEBUG_PUSH(ctx);
+	if (ctx->upload.use_pbo && !ctx->upload.pbos[0])
+		glGenBuffers(TW_EGL_UPLOAD_PBO_CNT, ctx->upload.pbos);
+}
+
+void
+tw_egl_render_context_end_upload(struct tw_egl_render_context *ctx)
+{
+	assert(ctx->upload.depth);
+	if (--ctx->upload.depth)
+		return;
+	TW_GLES_DEBUG_POP(ctx);
+	if (!ctx->upload.was_current)
+		tw_egl_unset_current(&ctx->egl);
+}
+
+void
+tw_egl_render_context_fini_upload(struct tw_egl_render_context *ctx)
+{
+	if (ctx->upload.pbos[0]) {
+		tw_egl_make_current(&ctx->egl, EGL_NO_SURFACE);
+		glDeleteBuffers(TW_EGL_UPLOAD_PBO_CNT, ctx->upload.pbos);
+		tw_egl_unset_current(&ctx->egl);
+	}
+	struct tw_surface_buffer *buffer, *tmp;
+
+	wl_list_for_each_safe(buffer, tmp, &ctx->upload.pending, deferred_link)
+		tw_reset_wl_list(&buffer->deferred_link);
+	wl_array_release(&ctx->upload.boxes);
+}
+
+/* greedily merge the y-x sorted damage boxes, the result is in scratch */
+static int
+upload_coalesce_damage(struct tw_egl_render_context *ctx,
+                       pixman_region32_t *damage, pixman_box32_t **out)
+{
+	int n, m = 1;
+	pixman_box32_t *boxes = pixman_region32_rectangles(damage, &n);
+	pixman_box32_t *dst, *cur, merged;
+
+	*out = boxes;
+	ctx->upload.boxes.size = 0;
+	if (n <= 1 || !wl_array_add(&ctx->upload.boxes, n * sizeof(*boxes)))
+		return n;
+
+	dst = ctx->upload.boxes.data;
+	dst[0] = boxes[0];
+	for (int i = 1; i < n; i++) {
+		cur = &dst[m-1];
+		merged.x1 = MIN(cur->x1, boxes[i].x1);
+		merged.y1 = MIN(cur->y1, boxes[i].y1);
+		merged.x2 = MAX(cur->x2, boxes[i].x2);
+		merged.y2 = MAX(cur->y2, boxes[i].y2);
+		if (box_area(&merged) - box_area(cur) - box_area(&boxes[i]) <=
+		    TW_EGL_UPLOAD_CALL_COST)
+			*cur = merged;
+		else
+			dst[m++] = boxes[i];
+	}
+	*out = dst;
+	return m;
+}
+
+/* upload straight from shm memory, texture needs to be bound */
+static void
+upload_boxes_direct(struct tw_egl_render_texture *texture,
+                    struct wl_shm_buffer *buffer, GLuint glfmt,
+                    const pixman_box32_t *boxes, int n)
+{
+	uint32_t stride = wl_shm_buffer_get_stride(buffer);
+	void *data = wl_shm_buffer_get_data(buffer);
+
+	glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, stride / 4);
+	for (int i = 0; i < n; i++) {
+		glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, boxes[i].x1);
+		glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, boxes[i].y1);
+		glTexSubImage2D(texture->target, 0, boxes[i].x1, boxes[i].y1,
+		                boxes[i].x2 - boxes[i].x1,
+		                boxes[i].y2 - boxes[i].y1,
+		                glfmt, GL_UNSIGNED_BYTE, data);
+	}
+	glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, 0);
+	glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, 0);
+	glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, 0);
+}
+
+/* pack the boxes tightly into the next pixel unpack buffer of the ring, that
+ * is the only copy of the shm memory, the transfer to the texture happens
+ * asynchronously. Texture needs to be bound. */
+static bool
+upload_boxes_streaming(struct tw_egl_render_context *ctx,
+                       struct tw_egl_render_texture *texture,
+                       struct wl_shm_buffer *buffer, GLuint glfmt,
+                       const pixman_box32_t *boxes, int n)
+{
+	uint32_t stride = wl_shm_buffer_get_stride(buffer);
+	const uint8_t *src = wl_shm_buffer_get_data(buffer);
+	GLsizeiptr size = 0;
+	uintptr_t offset = 0;
+	uint8_t *dst;
+	bool ret;
+
+	for (int i = 0; i < n; i++)
+		size += box_area(&boxes[i]) * 4;
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER,
+	             ctx->upload.pbos[ctx->upload.pbo_head]);
+	ctx->upload.pbo_head = (ctx->upload.pbo_head + 1) %
+		TW_EGL_UPLOAD_PBO_CNT;
+	//orphan the storage so we never wait on the previous transfer
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+	dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+	                       GL_MAP_WRITE_BIT |
+	                       GL_MAP_INVALIDATE_BUFFER_BIT);
+	if (!dst) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		return false;
+	}
+	for (int i = 0; i < n; i++) {
+		size_t row = (boxes[i].x2 - boxes[i].x1) * 4;
+
+		for (int y = boxes[i].y1; y < boxes[i].y2; y++) {
+			memcpy(dst + offset,
+			       src + (size_t)y * stride + boxes[i].x1 * 4,
+			       row);
+			offset += row;
+		}
+	}
+	ret = glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+	offset = 0;
+	for (int i = 0; ret && i < n; i++) {
+		glTexSubImage2D(texture->target, 0, boxes[i].x1, boxes[i].y1,
+		                boxes[i].x2 - boxes[i].x1,
+		                boxes[i].y2 - boxes[i].y1,
+		                glfmt, GL_UNSIGNED_BYTE, (void *)offset);
+		offset += box_area(&boxes[i]) * 4;
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	return ret;
+}
+
 /******************************************************************************
  * texture import
  *****************************************************************************/
 
+/* sampler states are set once at creation, so renderers do not need to set
+ * them on every draw, texture needs to be bound */
+static inline void
+texture_init_params(struct tw_egl_render_texture *texture)
+{
+	glTexParameteri(texture->target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(texture->target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+}
+
 static bool
 texture_init_pixels(struct tw_egl_render_texture *texture,
                     struct tw_egl_render_context *ctx,
@@ -104,8 +280,6 @@ texture_init_pixels(struct tw_egl_render_texture *texture,
 	enum wl_shm_format format;
 	GLuint glfmt;
 
-	tw_egl_make_current(&ctx->egl, EGL_NO_SURFACE);
-
 	format = wl_shm_buffer_get_format(buffer);
 	width = wl_shm_buffer_get_width(buffer);
 	height = wl_shm_buffer_get_height(buffer);
@@ -121,11 +295,12 @@ texture_init_pixels(struct tw_egl_render_texture *texture,
 	texture->base.has_alpha = wl_format_has_alpha(format);
 	texture->base.inverted_y = false;
 
-	TW_GLES_DEBUG_PUSH(ctx);
+	tw_egl_render_context_begin_upload(ctx);
 
 	wl_shm_buffer_begin_access(buffer);
 	glGenTextures(1, &texture->gltex);
 	glBindTexture(texture->target, texture->gltex);
+	texture_init_params(texture);
 	glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, stride / 4);
 	glTexImage2D(texture->target, 0, glfmt,
 	             width, height, 0, glfmt,
@@ -137,9 +312,7 @@ texture_init_pixels(struct tw_egl_render_texture *texture,
 
 	assert(glGetError() == GL_NO_ERROR);
 
-	TW_GLES_DEBUG_POP(ctx);
-
-	tw_egl_unset_current(&ctx->egl);
+	tw_egl_render_context_end_upload(ctx);
 	return true;
 }
 
@@ -194,6 +367,7 @@ texture_init_wl_drm(struct tw_egl_render_texture *texture,
 
 	glGenTextures(1, &texture->gltex);
 	glBindTexture(GL_TEXTURE_EXTERNAL_OES, texture->gltex);
+	texture_init_params(texture);
 	ctx->funcs.image_get_texture2d_oes(GL_TEXTURE_EXTERNAL_OES,
 	                                   texture->image);
 	glBindTexture(GL_TEXTURE_EXTERNAL_OES, 0);
@@ -245,6 +419,7 @@ texture_init_dma(struct tw_egl_render_texture *texture,
 
 	glGenTextures(1, &texture->gltex);
 	glBindTexture(texture->target, texture->gltex);
+	texture_init_params(texture);
 	ctx->funcs.image_get_texture2d_oes(texture->target,
 	                                   texture->image);
 	glBindTexture(texture->target, 0);
@@ -257,52 +432,6 @@ texture_init_dma(struct tw_egl_render_texture *texture,
 	return true;
 }
 
-static bool
-texture_update_pixels(struct tw_egl_render_texture *texture,
-                      struct tw_egl_render_context *ctx,
-                      struct wl_shm_buffer *buffer,
-                      uint32_t src_x, uint32_t src_y,
-                      uint32_t dst_x, uint32_t dst_y,
-                      uint32_t width, uint32_t height)
-{
-	uint32_t stride;
-	enum wl_shm_format format;
-	GLuint glfmt;
-
-	tw_egl_make_current(&ctx->egl, EGL_NO_SURFACE);
-
-	format = wl_shm_buffer_get_format(buffer);
-	stride = wl_shm_buffer_get_stride(buffer);
-	if (!wl_format_supported(ctx, format))
-		return false;
-	glfmt = wl_format_to_gl_format(format);
-
-	TW_GLES_DEBUG_PUSH(ctx);
-
-	wl_shm_buffer_begin_access(buffer);
-	glBindTexture(texture->target, texture->gltex);
-
-	glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, stride / 4);;
-	glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, src_x);
-	glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, src_y);
-
-	glTexSubImage2D(texture->target, 0, dst_x, dst_y, width, height,
-	                glfmt, GL_UNSIGNED_BYTE,
-	                wl_shm_buffer_get_data(buffer));
-
-	glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, 0);
-	glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, 0);
-	glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, 0);
-
-	glBindTexture(texture->target, 0);
-	wl_shm_buffer_end_access(buffer);
-
-	TW_GLES_DEBUG_POP(ctx);
-
-	tw_egl_unset_current(&ctx->egl);
-	return true;
-}
-
 static bool
 shm_buffer_compatible(struct wl_shm_buffer *shmbuf,
                       struct tw_surface_buffer *buffer)
@@ -348,6 +477,38 @@ tw_egl_render_texture_init(struct tw_egl_render_texture *texture,
         return true;
 }
 
+/* upload the damage of shm buffer, damage is in buffer space */
+static bool
+texture_upload_damage(struct tw_egl_render_texture *texture,
+                      struct tw_egl_render_context *ctx,
+                      struct wl_shm_buffer *shmbuf,
+                      pixman_region32_t *damage)
+{
+	bool ret;
+	int n;
+	pixman_box32_t *boxes;
+	GLuint glfmt = wl_format_to_gl_format(texture->base.wl_format);
+
+	n = upload_coalesce_damage(ctx, damage, &boxes);
+	if (!n)
+		return true;
+
+	//context is current only once for all the boxes
+	tw_egl_render_context_begin_upload(ctx);
+	wl_shm_buffer_begin_access(shmbuf);
+	glBindTexture(texture->target, texture->gltex);
+
+	if (!ctx->upload.use_pbo ||
+	    !upload_boxes_streaming(ctx, texture, shmbuf, glfmt, boxes, n))
+		upload_boxes_direct(texture, shmbuf, glfmt, boxes, n);
+
+	glBindTexture(texture->target, 0);
+	wl_shm_buffer_end_access(shmbuf);
+	ret = glGetError() == GL_NO_ERROR;
+	tw_egl_render_context_end_upload(ctx);
+	return ret;
+}
+
 static bool
 tw_egl_render_texture_update(struct tw_egl_render_texture *texture,
                              struct tw_egl_render_context *ctx,
@@ -356,33 +517,30 @@ tw_egl_render_texture_update(struct tw_egl_render_texture *texture,
                              struct tw_surface_buffer *buffer)
 {
 	bool ret = true;
-	pixman_region32_t all_damage, *damages;
-	int n;
-	pixman_box32_t *rects, *r;
+	pixman_region32_t damage;
 	struct wl_shm_buffer *shmbuf = wl_shm_buffer_get(wl_buffer);
 
 	if (!shm_buffer_compatible(shmbuf, buffer))
 		return false;
+	if (!wl_format_supported(ctx, buffer->format))
+		return false;
 
-	//copy data
-	pixman_region32_init_rect(&all_damage, 0, 0,
+	pixman_region32_init_rect(&damage, 0, 0,
 	                          buffer->width, buffer->height);
-	wl_shm_buffer_begin_access(shmbuf);
-	damages = (update_damage) ? update_damage : &all_damage;
-	rects = pixman_region32_rectangles(damages, &n);
-	for (int i = 0; i < n; i++) {
-		r = &rects[i];
-		if (!texture_update_pixels(texture, ctx, shmbuf,
-		                           r->x1, r->y1,
-		                           r->x1, r->y1,
-		                           r->x2-r->x1, r->y2-r->y1)) {
-			ret = false;
-			goto out;
-		}
+	if (update_damage)
+		pixman_region32_intersect(&damage, &damage, update_damage);
+	//mailbox, only the latest buffer gets uploaded, at repaint
+	if (ctx->upload.deferred) {
+		pixman_region32_union(&texture->pending_damage,
+		                      &texture->pending_damage, &damage);
+		buffer->deferred = true;
+		tw_reset_wl_list(&buffer->deferred_link);
+		wl_list_insert(ctx->upload.pending.prev,
+		               &buffer->deferred_link);
+	} else {
+		ret = texture_upload_damage(texture, ctx, shmbuf, &damage);
 	}
-out:
-	wl_shm_buffer_end_access(shmbuf);
-	pixman_region32_fini(&all_damage);
+	pixman_region32_fini(&damage);
 	return ret;
 }
 
@@ -407,6 +565,7 @@ tw_egl_render_texture_destroy(struct tw_render_texture *texture,
 	TW_GLES_DEBUG_POP(ctx);
 
 	tw_egl_unset_current(&ctx->egl);
+	pixman_region32_fini(&egl_texture->pending_damage);
 
         free(egl_texture);
 }
@@ -424,6 +583,7 @@ tw_egl_render_texture_new(struct tw_render_context *base,
 		free(texture);
 		return NULL;
 	}
+	pixman_region32_init(&texture->pending_damage);
 	texture->base.ctx = base;
 	texture->base.destroy = tw_egl_render_texture_destroy;
 	return texture;
@@ -456,12 +616,19 @@ tw_egl_render_context_import_buffer(struct tw_event_buffer_uploading *event,
 	struct tw_egl_render_texture *texture;
 	struct tw_egl_render_texture *old_texture = surface->buffer.handle.ptr;
 	struct tw_surface_buffer *buffer = event->buffer;
-
-	if (!event->new_upload)
-		return tw_egl_render_texture_update(old_texture, ctx,
-		                                    event->wl_buffer,
-		                                    event->damages, buffer);
+	struct wl_shm_buffer *shmbuf;
+	bool ret;
+
+	TW_PROBE2(import_buffer, surface, event->new_upload);
+	if (!event->new_upload) {
+		ret = tw_egl_render_texture_update(old_texture, ctx,
+		                                   event->wl_buffer,
+		                                   event->damages, buffer);
+		TW_PROBE2(import_buffer_done, surface, ret);
+		return ret;
+	}
 	texture = tw_egl_render_texture_new(&ctx->base, event->wl_buffer);
+	TW_PROBE2(import_buffer_done, surface, texture != NULL);
 	if (!texture) {
 		tw_logl_level(TW_LOG_WARN, "EE: failed to update the texture");
 		return false;
@@ -469,6 +636,12 @@ tw_egl_render_context_import_buffer(struct tw_event_buffer_uploading *event,
 	event->buffer->handle.ptr = &texture->base;
 	event->buffer->width = texture->base.width;
 	event->buffer->height = texture->base.height;
+	event->buffer->deferred = false;
+	//for checking the compatibility of next shm buffer
+	if ((shmbuf = wl_shm_buffer_get(event->wl_buffer))) {
+		event->buffer->format = wl_shm_buffer_get_format(shmbuf);
+		event->buffer->stride = wl_shm_buffer_get_stride(shmbuf);
+	}
 
 	if (old_texture)
 		tw_egl_render_texture_destroy(&old_texture->base, &ctx->base);
@@ -478,3 +651,56 @@ tw_egl_render_context_import_buffer(struct tw_event_buffer_uploading *event,
                                  notify_buffer_surface_destroy);
         return true;
 }
+
+WL_EXPORT void
+tw_egl_render_context_set_deferred_upload(struct tw_render_context *base,
+                                          bool deferred)
+{
+	struct tw_egl_render_context *ctx = wl_container_of(base, ctx, base);
+
+	assert(base->type == TW_RENDERER_EGL);
+	ctx->upload.deferred = deferred;
+}
+
+WL_EXPORT bool
+tw_egl_render_context_flush_surface(struct tw_render_context *base,
+                                    struct tw_surface *surface)
+{
+	bool ret;
+	struct tw_egl_render_context *ctx = wl_container_of(base, ctx, base);
+	struct tw_egl_render_texture *texture = surface->buffer.handle.ptr;
+	struct wl_shm_buffer *shmbuf;
+
+	if (!surface->buffer.deferred || !texture)
+		return true;
+	//the deferred half of the import, traced as an update
+	TW_PROBE2(import_buffer, surface, false);
+	shmbuf = wl_shm_buffer_get(surface->buffer.resource);
+	ret = shmbuf && texture_upload_damage(texture, ctx, shmbuf,
+	                                      &texture->pending_damage);
+	TW_PROBE2(import_buffer_done, surface, ret);
+	pixman_region32_clear(&texture->pending_damage);
+	tw_surface_buffer_release_deferred(&surface->buffer);
+	return ret;
+}
+
+WL_EXPORT void
+tw_egl_render_context_flush_pending(struct tw_render_context *base)
+{
+	struct tw_egl_render_context *ctx = wl_container_of(base, ctx, base);
+	struct tw_surface_buffer *buffer, *tmp;
+	struct tw_surface *surface;
+
+	if (wl_list_empty(&ctx->upload.pending))
+		return;
+	tw_egl_render_context_begin_upload(ctx);
+	wl_list_for_each_safe(buffer, tmp, &ctx->upload.pending,
+	                      deferred_link) {
+		surface = wl_container_of(buffer, surface, buffer);
+		tw_egl_render_context_flush_surface(base, surface);
+		//no texture to upload to, do not keep the client waiting
+		if (buffer->deferred)
+			tw_surface_buffer_release_deferred(buffer);
+	}
+	tw_egl_render_context_end_upload(ctx);
+}
@@ -0,0 +1,62 @@
+/*
+ * internal.h - taiwins pixman render context header
+ *
+ * Copyright (c) 2021 Xichen Zhou
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+#ifndef TW_PIXMAN_RENDER_INTERNAL_H
+#define TW_PIXMAN_RENDER_INTERNAL_H
+
+#include <pixman.h>
+#include <taiwins/objects/surface.h>
+#include <taiwins/render_context_pixman.h>
+#include <taiwins/render_surface.h>
+
+#include "render.h"
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+struct tw_pixman_render_context {
+	struct tw_render_context base;
+	struct wl_array pixel_formats;
+
+	struct wl_listener surface_created;
+};
+
+/* presentable handle points to this, we have only one buffer, its content is
+ * kept between frames */
+struct tw_pixman_presentable {
+	pixman_image_t *image;
+	int age;
+};
+
+bool
+tw_pixman_render_context_import_buffer(struct tw_event_buffer_uploading *event,
+                                       void *callback);
+
+bool
+tw_pixman_wl_format_supported(struct tw_pixman_render_context *ctx,
+                              enum wl_shm_format format);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif /* EOF */
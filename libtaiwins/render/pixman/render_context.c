@@ -0,0 +1,246 @@
+/*
+ * render_context.c - taiwins pixman render context
+ *
+ * Copyright (c) 2021 Xichen Zhou
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <pixman.h>
+#include <wayland-server.h>
+#include <wayland-util.h>
+#include <taiwins/objects/utils.h>
+#include <taiwins/objects/logger.h>
+#include <taiwins/objects/compositor.h>
+#include <taiwins/objects/surface.h>
+#include <taiwins/render_pipeline.h>
+
+#include "internal.h"
+#include "render.h"
+
+/******************************************************************************
+ * image presentable implementation
+ *****************************************************************************/
+
+static void
+handle_image_surface_destroy(struct tw_render_presentable *surf,
+                             struct tw_render_context *base)
+{
+	struct tw_pixman_presentable *presentable =
+		(struct tw_pixman_presentable *)surf->handle;
+
+	if (!presentable)
+		return;
+	pixman_image_unref(presentable->image);
+	free(presentable);
+}
+
+static bool
+commit_image_surface(struct tw_render_presentable *surf,
+                     struct tw_render_context *base)
+{
+	//nothing to swap, the image is read directly
+	return true;
+}
+
+static int
+make_image_surface_current(struct tw_render_presentable *surf,
+                           struct tw_render_context *base)
+{
+	struct tw_pixman_presentable *presentable =
+		(struct tw_pixman_presentable *)surf->handle;
+	int age = presentable->age;
+
+	//single buffered, content is valid from the second frame on.
+	presentable->age = 1;
+	return age;
+}
+
+static const struct tw_render_presentable_impl image_surface_impl = {
+	.destroy = handle_image_surface_destroy,
+	.commit = commit_image_surface,
+	.make_current = make_image_surface_current,
+};
+
+/******************************************************************************
+ * render context implementation
+ *****************************************************************************/
+
+static bool
+new_window_surface(struct tw_render_presentable *surf,
+                   struct tw_render_context *base, void *native_surface,
+                   uint32_t format)
+{
+	tw_logl_level(TW_LOG_ERRO, "pixman context does not support window "
+	              "surface");
+	return false;
+}
+
+static bool
+new_image_surface(struct tw_render_presentable *surf,
+                  struct tw_render_context *base,
+                  unsigned int width, unsigned int height)
+{
+	struct tw_pixman_presentable *presentable =
+		calloc(1, sizeof(*presentable));
+
+	if (!presentable)
+		return false;
+	presentable->image = pixman_image_create_bits(PIXMAN_a8r8g8b8,
+	                                              width, height, NULL, 0);
+	if (!presentable->image) {
+		tw_logl_level(TW_LOG_ERRO, "failed to create pixman image");
+		free(presentable);
+		return false;
+	}
+	presentable->age = 0;
+	surf->handle = (intptr_t)presentable;
+	surf->impl = &image_surface_impl;
+	return true;
+}
+
+static const struct tw_render_context_impl pixman_context_impl = {
+	.new_offscreen_surface = new_image_surface,
+	.new_window_surface = new_window_surface,
+};
+
+/******************************************************************************
+ * listeners
+ *****************************************************************************/
+
+static void
+notify_context_surface_created(struct wl_listener *listener, void *data)
+{
+	struct tw_surface *tw_surface = data;
+	struct tw_pixman_render_context *ctx =
+		wl_container_of(listener, ctx, surface_created);
+	struct tw_render_surface *surface =
+		wl_container_of(tw_surface, surface, surface);
+
+	tw_render_surface_init(surface, &ctx->base);
+	tw_surface->buffer.buffer_import.callback = ctx;
+	tw_surface->buffer.buffer_import.buffer_import =
+		tw_pixman_render_context_import_buffer;
+}
+
+static void
+notify_context_display_destroy(struct wl_listener *listener, void *display)
+{
+	struct tw_pixman_render_context *ctx =
+		wl_container_of(listener, ctx, base.display_destroy);
+
+	struct tw_render_pipeline *pipeline, *tmp;
+
+	wl_signal_emit(&ctx->base.signals.destroy, &ctx->base);
+
+	wl_array_release(&ctx->pixel_formats);
+	wl_list_remove(&ctx->base.display_destroy.link);
+	wl_list_remove(&ctx->surface_created.link);
+
+	wl_list_for_each_safe(pipeline, tmp, &ctx->base.pipelines, link)
+		tw_render_pipeline_destroy(pipeline);
+	tw_linux_dmabuf_fini(&ctx->base.dma_manager);
+	tw_compositor_fini(&ctx->base.compositor_manager);
+	tw_render_arena_fini(&ctx->base.frame_arena);
+	wl_array_release(&ctx->base.views.prev);
+
+	free(ctx);
+}
+
+/******************************************************************************
+ * shm API
+ *****************************************************************************/
+
+static bool
+add_wl_shm_format(struct tw_pixman_render_context *ctx,
+                  enum wl_shm_format format)
+{
+	enum wl_shm_format *f;
+
+	if (tw_pixman_wl_format_supported(ctx, format))
+		return true;
+	f = wl_array_add(&ctx->pixel_formats, sizeof(format));
+	if (f) {
+		*f = format;
+		wl_display_add_shm_format(ctx->base.display, format);
+		return true;
+	}
+	return false;
+}
+
+static void
+init_context_formats(struct tw_pixman_render_context *ctx)
+{
+	wl_display_init_shm(ctx->base.display);
+	wl_array_init(&ctx->pixel_formats);
+	add_wl_shm_format(ctx, WL_SHM_FORMAT_ABGR8888);
+	add_wl_shm_format(ctx, WL_SHM_FORMAT_XBGR8888);
+	add_wl_shm_format(ctx, WL_SHM_FORMAT_ARGB8888);
+	add_wl_shm_format(ctx, WL_SHM_FORMAT_XRGB8888);
+}
+
+bool
+tw_pixman_wl_format_supported(struct tw_pixman_render_context *ctx,
+                              enum wl_shm_format format)
+{
+	enum wl_shm_format *f;
+	wl_array_for_each(f, &ctx->pixel_formats)
+		if (format == *f)
+			return true;
+	return false;
+}
+
+/******************************************************************************
+ * initializers
+ *****************************************************************************/
+
+WL_EXPORT pixman_image_t *
+tw_pixman_presentable_image(struct tw_render_presentable *surf)
+{
+	struct tw_pixman_presentable *presentable =
+		(struct tw_pixman_presentable *)surf->handle;
+
+	if (!presentable || surf->impl != &image_surface_impl)
+		return NULL;
+	return presentable->image;
+}
+
+WL_EXPORT struct tw_render_context *
+tw_render_context_create_pixman(struct wl_display *display)
+{
+	struct tw_pixman_render_context *ctx = calloc(1, sizeof(*ctx));
+
+	if (!ctx)
+		return NULL;
+	if (!tw_render_context_init(&ctx->base, display, TW_RENDERER_PIXMAN,
+	                            &pixman_context_impl))
+		goto err_init_base;
+
+	init_context_formats(ctx);
+	//no dma_manager implementation, dmabuf import always fails.
+	tw_set_display_destroy_listener(display, &ctx->base.display_destroy,
+	                                notify_context_display_destroy);
+	tw_signal_setup_listener(&ctx->base.compositor_manager.surface_created,
+	                         &ctx->surface_created,
+	                         notify_context_surface_created);
+	return &ctx->base;
+err_init_base:
+	free(ctx);
+	return NULL;
+}
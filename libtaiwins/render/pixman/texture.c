@@ -0,0 +1,271 @@
+/*
+ * texture.c - taiwins pixman renderer texture functions
+ *
+ * Copyright (c) 2021 Xichen Zhou
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <pixman.h>
+#include <wayland-server.h>
+#include <wayland-util.h>
+
+#include <taiwins/objects/logger.h>
+#include <taiwins/objects/utils.h>
+#include <taiwins/objects/surface.h>
+#include <taiwins/render_context.h>
+
+#include "internal.h"
+#include "probes.h"
+
+static inline pixman_format_code_t
+wl_format_to_pixman_format(enum wl_shm_format format)
+{
+	switch (format) {
+	case WL_SHM_FORMAT_ARGB8888:
+		return PIXMAN_a8r8g8b8;
+	case WL_SHM_FORMAT_XRGB8888:
+		return PIXMAN_x8r8g8b8;
+	case WL_SHM_FORMAT_ABGR8888:
+		return PIXMAN_a8b8g8r8;
+	case WL_SHM_FORMAT_XBGR8888:
+		return PIXMAN_x8b8g8r8;
+	default:
+		assert(0);
+		return PIXMAN_a8r8g8b8;
+	}
+}
+
+static inline bool
+wl_format_has_alpha(enum wl_shm_format format)
+{
+	switch (format) {
+	case WL_SHM_FORMAT_ARGB8888:
+	case WL_SHM_FORMAT_ABGR8888:
+		return true;
+	case WL_SHM_FORMAT_XRGB8888:
+	case WL_SHM_FORMAT_XBGR8888:
+		return false;
+	default:
+		assert(0);
+		return false;
+	}
+}
+
+static bool
+shm_buffer_compatible(struct wl_shm_buffer *shmbuf,
+                      struct tw_surface_buffer *buffer)
+{
+	return (shmbuf &&
+		(wl_shm_buffer_get_format(shmbuf) == buffer->format) &&
+		(wl_shm_buffer_get_stride(shmbuf) == buffer->stride) &&
+		(wl_shm_buffer_get_width(shmbuf)  == buffer->width) &&
+	        (wl_shm_buffer_get_height(shmbuf) == buffer->height));
+}
+
+/******************************************************************************
+ * texture import
+ *****************************************************************************/
+
+/* the wl_buffer is released right after the upload, we have to keep a copy of
+ * the pixels. Only the damaged rectangles are copied. */
+static bool
+texture_copy_pixels(struct tw_pixman_render_texture *texture,
+                    struct wl_shm_buffer *buffer,
+                    pixman_region32_t *damage)
+{
+	int n;
+	pixman_box32_t *r;
+	pixman_image_t *src;
+	enum wl_shm_format format = wl_shm_buffer_get_format(buffer);
+
+	wl_shm_buffer_begin_access(buffer);
+	src = pixman_image_create_bits_no_clear(
+		wl_format_to_pixman_format(format),
+		wl_shm_buffer_get_width(buffer),
+		wl_shm_buffer_get_height(buffer),
+		wl_shm_buffer_get_data(buffer),
+		wl_shm_buffer_get_stride(buffer));
+	if (!src) {
+		wl_shm_buffer_end_access(buffer);
+		return false;
+	}
+	r = pixman_region32_rectangles(damage, &n);
+	for (int i = 0; i < n; i++)
+		pixman_image_composite32(PIXMAN_OP_SRC, src, NULL,
+		                         texture->image,
+		                         r[i].x1, r[i].y1, 0, 0,
+		                         r[i].x1, r[i].y1,
+		                         r[i].x2-r[i].x1, r[i].y2-r[i].y1);
+	pixman_image_unref(src);
+	wl_shm_buffer_end_access(buffer);
+	return true;
+}
+
+static bool
+texture_init_pixels(struct tw_pixman_render_texture *texture,
+                    struct tw_pixman_render_context *ctx,
+                    struct wl_shm_buffer *buffer)
+{
+	bool ret;
+	uint32_t width, height;
+	enum wl_shm_format format;
+	pixman_region32_t all;
+
+	format = wl_shm_buffer_get_format(buffer);
+	width = wl_shm_buffer_get_width(buffer);
+	height = wl_shm_buffer_get_height(buffer);
+	if (!tw_pixman_wl_format_supported(ctx, format))
+		return false;
+
+	texture->image = pixman_image_create_bits_no_clear(
+		wl_format_to_pixman_format(format), width, height, NULL, 0);
+	if (!texture->image)
+		return false;
+	texture->base.width = width;
+	texture->base.height = height;
+	texture->base.wl_format = format;
+	texture->base.has_alpha = wl_format_has_alpha(format);
+	texture->base.inverted_y = false;
+
+	pixman_region32_init_rect(&all, 0, 0, width, height);
+	ret = texture_copy_pixels(texture, buffer, &all);
+	pixman_region32_fini(&all);
+	return ret;
+}
+
+static bool
+tw_pixman_render_texture_update(struct tw_pixman_render_texture *texture,
+                                struct wl_resource *wl_buffer,
+                                pixman_region32_t *update_damage,
+                                struct tw_surface_buffer *buffer)
+{
+	bool ret;
+	pixman_region32_t damage;
+	struct wl_shm_buffer *shmbuf = wl_shm_buffer_get(wl_buffer);
+
+	if (!shm_buffer_compatible(shmbuf, buffer))
+		return false;
+
+	pixman_region32_init_rect(&damage, 0, 0,
+	                          buffer->width, buffer->height);
+	if (update_damage)
+		pixman_region32_intersect(&damage, &damage, update_damage);
+	ret = texture_copy_pixels(texture, shmbuf, &damage);
+	pixman_region32_fini(&damage);
+	return ret;
+}
+
+/******************************************************************************
+ * texture creation
+ *****************************************************************************/
+
+static void
+tw_pixman_render_texture_destroy(struct tw_render_texture *texture,
+                                 struct tw_render_context *base)
+{
+	struct tw_pixman_render_texture *pixman_texture =
+		wl_container_of(texture, pixman_texture, base);
+
+	if (pixman_texture->image)
+		pixman_image_unref(pixman_texture->image);
+	free(pixman_texture);
+}
+
+static struct tw_pixman_render_texture *
+tw_pixman_render_texture_new(struct tw_render_context *base,
+                             struct wl_resource *res)
+{
+	struct tw_pixman_render_texture *texture;
+	struct tw_pixman_render_context *ctx = wl_container_of(base, ctx, base);
+	struct wl_shm_buffer *shmbuf = wl_shm_buffer_get(res);
+
+	//only shm buffers can be imported on CPU
+	if (!shmbuf)
+		return NULL;
+	if (!(texture = calloc(1, sizeof(*texture))))
+		return NULL;
+	if (!texture_init_pixels(texture, ctx, shmbuf)) {
+		tw_pixman_render_texture_destroy(&texture->base, base);
+		return NULL;
+	}
+	texture->base.ctx = base;
+	texture->base.destroy = tw_pixman_render_texture_destroy;
+	return texture;
+}
+
+static void
+notify_buffer_surface_destroy(struct wl_listener *listener, void *data)
+{
+	struct tw_surface_buffer *buffer =
+		wl_container_of(listener, buffer, surface_destroy_listener);
+	struct tw_surface *surface =
+		wl_container_of(buffer, surface, buffer);
+
+	if (tw_surface_has_texture(surface)) {
+		struct tw_pixman_render_texture *texture;
+
+		texture = wl_container_of(buffer->handle.ptr, texture, base);
+		tw_pixman_render_texture_destroy(&texture->base,
+		                                 texture->base.ctx);
+	}
+}
+
+bool
+tw_pixman_render_context_import_buffer(struct tw_event_buffer_uploading *event,
+                                       void *callback)
+{
+	struct tw_pixman_render_context *ctx = callback;
+	struct tw_surface *surface =
+		wl_container_of(event->buffer, surface, buffer);
+	struct tw_pixman_render_texture *texture;
+	struct tw_pixman_render_texture *old_texture =
+		surface->buffer.handle.ptr;
+	struct tw_surface_buffer *buffer = event->buffer;
+	bool ret;
+
+	TW_PROBE2(import_buffer, surface, event->new_upload);
+	if (!event->new_upload) {
+		ret = tw_pixman_render_texture_update(old_texture,
+		                                      event->wl_buffer,
+		                                      event->damages, buffer);
+		TW_PROBE2(import_buffer_done, surface, ret);
+		return ret;
+	}
+	texture = tw_pixman_render_texture_new(&ctx->base, event->wl_buffer);
+	TW_PROBE2(import_buffer_done, surface, texture != NULL);
+	if (!texture) {
+		tw_logl_level(TW_LOG_WARN, "EE: failed to update the texture");
+		return false;
+	}
+	event->buffer->handle.ptr = &texture->base;
+	event->buffer->width = texture->base.width;
+	event->buffer->height = texture->base.height;
+	event->buffer->format = texture->base.wl_format;
+	event->buffer->stride =
+		wl_shm_buffer_get_stride(wl_shm_buffer_get(event->wl_buffer));
+
+	if (old_texture)
+		tw_pixman_render_texture_destroy(&old_texture->base,
+		                                 &ctx->base);
+	tw_reset_wl_list(&buffer->surface_destroy_listener.link);
+	tw_signal_setup_listener(&surface->signals.destroy,
+	                         &buffer->surface_destroy_listener,
+	                         notify_buffer_surface_destroy);
+	return true;
+}
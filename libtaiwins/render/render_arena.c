@@ -0,0 +1,148 @@
+/*
+ * render_arena.c - taiwins per-frame scratch allocator
+ *
+ * Copyright (c) 2021 Xichen Zhou
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <wayland-server-core.h>
+#include <taiwins/objects/surface.h>
+
+#include <taiwins/render_arena.h>
+
+#define ARENA_ALIGN 16
+#define ARENA_BLOCK_SIZE 16384
+
+struct tw_render_arena_block {
+	struct tw_render_arena_block *next;
+	size_t size, used;
+	_Alignas(ARENA_ALIGN) unsigned char data[];
+};
+
+static inline size_t
+arena_align(size_t size)
+{
+	return (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+static struct tw_render_arena_block *
+arena_new_block(struct tw_render_arena *arena, size_t size)
+{
+	struct tw_render_arena_block *block =
+		malloc(sizeof(*block) + size);
+
+	if (!block)
+		return NULL;
+	block->size = size;
+	block->used = 0;
+	block->next = arena->blocks;
+	arena->blocks = block;
+	return block;
+}
+
+WL_EXPORT void
+tw_render_arena_init(struct tw_render_arena *arena)
+{
+	arena->blocks = NULL;
+	arena->used_regions = 0;
+	wl_array_init(&arena->regions);
+}
+
+WL_EXPORT void
+tw_render_arena_fini(struct tw_render_arena *arena)
+{
+	struct tw_render_arena_block *block, *next;
+	pixman_region32_t **region;
+
+	for (block = arena->blocks; block; block = next) {
+		next = block->next;
+		free(block);
+	}
+	wl_array_for_each(region, &arena->regions) {
+		pixman_region32_fini(*region);
+		free(*region);
+	}
+	wl_array_release(&arena->regions);
+	tw_render_arena_init(arena);
+}
+
+WL_EXPORT void *
+tw_render_arena_alloc(struct tw_render_arena *arena, size_t size)
+{
+	struct tw_render_arena_block *block = arena->blocks;
+	void *ptr;
+
+	size = arena_align(size ? size : 1);
+	if (!block || block->size - block->used < size) {
+		size_t block_size = ARENA_BLOCK_SIZE;
+
+		while (block_size < size)
+			block_size *= 2;
+		if (!(block = arena_new_block(arena, block_size)))
+			return NULL;
+	}
+	ptr = block->data + block->used;
+	block->used += size;
+	return ptr;
+}
+
+WL_EXPORT pixman_region32_t *
+tw_render_arena_region(struct tw_render_arena *arena)
+{
+	pixman_region32_t **regions = arena->regions.data;
+	pixman_region32_t *region;
+
+	if (arena->used_regions < arena->regions.size / sizeof(region)) {
+		region = regions[arena->used_regions++];
+		tw_region_reset(region);
+		return region;
+	}
+	if (!(region = malloc(sizeof(*region))))
+		return NULL;
+	if (!(regions = wl_array_add(&arena->regions, sizeof(region)))) {
+		free(region);
+		return NULL;
+	}
+	pixman_region32_init(region);
+	*regions = region;
+	arena->used_regions++;
+	return region;
+}
+
+WL_EXPORT void
+tw_render_arena_reset(struct tw_render_arena *arena)
+{
+	struct tw_render_arena_block *block = arena->blocks, *next;
+	size_t total = 0;
+
+	arena->used_regions = 0;
+	if (!block)
+		return;
+	block->used = 0;
+	if (!block->next)
+		return;
+	//the frame did not fit, one block of everything for the next one
+	for (; block; block = next) {
+		next = block->next;
+		total += block->size;
+		free(block);
+	}
+	arena->blocks = NULL;
+	arena_new_block(arena, total);
+}
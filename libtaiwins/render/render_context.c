@@ -28,6 +28,7 @@
 #include <wayland-server.h>
 #include <taiwins/render_context.h>
 #include <taiwins/render_output.h>
+#include <taiwins/render_pipeline.h>
 #include <taiwins/render_surface.h>
 #include <taiwins/objects/subsurface.h>
 #include <taiwins/objects/logger.h>
@@ -46,6 +47,8 @@ notify_tw_surface_destroy(struct wl_listener *listener, void *data)
 	struct tw_render_surface *surface =
 		wl_container_of(listener, surface, listeners.destroy);
 	assert(data == &surface->surface);
+	//the view lists and touching views hold the surface
+	surface->ctx->views.dirty = true;
 	wl_signal_emit(&surface->ctx->signals.wl_surface_destroy, data);
 	tw_render_surface_fini(surface);
 }
@@ -56,6 +59,10 @@ notify_tw_surface_dirty(struct wl_listener *listener, void *data)
 	struct tw_render_surface *surface =
 		wl_container_of(listener, surface, listeners.dirty);
 	assert(data == &surface->surface);
+	surface->dirty_serial++;
+	//moved or restacked, content updates keep the view lists
+	if (pixman_region32_not_empty(&surface->surface.geometry.dirty))
+		surface->ctx->views.dirty = true;
 	//forwarding the dirty event.
 	wl_signal_emit(&surface->ctx->signals.wl_surface_dirty, data);
 }
@@ -93,6 +100,8 @@ tw_render_surface_init(struct tw_render_surface *surface,
 
 	pixman_region32_init(&surface->clip);
 	surface->ctx = ctx;
+	surface->view_build = 0;
+	surface->view_index = 0;
 #ifdef TW_OVERLAY_PLANE
 	for (int i = 0; i < 32; i++)
 		pixman_region32_init(&surface->output_damage[i]);
@@ -143,6 +152,40 @@ tw_render_surface_from_resource(struct wl_resource *resource)
 
 static const struct tw_allocator tw_render_compositor_allocator;
 
+/* toolkits create a wl_region for every opaque or input region they set, the
+ * objects are churned through per type slabs. The slabs outlive the render
+ * context, objects of clients still around may be freed after it */
+static struct {
+	bool initialized;
+	struct tw_slab surfaces, subsurfaces, regions;
+} s_compositor_slabs;
+
+static void
+compositor_slabs_init(void)
+{
+	if (s_compositor_slabs.initialized)
+		return;
+	tw_slab_init(&s_compositor_slabs.surfaces,
+	             sizeof(struct tw_render_surface), "wl_surface");
+	tw_slab_init(&s_compositor_slabs.subsurfaces,
+	             sizeof(struct tw_subsurface), "wl_subsurface");
+	tw_slab_init(&s_compositor_slabs.regions,
+	             sizeof(struct tw_region), "wl_region");
+	s_compositor_slabs.initialized = true;
+}
+
+static struct tw_slab *
+compositor_slab_for(const struct wl_interface *interface)
+{
+	if (interface == &wl_surface_interface)
+		return &s_compositor_slabs.surfaces;
+	else if (interface == &wl_subsurface_interface)
+		return &s_compositor_slabs.subsurfaces;
+	else if (interface == &wl_region_interface)
+		return &s_compositor_slabs.regions;
+	return NULL;
+}
+
 static void *
 handle_alloc_compositor_obj(size_t size, const struct wl_interface *interface)
 {
@@ -152,14 +195,14 @@ handle_alloc_compositor_obj(size_t size, const struct wl_interface *interface)
 		assert(size == sizeof(struct tw_surface));
 		assert(interface == &wl_surface_interface);
 
-		surface = calloc(1, sizeof(*surface));
-		return &surface->surface;
+		surface = tw_slab_alloc(&s_compositor_slabs.surfaces);
+		return surface ? &surface->surface : NULL;
 	} else if (interface == &wl_subsurface_interface) {
 		assert(size == sizeof(struct tw_subsurface));
-		return calloc(1, size);
+		return tw_slab_alloc(&s_compositor_slabs.subsurfaces);
 	} else if (interface == &wl_region_interface) {
 		assert(size == sizeof(struct tw_region));
-		return calloc(1, size);
+		return tw_slab_alloc(&s_compositor_slabs.regions);
 	} else {
 		tw_logl_level(TW_LOG_ERRO, "invalid interface");
 		assert(0);
@@ -176,15 +219,15 @@ handle_free_compositor_obj(void *ptr, const struct wl_interface *interface)
 			wl_container_of(tw_surface, surface, surface);
 		assert(interface == &wl_surface_interface);
 		assert(tw_surface->alloc == &tw_render_compositor_allocator);
-		free(surface);
+		tw_slab_free(&s_compositor_slabs.surfaces, surface);
 	} else if (interface == &wl_subsurface_interface) {
 		struct tw_subsurface *subsurface = ptr;
 		assert(subsurface->alloc == &tw_render_compositor_allocator);
-		free(subsurface);
+		tw_slab_free(&s_compositor_slabs.subsurfaces, subsurface);
 	} else if (interface == &wl_region_interface) {
 		struct tw_region *region = ptr;
 		assert(region->alloc == &tw_render_compositor_allocator);
-		free(region);
+		tw_slab_free(&s_compositor_slabs.regions, region);
 	} else {
 		tw_logl_level(TW_LOG_ERRO, "invalid interface");
 		assert(0);
@@ -208,11 +251,12 @@ tw_render_context_destroy(struct tw_render_context *ctx)
 	ctx->display_destroy.notify(&ctx->display_destroy, ctx->display);
 }
 
-static void
+static unsigned int
 subsurface_add_to_list(struct wl_list *parent, struct tw_surface *surface,
                        enum tw_subsurface_pos pos)
 {
 	struct tw_subsurface *sub;
+	unsigned int n = 1;
 	//insert subsurface BEFORE the parent if it is placed above or AFTER
 	//the if it is placed below
 	struct wl_list *node =
@@ -220,17 +264,21 @@ subsurface_add_to_list(struct wl_list *parent, struct tw_surface *surface,
 
 	wl_list_insert(node, &surface->links[TW_VIEW_GLOBAL_LINK]);
 	wl_list_for_each_reverse(sub, &surface->subsurfaces, parent_link) {
-		subsurface_add_to_list(&surface->links[TW_VIEW_GLOBAL_LINK],
-		                       sub->surface, sub->pos);
+		n += subsurface_add_to_list(
+			&surface->links[TW_VIEW_GLOBAL_LINK],
+			sub->surface, sub->pos);
 	}
+	return n;
 }
 
-static void
+/* returns the number of views added, subsurfaces included */
+static unsigned int
 surface_add_to_list(struct tw_layers_manager *manager,
                     struct tw_surface *surface)
 {
 	//we should also add to the output
 	struct tw_subsurface *sub;
+	unsigned int n = 1;
 
 	wl_list_insert(manager->views.prev,
 	               &surface->links[TW_VIEW_GLOBAL_LINK]);
@@ -239,8 +287,10 @@ surface_add_to_list(struct tw_layers_manager *manager,
 	//reverse order of the subsurfaces and insert them one by one in front
 	//of the main surface
 	wl_list_for_each_reverse(sub, &surface->subsurfaces, parent_link)
-		subsurface_add_to_list(&surface->links[TW_VIEW_GLOBAL_LINK],
-		                       sub->surface, sub->pos);
+		n += subsurface_add_to_list(
+			&surface->links[TW_VIEW_GLOBAL_LINK],
+			sub->surface, sub->pos);
+	return n;
 }
 
 static void
@@ -268,6 +318,136 @@ surface_add_to_outputs_list(struct tw_render_context *ctx,
 		surface_add_to_outputs_list(ctx, sub->surface);
 }
 
+static inline bool
+box_touches_rect(const pixman_box32_t *box, const pixman_rectangle32_t *rect)
+{
+	return box->x1 < rect->x + (int32_t)rect->width &&
+		box->x2 > rect->x &&
+		box->y1 < rect->y + (int32_t)rect->height &&
+		box->y2 > rect->y;
+}
+
+/* the surface touches the outputs in its output_mask, plus the ones under the
+ * area it just left */
+static void
+surface_add_to_touching_outputs(struct tw_render_context *ctx,
+                                struct tw_surface *surface)
+{
+	struct tw_surface **view;
+	struct tw_render_output *output;
+	struct tw_render_surface *render_surface =
+		wl_container_of(surface, render_surface, surface);
+	pixman_box32_t bbox = {
+		surface->geometry.xywh.x,
+		surface->geometry.xywh.y,
+		surface->geometry.xywh.x + surface->geometry.xywh.width,
+		surface->geometry.xywh.y + surface->geometry.xywh.height,
+	};
+	pixman_box32_t *dirty =
+		pixman_region32_extents(&surface->geometry.dirty);
+	bool moved = pixman_region32_not_empty(&surface->geometry.dirty);
+
+	wl_list_for_each(output, &ctx->outputs, link) {
+		pixman_rectangle32_t rect =
+			tw_output_device_geometry(&output->device);
+
+		if (!(render_surface->output_mask & (1u << output->device.id)) &&
+		    !box_touches_rect(&bbox, &rect) &&
+		    !(moved && box_touches_rect(dirty, &rect)))
+			continue;
+		if ((view = wl_array_add(&output->touching_views,
+		                         sizeof(*view))))
+			*view = surface;
+	}
+}
+
+/* damage where the view is and where it just was */
+static void
+surface_damage_outputs(struct tw_render_context *ctx,
+                       struct tw_surface *surface)
+{
+	pixman_region32_t area;
+	struct tw_render_output *output;
+
+	pixman_region32_init_rect(&area,
+	                          surface->geometry.xywh.x,
+	                          surface->geometry.xywh.y,
+	                          surface->geometry.xywh.width,
+	                          surface->geometry.xywh.height);
+	pixman_region32_union(&area, &area, &surface->geometry.dirty);
+	wl_list_for_each(output, &ctx->outputs, link)
+		tw_render_output_damage_region(output, &area);
+	pixman_region32_fini(&area);
+}
+
+static void
+damage_whole_outputs(struct tw_render_context *ctx)
+{
+	pixman_region32_t area;
+	struct tw_render_output *output;
+
+	wl_list_for_each(output, &ctx->outputs, link) {
+		pixman_rectangle32_t rect =
+			tw_output_device_geometry(&output->device);
+
+		pixman_region32_init_rect(&area, rect.x, rect.y,
+		                          rect.width, rect.height);
+		tw_render_output_damage_region(output, &area);
+		pixman_region32_fini(&area);
+	}
+}
+
+/* the renderers only damage the views in the list, the views leaving it, the
+ * ones entering it and the ones restacked are damaged here */
+static void
+record_prev_views(struct tw_render_context *ctx,
+                  struct tw_layers_manager *manager)
+{
+	unsigned int i = 0;
+	struct tw_surface *surface, **view;
+	struct tw_render_surface *render_surface;
+
+	ctx->views.prev.size = 0;
+	wl_list_for_each(surface, &manager->views, links[TW_VIEW_GLOBAL_LINK]) {
+		render_surface = wl_container_of(surface, render_surface,
+		                                 surface);
+		render_surface->view_build = ctx->views.build;
+		render_surface->view_index = i++;
+		if ((view = wl_array_add(&ctx->views.prev, sizeof(*view))))
+			*view = surface;
+	}
+}
+
+static void
+damage_changed_views(struct tw_render_context *ctx,
+                     struct tw_layers_manager *manager)
+{
+	unsigned int top = 0;
+	uint32_t prev_build = ctx->views.build - 1;
+	struct tw_surface *surface, **view;
+	struct tw_render_surface *render_surface;
+
+	//a view listed after one that used to come after it is restacked,
+	//what changed between the two is inside of both
+	wl_list_for_each(surface, &manager->views, links[TW_VIEW_GLOBAL_LINK]) {
+		render_surface = wl_container_of(surface, render_surface,
+		                                 surface);
+		if (render_surface->view_build != prev_build ||
+		    render_surface->view_index < top)
+			surface_damage_outputs(ctx, surface);
+		else
+			top = render_surface->view_index;
+		render_surface->view_build = ctx->views.build;
+	}
+	wl_array_for_each(view, &ctx->views.prev) {
+		render_surface = wl_container_of(*view, render_surface,
+		                                 surface);
+		if (render_surface->view_build == prev_build)
+			surface_damage_outputs(ctx, *view);
+	}
+	ctx->views.prev.size = 0;
+}
+
 WL_EXPORT void
 tw_render_context_build_view_list(struct tw_render_context *ctx,
                                   struct tw_layers_manager *manager)
@@ -275,23 +455,91 @@ tw_render_context_build_view_list(struct tw_render_context *ctx,
 	struct tw_surface *surface;
 	struct tw_layer *layer;
 	struct tw_render_output *output;
+	bool same_manager = ctx->views.manager == manager;
+
+	if (!ctx->views.dirty && same_manager &&
+	    ctx->views.serial == manager->serial)
+		return;
 
 	SCOPE_PROFILE_BEG();
 
+	//the old list is only valid for the manager it was built for
+	if (same_manager)
+		record_prev_views(ctx, manager);
+	else
+		damage_whole_outputs(ctx);
+	ctx->views.build++;
+	ctx->views.dirty = false;
+	ctx->views.manager = manager;
+	ctx->views.serial = manager->serial;
 	wl_list_init(&manager->views);
 	wl_list_for_each(output, &ctx->outputs, link)
 		wl_list_init(&output->views);
 
 	wl_list_for_each(layer, &manager->layers, link) {
+		layer->n_views = 0;
 		wl_list_for_each(surface, &layer->views, layer_link) {
-			surface_add_to_list(manager, surface);
+			layer->n_views += surface_add_to_list(manager, surface);
 			surface_add_to_outputs_list(ctx, surface);
 		}
 	}
+	wl_list_for_each(output, &ctx->outputs, link)
+		output->touching_views.size = 0;
+	wl_list_for_each(surface, &manager->views, links[TW_VIEW_GLOBAL_LINK])
+		surface_add_to_touching_outputs(ctx, surface);
+	if (same_manager)
+		damage_changed_views(ctx, manager);
 
 	SCOPE_PROFILE_END();
 }
 
+WL_EXPORT void
+tw_render_context_dirty_views(struct tw_render_context *ctx)
+{
+	ctx->views.dirty = true;
+}
+
+WL_EXPORT void
+tw_render_context_begin_frames(struct tw_render_context *ctx)
+{
+	struct tw_render_pipeline *pipeline;
+
+	ctx->in_batch = true;
+	wl_signal_emit(&ctx->signals.begin_frames, ctx);
+	wl_list_for_each(pipeline, &ctx->pipelines, link) {
+		if (!pipeline->impl.prepare_frame)
+			continue;
+		pipeline->impl.prepare_frame(pipeline);
+		pipeline->prepared = true;
+	}
+}
+
+WL_EXPORT void
+tw_render_context_end_frames(struct tw_render_context *ctx)
+{
+	struct tw_render_pipeline *pipeline;
+
+	wl_list_for_each(pipeline, &ctx->pipelines, link)
+		pipeline->prepared = false;
+	//the prepared scene is shared by the outputs of the batch
+	ctx->in_batch = false;
+	tw_render_arena_reset(&ctx->frame_arena);
+	wl_signal_emit(&ctx->signals.end_frames, ctx);
+}
+
+WL_EXPORT bool
+tw_render_context_get_object_stats(struct tw_render_context *ctx,
+                                   const struct wl_interface *interface,
+                                   struct tw_slab_stats *stats)
+{
+	struct tw_slab *slab = compositor_slab_for(interface);
+
+	if (!slab || !s_compositor_slabs.initialized)
+		return false;
+	tw_slab_sample_stats(slab, stats);
+	return true;
+}
+
 bool
 tw_render_context_init(struct tw_render_context *ctx,
                        struct wl_display *display,
@@ -307,15 +555,24 @@ tw_render_context_init(struct tw_render_context *ctx,
 	ctx->impl = impl;
 	ctx->display = display;
 	ctx->compositor_manager.obj_alloc = &tw_render_compositor_allocator;
+	compositor_slabs_init();
 
 	wl_list_init(&ctx->pipelines);
 	wl_list_init(&ctx->outputs);
+	ctx->views.dirty = true;
+	ctx->views.manager = NULL;
+	ctx->views.build = 0;
+	wl_array_init(&ctx->views.prev);
+	tw_render_arena_init(&ctx->frame_arena);
+	ctx->in_batch = false;
 
 	wl_signal_init(&ctx->signals.destroy);
 	wl_signal_init(&ctx->signals.destroy);
 	wl_signal_init(&ctx->signals.output_lost);
 	wl_signal_init(&ctx->signals.wl_surface_dirty);
 	wl_signal_init(&ctx->signals.wl_surface_destroy);
+	wl_signal_init(&ctx->signals.begin_frames);
+	wl_signal_init(&ctx->signals.end_frames);
 
 	return true;
 }
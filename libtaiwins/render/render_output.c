@@ -37,6 +37,7 @@
 
 #include "render.h"
 #include "output_device.h"
+#include "probes.h"
 
 static inline bool
 check_bits(uint32_t data, uint32_t mask)
@@ -58,13 +59,12 @@ static void
 init_output_state(struct tw_render_output *o)
 {
 	wl_list_init(&o->link);
-	//okay, here is what we will need to fix
-	for (int i = 0; i < 3; i++)
+	wl_array_init(&o->touching_views);
+	for (int i = 0; i < TW_DAMAGE_HISTORY_CNT; i++)
 		pixman_region32_init(&o->state.damages[i]);
 
+	o->state.damage_head = 0;
 	o->state.pending_damage = &o->state.damages[0];
-	o->state.curr_damage = &o->state.damages[1];
-	o->state.prev_damage = &o->state.damages[2];
 	o->state.repaint_state = TW_REPAINT_DIRTY;
 	tw_mat3_init(&o->state.view_2d);
 }
@@ -73,11 +73,25 @@ static void
 fini_output_state(struct tw_render_output *o)
 {
 	wl_list_remove(&o->link);
+	wl_array_release(&o->touching_views);
 
-	for (int i = 0; i < 3; i++)
+	for (int i = 0; i < TW_DAMAGE_HISTORY_CNT; i++)
 		pixman_region32_fini(&o->state.damages[i]);
 }
 
+/* the buffers we presented are no longer valid after mode changes, every
+ * buffer would be treated as completely damaged */
+static void
+reset_output_damage(struct tw_render_output *o)
+{
+	pixman_rectangle32_t rect = tw_output_device_geometry(&o->device);
+
+	for (int i = 0; i < TW_DAMAGE_HISTORY_CNT; i++)
+		pixman_region32_union_rect(&o->state.damages[i],
+		                           &o->state.damages[i], 0, 0,
+		                           rect.width, rect.height);
+}
+
 static void
 rebuild_render_output_view_mat(struct tw_render_output *output)
 {
@@ -109,22 +123,21 @@ rebuild_render_output_view_mat(struct tw_render_output *output)
 
 /**
  * @brief manage the backend output damage state
+ *
+ * The pending damage becomes the damage of last frame, the oldest damage in
+ * the ring is recycled as the new pending damage. Renderer composes the buffer
+ * damage with the history based on the buffer age, so it works for any
+ * swapchain depth up to TW_DAMAGE_HISTORY_CNT.
  */
 static inline void
 shuffle_output_damage(struct tw_render_output *output)
 {
-	//here we swap the damage as if it is output is triple-buffered. It is
-	//okay even if output is actually double buffered, as we only need to
-	//ensure that renderer requested the correct damage based on the age.
-	pixman_region32_t *curr = output->state.curr_damage;
-	pixman_region32_t *pending = output->state.pending_damage;
-	pixman_region32_t *previous = output->state.prev_damage;
-
-	//later on renderer will access either current or previous damage for
-	//composing buffer_damage.
-	output->state.curr_damage = pending;
-	output->state.prev_damage = curr;
-	output->state.pending_damage = previous;
+	unsigned int head =
+		(output->state.damage_head + 1) % TW_DAMAGE_HISTORY_CNT;
+
+	output->state.damage_head = head;
+	output->state.pending_damage = &output->state.damages[head];
+	tw_region_reset(output->state.pending_damage);
 }
 
 /*
@@ -149,7 +162,8 @@ tick_render_output_frame(struct tw_render_output *output)
 
 	assert(ctx);
 	buffer_age = tw_render_presentable_make_current(presentable, ctx);
-	buffer_age = (buffer_age < 0) ? 2 : buffer_age;
+	//unknown buffer age, the content of the buffer is undefined.
+	buffer_age = (buffer_age < 0) ? 0 : buffer_age;
 
 	wl_list_for_each(pipeline, &ctx->pipelines, link)
 		tw_render_pipeline_repaint(pipeline, output, buffer_age);
@@ -177,6 +191,11 @@ notify_render_output_new_mode(struct wl_listener *listener, void *data)
 	struct tw_render_output *output =
 		wl_container_of(listener, output, listeners.set_mode);
 	rebuild_render_output_view_mat(output);
+	reset_output_damage(output);
+	output->state.repaint_causes |= TW_REPAINT_CAUSE_OUTPUT;
+	//the output geometry decides which views touch it
+	if (output->ctx)
+		tw_render_context_dirty_views(output->ctx);
 }
 
 /******************************************************************************
@@ -238,6 +257,7 @@ tw_render_output_set_context(struct tw_render_output *output,
 	output->ctx = ctx;
 	tw_reset_wl_list(&output->link);
 	wl_list_insert(ctx->outputs.prev, &output->link);
+	tw_render_context_dirty_views(ctx);
 }
 
 void
@@ -248,6 +268,7 @@ tw_render_output_unset_context(struct tw_render_output *output)
 	assert(!output->surface.handle);
 	output->ctx = NULL;
 	tw_reset_wl_list(&output->link);
+	tw_render_context_dirty_views(ctx);
 	wl_signal_emit(&ctx->signals.output_lost, output);
 }
 
@@ -271,6 +292,56 @@ tw_render_output_dirty(struct tw_render_output *output)
 		wl_signal_emit(&output->signals.need_frame, output);
 }
 
+WL_EXPORT void
+tw_render_output_dirty_cause(struct tw_render_output *output,
+                             enum tw_render_output_repaint_cause cause)
+{
+	output->state.repaint_causes |= cause;
+	tw_render_output_dirty(output);
+}
+
+WL_EXPORT void
+tw_render_output_damage_region(struct tw_render_output *output,
+                               const pixman_region32_t *damage)
+{
+	pixman_region32_t local;
+	pixman_rectangle32_t rect = tw_output_device_geometry(&output->device);
+
+	pixman_region32_init(&local);
+	pixman_region32_intersect_rect(&local,
+	                               (pixman_region32_t *)damage,
+	                               rect.x, rect.y, rect.width, rect.height);
+	pixman_region32_translate(&local, -rect.x, -rect.y);
+	pixman_region32_union(output->state.pending_damage,
+	                      output->state.pending_damage, &local);
+	pixman_region32_fini(&local);
+}
+
+WL_EXPORT void
+tw_render_output_get_buffer_damage(struct tw_render_output *output,
+                                   int buffer_age, pixman_region32_t *damage)
+{
+	unsigned int idx;
+	pixman_rectangle32_t rect = tw_output_device_geometry(&output->device);
+
+	if (buffer_age <= 0 || buffer_age > TW_DAMAGE_HISTORY_CNT) {
+		pixman_region32_clear(damage);
+		pixman_region32_union_rect(damage, damage, 0, 0,
+		                           rect.width, rect.height);
+		return;
+	}
+	pixman_region32_copy(damage, output->state.pending_damage);
+	//a buffer of age N missed the last N-1 frames
+	for (int i = 1; i < buffer_age; i++) {
+		idx = (output->state.damage_head + TW_DAMAGE_HISTORY_CNT - i) %
+			TW_DAMAGE_HISTORY_CNT;
+		pixman_region32_union(damage, damage,
+		                      &output->state.damages[idx]);
+	}
+	pixman_region32_intersect_rect(damage, damage, 0, 0,
+	                               rect.width, rect.height);
+}
+
 WL_EXPORT void
 tw_render_output_post_frame(struct tw_render_output *output)
 {
@@ -284,9 +355,16 @@ tw_render_output_post_frame(struct tw_render_output *output)
 		return;
 
 	output->state.repaint_state |= TW_REPAINT_SCHEDULED;
+	TW_PROBE2(frame_begin, output->device.id,
+	          output->state.repaint_causes);
 	wl_signal_emit(&output->signals.pre_frame, output);
 	tick_render_output_frame(output);
 	wl_signal_emit(&output->signals.post_frame, output);
+	TW_PROBE1(frame_end, output->device.id);
+	output->state.repaint_causes = 0;
+	//nothing of the frame lives past here, unless the batch goes on
+	if (!output->ctx->in_batch)
+		tw_render_arena_reset(&output->ctx->frame_arena);
 }
 
 /*
@@ -314,9 +392,11 @@ tw_render_output_present(struct tw_render_output *output,
 	struct timespec now;
 	if (event == NULL) {
 		event = &_event;
-		clock_gettime(dev->clk_id, &now);
+		tw_output_device_get_time(dev, &now);
 		event->time = now;
 	}
 	event->refresh = tw_millihertz_to_ns(mhz);
+	TW_PROBE3(present, output->device.id, event->time.tv_sec,
+	          event->time.tv_nsec);
 	wl_signal_emit(&output->signals.present, event);
 }
@@ -31,6 +31,8 @@ tw_render_pipeline_init(struct tw_render_pipeline *pipeline,
 	assert(ctx);
 	pipeline->name = name;
 	pipeline->ctx = ctx;
+	pipeline->prepared = false;
+	pipeline->impl.prepare_frame = NULL;
 	wl_list_init(&pipeline->link);
 	wl_list_init(&pipeline->ctx_destroy.link);
 
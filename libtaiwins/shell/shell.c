@@ -79,6 +79,7 @@ shell_create_ui_element(struct tw_shell *shell,
 	// install surface data.
 	tw_reset_wl_list(&surface->layer_link);
 	wl_list_insert(layer->views.prev, &surface->layer_link);
+	tw_layer_dirty(layer);
 	//TODO we should check for the ROLE assigning
 	shell_ui_set_role(elem, role, surface);
 	wl_list_init(&elem->grab_close.link);
@@ -203,8 +204,11 @@ shell_ui_unbind(struct wl_resource *resource)
 	struct tw_shell_ui *ui  = wl_resource_get_user_data(resource);
 	struct tw_shell_output *output = ui->output;
 
-	if (ui->binded)
+	if (ui->binded) {
 		tw_reset_wl_list(&ui->binded->layer_link);
+		if (ui->layer)
+			tw_layer_dirty(ui->layer);
+	}
 	tw_reset_wl_list(&ui->surface_destroy.link);
 	tw_reset_wl_list(&ui->grab_close.link);
 
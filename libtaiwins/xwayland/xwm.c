@@ -46,6 +46,7 @@
 
 #include "xwayland/xwm.h"
 #include "xwayland/xsurface.h"
+#include "probes.h"
 
 /******************************************************************************
  * handlers
@@ -207,8 +208,10 @@ handle_x11_events(int fd, uint32_t mask, void *data)
 		destroy_xwm(xwm);
 		return 0;
 	}
+	TW_PROBE(xwm_events_begin);
 	while ((event = xcb_poll_for_event(xwm->xcb_conn))) {
 		count++;
+		TW_PROBE1(xwm_event, event->response_type);
 		if (tw_xwm_handle_selection_event(xwm, event)) {
 			free(event);
 			continue;
@@ -237,6 +240,7 @@ handle_x11_events(int fd, uint32_t mask, void *data)
 
 		free(event);
 	}
+	TW_PROBE1(xwm_events_end, count);
 	if (count)
 		xcb_flush(xwm->xcb_conn);
 	return count;
@@ -0,0 +1,1054 @@
+#include <assert.h>
+#include <errno.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include <pixman.h>
+#include <wayland-server-core.h>
+#include <wayland-server.h>
+#include <wayland-client.h>
+#include <wayland-xdg-shell-client-protocol.h>
+#include <ctypes/helpers.h>
+#include <taiwins/objects/logger.h>
+#include <taiwins/objects/surface.h>
+#include <taiwins/objects/utils.h>
+#include <taiwins/backend.h>
+#include <taiwins/backend_headless.h>
+#include <taiwins/engine.h>
+#include <taiwins/render_context.h>
+#include <taiwins/render_pipeline.h>
+#include <taiwins/render_output.h>
+#include "test_desktop.h"
+#include "../tools/replay.h"
+
+/*
+ * tw-bench-compositor runs the compositor on the headless backend with the
+ * pixman renderer, so it needs no GPU, and forks synthetic wl_shm clients
+ * committing at a fixed rate. Only the compositor process is measured, the
+ * clients are separate processes. With --replay a session recorded by
+ * `taiwins --record-session` is played instead of the synthetic clients, and
+ * --input replays a TW_INPUT_RECORD recording through the headless seat.
+ */
+
+#define MAX_OUTPUTS 8
+#define MAX_CLIENTS 256
+#define CLIENT_BUFFERS 3
+#define CLIENT_OFFSET 24
+
+struct tw_render_pipeline *
+tw_pixman_render_pipeline_create_default(struct tw_render_context *ctx,
+                                         struct tw_layers_manager *manager);
+struct tw_server_output_manager *
+tw_server_output_manager_create_global(struct tw_engine *engine,
+                                       struct tw_render_context *ctx);
+
+enum bench_damage {
+	BENCH_DAMAGE_FULL,
+	BENCH_DAMAGE_RECT,
+	BENCH_DAMAGE_SCROLL,
+	BENCH_DAMAGE_VIDEO,
+};
+
+static const char *damage_names[] = {
+	[BENCH_DAMAGE_FULL] = "full",
+	[BENCH_DAMAGE_RECT] = "rect",
+	[BENCH_DAMAGE_SCROLL] = "scroll",
+	[BENCH_DAMAGE_VIDEO] = "video",
+};
+
+static struct bench_options {
+	struct {
+		unsigned int w, h;
+	} outputs[MAX_OUTPUTS];
+	int n_outputs;
+	int n_clients;
+	unsigned int client_w, client_h;
+	unsigned int rate; /**< commits per second, 0 follows frame callbacks */
+	unsigned int refresh; /**< output refresh in Hz, 0 is unthrottled */
+	bool manual_clock;
+	enum bench_damage damage;
+	unsigned int seconds, warmup;
+	const char *replay, *input;
+	double replay_speed;
+} opts = {
+	.n_clients = 4,
+	.client_w = 640,
+	.client_h = 480,
+	.rate = 60,
+	.damage = BENCH_DAMAGE_FULL,
+	.seconds = 5,
+	.warmup = 1,
+	.replay_speed = 1.0,
+};
+
+/******************************************************************************
+ * synthetic client
+ *****************************************************************************/
+
+struct bench_buffer {
+	struct wl_buffer *wl_buffer;
+	uint32_t *data;
+	bool busy;
+};
+
+struct bench_client {
+	struct wl_display *display;
+	struct wl_compositor *compositor;
+	struct wl_shm *shm;
+	struct xdg_wm_base *wm_base;
+	struct wl_surface *surface;
+	struct xdg_surface *xdg_surface;
+	struct xdg_toplevel *toplevel;
+	struct wl_callback *frame;
+
+	struct bench_buffer buffers[CLIENT_BUFFERS];
+	unsigned int w, h, stride;
+	unsigned int seq;
+	bool configured, frame_done;
+	pixman_box32_t last_rect;
+};
+
+static void
+handle_global(void *data, struct wl_registry *registry, uint32_t name,
+              const char *interface, uint32_t version)
+{
+	struct bench_client *client = data;
+
+	if (!strcmp(interface, wl_compositor_interface.name))
+		client->compositor = wl_registry_bind(registry, name,
+		                                      &wl_compositor_interface,
+		                                      MIN(version, 4));
+	else if (!strcmp(interface, wl_shm_interface.name))
+		client->shm = wl_registry_bind(registry, name,
+		                               &wl_shm_interface, 1);
+	else if (!strcmp(interface, xdg_wm_base_interface.name))
+		client->wm_base = wl_registry_bind(registry, name,
+		                                   &xdg_wm_base_interface, 1);
+}
+
+static void
+handle_global_remove(void *data, struct wl_registry *registry, uint32_t name)
+{
+}
+
+static const struct wl_registry_listener registry_listener = {
+	.global = handle_global,
+	.global_remove = handle_global_remove,
+};
+
+static void
+handle_wm_base_ping(void *data, struct xdg_wm_base *wm_base, uint32_t serial)
+{
+	xdg_wm_base_pong(wm_base, serial);
+}
+
+static const struct xdg_wm_base_listener wm_base_listener = {
+	.ping = handle_wm_base_ping,
+};
+
+static void
+handle_xdg_surface_configure(void *data, struct xdg_surface *xdg_surface,
+                             uint32_t serial)
+{
+	struct bench_client *client = data;
+
+	xdg_surface_ack_configure(xdg_surface, serial);
+	client->configured = true;
+}
+
+static const struct xdg_surface_listener xdg_surface_listener = {
+	.configure = handle_xdg_surface_configure,
+};
+
+//the client keeps its own size, whatever the desktop suggests
+static void
+handle_toplevel_configure(void *data, struct xdg_toplevel *toplevel,
+                          int32_t width, int32_t height,
+                          struct wl_array *states)
+{
+}
+
+static void
+handle_toplevel_close(void *data, struct xdg_toplevel *toplevel)
+{
+}
+
+static const struct xdg_toplevel_listener toplevel_listener = {
+	.configure = handle_toplevel_configure,
+	.close = handle_toplevel_close,
+};
+
+static void
+handle_buffer_release(void *data, struct wl_buffer *wl_buffer)
+{
+	struct bench_buffer *buffer = data;
+	buffer->busy = false;
+}
+
+static const struct wl_buffer_listener buffer_listener = {
+	.release = handle_buffer_release,
+};
+
+static void
+handle_frame_done(void *data, struct wl_callback *callback, uint32_t time)
+{
+	struct bench_client *client = data;
+
+	wl_callback_destroy(callback);
+	client->frame = NULL;
+	client->frame_done = true;
+}
+
+static const struct wl_callback_listener frame_listener = {
+	.done = handle_frame_done,
+};
+
+static bool
+client_create_buffers(struct bench_client *client)
+{
+	struct wl_shm_pool *pool;
+	size_t size = (size_t)client->stride * client->h;
+	uint8_t *data;
+	int fd = memfd_create("tw-bench-client", MFD_CLOEXEC);
+
+	if (fd < 0)
+		return false;
+	if (ftruncate(fd, size * CLIENT_BUFFERS) < 0) {
+		close(fd);
+		return false;
+	}
+	data = mmap(NULL, size * CLIENT_BUFFERS, PROT_READ | PROT_WRITE,
+	            MAP_SHARED, fd, 0);
+	if (data == MAP_FAILED) {
+		close(fd);
+		return false;
+	}
+	pool = wl_shm_create_pool(client->shm, fd, size * CLIENT_BUFFERS);
+	for (int i = 0; i < CLIENT_BUFFERS; i++) {
+		struct bench_buffer *buffer = &client->buffers[i];
+
+		buffer->data = (uint32_t *)(data + size * i);
+		buffer->wl_buffer =
+			wl_shm_pool_create_buffer(pool, size * i,
+			                          client->w, client->h,
+			                          client->stride,
+			                          WL_SHM_FORMAT_XRGB8888);
+		wl_buffer_add_listener(buffer->wl_buffer, &buffer_listener,
+		                       buffer);
+		memset(buffer->data, 0x40, size);
+	}
+	wl_shm_pool_destroy(pool);
+	close(fd);
+	return true;
+}
+
+static void
+fill_rect(struct bench_client *client, uint32_t *data,
+          const pixman_box32_t *box, uint32_t color)
+{
+	for (int y = box->y1; y < box->y2; y++) {
+		uint32_t *row = data + (size_t)y * client->w;
+		for (int x = box->x1; x < box->x2; x++)
+			row[x] = color;
+	}
+}
+
+/* draw the next frame into the buffer and return the damage, in buffer
+ * coordinates */
+static void
+client_draw(struct bench_client *client, struct bench_buffer *buffer,
+            pixman_box32_t *damage, int *n_damage)
+{
+	unsigned int w = client->w, h = client->h, seq = client->seq++;
+	uint32_t color = 0xff000000 | (seq * 0x010305);
+	pixman_box32_t full = {0, 0, w, h};
+
+	switch (opts.damage) {
+	case BENCH_DAMAGE_FULL:
+		fill_rect(client, buffer->data, &full, color);
+		damage[0] = full;
+		*n_damage = 1;
+		break;
+	case BENCH_DAMAGE_RECT: {
+		//a small square moving across, like a blinking cursor or a
+		//spinner, the old spot is damaged as well
+		int size = MIN(64, (int)MIN(w, h));
+		int x = (seq * 7) % (w - size + 1);
+		int y = (seq * 3) % (h - size + 1);
+		pixman_box32_t rect = {x, y, x + size, y + size};
+
+		fill_rect(client, buffer->data, &client->last_rect, 0xff404040);
+		fill_rect(client, buffer->data, &rect, color);
+		damage[0] = client->last_rect;
+		damage[1] = rect;
+		*n_damage = 2;
+		client->last_rect = rect;
+		break;
+	}
+	case BENCH_DAMAGE_SCROLL: {
+		//content moves up, new lines come in at the bottom
+		unsigned int lines = MIN(16u, h);
+		pixman_box32_t bottom = {0, h - lines, w, h};
+
+		memmove(buffer->data, buffer->data + (size_t)lines * w,
+		        (size_t)(h - lines) * client->stride);
+		fill_rect(client, buffer->data, &bottom, color);
+		damage[0] = full;
+		*n_damage = 1;
+		break;
+	}
+	case BENCH_DAMAGE_VIDEO: {
+		//a 16:9 player in the middle, the rest of the window is static
+		unsigned int vw = w * 3 / 4, vh = MIN(vw * 9 / 16, h);
+		pixman_box32_t video = {
+			(w - vw) / 2, (h - vh) / 2,
+			(w - vw) / 2 + vw, (h - vh) / 2 + vh,
+		};
+
+		fill_rect(client, buffer->data, &video, color);
+		damage[0] = video;
+		*n_damage = 1;
+		break;
+	}
+	}
+}
+
+static void
+client_commit(struct bench_client *client)
+{
+	struct bench_buffer *buffer = NULL;
+	pixman_box32_t damage[2];
+	int n_damage = 0;
+
+	for (int i = 0; i < CLIENT_BUFFERS; i++) {
+		if (!client->buffers[i].busy) {
+			buffer = &client->buffers[i];
+			break;
+		}
+	}
+	//compositor is holding all of them, skip this one
+	if (!buffer)
+		return;
+	client_draw(client, buffer, damage, &n_damage);
+	buffer->busy = true;
+	wl_surface_attach(client->surface, buffer->wl_buffer, 0, 0);
+	for (int i = 0; i < n_damage; i++)
+		wl_surface_damage_buffer(client->surface,
+		                         damage[i].x1, damage[i].y1,
+		                         damage[i].x2 - damage[i].x1,
+		                         damage[i].y2 - damage[i].y1);
+	if (!client->frame) {
+		client->frame = wl_surface_frame(client->surface);
+		wl_callback_add_listener(client->frame, &frame_listener,
+		                         client);
+	}
+	client->frame_done = false;
+	wl_surface_commit(client->surface);
+}
+
+static int
+run_client(const char *socket)
+{
+	struct bench_client client = {
+		.w = opts.client_w,
+		.h = opts.client_h,
+		.stride = opts.client_w * 4,
+	};
+	struct wl_registry *registry;
+	struct pollfd fds[2];
+	int timer = -1;
+
+	if (!(client.display = wl_display_connect(socket)))
+		return EXIT_FAILURE;
+	registry = wl_display_get_registry(client.display);
+	wl_registry_add_listener(registry, &registry_listener, &client);
+	wl_display_roundtrip(client.display);
+	if (!client.compositor || !client.shm || !client.wm_base)
+		return EXIT_FAILURE;
+	xdg_wm_base_add_listener(client.wm_base, &wm_base_listener, &client);
+
+	client.surface = wl_compositor_create_surface(client.compositor);
+	client.xdg_surface = xdg_wm_base_get_xdg_surface(client.wm_base,
+	                                                 client.surface);
+	xdg_surface_add_listener(client.xdg_surface, &xdg_surface_listener,
+	                         &client);
+	client.toplevel = xdg_surface_get_toplevel(client.xdg_surface);
+	xdg_toplevel_add_listener(client.toplevel, &toplevel_listener,
+	                          &client);
+	xdg_toplevel_set_title(client.toplevel, "tw-bench-client");
+	wl_surface_commit(client.surface);
+	while (!client.configured)
+		if (wl_display_dispatch(client.display) < 0)
+			return EXIT_FAILURE;
+	if (!client_create_buffers(&client))
+		return EXIT_FAILURE;
+	client_commit(&client);
+
+	if (opts.rate) {
+		long ns = TW_NS_PER_S / opts.rate;
+		struct itimerspec spec = {
+			.it_interval = {ns / TW_NS_PER_S, ns % TW_NS_PER_S},
+			.it_value = {ns / TW_NS_PER_S, ns % TW_NS_PER_S},
+		};
+		timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+		if (timer < 0 || timerfd_settime(timer, 0, &spec, NULL) < 0)
+			return EXIT_FAILURE;
+	}
+	fds[0] = (struct pollfd){wl_display_get_fd(client.display), POLLIN};
+	fds[1] = (struct pollfd){timer, POLLIN};
+
+	//runs until the compositor goes away
+	while (true) {
+		uint64_t expired;
+
+		while (wl_display_prepare_read(client.display) != 0)
+			if (wl_display_dispatch_pending(client.display) < 0)
+				return EXIT_SUCCESS;
+		if (wl_display_flush(client.display) < 0 && errno != EAGAIN) {
+			wl_display_cancel_read(client.display);
+			return EXIT_SUCCESS;
+		}
+		if (poll(fds, timer >= 0 ? 2 : 1, -1) < 0 && errno != EINTR) {
+			wl_display_cancel_read(client.display);
+			return EXIT_FAILURE;
+		}
+		if (fds[0].revents & POLLIN) {
+			if (wl_display_read_events(client.display) < 0)
+				return EXIT_SUCCESS;
+		} else {
+			wl_display_cancel_read(client.display);
+		}
+		if (fds[0].revents & (POLLHUP | POLLERR))
+			return EXIT_SUCCESS;
+		if (wl_display_dispatch_pending(client.display) < 0)
+			return EXIT_SUCCESS;
+
+		if (timer >= 0 && (fds[1].revents & POLLIN) &&
+		    read(timer, &expired, sizeof(expired)) > 0)
+			client_commit(&client);
+		else if (timer < 0 && client.frame_done)
+			client_commit(&client);
+	}
+}
+
+/******************************************************************************
+ * compositor side
+ *****************************************************************************/
+
+struct bench_output {
+	struct tw_render_output *output;
+	struct timespec frame_start;
+	struct wl_listener pre_frame, post_frame;
+};
+
+struct bench_surface {
+	struct wl_list link;
+	struct tw_surface *surface;
+	struct wl_listener commit, destroy;
+};
+
+static struct bench {
+	struct wl_display *display;
+	struct tw_render_context *ctx;
+	struct wl_list surfaces;
+	struct bench_output outputs[MAX_OUTPUTS];
+	int n_outputs;
+	bool measuring, running;
+	struct tw_backend *backend;
+
+	pid_t clients[MAX_CLIENTS];
+	int n_clients;
+	int n_placed; /**< surfaces moved off the origin */
+
+	uint64_t frames, commits, upload_bytes;
+	uint64_t frame_allocs, alloc_batches;
+	uint64_t batch_allocs; /* frame_allocs at begin_frames */
+	bool in_frame;
+	uint32_t *frame_us;
+	size_t n_frame_us, cap_frame_us;
+
+	struct timespec start, end;
+	struct rusage usage_start, usage_end;
+
+	struct wl_listener new_output;
+	struct wl_listener surface_dirty;
+	struct wl_listener begin_frames, end_frames;
+} bench = {0};
+
+/******************************************************************************
+ * allocation counter
+ *****************************************************************************/
+
+/* the compositor allocates nothing inside a steady frame, we count the calls
+ * from begin_frames to end_frames of every batch by interposing the glibc
+ * allocator */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+void *
+malloc(size_t size)
+{
+	bench.frame_allocs += bench.in_frame;
+	return __libc_malloc(size);
+}
+
+void *
+calloc(size_t nmemb, size_t size)
+{
+	bench.frame_allocs += bench.in_frame;
+	return __libc_calloc(nmemb, size);
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+	bench.frame_allocs += bench.in_frame;
+	return __libc_realloc(ptr, size);
+}
+
+static void
+bench_add_frame_time(uint32_t us)
+{
+	if (bench.n_frame_us == bench.cap_frame_us) {
+		size_t cap = bench.cap_frame_us ? bench.cap_frame_us * 2 : 1024;
+		uint32_t *samples = realloc(bench.frame_us,
+		                            cap * sizeof(*samples));
+		if (!samples)
+			return;
+		bench.frame_us = samples;
+		bench.cap_frame_us = cap;
+	}
+	bench.frame_us[bench.n_frame_us++] = us;
+}
+
+static void
+notify_bench_pre_frame(struct wl_listener *listener, void *data)
+{
+	struct bench_output *output =
+		wl_container_of(listener, output, pre_frame);
+	clock_gettime(CLOCK_MONOTONIC, &output->frame_start);
+}
+
+static void
+notify_bench_post_frame(struct wl_listener *listener, void *data)
+{
+	struct bench_output *output =
+		wl_container_of(listener, output, post_frame);
+	struct timespec now;
+	bool in_frame = bench.in_frame;
+
+	if (!bench.measuring)
+		return;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	bench.frames++;
+	//the samples are ours, not the compositor's
+	bench.in_frame = false;
+	bench_add_frame_time(tw_timespec_diff_us(&now, &output->frame_start));
+	bench.in_frame = in_frame;
+}
+
+static void
+notify_bench_begin_frames(struct wl_listener *listener, void *data)
+{
+	bench.batch_allocs = bench.frame_allocs;
+	bench.in_frame = bench.measuring;
+}
+
+static void
+notify_bench_end_frames(struct wl_listener *listener, void *data)
+{
+	if (bench.in_frame && bench.frame_allocs != bench.batch_allocs)
+		bench.alloc_batches++;
+	bench.in_frame = false;
+}
+
+static void
+notify_bench_new_output(struct wl_listener *listener, void *data)
+{
+	struct tw_output_device *device = data;
+	struct tw_render_output *render_output =
+		wl_container_of(device, render_output, device);
+	struct bench_output *output;
+
+	if (bench.n_outputs >= MAX_OUTPUTS)
+		return;
+	output = &bench.outputs[bench.n_outputs++];
+	output->output = render_output;
+	tw_signal_setup_listener(&render_output->signals.pre_frame,
+	                         &output->pre_frame, notify_bench_pre_frame);
+	tw_signal_setup_listener(&render_output->signals.post_frame,
+	                         &output->post_frame,
+	                         notify_bench_post_frame);
+}
+
+static void
+notify_bench_surface_commit(struct wl_listener *listener, void *data)
+{
+	struct bench_surface *surface =
+		wl_container_of(listener, surface, commit);
+	struct tw_view *current = surface->surface->current;
+	pixman_box32_t *boxes;
+	int n;
+
+	if (!bench.measuring)
+		return;
+	bench.commits++;
+	if (!(current->commit_state & TW_SURFACE_ATTACHED))
+		return;
+	//what a GPU renderer has to upload for this commit
+	boxes = pixman_region32_rectangles(&current->buffer_damage, &n);
+	for (int i = 0; i < n; i++)
+		bench.upload_bytes += (uint64_t)(boxes[i].x2 - boxes[i].x1) *
+			(boxes[i].y2 - boxes[i].y1) * 4;
+}
+
+static void
+notify_bench_surface_destroy(struct wl_listener *listener, void *data)
+{
+	struct bench_surface *surface =
+		wl_container_of(listener, surface, destroy);
+
+	wl_list_remove(&surface->commit.link);
+	wl_list_remove(&surface->destroy.link);
+	wl_list_remove(&surface->link);
+	free(surface);
+}
+
+/* surfaces are picked up on their first dirty commit, the commit signal comes
+ * after it so that commit is counted as well */
+static void
+notify_bench_surface_dirty(struct wl_listener *listener, void *data)
+{
+	struct tw_surface *tw_surface = data;
+	struct bench_surface *surface;
+	int offset;
+
+	wl_list_for_each(surface, &bench.surfaces, link)
+		if (surface->surface == tw_surface)
+			return;
+	if (!(surface = calloc(1, sizeof(*surface))))
+		return;
+	surface->surface = tw_surface;
+	wl_list_insert(&bench.surfaces, &surface->link);
+	tw_signal_setup_listener(&tw_surface->signals.commit,
+	                         &surface->commit,
+	                         notify_bench_surface_commit);
+	tw_signal_setup_listener(&tw_surface->signals.destroy,
+	                         &surface->destroy,
+	                         notify_bench_surface_destroy);
+	//away from the origin, so the renderer paints through a translation
+	//and the allocation count covers it. It is listed by now, the dirty
+	//signal of the move returns above
+	offset = CLIENT_OFFSET * (bench.n_placed++ % 16 + 1);
+	tw_surface_set_position(tw_surface, offset, offset);
+}
+
+static int
+handle_bench_warmup_done(void *data)
+{
+	bench.measuring = true;
+	clock_gettime(CLOCK_MONOTONIC, &bench.start);
+	getrusage(RUSAGE_SELF, &bench.usage_start);
+	return 0;
+}
+
+static int
+handle_bench_done(void *data)
+{
+	clock_gettime(CLOCK_MONOTONIC, &bench.end);
+	getrusage(RUSAGE_SELF, &bench.usage_end);
+	bench.measuring = false;
+	bench.running = false;
+	wl_display_terminate(bench.display);
+	return 0;
+}
+
+static void
+bench_spawn_clients(const char *socket)
+{
+	for (int i = 0; i < opts.n_clients; i++) {
+		pid_t pid = fork();
+
+		if (pid == 0)
+			_exit(run_client(socket));
+		else if (pid > 0)
+			bench.clients[bench.n_clients++] = pid;
+		else
+			tw_logl_level(TW_LOG_ERRO, "failed to fork client %d",
+			              i);
+	}
+}
+
+static void
+bench_spawn_replay(const char *socket)
+{
+	pid_t pid = fork();
+
+	if (pid == 0) {
+		struct tw_replay_stats stats;
+		bool ok = tw_replay_run(opts.replay, socket,
+		                        opts.replay_speed, &stats);
+
+		tw_replay_print_stats(&stats, stdout);
+		fflush(stdout);
+		_exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+	} else if (pid > 0) {
+		bench.clients[bench.n_clients++] = pid;
+	} else {
+		tw_logl_level(TW_LOG_ERRO, "failed to fork the replay");
+	}
+}
+
+/* the replay is the only child, the run ends with it */
+static int
+handle_bench_child(int signal_number, void *data)
+{
+	if (bench.n_clients &&
+	    waitpid(bench.clients[0], NULL, WNOHANG) == bench.clients[0]) {
+		bench.n_clients = 0;
+		handle_bench_done(NULL);
+	}
+	return 0;
+}
+
+/* vblanks come as soon as the compositor is idle, faster than real time */
+static void
+bench_run_manual_clock(struct wl_event_loop *loop)
+{
+	bench.running = true;
+	while (bench.running) {
+		wl_display_flush_clients(bench.display);
+		wl_event_loop_dispatch(loop, 0);
+		if (bench.running &&
+		    !tw_headless_backend_step_vblank(bench.backend)) {
+			wl_display_flush_clients(bench.display);
+			wl_event_loop_dispatch(loop, 10);
+		}
+	}
+}
+
+static void
+bench_reap_clients(void)
+{
+	for (int i = 0; i < bench.n_clients; i++)
+		kill(bench.clients[i], SIGTERM);
+	for (int i = 0; i < bench.n_clients; i++)
+		waitpid(bench.clients[i], NULL, 0);
+}
+
+static int
+cmp_samples(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	return (x > y) - (x < y);
+}
+
+static long
+rusage_cpu_us(const struct rusage *usage)
+{
+	return usage->ru_utime.tv_sec * 1000000L + usage->ru_utime.tv_usec +
+		usage->ru_stime.tv_sec * 1000000L + usage->ru_stime.tv_usec;
+}
+
+static bool
+bench_report(void)
+{
+	double secs = tw_timespec_diff_us(&bench.end, &bench.start) / 1e6;
+	long cpu_us = rusage_cpu_us(&bench.usage_end) -
+		rusage_cpu_us(&bench.usage_start);
+	size_t n = bench.n_frame_us;
+
+	printf("outputs %d", opts.n_outputs);
+	for (int i = 0; i < opts.n_outputs; i++)
+		printf("%s%ux%u", i ? "," : " ", opts.outputs[i].w,
+		       opts.outputs[i].h);
+	if (opts.refresh)
+		printf(" at %u Hz", opts.refresh);
+	if (opts.manual_clock)
+		printf(", manual clock");
+	if (opts.replay) {
+		printf(", replay %s at %gx, %.2f s\n", opts.replay,
+		       opts.replay_speed, secs);
+	} else {
+		printf(", clients %d %ux%u at ", opts.n_clients,
+		       opts.client_w, opts.client_h);
+		if (opts.rate)
+			printf("%u Hz", opts.rate);
+		else
+			printf("frame callbacks");
+		printf(", damage %s, %.2f s\n", damage_names[opts.damage],
+		       secs);
+	}
+
+	if (secs <= 0.0 || !bench.frames) {
+		printf("no frames were repainted\n");
+		return false;
+	}
+	printf("frames    %8llu  %8.1f /s\n",
+	       (unsigned long long)bench.frames, bench.frames / secs);
+	printf("cpu       %8ld us  %8.1f us/frame  %5.1f%%\n", cpu_us,
+	       (double)cpu_us / bench.frames, cpu_us / (secs * 1e4));
+	printf("commits   %8llu  %8.1f /s\n",
+	       (unsigned long long)bench.commits, bench.commits / secs);
+	printf("upload    %8.1f MiB  %8.1f MiB/s\n",
+	       bench.upload_bytes / 1048576.0,
+	       bench.upload_bytes / 1048576.0 / secs);
+	printf("mallocs   %8llu  %8.2f /frame  %llu batches allocated\n",
+	       (unsigned long long)bench.frame_allocs,
+	       (double)bench.frame_allocs / bench.frames,
+	       (unsigned long long)bench.alloc_batches);
+	if (n) {
+		qsort(bench.frame_us, n, sizeof(uint32_t), cmp_samples);
+		printf("frame us  p50 %u p90 %u p99 %u max %u\n",
+		       bench.frame_us[(n-1) * 50 / 100],
+		       bench.frame_us[(n-1) * 90 / 100],
+		       bench.frame_us[(n-1) * 99 / 100],
+		       bench.frame_us[n-1]);
+	}
+	if (bench.frame_allocs) {
+		printf("frames are expected to run without allocating\n");
+		return false;
+	}
+	return bench.commits > 0;
+}
+
+/******************************************************************************
+ * main
+ *****************************************************************************/
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr,
+	        "Usage: %s [options]\n"
+	        "  -o, --output WxH    add a headless output, default 1920x1080\n"
+	        "  -f, --refresh HZ    output refresh, default 0 unthrottled\n"
+	        "  -m, --manual-clock  step vblanks as fast as frames come\n"
+	        "  -c, --clients N     number of clients, default 4\n"
+	        "  -s, --size WxH      client buffer size, default 640x480\n"
+	        "  -r, --rate HZ       commits per second of every client,\n"
+	        "                      0 follows frame callbacks, default 60\n"
+	        "  -d, --damage TYPE   full, rect, scroll or video\n"
+	        "  -t, --time SECS     measured time, default 5, 0 runs a\n"
+	        "                      replay to its end\n"
+	        "  -w, --warmup SECS   time before measuring, default 1\n"
+	        "  -R, --replay FILE   replay a recorded session instead\n"
+	        "                      of the synthetic clients\n"
+	        "  -i, --input FILE    replay recorded input on the seat\n"
+	        "  -S, --speed X       replay speed, 0 for no waits, default 1\n",
+	        prog);
+}
+
+static bool
+parse_size(const char *arg, unsigned int *w, unsigned int *h)
+{
+	return sscanf(arg, "%ux%u", w, h) == 2 && *w > 0 && *h > 0;
+}
+
+static bool
+parse_options(int argc, char *argv[])
+{
+	static const struct option long_opts[] = {
+		{"output", required_argument, NULL, 'o'},
+		{"refresh", required_argument, NULL, 'f'},
+		{"manual-clock", no_argument, NULL, 'm'},
+		{"clients", required_argument, NULL, 'c'},
+		{"size", required_argument, NULL, 's'},
+		{"rate", required_argument, NULL, 'r'},
+		{"damage", required_argument, NULL, 'd'},
+		{"time", required_argument, NULL, 't'},
+		{"warmup", required_argument, NULL, 'w'},
+		{"replay", required_argument, NULL, 'R'},
+		{"input", required_argument, NULL, 'i'},
+		{"speed", required_argument, NULL, 'S'},
+		{"help", no_argument, NULL, 'h'},
+		{0},
+	};
+	int c;
+
+	while ((c = getopt_long(argc, argv, "o:f:mc:s:r:d:t:w:R:i:S:h", long_opts,
+	                        NULL)) != -1) {
+		switch (c) {
+		case 'o':
+			if (opts.n_outputs >= MAX_OUTPUTS ||
+			    !parse_size(optarg,
+			                &opts.outputs[opts.n_outputs].w,
+			                &opts.outputs[opts.n_outputs].h))
+				return false;
+			opts.n_outputs++;
+			break;
+		case 'f':
+			opts.refresh = strtoul(optarg, NULL, 10);
+			break;
+		case 'm':
+			opts.manual_clock = true;
+			break;
+		case 'c':
+			opts.n_clients = atoi(optarg);
+			if (opts.n_clients < 0 || opts.n_clients > MAX_CLIENTS)
+				return false;
+			break;
+		case 's':
+			if (!parse_size(optarg, &opts.client_w,
+			                &opts.client_h))
+				return false;
+			break;
+		case 'r':
+			opts.rate = strtoul(optarg, NULL, 10);
+			break;
+		case 'd':
+			opts.damage = BENCH_DAMAGE_VIDEO + 1;
+			for (unsigned i = 0; i <= BENCH_DAMAGE_VIDEO; i++)
+				if (!strcmp(optarg, damage_names[i]))
+					opts.damage = i;
+			if (opts.damage > BENCH_DAMAGE_VIDEO)
+				return false;
+			break;
+		case 't':
+			opts.seconds = strtoul(optarg, NULL, 10);
+			break;
+		case 'w':
+			opts.warmup = strtoul(optarg, NULL, 10);
+			break;
+		case 'R':
+			opts.replay = optarg;
+			break;
+		case 'i':
+			opts.input = optarg;
+			break;
+		case 'S':
+			opts.replay_speed = atof(optarg);
+			if (opts.replay_speed < 0)
+				return false;
+			break;
+		default:
+			return false;
+		}
+	}
+	if (!opts.n_outputs) {
+		opts.outputs[0].w = 1920;
+		opts.outputs[0].h = 1080;
+		opts.n_outputs = 1;
+	}
+	return opts.seconds > 0 || opts.replay;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct wl_event_loop *loop;
+	struct wl_event_source *warmup_timer, *done_timer, *child = NULL;
+	struct tw_backend *backend;
+	struct tw_engine *engine;
+	struct tw_render_pipeline *pipeline;
+	struct tw_test_desktop desktop;
+	char runtime_dir[] = "/tmp/tw-bench-XXXXXX";
+	const char *socket;
+	bool ret = false;
+
+	if (!parse_options(argc, argv)) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	//CI runners often have no session
+	if (!getenv("XDG_RUNTIME_DIR")) {
+		if (!mkdtemp(runtime_dir))
+			return EXIT_FAILURE;
+		setenv("XDG_RUNTIME_DIR", runtime_dir, 1);
+	}
+	signal(SIGPIPE, SIG_IGN);
+	tw_logger_use_file(stderr);
+	wl_list_init(&bench.surfaces);
+
+	if (!(bench.display = wl_display_create()))
+		return EXIT_FAILURE;
+	loop = wl_display_get_event_loop(bench.display);
+	if (!(backend = tw_headless_backend_create(bench.display)))
+		goto out;
+	for (int i = 0; i < opts.n_outputs; i++)
+		tw_headless_backend_add_output_mode(backend, opts.outputs[i].w,
+		                                    opts.outputs[i].h,
+		                                    opts.refresh * 1000);
+	tw_headless_backend_set_manual_clock(backend, opts.manual_clock);
+	bench.backend = backend;
+	tw_headless_backend_add_input_device(backend, TW_INPUT_TYPE_KEYBOARD);
+	tw_headless_backend_add_input_device(backend, TW_INPUT_TYPE_POINTER);
+	if (opts.input &&
+	    !tw_headless_backend_add_input_replay(backend, opts.input,
+	                                          opts.replay_speed))
+		goto out;
+	tw_signal_setup_listener(&backend->signals.new_output,
+	                         &bench.new_output, notify_bench_new_output);
+
+	engine = tw_engine_create_global(bench.display, backend);
+	if (!engine)
+		goto out;
+	tw_test_desktop_init(&desktop, engine);
+	if (!(bench.ctx = tw_render_context_create_pixman(bench.display)))
+		goto out;
+	pipeline = tw_pixman_render_pipeline_create_default(
+		bench.ctx, &engine->layers_manager);
+	wl_list_insert(bench.ctx->pipelines.next, &pipeline->link);
+	tw_server_output_manager_create_global(engine, bench.ctx);
+	tw_signal_setup_listener(&bench.ctx->signals.wl_surface_dirty,
+	                         &bench.surface_dirty,
+	                         notify_bench_surface_dirty);
+	tw_signal_setup_listener(&bench.ctx->signals.begin_frames,
+	                         &bench.begin_frames,
+	                         notify_bench_begin_frames);
+	tw_signal_setup_listener(&bench.ctx->signals.end_frames,
+	                         &bench.end_frames, notify_bench_end_frames);
+
+	if (!(socket = wl_display_add_socket_auto(bench.display)))
+		goto out;
+	tw_backend_start(backend, bench.ctx);
+	if (opts.replay) {
+		child = wl_event_loop_add_signal(loop, SIGCHLD,
+		                                 handle_bench_child, NULL);
+		bench_spawn_replay(socket);
+	} else {
+		bench_spawn_clients(socket);
+	}
+
+	warmup_timer = wl_event_loop_add_timer(loop, handle_bench_warmup_done,
+	                                       NULL);
+	done_timer = wl_event_loop_add_timer(loop, handle_bench_done, NULL);
+	if (opts.warmup)
+		wl_event_source_timer_update(warmup_timer, opts.warmup * 1000);
+	else
+		handle_bench_warmup_done(NULL);
+	if (opts.seconds)
+		wl_event_source_timer_update(done_timer,
+		                             (opts.warmup + opts.seconds) *
+		                             1000);
+
+	if (opts.manual_clock)
+		bench_run_manual_clock(loop);
+	else
+		wl_display_run(bench.display);
+	wl_event_source_remove(warmup_timer);
+	wl_event_source_remove(done_timer);
+	if (child)
+		wl_event_source_remove(child);
+	bench_reap_clients();
+	ret = bench_report();
+	tw_test_desktop_fini(&desktop);
+out:
+	wl_display_destroy(bench.display);
+	free(bench.frame_us);
+	if (strcmp(runtime_dir, "/tmp/tw-bench-XXXXXX"))
+		rmdir(runtime_dir);
+	return ret ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <wayland-server-core.h>
+#include <wayland-server.h>
+#include <taiwins/objects/logger.h>
+#include <taiwins/objects/utils.h>
+#include <taiwins/backend_headless.h>
+#include <taiwins/render_context.h>
+#include <taiwins/render_context_pixman.h>
+#include <taiwins/render_output.h>
+
+//frames of the headless output are presented only when we step the clock
+
+//the stepping has side effects, it must run in NDEBUG builds as well
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			fprintf(stderr, "%s:%d: check failed: %s\n", \
+			        __FILE__, __LINE__, #cond); \
+			goto err; \
+		} \
+	} while (0)
+
+static struct {
+	struct tw_render_output *output;
+	struct wl_listener new_output, need_frame, present;
+	unsigned int frames, presents;
+	struct timespec last_present;
+} test = {0};
+
+static void
+notify_need_frame(struct wl_listener *listener, void *data)
+{
+	test.frames++;
+	tw_render_output_post_frame(test.output);
+}
+
+static void
+notify_present(struct wl_listener *listener, void *data)
+{
+	struct tw_event_output_present *event = data;
+
+	test.presents++;
+	test.last_present = event->time;
+}
+
+static void
+notify_new_output(struct wl_listener *listener, void *data)
+{
+	test.output = data;
+	tw_signal_setup_listener(&test.output->signals.need_frame,
+	                         &test.need_frame, notify_need_frame);
+	tw_signal_setup_listener(&test.output->signals.present,
+	                         &test.present, notify_present);
+}
+
+int main(int argc, char *argv[])
+{
+	struct wl_display *display;
+	struct tw_backend *backend;
+	struct tw_render_context *ctx;
+	struct timespec now, first;
+	uint64_t period = tw_millihertz_to_ns(60000);
+
+	tw_logger_use_file(stderr);
+	display = wl_display_create();
+	if (!display)
+		return EXIT_FAILURE;
+
+	backend = tw_headless_backend_create(display);
+	if (!backend)
+		goto err;
+	tw_headless_backend_add_output_mode(backend, 640, 480, 60000);
+	tw_headless_backend_set_manual_clock(backend, true);
+	tw_signal_setup_listener(&backend->signals.new_output,
+	                         &test.new_output, notify_new_output);
+	ctx = tw_render_context_create_pixman(display);
+	if (!ctx)
+		goto err;
+	tw_backend_start(backend, ctx);
+	CHECK(test.output);
+
+	//the first frame is rendered but waits for its vblank
+	CHECK(test.frames == 1 && test.presents == 0);
+	CHECK(tw_headless_backend_step_vblank(backend) == 1);
+	CHECK(test.presents == 1);
+	tw_headless_backend_get_time(backend, &now);
+	CHECK(tw_timespec_diff_ns(&test.last_present, &now) == 0);
+	first = test.last_present;
+
+	//idle, nothing to present
+	CHECK(tw_headless_backend_step_vblank(backend) == 0);
+	CHECK(tw_headless_backend_step_time(backend, period * 10) == 0);
+	CHECK(test.presents == 1);
+
+	//a new frame lands on the vblank grid of the first one
+	tw_render_output_dirty(test.output);
+	CHECK(test.frames == 2);
+	CHECK(tw_headless_backend_step_time(backend, period / 2) == 0);
+	CHECK(tw_headless_backend_step_vblank(backend) == 1);
+	CHECK(test.presents == 2);
+	CHECK(tw_timespec_diff_ns(&test.last_present, &first) ==
+	       (int64_t)(period * 11));
+
+	wl_display_destroy(display);
+	return 0;
+err:
+	wl_display_destroy(display);
+	return EXIT_FAILURE;
+}
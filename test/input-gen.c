@@ -0,0 +1,217 @@
+#include <getopt.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <taiwins/input_recorder.h>
+
+/*
+ * tw-input-gen writes synthetic input recordings for --input of
+ * tw-bench-compositor, the load we see on real hardware without needing it:
+ * 1000 Hz pointer motion, key repeat storms and multi finger touch strokes.
+ */
+
+#define NS_PER_MS 1000000ull
+
+enum gen_pattern {
+	GEN_MOTION,
+	GEN_KEYS,
+	GEN_TOUCH,
+};
+
+static const char *pattern_names[] = {
+	[GEN_MOTION] = "motion",
+	[GEN_KEYS] = "keys",
+	[GEN_TOUCH] = "touch",
+};
+
+static struct {
+	enum gen_pattern pattern;
+	unsigned int rate, seconds;
+	const char *path;
+} opts = {
+	.pattern = GEN_MOTION,
+	.rate = 1000,
+	.seconds = 5,
+};
+
+static void
+write_record(FILE *file, uint16_t type, uint16_t device, uint64_t ts,
+             struct tw_input_record *record)
+{
+	record->type = type;
+	record->device = device;
+	record->ts = ts;
+	record->time = ts / NS_PER_MS;
+	fwrite(record, sizeof(*record), 1, file);
+}
+
+static void
+write_device(FILE *file, uint16_t device, enum tw_input_device_type type,
+             const char *name)
+{
+	struct tw_input_record record = {0};
+
+	record.u.device.type = type;
+	strncpy(record.u.device.name, name, sizeof(record.u.device.name) - 1);
+	write_record(file, TW_INPUT_RECORD_DEVICE, device, 0, &record);
+}
+
+/* circles across the output with a click every second */
+static void
+gen_motion(FILE *file, uint64_t step, uint64_t n)
+{
+	write_device(file, 0, TW_INPUT_TYPE_POINTER, "gen pointer");
+	for (uint64_t i = 0; i < n; i++) {
+		struct tw_input_record record = {0};
+		double a = 2.0 * M_PI * i / opts.rate;
+
+		record.u.motion.dx = 8.0 * cos(a);
+		record.u.motion.dy = 8.0 * sin(a);
+		record.u.motion.unaccel_dx = record.u.motion.dx;
+		record.u.motion.unaccel_dy = record.u.motion.dy;
+		write_record(file, TW_INPUT_RECORD_MOTION, 0, i * step,
+		             &record);
+		if (i % opts.rate == 0) {
+			record.u.button.button = 0x110; //BTN_LEFT
+			record.u.button.state = 1;
+			write_record(file, TW_INPUT_RECORD_BUTTON, 0,
+			             i * step, &record);
+			record.u.button.state = 0;
+			write_record(file, TW_INPUT_RECORD_BUTTON, 0,
+			             i * step, &record);
+		}
+	}
+}
+
+/* press and release through the letter rows, the rate counts both */
+static void
+gen_keys(FILE *file, uint64_t step, uint64_t n)
+{
+	write_device(file, 0, TW_INPUT_TYPE_KEYBOARD, "gen keyboard");
+	for (uint64_t i = 0; i < n; i++) {
+		struct tw_input_record record = {0};
+
+		record.u.key.keycode = 16 + (i / 2) % 34; //KEY_Q and on
+		record.u.key.state = !(i % 2);
+		write_record(file, TW_INPUT_RECORD_KEY, 0, i * step, &record);
+	}
+}
+
+/* two fingers stroking apart, lifted every half second */
+static void
+gen_touch(FILE *file, uint64_t step, uint64_t n)
+{
+	uint64_t stroke = opts.rate / 2 ? opts.rate / 2 : 1;
+
+	write_device(file, 0, TW_INPUT_TYPE_TOUCH, "gen touch");
+	for (uint64_t i = 0; i < n; i++) {
+		double t = (double)(i % stroke) / stroke;
+
+		for (int id = 0; id < 2; id++) {
+			struct tw_input_record record = {0};
+			uint16_t type = TW_INPUT_RECORD_TOUCH_MOTION;
+
+			if (i % stroke == 0)
+				type = TW_INPUT_RECORD_TOUCH_DOWN;
+			else if (i % stroke == stroke - 1)
+				type = TW_INPUT_RECORD_TOUCH_UP;
+			record.u.abs.id = id;
+			record.u.abs.x = id ? 0.5 + 0.4 * t : 0.5 - 0.4 * t;
+			record.u.abs.y = 0.5;
+			write_record(file, type, 0, i * step, &record);
+		}
+	}
+}
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr,
+	        "Usage: %s [options] -o FILE\n"
+	        "  -p, --pattern NAME  motion, keys or touch\n"
+	        "  -r, --rate HZ       events per second, default 1000\n"
+	        "  -t, --time SECS     recorded time, default 5\n",
+	        prog);
+}
+
+static bool
+parse_options(int argc, char *argv[])
+{
+	static const struct option long_opts[] = {
+		{"pattern", required_argument, NULL, 'p'},
+		{"rate", required_argument, NULL, 'r'},
+		{"time", required_argument, NULL, 't'},
+		{"output", required_argument, NULL, 'o'},
+		{0},
+	};
+	bool found;
+	int c;
+
+	while ((c = getopt_long(argc, argv, "p:r:t:o:", long_opts,
+	                        NULL)) != -1) {
+		switch (c) {
+		case 'p':
+			found = false;
+			for (unsigned i = 0; i <= GEN_TOUCH; i++) {
+				if (!strcmp(optarg, pattern_names[i])) {
+					opts.pattern = i;
+					found = true;
+				}
+			}
+			if (!found)
+				return false;
+			break;
+		case 'r':
+			opts.rate = strtoul(optarg, NULL, 10);
+			break;
+		case 't':
+			opts.seconds = strtoul(optarg, NULL, 10);
+			break;
+		case 'o':
+			opts.path = optarg;
+			break;
+		default:
+			return false;
+		}
+	}
+	return opts.path && opts.rate > 0 && opts.seconds > 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct tw_input_record_header header = {
+		.magic = TW_INPUT_RECORD_MAGIC,
+		.version = TW_INPUT_RECORD_VERSION,
+	};
+	uint64_t step, n;
+	FILE *file;
+
+	if (!parse_options(argc, argv)) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	if (!(file = fopen(opts.path, "wb"))) {
+		perror(opts.path);
+		return EXIT_FAILURE;
+	}
+	fwrite(&header, sizeof(header), 1, file);
+	step = 1000000000ull / opts.rate;
+	n = (uint64_t)opts.rate * opts.seconds;
+
+	switch (opts.pattern) {
+	case GEN_MOTION:
+		gen_motion(file, step, n);
+		break;
+	case GEN_KEYS:
+		gen_keys(file, step, n);
+		break;
+	case GEN_TOUCH:
+		gen_touch(file, step, n);
+		break;
+	}
+	return fclose(file) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,248 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <pixman.h>
+#include <wayland-server.h>
+#include <taiwins/objects/layers.h>
+#include <taiwins/objects/surface.h>
+#include <taiwins/objects/subsurface.h>
+#include <taiwins/objects/utils.h>
+
+/* picking the surface under the pointer, walking all the views against the
+ * layers manager grid, on a 4K desktop with a popup on every fourth window.
+ * The moving case drags one window between every pick */
+#define OUTPUT_W 3840
+#define OUTPUT_H 2160
+#define MOTIONS 20000
+
+struct window {
+	struct tw_surface surface, popup;
+	struct tw_subsurface sub;
+};
+
+static unsigned int seed = 0x7477;
+
+static inline int
+rand_in(int lo, int hi)
+{
+	seed = seed * 1103515245 + 12345;
+	return lo + (int)((seed >> 8) % (unsigned)(hi - lo));
+}
+
+static void
+surface_init(struct tw_surface *surface, int x, int y, int w, int h)
+{
+	surface->current = &surface->surface_states[0];
+	tw_mat3_init(&surface->current->surface_to_buffer);
+	pixman_region32_init_rect(&surface->current->input_region,
+	                          0, 0, w, h);
+	wl_list_init(&surface->subsurfaces);
+	wl_list_init(&surface->layer_link);
+	surface->geometry.x = x;
+	surface->geometry.y = y;
+	surface->geometry.xywh = (pixman_rectangle32_t){x, y, w, h};
+}
+
+static void
+window_init(struct window *window, bool popup)
+{
+	int w = rand_in(100, 1200), h = rand_in(80, 900);
+	int x = rand_in(0, OUTPUT_W - w), y = rand_in(0, OUTPUT_H - h);
+
+	surface_init(&window->surface, x, y, w, h);
+	if (!popup)
+		return;
+	surface_init(&window->popup, x + w / 2, y + h / 2, 200, 300);
+	window->sub.surface = &window->popup;
+	window->sub.parent = &window->surface;
+	wl_list_insert(&window->surface.subsurfaces, &window->sub.parent_link);
+}
+
+static void
+window_fini(struct window *window)
+{
+	pixman_region32_fini(&window->surface.current->input_region);
+	if (window->sub.surface)
+		pixman_region32_fini(&window->popup.current->input_region);
+}
+
+/* what tw_engine_pick_surface_from_layers did before the grid */
+static struct tw_surface *
+pick_subsurfaces(struct tw_surface *parent, float x, float y)
+{
+	struct tw_surface *surface;
+	struct tw_subsurface *sub;
+
+	wl_list_for_each(sub, &parent->subsurfaces, parent_link) {
+		surface = pick_subsurfaces(sub->surface, x, y);
+		if (!surface)
+			surface = sub->surface;
+		if (tw_surface_has_input_point(surface, x, y))
+			return surface;
+	}
+	return NULL;
+}
+
+static struct tw_surface *
+pick_linear(struct tw_layers_manager *manager, float x, float y)
+{
+	struct tw_layer *layer;
+	struct tw_surface *surface, *sub;
+
+	wl_list_for_each(layer, &manager->layers, link) {
+		if (layer->position >= TW_LAYER_POS_CURSOR)
+			continue;
+		wl_list_for_each(surface, &layer->views, layer_link) {
+			if ((sub = pick_subsurfaces(surface, x, y)))
+				return sub;
+			else if (tw_surface_has_input_point(surface, x, y))
+				return surface;
+		}
+	}
+	return NULL;
+}
+
+static void
+window_move(struct window *window, int dx, int dy)
+{
+	struct tw_surface *surfaces[2] = {&window->surface, &window->popup};
+
+	for (int i = 0; i < (window->sub.surface ? 2 : 1); i++) {
+		surfaces[i]->geometry.x += dx;
+		surfaces[i]->geometry.y += dy;
+		surfaces[i]->geometry.xywh.x += dx;
+		surfaces[i]->geometry.xywh.y += dy;
+	}
+}
+
+/* drag a window by one pixel per motion, as an interactive move does */
+static bool
+run_moving(struct tw_layers_manager *manager, struct window *windows,
+           int nwindows, long *moving_ns)
+{
+	struct timespec start, end;
+	struct window *dragged;
+	struct tw_surface *picked;
+	float sx, sy;
+	bool same = true;
+
+	seed = 0x7477;
+	dragged = &windows[rand_in(0, nwindows)];
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < MOTIONS; i++) {
+		window_move(dragged, (i & 1) ? 1 : -1, 0);
+		tw_layers_manager_dirty_geometry(manager);
+		tw_layers_manager_pick_surface(manager, rand_in(0, OUTPUT_W),
+		                               rand_in(0, OUTPUT_H), &sx, &sy);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	*moving_ns = tw_timespec_diff_ns(&end, &start) / MOTIONS;
+
+	//moving and after the move, when the grid is back
+	for (int i = 0; i < MOTIONS / 10; i++) {
+		float x = rand_in(0, OUTPUT_W) + 0.5f;
+		float y = rand_in(0, OUTPUT_H) + 0.5f;
+
+		if (i < MOTIONS / 20) {
+			window_move(dragged, rand_in(-20, 20),
+			            rand_in(-20, 20));
+			tw_layers_manager_dirty_geometry(manager);
+		}
+		picked = tw_layers_manager_pick_surface(manager, x, y,
+		                                        &sx, &sy);
+		same = same && picked == pick_linear(manager, x, y);
+	}
+	return same;
+}
+
+static bool
+run_picking(int nwindows)
+{
+	struct wl_display *display = wl_display_create();
+	struct tw_layers_manager manager;
+	struct tw_layer ui_layer, desktop_layer;
+	struct window *windows = calloc(nwindows, sizeof(*windows));
+	struct timespec start, end;
+	long linear_ns, grid_ns, build_ns, moving_ns;
+	float sx, sy;
+	bool same = true;
+
+	if (!windows || !display) {
+		free(windows);
+		if (display)
+			wl_display_destroy(display);
+		return false;
+	}
+	tw_layers_manager_init(&manager, display);
+	tw_layer_init(&ui_layer);
+	tw_layer_init(&desktop_layer);
+	tw_layer_set_position(&ui_layer, TW_LAYER_POS_DESKTOP_UI, &manager);
+	tw_layer_set_position(&desktop_layer, TW_LAYER_POS_DESKTOP_FRONT,
+	                      &manager);
+	for (int i = 0; i < nwindows; i++) {
+		struct tw_layer *layer = (i % 10 == 0) ?
+			&ui_layer : &desktop_layer;
+
+		window_init(&windows[i], i % 4 == 0);
+		wl_list_insert(layer->views.prev,
+		               &windows[i].surface.layer_link);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	tw_layers_manager_pick_surface(&manager, 0, 0, &sx, &sy);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	build_ns = tw_timespec_diff_ns(&end, &start);
+
+	//the same random pointer positions for both
+	seed = 0x7477;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < MOTIONS; i++)
+		pick_linear(&manager, rand_in(0, OUTPUT_W),
+		            rand_in(0, OUTPUT_H));
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	linear_ns = tw_timespec_diff_ns(&end, &start) / MOTIONS;
+
+	seed = 0x7477;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < MOTIONS; i++)
+		tw_layers_manager_pick_surface(&manager, rand_in(0, OUTPUT_W),
+		                               rand_in(0, OUTPUT_H), &sx, &sy);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	grid_ns = tw_timespec_diff_ns(&end, &start) / MOTIONS;
+
+	for (int i = 0; i < MOTIONS / 10; i++) {
+		float x = rand_in(0, OUTPUT_W) + 0.5f;
+		float y = rand_in(0, OUTPUT_H) + 0.5f;
+
+		same = same && pick_linear(&manager, x, y) ==
+			tw_layers_manager_pick_surface(&manager, x, y,
+			                               &sx, &sy);
+	}
+
+	same = run_moving(&manager, windows, nwindows, &moving_ns) && same;
+
+	printf("%5d windows: linear %7ld ns, grid %5ld ns, moving %7ld ns, "
+	       "grid %ux%u of %u px built in %7ld ns%s\n",
+	       nwindows, linear_ns, grid_ns, moving_ns, manager.pick.cols,
+	       manager.pick.rows, manager.pick.cell, build_ns,
+	       same ? "" : ", MISMATCH");
+
+	for (int i = 0; i < nwindows; i++)
+		window_fini(&windows[i]);
+	free(windows);
+	wl_display_destroy(display);
+	return same;
+}
+
+int
+main(int argc, char *argv[])
+{
+	int counts[] = {10, 100, 1000};
+	bool ret = true;
+
+	for (unsigned i = 0; i < sizeof(counts) / sizeof(counts[0]); i++)
+		ret = run_picking(counts[i]) && ret;
+	return ret ? 0 : -1;
+}
@@ -0,0 +1,385 @@
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <wayland-client.h>
+#include <wayland-server-core.h>
+#include <wayland-server.h>
+#include <taiwins/objects/layers.h>
+#include <taiwins/objects/logger.h>
+#include <taiwins/objects/surface.h>
+#include <taiwins/objects/utils.h>
+#include <taiwins/backend_headless.h>
+#include <taiwins/render_context.h>
+#include <taiwins/render_context_pixman.h>
+#include <taiwins/render_output.h>
+#include <taiwins/render_pipeline.h>
+#include <taiwins/render_surface.h>
+
+/*
+ * the pixman context does not need any GPU, it should run everywhere, and it
+ * is our reference renderer. A client draws two overlapping XRGB squares and
+ * a half transparent ARGB square over them, the output is checked pixel by
+ * pixel against the expected composition, the clip of the bottom square
+ * against the occlusion of the XRGB one above.
+ */
+
+#define OUTPUT_SIZE 64
+#define SQUARE 32
+#define NSURFACES 3
+
+struct tw_render_pipeline *
+tw_pixman_render_pipeline_create_default(struct tw_render_context *ctx,
+                                         struct tw_layers_manager *manager);
+
+struct test_surface {
+	struct tw_surface *surface;
+	struct wl_listener commit, destroy;
+	int x, y;
+	bool mapped;
+};
+
+static struct {
+	struct wl_display *display;
+	struct tw_render_output *output;
+	struct tw_layers_manager manager;
+	struct tw_layer layer;
+	struct test_surface surfaces[NSURFACES];
+	int n_surfaces;
+	bool checked, passed;
+
+	struct wl_listener new_output, need_frame, post_frame;
+	struct wl_listener surface_created;
+} test = {0};
+
+/******************************************************************************
+ * client
+ *****************************************************************************/
+
+struct client {
+	struct wl_compositor *compositor;
+	struct wl_shm *shm;
+};
+
+static void
+handle_global(void *data, struct wl_registry *registry, uint32_t name,
+              const char *interface, uint32_t version)
+{
+	struct client *client = data;
+
+	if (!strcmp(interface, wl_compositor_interface.name))
+		client->compositor = wl_registry_bind(registry, name,
+		                                      &wl_compositor_interface,
+		                                      1);
+	else if (!strcmp(interface, wl_shm_interface.name))
+		client->shm = wl_registry_bind(registry, name,
+		                               &wl_shm_interface, 1);
+}
+
+static void
+handle_global_remove(void *data, struct wl_registry *registry, uint32_t name)
+{
+}
+
+static const struct wl_registry_listener registry_listener = {
+	.global = handle_global,
+	.global_remove = handle_global_remove,
+};
+
+static struct wl_buffer *
+client_square(struct client *client, uint32_t format, uint32_t color)
+{
+	size_t size = SQUARE * SQUARE * 4;
+	struct wl_shm_pool *pool;
+	struct wl_buffer *buffer;
+	uint32_t *data;
+	int fd = memfd_create("tw-test-pixman", MFD_CLOEXEC);
+
+	if (fd < 0 || ftruncate(fd, size) < 0)
+		return NULL;
+	data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (data == MAP_FAILED)
+		return NULL;
+	for (int i = 0; i < SQUARE * SQUARE; i++)
+		data[i] = color;
+	pool = wl_shm_create_pool(client->shm, fd, size);
+	buffer = wl_shm_pool_create_buffer(pool, 0, SQUARE, SQUARE,
+	                                   SQUARE * 4, format);
+	wl_shm_pool_destroy(pool);
+	close(fd);
+	return buffer;
+}
+
+static int
+run_client(int fd)
+{
+	struct client client = {0};
+	struct wl_display *display = wl_display_connect_to_fd(fd);
+	struct wl_registry *registry;
+	//opaque red and blue, then 50% green, premultiplied
+	uint32_t formats[NSURFACES] = {
+		WL_SHM_FORMAT_XRGB8888, WL_SHM_FORMAT_XRGB8888,
+		WL_SHM_FORMAT_ARGB8888,
+	};
+	uint32_t colors[NSURFACES] = {0xffff0000, 0xff0000ff, 0x80008000};
+
+	if (!display)
+		return EXIT_FAILURE;
+	registry = wl_display_get_registry(display);
+	wl_registry_add_listener(registry, &registry_listener, &client);
+	wl_display_roundtrip(display);
+	if (!client.compositor || !client.shm)
+		return EXIT_FAILURE;
+	for (int i = 0; i < NSURFACES; i++) {
+		struct wl_surface *surface =
+			wl_compositor_create_surface(client.compositor);
+		struct wl_buffer *buffer =
+			client_square(&client, formats[i], colors[i]);
+
+		if (!buffer)
+			return EXIT_FAILURE;
+		wl_surface_attach(surface, buffer, 0, 0);
+		wl_surface_damage(surface, 0, 0, SQUARE, SQUARE);
+		wl_surface_commit(surface);
+	}
+	//stay until the compositor is done
+	while (wl_display_dispatch(display) >= 0);
+	return EXIT_SUCCESS;
+}
+
+/******************************************************************************
+ * server
+ *****************************************************************************/
+
+static bool
+pixel_near(uint32_t pixel, uint32_t expected)
+{
+	for (int shift = 0; shift < 24; shift += 8) {
+		int a = (pixel >> shift) & 0xff;
+		int b = (expected >> shift) & 0xff;
+
+		if (abs(a - b) > 1)
+			return false;
+	}
+	return true;
+}
+
+static bool
+check_output(pixman_image_t *image)
+{
+	static const struct {
+		int x, y;
+		uint32_t rgb;
+	} expects[] = {
+		{2, 2, 0x000000}, //background
+		{10, 10, 0xff0000}, //red only
+		{36, 12, 0xff0000},
+		{10, 30, 0x0000ff}, //blue over red
+		{2, 50, 0x0000ff}, //blue only
+		{30, 30, 0x00807f}, //green over blue
+		{36, 26, 0x7f8000}, //green over red
+		{50, 50, 0x008000}, //green over background
+		{60, 10, 0x000000},
+	};
+	uint32_t *data = pixman_image_get_data(image);
+	int stride = pixman_image_get_stride(image) / 4;
+	bool ok = true;
+
+	for (unsigned i = 0; i < sizeof(expects) / sizeof(expects[0]); i++) {
+		uint32_t pixel = data[expects[i].y * stride + expects[i].x];
+
+		if (!pixel_near(pixel, expects[i].rgb)) {
+			fprintf(stderr, "pixel (%d, %d) is %06x, expecting "
+			        "%06x\n", expects[i].x, expects[i].y,
+			        pixel & 0xffffff, expects[i].rgb);
+			ok = false;
+		}
+	}
+	return ok;
+}
+
+static bool
+check_clip(void)
+{
+	struct tw_render_surface *bottom =
+		wl_container_of(test.surfaces[0].surface, bottom, surface);
+	pixman_region32_t *clip = &bottom->clip;
+
+	//the blue XRGB square hides the red one
+	if (!pixman_region32_contains_point(clip, 10, 10, NULL) ||
+	    pixman_region32_contains_point(clip, 10, 30, NULL) ||
+	    pixman_region32_contains_point(clip, 30, 30, NULL)) {
+		fprintf(stderr, "the occluded part of the bottom surface is "
+		        "not clipped\n");
+		return false;
+	}
+	return true;
+}
+
+static void
+notify_surface_commit(struct wl_listener *listener, void *data)
+{
+	struct test_surface *surface =
+		wl_container_of(listener, surface, commit);
+	struct tw_surface *tw_surface = surface->surface;
+
+	if (surface->mapped || !tw_surface_has_texture(tw_surface))
+		return;
+	surface->mapped = true;
+	tw_surface_set_position(tw_surface, surface->x, surface->y);
+	//the later one stays on top, whatever order they map in
+	for (int i = 0; i < NSURFACES; i++)
+		if (test.surfaces[i].mapped)
+			tw_reset_wl_list(&test.surfaces[i].surface->layer_link);
+	for (int i = 0; i < NSURFACES; i++)
+		if (test.surfaces[i].mapped)
+			wl_list_insert(&test.layer.views,
+			               &test.surfaces[i].surface->layer_link);
+	tw_layers_manager_dirty(&test.manager);
+	tw_render_output_dirty(test.output);
+}
+
+static void
+notify_surface_destroy(struct wl_listener *listener, void *data)
+{
+	struct test_surface *surface =
+		wl_container_of(listener, surface, destroy);
+
+	if (surface->mapped)
+		tw_reset_wl_list(&surface->surface->layer_link);
+	tw_reset_wl_list(&surface->commit.link);
+	tw_reset_wl_list(&surface->destroy.link);
+	tw_layers_manager_dirty(&test.manager);
+}
+
+static void
+notify_surface_created(struct wl_listener *listener, void *data)
+{
+	struct test_surface *surface;
+
+	static const int positions[NSURFACES][2] = {
+		{8, 8}, {0, 24}, {24, 24},
+	};
+
+	if (test.n_surfaces >= NSURFACES)
+		return;
+	surface = &test.surfaces[test.n_surfaces];
+	surface->surface = data;
+	surface->x = positions[test.n_surfaces][0];
+	surface->y = positions[test.n_surfaces][1];
+	test.n_surfaces++;
+	tw_signal_setup_listener(&surface->surface->signals.commit,
+	                         &surface->commit, notify_surface_commit);
+	tw_signal_setup_listener(&surface->surface->signals.destroy,
+	                         &surface->destroy, notify_surface_destroy);
+}
+
+static void
+notify_need_frame(struct wl_listener *listener, void *data)
+{
+	tw_render_output_post_frame(test.output);
+}
+
+static void
+notify_post_frame(struct wl_listener *listener, void *data)
+{
+	for (int i = 0; i < NSURFACES; i++)
+		if (!test.surfaces[i].mapped)
+			return;
+	if (test.checked)
+		return;
+	test.checked = true;
+	test.passed = check_output(
+		tw_pixman_presentable_image(&test.output->surface));
+	test.passed = check_clip() && test.passed;
+	wl_display_terminate(test.display);
+}
+
+static void
+notify_new_output(struct wl_listener *listener, void *data)
+{
+	test.output = data;
+	tw_signal_setup_listener(&test.output->signals.need_frame,
+	                         &test.need_frame, notify_need_frame);
+	tw_signal_setup_listener(&test.output->signals.post_frame,
+	                         &test.post_frame, notify_post_frame);
+}
+
+static int
+handle_timeout(void *data)
+{
+	fprintf(stderr, "no frame with all the surfaces\n");
+	wl_display_terminate(test.display);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct tw_backend *backend;
+	struct tw_render_context *ctx;
+	struct tw_render_pipeline *pipeline;
+	struct wl_event_source *timer;
+	int fds[2];
+	pid_t pid;
+
+	tw_logger_use_file(stderr);
+	signal(SIGPIPE, SIG_IGN);
+	test.display = wl_display_create();
+	if (!test.display)
+		return EXIT_FAILURE;
+
+	backend = tw_headless_backend_create(test.display);
+	if (!backend)
+		goto err;
+	tw_headless_backend_add_output_mode(backend, OUTPUT_SIZE, OUTPUT_SIZE,
+	                                    60000);
+	tw_signal_setup_listener(&backend->signals.new_output,
+	                         &test.new_output, notify_new_output);
+	ctx = tw_render_context_create_pixman(test.display);
+	if (!ctx)
+		goto err;
+	tw_layers_manager_init(&test.manager, test.display);
+	tw_layer_init(&test.layer);
+	tw_layer_set_position(&test.layer, TW_LAYER_POS_DESKTOP_FRONT,
+	                      &test.manager);
+	pipeline = tw_pixman_render_pipeline_create_default(ctx,
+	                                                    &test.manager);
+	if (!pipeline)
+		goto err;
+	wl_list_insert(ctx->pipelines.next, &pipeline->link);
+	tw_signal_setup_listener(&ctx->compositor_manager.surface_created,
+	                         &test.surface_created,
+	                         notify_surface_created);
+	tw_backend_start(backend, ctx);
+	if (!test.output)
+		goto err;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0)
+		goto err;
+	if ((pid = fork()) == 0) {
+		close(fds[0]);
+		_exit(run_client(fds[1]));
+	}
+	close(fds[1]);
+	if (pid < 0 || !wl_client_create(test.display, fds[0]))
+		goto err;
+	timer = wl_event_loop_add_timer(wl_display_get_event_loop(test.display),
+	                                handle_timeout, NULL);
+	wl_event_source_timer_update(timer, 5000);
+	wl_display_run(test.display);
+	wl_event_source_remove(timer);
+
+	wl_display_destroy_clients(test.display);
+	waitpid(pid, NULL, 0);
+	wl_display_destroy(test.display);
+	return test.passed ? EXIT_SUCCESS : EXIT_FAILURE;
+err:
+	wl_display_destroy(test.display);
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,183 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <pixman.h>
+#include <taiwins/objects/surface.h>
+#include <taiwins/objects/utils.h>
+
+/* same parameters as the layer renderer */
+#define RECT_COST 4096
+#define MAX_RECTS 16
+#define OUTPUT_W 1920
+#define OUTPUT_H 1080
+#define MAX_WINDOWS 64
+#define ITERATIONS 2000
+
+struct layout {
+	const char *name;
+	int nwindows;
+	pixman_box32_t windows[MAX_WINDOWS]; /**< top to bottom */
+	pixman_region32_t damage;
+};
+
+struct result {
+	int64_t fragments, area;
+	long ns;
+};
+
+static unsigned int seed = 0x7477;
+
+static inline int
+rand_in(int lo, int hi)
+{
+	seed = seed * 1103515245 + 12345;
+	return lo + (int)((seed >> 8) % (unsigned)(hi - lo));
+}
+
+static inline void
+layout_add_window(struct layout *layout, int x, int y, int w, int h)
+{
+	assert(layout->nwindows < MAX_WINDOWS);
+	layout->windows[layout->nwindows++] =
+		(pixman_box32_t){x, y, x + w, y + h};
+}
+
+/* a window partially covered by two overlapping popups, dragging the popups
+ * damages both their old and new positions */
+static void
+layout_popups(struct layout *layout)
+{
+	layout->name = "popups";
+	layout_add_window(layout, 400, 300, 300, 400);
+	layout_add_window(layout, 550, 200, 260, 300);
+	layout_add_window(layout, 100, 100, 1200, 800);
+	pixman_region32_init_rect(&layout->damage, 400, 300, 300, 400);
+	pixman_region32_union_rect(&layout->damage, &layout->damage,
+	                           410, 290, 300, 400);
+	pixman_region32_union_rect(&layout->damage, &layout->damage,
+	                           550, 200, 260, 300);
+	pixman_region32_union_rect(&layout->damage, &layout->damage,
+	                           562, 212, 260, 300);
+}
+
+static void
+layout_cascade(struct layout *layout)
+{
+	layout->name = "cascade";
+	for (int i = 0; i < 16; i++)
+		layout_add_window(layout, 40 + i * 32, 30 + i * 24, 800, 600);
+	pixman_region32_init(&layout->damage);
+	//a few clients updating small areas
+	for (int i = 0; i < 16; i += 3)
+		pixman_region32_union_rect(&layout->damage, &layout->damage,
+		                           60 + i * 32, 50 + i * 24, 120, 40);
+}
+
+static void
+layout_random(struct layout *layout)
+{
+	layout->name = "random";
+	for (int i = 0; i < 48; i++)
+		layout_add_window(layout, rand_in(0, OUTPUT_W - 200),
+		                  rand_in(0, OUTPUT_H - 200),
+		                  rand_in(50, 600), rand_in(50, 400));
+	pixman_region32_init(&layout->damage);
+	for (int i = 0; i < 24; i++)
+		pixman_region32_union_rect(&layout->damage, &layout->damage,
+		                           rand_in(0, OUTPUT_W - 100),
+		                           rand_in(0, OUTPUT_H - 100),
+		                           rand_in(8, 100), rand_in(8, 100));
+}
+
+/* the fragments the pipeline would draw for the damage, every window is an
+ * opaque surface clipped by the ones above */
+static void
+layout_measure(struct layout *layout, pixman_region32_t *damage,
+               struct result *result)
+{
+	int n;
+	pixman_box32_t *boxes;
+	pixman_region32_t clipped, visible;
+
+	pixman_region32_init(&clipped);
+	result->fragments = 0;
+	result->area = 0;
+	for (int i = 0; i < layout->nwindows; i++) {
+		pixman_box32_t *w = &layout->windows[i];
+
+		pixman_region32_init_rect(&visible, w->x1, w->y1,
+		                          w->x2 - w->x1, w->y2 - w->y1);
+		pixman_region32_subtract(&visible, &visible, &clipped);
+		pixman_region32_union_rect(&clipped, &clipped, w->x1, w->y1,
+		                           w->x2 - w->x1, w->y2 - w->y1);
+		pixman_region32_intersect(&visible, &visible, damage);
+		boxes = pixman_region32_rectangles(&visible, &n);
+		result->fragments += n;
+		for (int j = 0; j < n; j++)
+			result->area += (int64_t)(boxes[j].x2 - boxes[j].x1) *
+				(boxes[j].y2 - boxes[j].y1);
+		pixman_region32_fini(&visible);
+	}
+	//clearing the damage
+	boxes = pixman_region32_rectangles(damage, &n);
+	result->fragments += n;
+	pixman_region32_fini(&clipped);
+}
+
+static bool
+run_layout(struct layout *layout)
+{
+	struct timespec start, end;
+	struct result before, after;
+	pixman_region32_t simplified, missing;
+	bool covered;
+
+	pixman_region32_init(&simplified);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < ITERATIONS; i++)
+		tw_region_simplify(&simplified, &layout->damage,
+		                   MAX_RECTS, RECT_COST);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	after.ns = tw_timespec_diff_ns(&end, &start) / ITERATIONS;
+	before.ns = 0;
+
+	layout_measure(layout, &layout->damage, &before);
+	layout_measure(layout, &simplified, &after);
+
+	//the simplified damage has to cover the original one
+	pixman_region32_init(&missing);
+	pixman_region32_subtract(&missing, &layout->damage, &simplified);
+	covered = !pixman_region32_not_empty(&missing) &&
+		pixman_region32_n_rects(&simplified) <= MAX_RECTS;
+	pixman_region32_fini(&missing);
+
+	printf("%-8s damage rects %3d -> %3d, fragments %5ld -> %5ld, "
+	       "area %8ld -> %8ld, cost %9ld -> %9ld, %6ld ns\n",
+	       layout->name,
+	       pixman_region32_n_rects(&layout->damage),
+	       pixman_region32_n_rects(&simplified),
+	       (long)before.fragments, (long)after.fragments,
+	       (long)before.area, (long)after.area,
+	       (long)(before.fragments * RECT_COST + before.area),
+	       (long)(after.fragments * RECT_COST + after.area),
+	       after.ns);
+	pixman_region32_fini(&simplified);
+	pixman_region32_fini(&layout->damage);
+	return covered;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct layout layouts[3] = {0};
+	bool ret = true;
+
+	layout_popups(&layouts[0]);
+	layout_cascade(&layouts[1]);
+	layout_random(&layouts[2]);
+	for (int i = 0; i < 3; i++)
+		ret = run_layout(&layouts[i]) && ret;
+	return ret ? 0 : -1;
+}
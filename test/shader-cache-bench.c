@@ -0,0 +1,106 @@
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <dirent.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <taiwins/objects/logger.h>
+#include <taiwins/objects/egl.h>
+#include <taiwins/objects/utils.h>
+#include <taiwins/render_context_egl.h>
+
+/* startup cost of the quad shaders, first with an empty program cache, then
+ * with the binaries the first pass stored */
+
+static long
+build_all_shaders(void)
+{
+	struct timespec start, end;
+	struct tw_egl_quad_shader_cache cache;
+
+	tw_egl_quad_shader_cache_init(&cache);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (unsigned i = 0; i < TW_EGL_QUAD_SHADER_CNT; i++)
+		tw_egl_quad_shader_cache_get(&cache, i);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	tw_egl_quad_shader_cache_fini(&cache);
+	return tw_timespec_diff_us(&end, &start);
+}
+
+/* count the cached binaries, remove them if asked */
+static int
+scan_cache_dir(const char *dir, bool remove)
+{
+	int n = 0;
+	DIR *d;
+	struct dirent *ent;
+	char path[PATH_MAX];
+
+	if (!(d = opendir(dir)))
+		return 0;
+	while ((ent = readdir(d))) {
+		if (ent->d_name[0] == '.')
+			continue;
+		n++;
+		if (remove) {
+			snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+			unlink(path);
+		}
+	}
+	closedir(d);
+	return n;
+}
+
+int main(int argc, char *argv[])
+{
+	int ret = EXIT_FAILURE, nbinaries;
+	long cold, warm;
+	char root[] = "/tmp/tw-shader-cache-XXXXXX";
+	char dir[PATH_MAX], parent[PATH_MAX];
+	struct tw_egl egl = {0};
+	struct tw_egl_options opts = {
+		.platform = EGL_PLATFORM_SURFACELESS_MESA,
+		.native_display = EGL_DEFAULT_DISPLAY,
+	};
+
+	tw_logger_use_file(stderr);
+	if (!mkdtemp(root))
+		return EXIT_FAILURE;
+	setenv("XDG_CACHE_HOME", root, 1);
+	//mesa keeps a disk cache of its own, it would warm up the cold pass
+	setenv("MESA_SHADER_CACHE_DISABLE", "true", 1);
+	snprintf(parent, sizeof(parent), "%s/taiwins", root);
+	snprintf(dir, sizeof(dir), "%s/shaders", parent);
+
+	if (!tw_egl_init(&egl, &opts))
+		goto err_egl;
+	if (!tw_egl_make_current(&egl, EGL_NO_SURFACE))
+		goto err_current;
+
+	cold = build_all_shaders();
+	nbinaries = scan_cache_dir(dir, false);
+	warm = build_all_shaders();
+
+	printf("%u programs, %d cached\n", TW_EGL_QUAD_SHADER_CNT, nbinaries);
+	printf("cold %ld us\n", cold);
+	printf("warm %ld us\n", warm);
+	if (!nbinaries)
+		printf("no program binary support, both passes compile\n");
+	else
+		printf("speedup %.2fx\n", warm ? (double)cold / warm : 0.0);
+	ret = EXIT_SUCCESS;
+
+	tw_egl_unset_current(&egl);
+err_current:
+	tw_egl_fini(&egl);
+err_egl:
+	scan_cache_dir(dir, true);
+	rmdir(dir);
+	rmdir(parent);
+	rmdir(root);
+	return ret;
+}
@@ -0,0 +1,63 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <taiwins/objects/slab.h>
+
+//the churn of a toolkit setting an opaque region on every resize
+
+struct object {
+	uint64_t id;
+	char payload[100];
+};
+
+#define N_OBJECTS 2000
+
+int main(int argc, char *argv[])
+{
+	struct tw_slab slab;
+	struct tw_slab_stats stats;
+	struct object *objects[N_OBJECTS];
+	size_t per_page;
+
+	tw_slab_init(&slab, sizeof(struct object), "object");
+	assert(slab.size % TW_SLAB_ALIGN == 0 &&
+	       slab.size >= sizeof(struct object));
+	per_page = slab.per_page;
+
+	for (int i = 0; i < N_OBJECTS; i++) {
+		objects[i] = tw_slab_alloc(&slab);
+		assert(objects[i]);
+		assert((uintptr_t)objects[i] % TW_SLAB_ALIGN == 0);
+		assert(objects[i]->id == 0);
+		objects[i]->id = i;
+		memset(objects[i]->payload, 0xff, sizeof(objects[i]->payload));
+	}
+	for (int i = 0; i < N_OBJECTS; i++)
+		assert(objects[i]->id == (uint64_t)i);
+	tw_slab_sample_stats(&slab, &stats);
+	assert(stats.live == N_OBJECTS && stats.peak == N_OBJECTS);
+	assert(stats.pages == (N_OBJECTS + per_page - 1) / per_page);
+
+	//free every other one, the holes are reused zeroed
+	for (int i = 0; i < N_OBJECTS; i += 2)
+		tw_slab_free(&slab, objects[i]);
+	for (int i = 0; i < N_OBJECTS; i += 2) {
+		objects[i] = tw_slab_alloc(&slab);
+		assert(objects[i]->id == 0 && objects[i]->payload[0] == 0);
+	}
+	tw_slab_sample_stats(&slab, &stats);
+	assert(stats.pages == (N_OBJECTS + per_page - 1) / per_page);
+	assert(stats.allocs == N_OBJECTS * 3 / 2);
+	assert(stats.frees == N_OBJECTS / 2);
+
+	//empty pages go back, but one
+	for (int i = 0; i < N_OBJECTS; i++)
+		tw_slab_free(&slab, objects[i]);
+	tw_slab_sample_stats(&slab, &stats);
+	assert(stats.live == 0 && stats.peak == N_OBJECTS);
+	assert(stats.pages == 1);
+
+	tw_slab_fini(&slab);
+	return 0;
+}
@@ -0,0 +1,55 @@
+/*
+ * frame-stats.c - dump the taiwins per output frame statistics
+ *
+ * Copyright (c) 2021 Xichen Zhou
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <tdbus.h>
+
+/* asks the running compositor through org.taiwins.stats on the session bus */
+int
+main(int argc, char *argv[])
+{
+	int ret = EXIT_FAILURE;
+	char *dump = NULL;
+	struct tdbus_reply reply = {0};
+	struct tdbus *bus = tdbus_new(SESSION_BUS);
+
+	if (!bus) {
+		fprintf(stderr, "failed to connect to the session bus\n");
+		return EXIT_FAILURE;
+	}
+	if (!tdbus_send_method_call(bus, "org.taiwins", "/org/taiwins",
+	                            "org.taiwins.stats", "FrameStats",
+	                            &reply, "")) {
+		fprintf(stderr, "taiwins is not running or has no bus\n");
+		goto out;
+	}
+	if (!tdbus_read(reply.message, "s", &dump))
+		goto out;
+	fputs(dump, stdout);
+	free(dump);
+	ret = EXIT_SUCCESS;
+out:
+	if (reply.message)
+		tdbus_free_message(reply.message);
+	tdbus_delete(bus);
+	return ret;
+}
@@ -0,0 +1,56 @@
+/*
+ * protocol-replay.c - replay a recorded session against a compositor
+ *
+ * Copyright (c) 2021 Xichen Zhou
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "replay.h"
+
+/* sessions come from `taiwins --record-session`, replayed on WAYLAND_DISPLAY */
+int
+main(int argc, char *argv[])
+{
+	struct tw_replay_stats stats;
+	double speed = 1.0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s:")) != -1) {
+		switch (opt) {
+		case 's':
+			speed = atof(optarg);
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (optind != argc - 1 || speed < 0)
+		goto usage;
+	if (!tw_replay_run(argv[optind], NULL, speed, &stats))
+		return EXIT_FAILURE;
+	tw_replay_print_stats(&stats, stdout);
+	return EXIT_SUCCESS;
+usage:
+	fprintf(stderr, "Usage: %s [-s speed] session\n"
+	        "  -s speed  scale the recorded timing, 0 for no waits\n",
+	        argv[0]);
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,739 @@
+/*
+ * replay.c - replay recorded taiwins sessions
+ *
+ * Copyright (c) 2021 Xichen Zhou
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <wayland-client.h>
+#include <taiwins/objects/recorder.h>
+
+#include <wayland-xdg-shell-client-protocol.h>
+#include <wayland-viewporter-client-protocol.h>
+#include <wayland-presentation-time-client-protocol.h>
+#include <wayland-xdg-output-client-protocol.h>
+#include <wayland-wlr-layer-shell-client-protocol.h>
+#include <wayland-taiwins-shell-client-protocol.h>
+#include <wayland-taiwins-console-client-protocol.h>
+#include <wayland-taiwins-theme-client-protocol.h>
+
+#include "replay.h"
+
+/******************************************************************************
+ * replay
+ *
+ * Requests are sent through the generic wl_proxy marshalling on the
+ * signatures of the interfaces, ids in the recording map to the proxies we
+ * created for them. What the client got from the compositor does not come
+ * back the same, so the registry names are looked up again by interface,
+ * configure and ping serials are taken from the events we received and shm
+ * pools are refilled from the recorded buffer contents.
+ *****************************************************************************/
+
+#define REPLAY_MAX_ARGS 20
+#define REPLAY_MAX_CLIENTS 256
+#define REPLAY_NS_PER_S 1000000000ull
+
+/* the globals a replay can bind, others are skipped */
+static const struct wl_interface *replay_globals[] = {
+	&wl_compositor_interface,
+	&wl_subcompositor_interface,
+	&wl_shm_interface,
+	&wl_seat_interface,
+	&wl_output_interface,
+	&wl_data_device_manager_interface,
+	&wl_shell_interface,
+	&xdg_wm_base_interface,
+	&wp_viewporter_interface,
+	&wp_presentation_interface,
+	&zxdg_output_manager_v1_interface,
+	&zwlr_layer_shell_v1_interface,
+	&taiwins_shell_interface,
+	&taiwins_console_interface,
+	&taiwins_theme_interface,
+};
+
+struct replay_pool {
+	int refs;
+	int fd;
+	uint8_t *data;
+	size_t size;
+};
+
+struct replay_object {
+	struct replay_client *client;
+	uint32_t id;
+	struct wl_proxy *proxy;
+	const struct wl_interface *interface;
+	//wl_shm_pool and wl_buffer
+	struct replay_pool *pool;
+	int32_t offset;
+	//last configure or ping
+	uint32_t serial;
+	bool has_serial;
+};
+
+struct replay_global {
+	uint32_t name, version;
+	char *interface;
+};
+
+struct replay_client {
+	uint16_t id;
+	bool dead;
+	struct wl_display *display;
+	struct replay_object **objects;
+	uint32_t n_objects;
+	struct wl_array globals;
+};
+
+struct replay {
+	FILE *file;
+	const char *socket;
+	double speed;
+	struct timespec start;
+	struct replay_client *clients[REPLAY_MAX_CLIENTS];
+	struct tw_replay_stats *stats;
+};
+
+static uint64_t
+replay_elapsed(const struct replay *replay)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - replay->start.tv_sec) * REPLAY_NS_PER_S +
+		now.tv_nsec - replay->start.tv_nsec;
+}
+
+static const char *
+replay_next_type(const char *sig)
+{
+	while (*sig && (*sig == '?' || (*sig >= '0' && *sig <= '9')))
+		sig++;
+	return sig;
+}
+
+static const struct wl_interface *
+replay_global_interface(const char *name)
+{
+	for (unsigned i = 0; i < sizeof(replay_globals) /
+		     sizeof(replay_globals[0]); i++)
+		if (strcmp(replay_globals[i]->name, name) == 0)
+			return replay_globals[i];
+	return NULL;
+}
+
+/******************************************************************************
+ * objects
+ *****************************************************************************/
+
+static void
+replay_pool_unref(struct replay_pool *pool)
+{
+	if (!pool || --pool->refs > 0)
+		return;
+	if (pool->data)
+		munmap(pool->data, pool->size);
+	close(pool->fd);
+	free(pool);
+}
+
+/* takes the fd */
+static struct replay_pool *
+replay_pool_create(int fd, size_t size)
+{
+	struct replay_pool *pool = calloc(1, sizeof(*pool));
+
+	if (!pool) {
+		close(fd);
+		return NULL;
+	}
+	pool->refs = 1;
+	pool->fd = fd;
+	pool->size = size;
+	pool->data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+	                  fd, 0);
+	if (pool->data == MAP_FAILED)
+		pool->data = NULL;
+	return pool;
+}
+
+static bool
+replay_pool_resize(struct replay_pool *pool, size_t size)
+{
+	void *data;
+
+	if (size <= pool->size || ftruncate(pool->fd, size) < 0)
+		return size <= pool->size;
+	data = mremap(pool->data, pool->size, size, MREMAP_MAYMOVE);
+	if (data == MAP_FAILED)
+		return false;
+	pool->data = data;
+	pool->size = size;
+	return true;
+}
+
+static struct replay_object *
+replay_object_get(struct replay_client *client, uint32_t id)
+{
+	return id < client->n_objects ? client->objects[id] : NULL;
+}
+
+static void
+replay_object_destroy(struct replay_object *object)
+{
+	struct replay_client *client = object->client;
+
+	if (object->id > 1)
+		wl_proxy_destroy(object->proxy);
+	if (object->id < client->n_objects)
+		client->objects[object->id] = NULL;
+	replay_pool_unref(object->pool);
+	free(object);
+}
+
+static int
+replay_dispatch(const void *impl, void *target, uint32_t opcode,
+                const struct wl_message *msg, union wl_argument *args);
+
+static struct replay_object *
+replay_object_add(struct replay_client *client, uint32_t id,
+                  struct wl_proxy *proxy, const struct wl_interface *iface)
+{
+	struct replay_object *object;
+
+	if (id >= client->n_objects) {
+		uint32_t n = client->n_objects ? client->n_objects : 64;
+		struct replay_object **objects;
+
+		while (n <= id)
+			n *= 2;
+		objects = realloc(client->objects, n * sizeof(*objects));
+		if (!objects)
+			return NULL;
+		memset(objects + client->n_objects, 0,
+		       (n - client->n_objects) * sizeof(*objects));
+		client->objects = objects;
+		client->n_objects = n;
+	}
+	//the client reused an id the replay never freed
+	if (client->objects[id])
+		replay_object_destroy(client->objects[id]);
+	if (!(object = calloc(1, sizeof(*object))))
+		return NULL;
+	object->client = client;
+	object->id = id;
+	object->proxy = proxy;
+	object->interface = iface;
+	client->objects[id] = object;
+	if (id > 1)
+		wl_proxy_add_dispatcher(proxy, replay_dispatch, NULL, object);
+	return object;
+}
+
+/* events only matter for what later requests send back */
+static int
+replay_dispatch(const void *impl, void *target, uint32_t opcode,
+                const struct wl_message *msg, union wl_argument *args)
+{
+	struct replay_object *object = wl_proxy_get_user_data(target);
+	struct replay_client *client = object->client;
+	const char *sig = msg->signature;
+
+	if (object->interface == &wl_registry_interface &&
+	    strcmp(msg->name, "global") == 0) {
+		struct replay_global *global =
+			wl_array_add(&client->globals, sizeof(*global));
+		if (global) {
+			global->name = args[0].u;
+			global->interface = strdup(args[1].s);
+			global->version = args[2].u;
+		}
+	} else if (strcmp(msg->name, "configure") == 0 ||
+	           strcmp(msg->name, "ping") == 0) {
+		for (int i = 0; *(sig = replay_next_type(sig)); sig++, i++) {
+			if (*sig == 'u') {
+				object->serial = args[i].u;
+				object->has_serial = true;
+				break;
+			}
+		}
+	}
+	sig = msg->signature;
+	for (int i = 0; *(sig = replay_next_type(sig)); sig++, i++)
+		if (*sig == 'h')
+			close(args[i].h);
+	//callbacks are gone once done
+	if (object->interface == &wl_callback_interface)
+		replay_object_destroy(object);
+	return 0;
+}
+
+/******************************************************************************
+ * clients
+ *****************************************************************************/
+
+static void
+replay_client_destroy(struct replay_client *client)
+{
+	struct replay_global *global;
+
+	for (uint32_t i = 2; i < client->n_objects; i++)
+		if (client->objects[i])
+			replay_object_destroy(client->objects[i]);
+	if (client->n_objects > 1 && client->objects[1])
+		replay_object_destroy(client->objects[1]);
+	wl_array_for_each(global, &client->globals)
+		free(global->interface);
+	wl_array_release(&client->globals);
+	free(client->objects);
+	if (client->display)
+		wl_display_disconnect(client->display);
+	free(client);
+}
+
+static struct replay_client *
+replay_client_create(struct replay *replay, uint16_t id)
+{
+	struct replay_client *client = calloc(1, sizeof(*client));
+
+	if (!client)
+		return NULL;
+	client->id = id;
+	wl_array_init(&client->globals);
+	if (!(client->display = wl_display_connect(replay->socket))) {
+		fprintf(stderr, "replay: failed to connect client %u\n", id);
+		free(client);
+		return NULL;
+	}
+	//id 1 is always the display
+	if (!replay_object_add(client, 1, (struct wl_proxy *)client->display,
+	                       &wl_display_interface)) {
+		replay_client_destroy(client);
+		return NULL;
+	}
+	replay->stats->clients++;
+	return client;
+}
+
+static void
+replay_client_check(struct replay_client *client)
+{
+	int err = wl_display_get_error(client->display);
+
+	if (err && !client->dead) {
+		fprintf(stderr, "replay: client %u stopped on error %s\n",
+		        client->id, strerror(err));
+		client->dead = true;
+	}
+}
+
+/* flush everyone and dispatch what is there, waiting at most timeout ms */
+static void
+replay_poll(struct replay *replay, int timeout)
+{
+	struct pollfd fds[REPLAY_MAX_CLIENTS];
+	struct replay_client *clients[REPLAY_MAX_CLIENTS];
+	int n = 0;
+
+	for (int i = 0; i < REPLAY_MAX_CLIENTS; i++) {
+		struct replay_client *client = replay->clients[i];
+
+		if (!client || client->dead)
+			continue;
+		wl_display_dispatch_pending(client->display);
+		wl_display_flush(client->display);
+		replay_client_check(client);
+		if (client->dead)
+			continue;
+		fds[n].fd = wl_display_get_fd(client->display);
+		fds[n].events = POLLIN;
+		clients[n++] = client;
+	}
+	if (poll(fds, n, timeout) <= 0)
+		return;
+	for (int i = 0; i < n; i++) {
+		if (fds[i].revents & (POLLIN | POLLERR | POLLHUP))
+			wl_display_dispatch(clients[i]->display);
+		replay_client_check(clients[i]);
+	}
+}
+
+static void
+replay_wait(struct replay *replay, uint64_t due)
+{
+	uint64_t now;
+
+	do {
+		now = replay_elapsed(replay);
+		replay_poll(replay, now >= due ? 0 :
+		            (int)((due - now + 999999) / 1000000));
+	} while (now < due);
+}
+
+/******************************************************************************
+ * requests
+ *****************************************************************************/
+
+struct replay_reader {
+	const uint8_t *data;
+	size_t size, pos;
+};
+
+static bool
+replay_read_u32(struct replay_reader *reader, uint32_t *v)
+{
+	if (reader->pos + 4 > reader->size)
+		return false;
+	memcpy(v, reader->data + reader->pos, 4);
+	reader->pos += 4;
+	return true;
+}
+
+static const void *
+replay_read_bytes(struct replay_reader *reader, size_t len)
+{
+	const void *bytes = reader->data + reader->pos;
+
+	if (reader->pos + len > reader->size)
+		return NULL;
+	reader->pos += len;
+	return bytes;
+}
+
+/* registry names differ per compositor run, bind by the interface instead */
+static bool
+replay_fix_bind(struct replay_client *client, union wl_argument *args,
+                const struct wl_interface **iface)
+{
+	struct replay_global *global;
+
+	if (!args[1].s || !(*iface = replay_global_interface(args[1].s)))
+		return false;
+	wl_array_for_each(global, &client->globals) {
+		if (strcmp(global->interface, args[1].s) == 0) {
+			args[0].u = global->name;
+			if (args[2].u > global->version)
+				args[2].u = global->version;
+			if (args[2].u > (uint32_t)(*iface)->version)
+				args[2].u = (*iface)->version;
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool
+replay_fix_serial(struct replay *replay, struct replay_object *object,
+                  const struct wl_message *msg, union wl_argument *args)
+{
+	bool ack = strcmp(msg->name, "ack_configure") == 0;
+	const char *sig = msg->signature;
+
+	if (!ack && strcmp(msg->name, "pong") != 0)
+		return true;
+	//the configure may still be on its way
+	for (int tries = 0; ack && !object->has_serial && tries < 3; tries++)
+		replay_poll(replay, 100);
+	if (!object->has_serial)
+		return false;
+	for (int i = 0; *(sig = replay_next_type(sig)); sig++, i++) {
+		if (*sig == 'u') {
+			args[i].u = object->serial;
+			break;
+		}
+	}
+	object->has_serial = false;
+	return true;
+}
+
+static bool
+replay_request(struct replay *replay, struct replay_client *client,
+               struct replay_reader *reader)
+{
+	union wl_argument args[REPLAY_MAX_ARGS] = {0};
+	int fds[REPLAY_MAX_ARGS];
+	int n_fds = 0, n_args = 0;
+	uint32_t id, opcode, new_id = 0, fd_size = 0;
+	uint32_t version;
+	struct replay_object *object, *created;
+	const struct wl_interface *new_iface = NULL;
+	const struct wl_message *msg;
+	struct wl_array arrays[REPLAY_MAX_ARGS];
+	struct wl_proxy *proxy;
+	const char *sig;
+	bool ok = false;
+
+	if (!replay_read_u32(reader, &id) || !replay_read_u32(reader, &opcode))
+		return false;
+	object = replay_object_get(client, id);
+	if (!object || opcode >= (uint32_t)object->interface->method_count)
+		return false;
+	msg = &object->interface->methods[opcode];
+	version = wl_proxy_get_version(object->proxy);
+
+	for (sig = msg->signature; *(sig = replay_next_type(sig)); sig++) {
+		uint8_t tag;
+		uint32_t v, len;
+		const void *bytes;
+		struct replay_object *ref;
+
+		if (n_args >= REPLAY_MAX_ARGS ||
+		    !(bytes = replay_read_bytes(reader, 1)) ||
+		    (tag = *(const uint8_t *)bytes) != (uint8_t)*sig ||
+		    !replay_read_u32(reader, &v))
+			goto out;
+		switch (*sig) {
+		case 'i':
+			args[n_args].i = (int32_t)v;
+			break;
+		case 'u':
+			args[n_args].u = v;
+			break;
+		case 'f':
+			args[n_args].f = (wl_fixed_t)v;
+			break;
+		case 'o':
+			ref = v ? replay_object_get(client, v) : NULL;
+			if (v && !ref)
+				goto out;
+			args[n_args].o = ref ? (struct wl_object *)ref->proxy :
+				NULL;
+			break;
+		case 'n':
+			new_id = v;
+			if (msg->types[n_args])
+				new_iface = msg->types[n_args];
+			else if (!replay_fix_bind(client, args, &new_iface))
+				goto out;
+			else
+				version = args[2].u;
+			args[n_args].n = 0;
+			break;
+		case 's':
+			len = v;
+			if (len && !(bytes = replay_read_bytes(reader, len)))
+				goto out;
+			args[n_args].s = len ? bytes : NULL;
+			break;
+		case 'a':
+			len = v;
+			if (!(bytes = replay_read_bytes(reader, len)))
+				goto out;
+			arrays[n_args].size = len;
+			arrays[n_args].alloc = len;
+			arrays[n_args].data = (void *)bytes;
+			args[n_args].a = &arrays[n_args];
+			break;
+		case 'h':
+			//only the size survives, shm pools get refilled later
+			fd_size = v;
+			fds[n_fds] = memfd_create("tw-replay-fd", MFD_CLOEXEC);
+			if (fds[n_fds] < 0 ||
+			    ftruncate(fds[n_fds], v) < 0)
+				goto out;
+			args[n_args].h = fds[n_fds++];
+			break;
+		}
+		n_args++;
+	}
+	if (!replay_fix_serial(replay, object, msg, args))
+		goto out;
+
+	proxy = wl_proxy_marshal_array_constructor_versioned(
+		object->proxy, opcode, args, new_iface, version);
+	ok = true;
+	if (new_iface && proxy) {
+		if (!(created = replay_object_add(client, new_id, proxy,
+		                                  new_iface))) {
+			wl_proxy_destroy(proxy);
+			goto out;
+		}
+		if (object->interface == &wl_shm_interface &&
+		    strcmp(msg->name, "create_pool") == 0 && n_fds) {
+			//keep the fd we sent for refilling the buffers
+			created->pool = replay_pool_create(fds[--n_fds],
+			                                   fd_size);
+		} else if (object->interface == &wl_shm_pool_interface &&
+		           strcmp(msg->name, "create_buffer") == 0 &&
+		           object->pool) {
+			created->pool = object->pool;
+			created->pool->refs++;
+			created->offset = args[1].i;
+		}
+	}
+	if (object->interface == &wl_shm_pool_interface && object->pool &&
+	    strcmp(msg->name, "resize") == 0)
+		replay_pool_resize(object->pool, args[0].i);
+	if (id > 1 && (strcmp(msg->name, "destroy") == 0 ||
+	               strcmp(msg->name, "release") == 0))
+		replay_object_destroy(object);
+out:
+	for (int i = 0; i < n_fds; i++)
+		close(fds[i]);
+	return ok;
+}
+
+static bool
+replay_shm(struct replay *replay, struct replay_client *client,
+           struct replay_reader *reader)
+{
+	uint32_t id, width, height, stride, format, n_spans;
+	struct replay_object *buffer;
+
+	if (!replay_read_u32(reader, &id) ||
+	    !replay_read_u32(reader, &width) ||
+	    !replay_read_u32(reader, &height) ||
+	    !replay_read_u32(reader, &stride) ||
+	    !replay_read_u32(reader, &format) ||
+	    !replay_read_u32(reader, &n_spans))
+		return false;
+	buffer = replay_object_get(client, id);
+	if (!buffer || !buffer->pool || !buffer->pool->data)
+		return false;
+	for (uint32_t i = 0; i < n_spans; i++) {
+		uint32_t first, rows;
+		size_t offset, len;
+		const void *data;
+
+		if (!replay_read_u32(reader, &first) ||
+		    !replay_read_u32(reader, &rows))
+			return false;
+		len = (size_t)rows * stride;
+		offset = buffer->offset + (size_t)first * stride;
+		if (!(data = replay_read_bytes(reader, len)))
+			return false;
+		if (offset + len > buffer->pool->size)
+			return false;
+		memcpy(buffer->pool->data + offset, data, len);
+		replay->stats->shm_bytes += len;
+	}
+	return true;
+}
+
+/******************************************************************************
+ * APIs
+ *****************************************************************************/
+
+bool
+tw_replay_run(const char *path, const char *socket, double speed,
+              struct tw_replay_stats *stats)
+{
+	struct tw_session_header header;
+	struct tw_session_record record;
+	struct replay replay = {0};
+	struct replay_client *client;
+	struct replay_reader reader;
+	uint8_t *payload = NULL;
+	size_t payload_size = 0;
+	bool ret = false;
+
+	memset(stats, 0, sizeof(*stats));
+	replay.socket = socket;
+	replay.speed = speed;
+	replay.stats = stats;
+	if (!(replay.file = fopen(path, "rb"))) {
+		perror(path);
+		return false;
+	}
+	if (fread(&header, sizeof(header), 1, replay.file) != 1 ||
+	    header.magic != TW_SESSION_MAGIC ||
+	    header.version != TW_SESSION_VERSION) {
+		fprintf(stderr, "replay: %s is not a taiwins session\n", path);
+		goto out;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &replay.start);
+
+	while (fread(&record, sizeof(record), 1, replay.file) == 1) {
+		if (record.size > payload_size) {
+			uint8_t *data = realloc(payload, record.size);
+
+			if (!data)
+				goto out;
+			payload = data;
+			payload_size = record.size;
+		}
+		if (record.size &&
+		    fread(payload, record.size, 1, replay.file) != 1)
+			break;
+		reader = (struct replay_reader){payload, record.size, 0};
+		stats->recorded_ns = record.ts;
+		replay_wait(&replay, speed > 0 ? record.ts / speed : 0);
+
+		if (record.client >= REPLAY_MAX_CLIENTS)
+			continue;
+		client = replay.clients[record.client];
+		switch (record.type) {
+		case TW_SESSION_CLIENT:
+			if (client)
+				replay_client_destroy(client);
+			replay.clients[record.client] =
+				replay_client_create(&replay, record.client);
+			break;
+		case TW_SESSION_CLIENT_GONE:
+			if (client) {
+				wl_display_roundtrip(client->display);
+				replay_client_destroy(client);
+			}
+			replay.clients[record.client] = NULL;
+			break;
+		case TW_SESSION_REQUEST:
+			if (client && !client->dead &&
+			    replay_request(&replay, client, &reader))
+				stats->requests++;
+			else
+				stats->skipped++;
+			break;
+		case TW_SESSION_SHM:
+			if (client && !client->dead)
+				replay_shm(&replay, client, &reader);
+			break;
+		}
+	}
+	ret = true;
+out:
+	for (int i = 0; i < REPLAY_MAX_CLIENTS; i++) {
+		if (!(client = replay.clients[i]))
+			continue;
+		if (!client->dead)
+			wl_display_roundtrip(client->display);
+		replay_client_destroy(client);
+	}
+	stats->replayed_ns = replay_elapsed(&replay);
+	free(payload);
+	fclose(replay.file);
+	return ret;
+}
+
+void
+tw_replay_print_stats(const struct tw_replay_stats *stats, FILE *file)
+{
+	fprintf(file, "replay: clients %u, requests %llu, skipped %llu, "
+	        "shm %.2f MiB, recorded %.3f s, replayed %.3f s\n",
+	        stats->clients, (unsigned long long)stats->requests,
+	        (unsigned long long)stats->skipped,
+	        stats->shm_bytes / (1024.0 * 1024.0),
+	        stats->recorded_ns / 1e9, stats->replayed_ns / 1e9);
+}
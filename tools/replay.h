@@ -0,0 +1,59 @@
+/*
+ * replay.h - replay recorded taiwins sessions
+ *
+ * Copyright (c) 2021 Xichen Zhou
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+#ifndef TW_REPLAY_H
+#define TW_REPLAY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+struct tw_replay_stats {
+	unsigned int clients;
+	uint64_t requests;
+	uint64_t skipped; /**< requests on objects the replay does not have */
+	uint64_t shm_bytes;
+	uint64_t recorded_ns, replayed_ns;
+};
+
+/**
+ * @brief replay a session recorded by tw_protocol_recorder
+ *
+ * Every recorded client gets its own connection to the socket, NULL for
+ * WAYLAND_DISPLAY. The speed scales the recorded timeline, 0 sends every
+ * request as soon as the previous one is out.
+ */
+bool
+tw_replay_run(const char *path, const char *socket, double speed,
+              struct tw_replay_stats *stats);
+
+void
+tw_replay_print_stats(const struct tw_replay_stats *stats, FILE *file);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif /* EOF */
@@ -0,0 +1,196 @@
+/*
+ * trace-convert.c - convert taiwins binary traces to chrome json
+ *
+ * Copyright (c) 2021 Xichen Zhou
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <taiwins/objects/profiler.h>
+
+/* the output loads in chrome://tracing and ui.perfetto.dev */
+
+#define MAX_THREADS 64
+
+struct trace_name {
+	uint64_t id;
+	char *str;
+};
+
+static struct {
+	struct trace_name *names;
+	size_t n_names, cap_names;
+	//open scopes per thread, so a trace toggled mid scope stays balanced
+	struct {
+		uint32_t tid;
+		int depth;
+	} threads[MAX_THREADS];
+	int n_threads;
+	bool first;
+} conv = {0};
+
+static const char *
+trace_name_lookup(uint64_t id)
+{
+	for (size_t i = conv.n_names; i > 0; i--)
+		if (conv.names[i-1].id == id)
+			return conv.names[i-1].str;
+	return "unknown";
+}
+
+static bool
+trace_name_add(uint64_t id, FILE *in, uint32_t len)
+{
+	struct trace_name *name;
+	char *str = calloc(1, len + 1);
+
+	if (!str || (len && fread(str, len, 1, in) != 1)) {
+		free(str);
+		return false;
+	}
+	if (conv.n_names == conv.cap_names) {
+		size_t cap = conv.cap_names ? conv.cap_names * 2 : 64;
+		struct trace_name *names =
+			realloc(conv.names, cap * sizeof(*names));
+		if (!names) {
+			free(str);
+			return false;
+		}
+		conv.names = names;
+		conv.cap_names = cap;
+	}
+	name = &conv.names[conv.n_names++];
+	name->id = id;
+	name->str = str;
+	return true;
+}
+
+static int *
+trace_thread_depth(uint32_t tid)
+{
+	for (int i = 0; i < conv.n_threads; i++)
+		if (conv.threads[i].tid == tid)
+			return &conv.threads[i].depth;
+	if (conv.n_threads == MAX_THREADS)
+		return NULL;
+	conv.threads[conv.n_threads].tid = tid;
+	conv.threads[conv.n_threads].depth = 0;
+	return &conv.threads[conv.n_threads++].depth;
+}
+
+static void
+write_json_string(FILE *out, const char *str)
+{
+	fputc('"', out);
+	for (const char *c = str; *c; c++) {
+		if (*c == '"' || *c == '\\')
+			fputc('\\', out);
+		if ((unsigned char)*c >= 0x20)
+			fputc(*c, out);
+	}
+	fputc('"', out);
+}
+
+static void
+write_event(FILE *out, const struct tw_trace_event *event)
+{
+	int *depth = trace_thread_depth(event->tid);
+
+	if (depth && event->phase == TW_TRACE_BEGIN)
+		(*depth)++;
+	else if (depth && event->phase == TW_TRACE_END && !(*depth)--) {
+		*depth = 0;
+		return;
+	}
+	fprintf(out, "%s{\"cat\":\"function\",\"name\":",
+	        conv.first ? "" : ",\n");
+	write_json_string(out, trace_name_lookup(event->name));
+	fprintf(out, ",\"ph\":\"%c\",\"pid\":0,\"tid\":%u,\"ts\":%llu.%03u",
+	        event->phase, event->tid,
+	        (unsigned long long)(event->ts / 1000),
+	        (unsigned)(event->ts % 1000));
+	if (event->phase == TW_TRACE_INSTANT)
+		fprintf(out, ",\"s\":\"t\"");
+	fprintf(out, "}");
+	conv.first = false;
+}
+
+static bool
+convert(FILE *in, FILE *out)
+{
+	struct tw_trace_header header;
+	struct tw_trace_event event;
+
+	if (fread(&header, sizeof(header), 1, in) != 1 ||
+	    header.magic != TW_TRACE_MAGIC) {
+		fprintf(stderr, "not a taiwins trace\n");
+		return false;
+	}
+	if (header.version != TW_TRACE_VERSION) {
+		fprintf(stderr, "unsupported trace version %u\n",
+		        header.version);
+		return false;
+	}
+	conv.first = true;
+	fprintf(out, "{\"otherData\": {},\"traceEvents\":[\n");
+	//a trace cut short by a crash is still useful, stop at the first
+	//partial record
+	while (fread(&event, sizeof(event), 1, in) == 1) {
+		if (event.phase == TW_TRACE_NAME) {
+			if (!trace_name_add(event.name, in, event.tid))
+				break;
+			continue;
+		}
+		write_event(out, &event);
+	}
+	fprintf(out, "\n]}\n");
+	return true;
+}
+
+int
+main(int argc, char *argv[])
+{
+	FILE *in, *out = stdout;
+	bool ret;
+
+	if (argc < 2 || argc > 3) {
+		fprintf(stderr, "Usage: %s trace [output.json]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	if (!(in = fopen(argv[1], "rb"))) {
+		perror(argv[1]);
+		return EXIT_FAILURE;
+	}
+	if (argc == 3 && !(out = fopen(argv[2], "w"))) {
+		perror(argv[2]);
+		fclose(in);
+		return EXIT_FAILURE;
+	}
+	ret = convert(in, out);
+
+	for (size_t i = 0; i < conv.n_names; i++)
+		free(conv.names[i].str);
+	free(conv.names);
+	fclose(in);
+	if (out != stdout)
+		fclose(out);
+	return ret ? EXIT_SUCCESS : EXIT_FAILURE;
+}